@@ -9,6 +9,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "shaders_class.h"
+#include "texture_cache.h"
 
 #include <iostream>
 
@@ -54,7 +55,13 @@ int main()
 
     // build and compile our shader zprogram
     // ------------------------------------
+    // the linked program is kept in shader_cache/, so later runs skip compiling
     Shader ourShader("5.1.transform.vs", "5.1.transform.fs");
+    const ProgramBinaryCache::Stats &shaderStats = ProgramBinaryCache::instance().stats();
+    std::cout << "shader cache: " << shaderStats.hits << " hits (" << shaderStats.savedMs << " ms saved), "
+              << shaderStats.misses << " misses (" << shaderStats.missMs << " ms)" << std::endl;
+    // rebuild the program whenever 5.1.transform.vs/.fs are saved, without restarting
+    ourShader.watch();
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
@@ -92,54 +99,20 @@ int main()
 
     // load and create a texture 
     // -------------------------
-    unsigned int texture1, texture2;
-    // texture 1
-    // ---------
-    glGenTextures(1, &texture1);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    unsigned char *data = stbi_load("../04_纹理/image/container.jpg", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
-    // texture 2
-    // ---------
-    glGenTextures(1, &texture2);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    data = stbi_load("../04_纹理/image/awesomeface.png", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        // note that the awesomeface.png has transparency and thus an alpha channel, so make sure to tell OpenGL the data type is of GL_RGBA
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
+    // the first run decodes the images and bakes their mip chains into
+    // texture_cache/; later runs map those files and upload them directly
+    TextureCache cache;
+    CachedTexture image1 = cache.load("../04_纹理/image/container.jpg");
+    CachedTexture image2 = cache.load("../04_纹理/image/awesomeface.png");
+    if (!image1.ok())
+        std::cout << "Failed to load texture: " << image1.error << std::endl;
+    if (!image2.ok())
+        std::cout << "Failed to load texture: " << image2.error << std::endl;
+    unsigned int texture1 = TextureCache::upload(image1);
+    unsigned int texture2 = TextureCache::upload(image2);
+    const TextureCache::Stats &stats = cache.stats();
+    std::cout << "texture cache: " << stats.hits << " hits (" << stats.hitMs << " ms), "
+              << stats.misses << " misses (" << stats.missMs << " ms)" << std::endl;
 
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
     // -------------------------------------------------------------------------------------------
@@ -172,6 +145,9 @@ int main()
         transform = glm::translate(transform, glm::vec3(0.5f, -0.5f, 0.0f));
         transform = glm::rotate(transform, (float)glfwGetTime(), glm::vec3(0.0f, 0.0f, 1.0f));
 
+        // pick up edited shader sources (the old program stays if the new one doesn't link)
+        ourShader.reload();
+
         // get matrix's uniform location and set matrix
         ourShader.use();
         unsigned int transformLoc = glGetUniformLocation(ourShader.ID, "transform");
@@ -192,6 +168,8 @@ int main()
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
+    glDeleteTextures(1, &texture1);
+    glDeleteTextures(1, &texture2);
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
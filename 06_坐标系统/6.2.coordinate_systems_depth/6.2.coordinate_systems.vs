@@ -4,9 +4,16 @@ layout (location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// filled once per frame from a UniformRing (see uniform_buffer.h)
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+};
+layout (std140) uniform Object
+{
+	mat4 model;
+};
 
 void main()
 {
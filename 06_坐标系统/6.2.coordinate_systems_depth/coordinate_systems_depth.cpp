@@ -9,8 +9,12 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "shaders_class.h"
+#include "texture_loader.h"
+#include "uniform_buffer.h"
+#include "mip_generator.h"
 
 #include <iostream>
+#include <memory>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
@@ -19,6 +23,17 @@ void processInput(GLFWwindow *window);
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+// the vertex shader's uniform blocks, as C++ structs
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+struct ObjectBlock
+{
+    glm::mat4 model;
+};
+
 int main()
 {
     // glfw: initialize and configure
@@ -58,7 +73,10 @@ int main()
 
     // build and compile our shader zprogram
     // ------------------------------------
-    Shader ourShader("6.2.coordinate_systems.vs", "6.2.coordinate_systems.fs");
+    // only submitted here: the driver can compile it while the textures below load,
+    // and shaders.get() collects the result once it is needed
+    ShaderLibrary shaders;
+    const unsigned int boxShader = shaders.add("6.2.coordinate_systems.vs", "6.2.coordinate_systems.fs");
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
@@ -122,56 +140,49 @@ int main()
     glEnableVertexAttribArray(1);
 
 
-    // load and create a texture 
-    // -------------------------
-    unsigned int texture1, texture2;
-    // texture 1
-    // ---------
-    glGenTextures(1, &texture1);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    unsigned char *data = stbi_load("../../04_纹理/image/container.jpg", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
-    // texture 2
-    // ---------
-    glGenTextures(1, &texture2);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    data = stbi_load("../../04_纹理/image/awesomeface.png", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        // note that the awesomeface.png has transparency and thus an alpha channel, so make sure to tell OpenGL the data type is of GL_RGBA
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
+    // load and create the textures
+    // -----------------------------
+    // both images are decoded on worker threads (flipped on the y-axis, which
+    // is the default); each texture is created as soon as its image is ready
+    TextureLoader loader(2);
+    loader.submit("../../04_纹理/image/container.jpg");
+    loader.submit("../../04_纹理/image/awesomeface.png");
+    unsigned int textures[2];
+    glGenTextures(2, textures);
+    LoadedTexture image;
+    while (loader.next(image))
     {
-        std::cout << "Failed to load texture" << std::endl;
+        glBindTexture(GL_TEXTURE_2D, textures[image.index]);
+        // set the texture wrapping parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        // set texture filtering parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (image.ok())
+        {
+            // build the mipmaps on the CPU, averaging in linear light, and upload every level
+            // awesomeface.png has transparency and thus an alpha channel, so tell OpenGL the data is GL_RGBA
+            MipOptions mipOptions;
+            mipOptions.wrap = MipWrap::Repeat;
+            MipChain chain = MipGenerator::generate(image.pixels.get(), image.width, image.height, image.components, mipOptions);
+            GLenum format = image.components == 4 ? GL_RGBA : GL_RGB;
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (size_t level = 0; level < chain.levels.size(); ++level)
+                glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGB, chain.levels[level].width, chain.levels[level].height, 0, format, GL_UNSIGNED_BYTE, chain.levels[level].pixels.data());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        }
+        else
+        {
+            std::cout << "Failed to load texture " << image.path << ": " << image.error << std::endl;
+        }
     }
-    stbi_image_free(data);
+    unsigned int texture1 = textures[0], texture2 = textures[1];
+
+    Shader &ourShader = shaders.get(boxShader);
+    const ShaderLibrary::Stats &shaderStats = shaders.stats();
+    std::cout << "shaders: " << shaderStats.readyOnUse << " of " << shaderStats.programs << " compiled during loading, "
+              << shaderStats.waitMs << " ms waited" << std::endl;
 
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
     // -------------------------------------------------------------------------------------------
@@ -179,6 +190,17 @@ int main()
     ourShader.setInt("texture1", 0);
     ourShader.setInt("texture2", 1);
 
+    // the matrices live in uniform buffers: the camera block is written once per frame, the object blocks of
+    // all boxes together, and each draw just binds its range of the ring
+    // -------------------------------------------------------------------------------------------------------
+    const Std140Layout<CameraBlock> cameraLayout("Camera", { { "view", &CameraBlock::view }, { "projection", &CameraBlock::projection } });
+    const Std140Layout<ObjectBlock> objectLayout("Object", { { "model", &ObjectBlock::model } });
+    if (ourShader.blockSize("Camera") != (GLint)cameraLayout.size() || ourShader.blockSize("Object") != (GLint)objectLayout.size())
+        std::cout << "Uniform blocks don't match the shader, expected:\n" << cameraLayout.glsl() << objectLayout.glsl() << std::endl;
+    const GLuint cameraBinding = Shader::blockBinding("Camera");
+    const GLuint objectBinding = Shader::blockBinding("Object");
+    std::unique_ptr<UniformRing> uniforms = std::make_unique<UniformRing>();
+
 
     // render loop
     // -----------
@@ -203,42 +225,31 @@ int main()
         ourShader.use();
 
         // create transformations
-        glm::mat4 model         = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-        glm::mat4 view          = glm::mat4(1.0f);
-        glm::mat4 projection    = glm::mat4(1.0f);
-        model = glm::rotate(model, (float)glfwGetTime(), glm::vec3(0.5f, 1.0f, 0.0f));
-        view  = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
-        projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        // retrieve the matrix uniform locations
-        unsigned int modelLoc = glGetUniformLocation(ourShader.ID, "model");
-        unsigned int viewLoc  = glGetUniformLocation(ourShader.ID, "view");
-        // pass them to the shaders (3 different ways)
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-        // note: currently we set the projection matrix each frame, but since the projection matrix rarely changes it's often best practice to set it outside the main loop only once.
-        ourShader.setMat4("projection", projection);
-
-        // render box
+        CameraBlock camera;
+        camera.view       = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
+        camera.projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        ObjectBlock boxes[2];
+        boxes[0].model = glm::rotate(glm::mat4(1.0f), (float)glfwGetTime(), glm::vec3(0.5f, 1.0f, 0.0f));
+        // the second box sits half a unit lower, rather than being seen through a lowered camera
+        boxes[1].model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5f, 0.0f));
+        boxes[1].model = glm::rotate(boxes[1].model, glm::radians(45.0f), glm::vec3(0.0f, 1.0f, 1.0f));
+
+        // pass them to the shaders: every block of the frame goes into the ring, then one commit
+        uniforms->beginFrame();
+        UniformRing::Range cameraRange = uniforms->push(cameraLayout, camera);
+        UniformRing::Range boxRanges[2];
+        for (int i = 0; i < 2; ++i)
+            boxRanges[i] = uniforms->push(objectLayout, boxes[i]);
+        uniforms->commit();
+        uniforms->bind(cameraBinding, cameraRange);
+
+        // render boxes
         glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-
-        // create transformations
-        model         = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-        view          = glm::mat4(1.0f);
-        projection    = glm::mat4(1.0f);
-        model = glm::rotate(model, glm::radians(45.0f), glm::vec3(0.0f, 1.0f, 1.0f));
-        view  = glm::translate(view, glm::vec3(0.0f, -0.5f, -3.0f));
-        projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        // retrieve the matrix uniform locations
-        modelLoc = glGetUniformLocation(ourShader.ID, "model");
-        viewLoc  = glGetUniformLocation(ourShader.ID, "view");
-        // pass them to the shaders (3 different ways)
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-        // note: currently we set the projection matrix each frame, but since the projection matrix rarely changes it's often best practice to set it outside the main loop only once.
-        ourShader.setMat4("projection", projection);
-
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        for (int i = 0; i < 2; ++i)
+        {
+            uniforms->bind(objectBinding, boxRanges[i]);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+        }
 
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -247,10 +258,16 @@ int main()
         glfwPollEvents();
     }
 
+    // every frame after the first leaves the program bound as it was
+    const Shader::StateStats &state = Shader::stateStats();
+    std::cout << "shader state: " << state.programs << " glUseProgram calls (" << state.programsSkipped << " skipped), "
+              << state.uniforms << " glUniform calls (" << state.uniformsSkipped << " skipped)" << std::endl;
+
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
+    uniforms.reset();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -0,0 +1,239 @@
+// stb_image decode throughput: decodes a corpus of PNG, JPEG, HDR, GIF, TGA
+// and BMP files from memory and reports MB/s (file bytes) and MP/s (pixels)
+// per format and per stage. The corpus is the tutorial image/ folders plus
+// synthetic images built here: PNG rows cycle through all five filters and
+// are deflated with a small LZ77 encoder, GIF is LZW-coded, HDR and one TGA
+// are run-length encoded. JPEG has no encoder here, so it comes from the
+// repo and from files given on the command line.
+//
+// The stages are measured from outside the library, each as the difference
+// between two best-of-N timings:
+//     header   stbi_info_from_memory
+//     decode   stbi_load in the file's own channel count (stbi_loadf for HDR)
+//     convert  extra cost of asking for a different channel count
+//     flip     extra cost of stbi_set_flip_vertically_on_load
+// so compare one build against another rather than reading single numbers.
+// Built with -DSTBI_PROFILE, the decode is also split into stb_image's own
+// stages (decode.zlib, decode.png_unfilter, decode.jpeg_entropy, ...) from
+// its stage counters; their bytes and pixels are what each stage processed.
+// The SIMD configuration the file was built with is printed first; build it
+// with -DSTBI_NO_SIMD (or -DSTBI_NEON on ARM) to compare paths.
+//
+// build from this folder:
+//     g++ -O2 image_decoding.cpp -o image_decoding -I../include [-DSTBI_PROFILE]
+// run from this folder, optionally with more images:
+//     ./image_decoding [--csv] [--size N] [--root DIR] [image ...]
+// --csv prints one line per format and stage for tracking runs over time.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "synthetic_images.h"
+
+struct Sample
+{
+    std::string name;
+    std::string format;
+    std::vector<unsigned char> bytes;
+};
+
+// best of several runs, repeating until enough time has passed to be stable
+template <typename Function>
+static double bestMs(Function &&function)
+{
+    double best = 1e30, total = 0.0;
+    for (int run = 0; run < 50 && (run < 3 || total < 200.0); ++run)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, ms);
+        total += ms;
+    }
+    return best;
+}
+
+struct Totals
+{
+    size_t files = 0, bytes = 0, pixels = 0;
+    double ms = 0.0;
+};
+
+int main(int argc, char *argv[])
+{
+    bool csv = false;
+    int size = 1024;
+    std::string root = "..";
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--csv")
+            csv = true;
+        else if (arg == "--size" && i + 1 < argc)
+            size = std::max(16, std::atoi(argv[++i]));
+        else if (arg == "--root" && i + 1 < argc)
+            root = argv[++i];
+        else
+            paths.push_back(arg);
+    }
+
+    // the tutorial image/ folders, then anything passed in
+    std::vector<Sample> corpus;
+    std::error_code ec;
+    for (const auto &chapter : std::filesystem::directory_iterator(root, ec))
+    {
+        const std::filesystem::path folder = chapter.path() / "image";
+        if (!std::filesystem::is_directory(folder, ec))
+            continue;
+        for (const auto &entry : std::filesystem::directory_iterator(folder, ec))
+            if (entry.is_regular_file())
+                paths.push_back(entry.path().string());
+    }
+    std::sort(paths.begin(), paths.end());
+    for (const std::string &path : paths)
+    {
+        Sample sample;
+        sample.name = path;
+        if (!readFile(path, sample.bytes))
+        {
+            std::fprintf(stderr, "%s: could not read\n", path.c_str());
+            continue;
+        }
+        sample.format = formatOf(sample.bytes);
+        corpus.push_back(std::move(sample));
+    }
+
+    const std::vector<unsigned char> rgb = synthesize(size, size, 3), rgba = synthesize(size, size, 4), grey = synthesize(size, size, 1);
+    const std::string dims = std::to_string(size) + "x" + std::to_string(size);
+    corpus.push_back({ "synthetic " + dims + " rgb", "png", encodePng(rgb, size, size, 3) });
+    corpus.push_back({ "synthetic " + dims + " rgba", "png", encodePng(rgba, size, size, 4) });
+    corpus.push_back({ "synthetic " + dims + " grey", "png", encodePng(grey, size, size, 1) });
+    corpus.push_back({ "synthetic " + dims + " rgb", "bmp", encodeBmp(rgb, size, size, 3) });
+    corpus.push_back({ "synthetic " + dims + " rgba", "bmp", encodeBmp(rgba, size, size, 4) });
+    corpus.push_back({ "synthetic " + dims + " rgb", "tga", encodeTga(rgb, size, size, 3, false) });
+    corpus.push_back({ "synthetic " + dims + " rgba rle", "tga", encodeTga(rgba, size, size, 4, true) });
+    corpus.push_back({ "synthetic " + dims + " 332", "gif", encodeGif(rgb, size, size, 3) });
+    corpus.push_back({ "synthetic " + dims + " rle", "hdr", encodeHdr(rgb, size, size, 3) });
+
+#if defined(STBI_NO_SIMD)
+    const char *simd = "none";
+#elif defined(STBI_NEON)
+    const char *simd = "neon";
+#elif defined(STBI_SSE2)
+    const char *simd = "sse2";
+#else
+    const char *simd = "none";
+#endif
+
+    std::vector<std::string> stages = { "header", "decode", "convert", "flip", "total" };
+#ifdef STBI_PROFILE
+    for (int s = 0; s < STBI_STAGE_COUNT; ++s)
+        stages.push_back(std::string("decode.") + stbi_profile_stage_name(s));
+#endif
+    std::map<std::string, std::map<std::string, Totals>> totals;     // format, then stage
+    if (!csv)
+        std::printf("simd: %s\n%-52s %-5s %7s %9s %9s %9s %9s %9s\n", simd, "image", "fmt", "KB", "header", "decode", "convert",
+                    "flip", "MP/s");
+    for (const Sample &sample : corpus)
+    {
+        const unsigned char *bytes = sample.bytes.data();
+        const int length = (int)sample.bytes.size();
+        int width, height, components;
+        if (!stbi_info_from_memory(bytes, length, &width, &height, &components))
+        {
+            std::fprintf(stderr, "%s: %s\n", sample.name.c_str(), stbi_failure_reason());
+            continue;
+        }
+        const bool hdr = stbi_is_hdr_from_memory(bytes, length) != 0;
+        // convert to the other common layout: RGB <-> RGBA, grey -> RGBA
+        const int other = components == 4 ? 3 : 4;
+        auto load = [&](int desired) {
+            int w, h, n;
+            void *pixels = hdr ? (void *)stbi_loadf_from_memory(bytes, length, &w, &h, &n, desired)
+                               : (void *)stbi_load_from_memory(bytes, length, &w, &h, &n, desired);
+            stbi_image_free(pixels);
+        };
+
+        double ms[5];
+        ms[0] = bestMs([&] { int w, h, n; stbi_info_from_memory(bytes, length, &w, &h, &n); });
+        stbi_set_flip_vertically_on_load(false);
+        ms[1] = bestMs([&] { load(0); });
+        ms[2] = std::max(0.0, bestMs([&] { load(other); }) - ms[1]);
+        stbi_set_flip_vertically_on_load(true);
+        ms[3] = std::max(0.0, bestMs([&] { load(0); }) - ms[1]);
+        stbi_set_flip_vertically_on_load(false);
+        ms[4] = ms[1] + ms[2] + ms[3];
+
+        const size_t pixels = (size_t)width * height;
+        for (int s = 0; s < 5; ++s)
+        {
+            Totals &t = totals[sample.format][stages[s]];
+            ++t.files;
+            t.bytes += sample.bytes.size();
+            t.pixels += pixels;
+            t.ms += ms[s];
+        }
+#ifdef STBI_PROFILE
+        // the quickest of a few plain decodes, stage by stage
+        stbi_profile_counter best[STBI_STAGE_COUNT] = {};
+        for (int run = 0; run < 5; ++run)
+        {
+            stbi_profile_counter counters[STBI_STAGE_COUNT];
+            stbi_profile_reset();
+            load(0);
+            stbi_profile_read(counters);
+            for (int s = 0; s < STBI_STAGE_COUNT; ++s)
+                if (run == 0 || counters[s].ns < best[s].ns)
+                    best[s] = counters[s];
+        }
+        for (int s = 0; s < STBI_STAGE_COUNT; ++s)
+            if (best[s].calls)
+            {
+                Totals &t = totals[sample.format][stages[5 + s]];
+                ++t.files;
+                t.bytes += best[s].bytes;
+                t.pixels += best[s].pixels;
+                t.ms += best[s].ns / 1e6;
+            }
+#endif
+        if (!csv)
+            std::printf("%-52s %-5s %7.1f %9.3f %9.3f %9.3f %9.3f %9.2f\n", sample.name.c_str(), sample.format.c_str(),
+                        length / 1024.0, ms[0], ms[1], ms[2], ms[3], pixels / ms[1] / 1000.0);
+    }
+
+    if (csv)
+        std::printf("simd,format,stage,files,bytes,pixels,ms,mb_per_s,mp_per_s\n");
+    else
+        std::printf("\n%-5s %-20s %6s %10s %9s %9s %9s\n", "fmt", "stage", "files", "MB", "ms", "MB/s", "MP/s");
+    for (const auto &format : totals)
+        for (const std::string &stage : stages)
+        {
+            const auto found = format.second.find(stage);
+            if (found == format.second.end())
+                continue;
+            const Totals &t = found->second;
+            // a stage too cheap to measure reports no rate rather than a huge one
+            const double seconds = t.ms / 1000.0;
+            const double mb = t.bytes / 1e6, mp = t.pixels / 1e6;
+            const double mbRate = seconds > 0.0 ? mb / seconds : 0.0, mpRate = seconds > 0.0 ? mp / seconds : 0.0;
+            if (csv)
+                std::printf("%s,%s,%s,%zu,%zu,%zu,%.4f,%.2f,%.2f\n", simd, format.first.c_str(), stage.c_str(), t.files, t.bytes,
+                            t.pixels, t.ms, mbRate, mpRate);
+            else
+                std::printf("%-5s %-20s %6zu %10.2f %9.3f %9.1f %9.1f\n", format.first.c_str(), stage.c_str(), t.files, mb, t.ms,
+                            mbRate, mpRate);
+        }
+    return 0;
+}
@@ -0,0 +1,129 @@
+// stb_image scratch estimate check: decodes every image into an stbi_arena of
+// exactly the size stbi_scratch_size_from_memory reports and fails if the
+// arena overflowed or the pixels differ from a decode with the default
+// allocator. Runs each image with desired_channels 0 to 4 so the conversion
+// buffers are covered too. The images are synthetic PNG, BMP (24 and 32 bit),
+// TGA (raw and RLE), GIF and HDR at a few awkward sizes, plus the tutorial
+// image/ folders for JPEG and anything given on the command line.
+//
+// build from this folder:
+//     g++ -O2 scratch_arena.cpp -o scratch_arena -I../include
+// run from this folder, optionally with more images:
+//     ./scratch_arena [--root DIR] [image ...]
+// exits non-zero on any failure.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "synthetic_images.h"
+
+struct Sample
+{
+    std::string name;
+    std::vector<unsigned char> bytes;
+};
+
+// ----------------------------------------------------------------------------
+// decode with the default allocator, then again from an arena of exactly the
+// estimated size; returns the number of failures
+static int check(const Sample &sample, int desired)
+{
+    int width = 0, height = 0, components = 0;
+    stbi_uc *reference = stbi_load_from_memory(sample.bytes.data(), (int)sample.bytes.size(), &width, &height, &components, desired);
+    size_t estimate = 0;
+    if (!stbi_scratch_size_from_memory(sample.bytes.data(), (int)sample.bytes.size(), desired, &estimate))
+    {
+        stbi_image_free(reference);
+        if (!reference)
+            return 0;
+        std::printf("FAIL %s req %d: no estimate (%s)\n", sample.name.c_str(), desired, stbi_failure_reason());
+        return 1;
+    }
+
+    std::vector<unsigned char> memory(estimate);
+    stbi_arena arena;
+    stbi_arena_init(&arena, memory.data(), memory.size());
+    stbi_allocator allocator = stbi_arena_allocator(&arena);
+    stbi_set_allocator_thread(&allocator);
+    int gotWidth = 0, gotHeight = 0, gotComponents = 0;
+    stbi_uc *pixels = stbi_load_from_memory(sample.bytes.data(), (int)sample.bytes.size(), &gotWidth, &gotHeight, &gotComponents, desired);
+    int failures = 0;
+    if (arena.overflow)
+    {
+        std::printf("FAIL %s req %d: estimate %zu, peak %zu, overflow %zu\n", sample.name.c_str(), desired, estimate, arena.peak, arena.overflow);
+        ++failures;
+    }
+    if (!reference != !pixels || (reference && (gotWidth != width || gotHeight != height ||
+        std::memcmp(reference, pixels, (size_t)width * height * (desired ? desired : components)))))
+    {
+        std::printf("FAIL %s req %d: pixels differ from the default allocator\n", sample.name.c_str(), desired);
+        ++failures;
+    }
+    stbi_image_free(pixels);
+    stbi_set_allocator_thread(NULL);
+    stbi_image_free(reference);
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string root = "..";
+    std::vector<Sample> corpus;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!std::strcmp(argv[i], "--root") && i + 1 < argc)
+            root = argv[++i];
+        else
+        {
+            Sample sample{ argv[i], {} };
+            if (readFile(argv[i], sample.bytes))
+                corpus.push_back(std::move(sample));
+            else
+                std::printf("skipping %s: cannot read\n", argv[i]);
+        }
+    }
+
+    std::error_code error;
+    for (const auto &folder : std::filesystem::directory_iterator(root, error))
+    {
+        const std::filesystem::path images = folder.path() / "image";
+        if (!folder.is_directory() || !std::filesystem::is_directory(images, error))
+            continue;
+        for (const auto &entry : std::filesystem::directory_iterator(images, error))
+        {
+            Sample sample{ entry.path().string(), {} };
+            if (entry.is_regular_file() && readFile(sample.name, sample.bytes))
+                corpus.push_back(std::move(sample));
+        }
+    }
+
+    // odd widths exercise row padding in BMP and the partial bytes at row ends
+    const int sizes[][2] = { { 1, 1 }, { 37, 19 }, { 64, 64 }, { 251, 3 } };
+    for (const auto &size : sizes)
+    {
+        const int width = size[0], height = size[1];
+        const std::string dims = std::to_string(width) + "x" + std::to_string(height);
+        const std::vector<unsigned char> rgb = synthesize(width, height, 3), rgba = synthesize(width, height, 4), grey = synthesize(width, height, 1);
+        corpus.push_back({ "png " + dims + " rgb", encodePng(rgb, width, height, 3) });
+        corpus.push_back({ "png " + dims + " rgba", encodePng(rgba, width, height, 4) });
+        corpus.push_back({ "png " + dims + " grey", encodePng(grey, width, height, 1) });
+        corpus.push_back({ "bmp " + dims + " rgb", encodeBmp(rgb, width, height, 3) });
+        corpus.push_back({ "bmp " + dims + " rgba", encodeBmp(rgba, width, height, 4) });
+        corpus.push_back({ "tga " + dims + " rgb", encodeTga(rgb, width, height, 3, false) });
+        corpus.push_back({ "tga " + dims + " rgba rle", encodeTga(rgba, width, height, 4, true) });
+        corpus.push_back({ "gif " + dims + " 332", encodeGif(rgb, width, height, 3) });
+        corpus.push_back({ "hdr " + dims + " rle", encodeHdr(rgb, width, height, 3) });
+    }
+
+    int failures = 0, runs = 0;
+    for (const Sample &sample : corpus)
+        for (int desired = 0; desired <= 4; ++desired, ++runs)
+            failures += check(sample, desired);
+    std::printf("%zu images, %d decodes, %d failures\n", corpus.size(), runs, failures);
+    return failures != 0;
+}
@@ -0,0 +1,472 @@
+// Synthetic test images for the programs in this folder: a content generator
+// and small encoders for PNG (all five filters, LZ77 + fixed Huffman deflate),
+// BMP, TGA (raw or RLE), GIF (LZW) and HDR (RLE), plus file helpers. The
+// encoders write just enough of each format for stb_image to decode.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// synthetic content: smooth gradients, a few hard edges and some noise, so
+// neither the filters nor the compressors get an easy ride
+inline std::vector<unsigned char> synthesize(int width, int height, int components)
+{
+    std::vector<unsigned char> pixels((size_t)width * height * components);
+    uint32_t noise = 0x9e3779b9u;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            noise ^= noise << 13;
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+            const float u = (float)x / width, v = (float)y / height;
+            const bool stripe = ((x / 37) + (y / 53)) % 5 == 0;
+            const float value[4] = {
+                255.0f * u,
+                255.0f * (0.5f + 0.5f * std::sin(9.0f * u + 5.0f * v)),
+                stripe ? 230.0f : 255.0f * v * (1.0f - u),
+                std::hypot(u - 0.5f, v - 0.5f) < 0.4f ? 255.0f : 64.0f + 128.0f * u,
+            };
+            unsigned char *p = &pixels[((size_t)y * width + x) * components];
+            for (int c = 0; c < components; ++c)
+            {
+                const int channel = components < 3 ? (c == 0 ? 1 : 3) : c;
+                p[c] = (unsigned char)std::min(255.0f, value[channel] + (float)(noise & 7));
+            }
+        }
+    return pixels;
+}
+
+inline void put16le(std::vector<unsigned char> &out, unsigned value) { out.push_back(value & 255); out.push_back((value >> 8) & 255); }
+inline void put32le(std::vector<unsigned char> &out, unsigned value) { put16le(out, value & 0xffff); put16le(out, value >> 16); }
+inline void put32be(std::vector<unsigned char> &out, unsigned value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back((value >> shift) & 255);
+}
+
+// ----------------------------------------------------------------------------
+// zlib stream with fixed-Huffman deflate blocks and greedy LZ77 matching
+class BitWriter
+{
+public:
+    std::vector<unsigned char> bytes;
+
+    void put(unsigned value, int count)
+    {
+        buffer |= value << used;
+        used += count;
+        while (used >= 8)
+        {
+            bytes.push_back(buffer & 255);
+            buffer >>= 8;
+            used -= 8;
+        }
+    }
+    // Huffman codes go out most significant bit first
+    void putCode(unsigned code, int count)
+    {
+        unsigned reversed = 0;
+        for (int i = 0; i < count; ++i)
+            reversed |= ((code >> i) & 1) << (count - 1 - i);
+        put(reversed, count);
+    }
+    void flush()
+    {
+        if (used > 0)
+            bytes.push_back(buffer & 255);
+        buffer = 0;
+        used = 0;
+    }
+
+private:
+    unsigned buffer = 0;
+    int used = 0;
+};
+
+inline void putLiteral(BitWriter &bits, int symbol)
+{
+    if (symbol < 144)      bits.putCode(0x30 + symbol, 8);
+    else if (symbol < 256) bits.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) bits.putCode(symbol - 256, 7);
+    else                   bits.putCode(0xc0 + symbol - 280, 8);
+}
+
+inline std::vector<unsigned char> zlibCompress(const std::vector<unsigned char> &data)
+{
+    static const int lengthBase[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+    static const int lengthExtra[] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+    static const int distanceBase[] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+    static const int distanceExtra[] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+    BitWriter bits;
+    bits.put(0x78, 8);
+    bits.put(0x01, 8);
+    bits.put(1, 1);     // final block
+    bits.put(1, 2);     // fixed Huffman codes
+    std::vector<int> head(1 << 15, -1);
+    const size_t n = data.size();
+    size_t i = 0;
+    while (i < n)
+    {
+        int length = 0, distance = 0;
+        if (i + 3 <= n)
+        {
+            const unsigned hash = ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & 0x7fff;
+            const int candidate = head[hash];
+            head[hash] = (int)i;
+            if (candidate >= 0 && i - candidate <= 32768)
+            {
+                const size_t limit = std::min<size_t>(258, n - i);
+                size_t match = 0;
+                while (match < limit && data[candidate + match] == data[i + match])
+                    ++match;
+                if (match >= 3)
+                {
+                    length = (int)match;
+                    distance = (int)(i - candidate);
+                }
+            }
+        }
+        if (length == 0)
+        {
+            putLiteral(bits, data[i++]);
+            continue;
+        }
+        int code = 28;
+        while (lengthBase[code] > length)
+            --code;
+        putLiteral(bits, 257 + code);
+        bits.put(length - lengthBase[code], lengthExtra[code]);
+        code = 29;
+        while (distanceBase[code] > distance)
+            --code;
+        bits.putCode(code, 5);
+        bits.put(distance - distanceBase[code], distanceExtra[code]);
+        i += length;
+    }
+    putLiteral(bits, 256);
+    bits.flush();
+
+    unsigned a = 1, b = 0;
+    for (unsigned char byte : data)
+    {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32be(bits.bytes, (b << 16) | a);
+    return bits.bytes;
+}
+
+inline unsigned crc32(const unsigned char *data, size_t size)
+{
+    static unsigned table[256];
+    if (!table[1])
+        for (unsigned i = 0; i < 256; ++i)
+        {
+            unsigned c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    unsigned crc = 0xffffffffu;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+// ----------------------------------------------------------------------------
+inline std::vector<unsigned char> encodePng(const std::vector<unsigned char> &pixels, int width, int height, int components)
+{
+    static const unsigned char colourType[] = { 0, 0, 4, 2, 6 };
+    const size_t stride = (size_t)width * components;
+    std::vector<unsigned char> filtered;
+    filtered.reserve((stride + 1) * height);
+    for (int y = 0; y < height; ++y)
+    {
+        const int filter = y % 5;
+        filtered.push_back((unsigned char)filter);
+        const unsigned char *row = &pixels[y * stride], *up = y ? row - stride : nullptr;
+        for (size_t i = 0; i < stride; ++i)
+        {
+            const int a = i >= (size_t)components ? row[i - components] : 0;
+            const int b = up ? up[i] : 0;
+            const int c = up && i >= (size_t)components ? up[i - components] : 0;
+            int predicted = 0;
+            switch (filter)
+            {
+            case 1: predicted = a; break;
+            case 2: predicted = b; break;
+            case 3: predicted = (a + b) >> 1; break;
+            case 4:
+            {
+                const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                predicted = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                break;
+            }
+            }
+            filtered.push_back((unsigned char)(row[i] - predicted));
+        }
+    }
+
+    std::vector<unsigned char> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    auto chunk = [&out](const char *type, const std::vector<unsigned char> &body) {
+        put32be(out, (unsigned)body.size());
+        const size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), body.begin(), body.end());
+        put32be(out, crc32(&out[start], out.size() - start));
+    };
+    std::vector<unsigned char> header;
+    put32be(header, width);
+    put32be(header, height);
+    header.insert(header.end(), { 8, colourType[components], 0, 0, 0 });
+    chunk("IHDR", header);
+    chunk("IDAT", zlibCompress(filtered));
+    chunk("IEND", {});
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+inline std::vector<unsigned char> encodeBmp(const std::vector<unsigned char> &pixels, int width, int height, int components)
+{
+    const int bits = components * 8;
+    const size_t stride = ((size_t)width * components + 3) & ~(size_t)3;
+    std::vector<unsigned char> out = { 'B', 'M' };
+    put32le(out, (unsigned)(54 + stride * height));
+    put32le(out, 0);
+    put32le(out, 54);
+    put32le(out, 40);
+    put32le(out, width);
+    put32le(out, height);   // bottom-up
+    put16le(out, 1);
+    put16le(out, bits);
+    put32le(out, 0);
+    put32le(out, (unsigned)(stride * height));
+    put32le(out, 2835);
+    put32le(out, 2835);
+    put32le(out, 0);
+    put32le(out, 0);
+    for (int y = height - 1; y >= 0; --y)
+    {
+        const size_t start = out.size();
+        for (int x = 0; x < width; ++x)
+        {
+            const unsigned char *p = &pixels[((size_t)y * width + x) * components];
+            out.insert(out.end(), { p[2], p[1], p[0] });
+            if (components == 4)
+                out.push_back(p[3]);
+        }
+        out.resize(start + stride, 0);
+    }
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+inline std::vector<unsigned char> encodeTga(const std::vector<unsigned char> &pixels, int width, int height, int components, bool rle)
+{
+    std::vector<unsigned char> out = { 0, 0, (unsigned char)(rle ? 10 : 2), 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    put16le(out, width);
+    put16le(out, height);
+    out.push_back((unsigned char)(components * 8));
+    out.push_back(components == 4 ? 8 : 0);     // bottom-up, alpha bits
+    for (int y = height - 1; y >= 0; --y)
+    {
+        const unsigned char *row = &pixels[(size_t)y * width * components];
+        auto texel = [&](int x) { return row + (size_t)x * components; };
+        auto putTexel = [&](int x) {
+            const unsigned char *p = texel(x);
+            out.insert(out.end(), { p[2], p[1], p[0] });
+            if (components == 4)
+                out.push_back(p[3]);
+        };
+        if (!rle)
+        {
+            for (int x = 0; x < width; ++x)
+                putTexel(x);
+            continue;
+        }
+        // packets stay within a row, as most encoders do
+        for (int x = 0; x < width;)
+        {
+            int run = 1;
+            while (x + run < width && run < 128 && !std::memcmp(texel(x), texel(x + run), components))
+                ++run;
+            if (run > 1)
+            {
+                out.push_back((unsigned char)(0x80 | (run - 1)));
+                putTexel(x);
+                x += run;
+                continue;
+            }
+            int count = 1;
+            while (x + count < width && count < 128 &&
+                   (x + count + 1 >= width || std::memcmp(texel(x + count), texel(x + count + 1), components)))
+                ++count;
+            out.push_back((unsigned char)(count - 1));
+            for (int i = 0; i < count; ++i)
+                putTexel(x + i);
+            x += count;
+        }
+    }
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+// GIF89a with a 3-3-2 palette and LZW, clearing the table when it fills
+inline std::vector<unsigned char> encodeGif(const std::vector<unsigned char> &pixels, int width, int height, int components)
+{
+    std::vector<unsigned char> out = { 'G', 'I', 'F', '8', '9', 'a' };
+    put16le(out, width);
+    put16le(out, height);
+    out.insert(out.end(), { 0xf7, 0, 0 });
+    for (int i = 0; i < 256; ++i)
+        out.insert(out.end(), { (unsigned char)((i >> 5) * 255 / 7), (unsigned char)(((i >> 2) & 7) * 255 / 7), (unsigned char)((i & 3) * 255 / 3) });
+    out.push_back(',');
+    put16le(out, 0);
+    put16le(out, 0);
+    put16le(out, width);
+    put16le(out, height);
+    out.push_back(0);
+    out.push_back(8);   // minimum code size
+
+    BitWriter bits;
+    const int clear = 256, end = 257;
+    std::vector<int> table((size_t)4096 * 256, -1);
+    int next = 258, size = 9, prefix = -1;
+    bits.put(clear, size);
+    const size_t texels = (size_t)width * height;
+    for (size_t i = 0; i < texels; ++i)
+    {
+        const unsigned char *p = &pixels[i * components];
+        const int index = components >= 3 ? (p[0] & 0xe0) | ((p[1] >> 3) & 0x1c) | (p[2] >> 6) : p[0];
+        if (prefix < 0)
+        {
+            prefix = index;
+            continue;
+        }
+        int &entry = table[(size_t)prefix * 256 + index];
+        if (entry >= 0)
+        {
+            prefix = entry;
+            continue;
+        }
+        bits.put(prefix, size);
+        if (next == 4096)
+        {
+            bits.put(clear, size);
+            std::fill(table.begin(), table.end(), -1);
+            next = 258;
+            size = 9;
+        }
+        else
+        {
+            entry = next++;
+            if (next > (1 << size) && size < 12)
+                ++size;
+        }
+        prefix = index;
+    }
+    bits.put(prefix, size);
+    bits.put(end, size);
+    bits.flush();
+    for (size_t i = 0; i < bits.bytes.size(); i += 255)
+    {
+        const size_t count = std::min<size_t>(255, bits.bytes.size() - i);
+        out.push_back((unsigned char)count);
+        out.insert(out.end(), bits.bytes.begin() + i, bits.bytes.begin() + i + count);
+    }
+    out.insert(out.end(), { 0, ';' });
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+// Radiance RGBE with run-length scanlines
+inline std::vector<unsigned char> encodeHdr(const std::vector<unsigned char> &pixels, int width, int height, int components)
+{
+    const std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(height) + " +X " + std::to_string(width) + "\n";
+    std::vector<unsigned char> out(header.begin(), header.end());
+    std::vector<unsigned char> rgbe((size_t)width * 4);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const unsigned char *p = &pixels[((size_t)y * width + x) * components];
+            // stretch LDR values into a range that needs the exponent
+            float value[3];
+            for (int c = 0; c < 3; ++c)
+                value[c] = std::pow(p[components >= 3 ? c : 0] / 255.0f, 2.2f) * (1.0f + 15.0f * x / width);
+            const float largest = std::max(value[0], std::max(value[1], value[2]));
+            unsigned char *e = &rgbe[(size_t)x * 4];
+            if (largest < 1e-32f)
+            {
+                e[0] = e[1] = e[2] = e[3] = 0;
+                continue;
+            }
+            int exponent;
+            const float scale = std::frexp(largest, &exponent) * 256.0f / largest;
+            for (int c = 0; c < 3; ++c)
+                e[c] = (unsigned char)(value[c] * scale);
+            e[3] = (unsigned char)(exponent + 128);
+        }
+        out.insert(out.end(), { 2, 2, (unsigned char)(width >> 8), (unsigned char)(width & 255) });
+        for (int c = 0; c < 4; ++c)
+            for (int x = 0; x < width;)
+            {
+                int run = 1;
+                while (x + run < width && run < 127 && rgbe[(size_t)(x + run) * 4 + c] == rgbe[(size_t)x * 4 + c])
+                    ++run;
+                if (run >= 3)
+                {
+                    out.insert(out.end(), { (unsigned char)(128 + run), rgbe[(size_t)x * 4 + c] });
+                    x += run;
+                    continue;
+                }
+                int count = 0;
+                while (x + count < width && count < 128)
+                {
+                    const int at = x + count;
+                    if (at + 2 < width && rgbe[(size_t)at * 4 + c] == rgbe[(size_t)(at + 1) * 4 + c] &&
+                        rgbe[(size_t)at * 4 + c] == rgbe[(size_t)(at + 2) * 4 + c])
+                        break;
+                    ++count;
+                }
+                out.push_back((unsigned char)count);
+                for (int i = 0; i < count; ++i)
+                    out.push_back(rgbe[(size_t)(x + i) * 4 + c]);
+                x += count;
+            }
+    }
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+inline std::string formatOf(const std::vector<unsigned char> &bytes)
+{
+    auto starts = [&bytes](const char *magic) { return bytes.size() >= std::strlen(magic) && !std::memcmp(bytes.data(), magic, std::strlen(magic)); };
+    if (starts("\x89PNG")) return "png";
+    if (starts("\xff\xd8")) return "jpeg";
+    if (starts("GIF8")) return "gif";
+    if (starts("BM")) return "bmp";
+    if (starts("#?RADIANCE") || starts("#?RGBE")) return "hdr";
+    if (starts("8BPS")) return "psd";
+    if (starts("P5") || starts("P6")) return "pnm";
+    // TGA has no magic; trust stb_image to recognise it
+    return "tga";
+}
+
+inline bool readFile(const std::string &path, std::vector<unsigned char> &bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !bytes.empty();
+}
@@ -0,0 +1,81 @@
+// Block compression quality versus speed: compresses each image to BC1, BC3
+// and BC7 with TextureCompressor, on one thread and on all of them, and
+// reports throughput, PSNR of the decoded result and the size saving over
+// the raw stbi_load pixels. Colour PSNR skips texels whose source alpha is 0;
+// BC1 still loses on texels between 1 and 127, which it makes transparent
+// black. No window or GL context is needed.
+//
+// build from this folder:
+//     g++ -O2 texture_compression.cpp -o texture_compression -I../include -I.. -lpthread
+// run with image paths, or none for the tutorial textures:
+//     ./texture_compression [image ...]
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "texture_compressor.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> paths(argv + 1, argv + argc);
+    if (paths.empty())
+        paths = { "../04_纹理/image/container.jpg", "../04_纹理/image/awesomeface.png", "../04_纹理/image/textures.png" };
+    const unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    const char *const names[] = { "BC1", "BC3", "BC7" };
+
+    std::printf("%-36s %-6s %9s %9s %9s %8s %8s %7s\n", "image", "format", "ms (1t)", "MP/s (1t)",
+                ("MP/s (" + std::to_string(threads) + "t)").c_str(), "PSNR rgb", "PSNR a", "ratio");
+    for (const std::string &path : paths)
+    {
+        int width, height, components;
+        unsigned char *pixels = stbi_load(path.c_str(), &width, &height, &components, 0);
+        if (!pixels)
+        {
+            std::printf("%-36s failed to load: %s\n", path.c_str(), stbi_failure_reason());
+            continue;
+        }
+        // the source as RGBA, to compare against the decoded blocks
+        const size_t texels = (size_t)width * height;
+        std::vector<unsigned char> rgba(texels * 4);
+        for (size_t i = 0; i < texels; ++i)
+            for (int c = 0; c < 4; ++c)
+                rgba[i * 4 + c] = c < 3 ? pixels[i * components + (components >= 3 ? c : 0)]
+                                        : (components == 2 || components == 4 ? pixels[i * components + components - 1] : 255);
+        const bool alpha = components == 2 || components == 4;
+
+        for (int f = 0; f < 3; ++f)
+        {
+            const BlockFormat format = (BlockFormat)f;
+            auto start = std::chrono::steady_clock::now();
+            CompressedLevel level = TextureCompressor::compress(pixels, width, height, components, format, 1);
+            const double single = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            start = std::chrono::steady_clock::now();
+            TextureCompressor::compress(pixels, width, height, components, format, threads);
+            const double all = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            // colour only counts where the source isn't fully transparent
+            std::vector<unsigned char> decoded = TextureCompressor::decompress(level, format), seen, seenDecoded;
+            for (size_t i = 0; i < texels; ++i)
+                if (rgba[i * 4 + 3] != 0)
+                {
+                    seen.insert(seen.end(), &rgba[i * 4], &rgba[i * 4 + 3]);
+                    seenDecoded.insert(seenDecoded.end(), &decoded[i * 4], &decoded[i * 4 + 3]);
+                }
+            const double rgbPsnr = TextureCompressor::psnr(seen.data(), 3, seenDecoded.data(), 3, seen.size() / 3, 3);
+            const double alphaPsnr = TextureCompressor::psnr(rgba.data() + 3, 4, decoded.data() + 3, 4, texels, 1);
+            char alphaText[16] = "-";
+            if (alpha)
+                std::snprintf(alphaText, sizeof(alphaText), "%.2f", alphaPsnr);
+            std::printf("%-36s %-6s %9.2f %9.2f %9.2f %8.2f %8s %6.1fx\n", path.c_str(), names[f], single,
+                        texels / single / 1000.0, texels / all / 1000.0, rgbPsnr, alphaText,
+                        (double)(texels * components) / level.data.size());
+        }
+        stbi_image_free(pixels);
+    }
+    return 0;
+}
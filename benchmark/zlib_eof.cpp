@@ -0,0 +1,197 @@
+// stb_image zlib decoder check against zlib itself: random data is deflated
+// by zlib as raw streams (no header, no checksum after the last block), so
+// each one ends exactly at the end of the input, and every stb entry point
+// that takes raw deflate must give the original bytes back. Near the end the
+// decoder has to look at bits past the last byte (implicit zeros), which is
+// where a decoder that refills its bit buffer differently goes wrong. The
+// output is compared with what went into zlib. The data mixes
+// noise, runs and text-like repeats, and is deflated with every zlib
+// strategy at several levels, so fixed, dynamic and stored blocks all end
+// streams.
+//
+// build from this folder:
+//     g++ -O2 zlib_eof.cpp -o zlib_eof -I../include -lz
+// run from this folder:
+//     ./zlib_eof [--count N] [--seed S]
+// exits non-zero on any failure.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct Random
+{
+    uint64_t state;
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 11);
+    }
+    uint32_t below(uint32_t n) { return next() % n; }
+};
+
+// ----------------------------------------------------------------------------
+static std::vector<unsigned char> makeData(Random &random)
+{
+    static const char *const words[] = { "texture ", "shader ", "vertex ", "uniform ", "sampler2D ", "vec4 ", "\n", "  " };
+    const size_t size = random.below(4) == 0 ? random.below(64) + 1 : random.below(60000) + 1;
+    const int kind = (int)random.below(4);
+    std::vector<unsigned char> data;
+    while (data.size() < size)
+    {
+        switch (random.below(4) == 0 ? (int)random.below(4) : kind)
+        {
+        case 0: // noise
+            for (int i = 0; i < 64; ++i)
+                data.push_back((unsigned char)random.next());
+            break;
+        case 1: // runs
+            data.insert(data.end(), random.below(300) + 1, (unsigned char)random.below(4));
+            break;
+        case 2: // text-like
+            for (int i = 0; i < 8; ++i)
+            {
+                const char *word = words[random.below(8)];
+                data.insert(data.end(), word, word + std::strlen(word));
+            }
+            break;
+        default: // a few symbols, skewed
+            for (int i = 0; i < 64; ++i)
+                data.push_back((unsigned char)(random.below(16) * random.below(16) / 8));
+            break;
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+static bool deflateRaw(const std::vector<unsigned char> &data, int level, int strategy, std::vector<unsigned char> &out)
+{
+    z_stream z = {};
+    if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+        return false;
+    out.resize(deflateBound(&z, (uLong)data.size()) + 16);
+    z.next_in = (Bytef *)data.data();
+    z.avail_in = (uInt)data.size();
+    z.next_out = out.data();
+    z.avail_out = (uInt)out.size();
+    const int status = deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return status == Z_STREAM_END;
+}
+
+// stbi_zlib_decode_stream, handed the input in pieces of 'piece' bytes
+struct StreamCase
+{
+    const std::vector<unsigned char> *input;
+    size_t at, piece;
+    std::vector<unsigned char> output;
+};
+
+static int readPiece(void *user, char *data, int size)
+{
+    StreamCase *c = (StreamCase *)user;
+    size_t n = c->input->size() - c->at;
+    if (n > c->piece) n = c->piece;
+    if (n > (size_t)size) n = (size_t)size;
+    std::memcpy(data, c->input->data() + c->at, n);
+    c->at += n;
+    return (int)n;
+}
+
+static int writePiece(void *user, const char *data, int size)
+{
+    StreamCase *c = (StreamCase *)user;
+    c->output.insert(c->output.end(), data, data + size);
+    return 1;
+}
+
+// ----------------------------------------------------------------------------
+// whether every raw entry point decodes 'stream' to 'expected'; names the
+// first that doesn't in 'failed'
+static bool decodesTo(const std::vector<unsigned char> &stream, const std::vector<unsigned char> &expected, std::string &failed)
+{
+    const char *in = (const char *)stream.data();
+    const int len = (int)stream.size();
+    auto same = [&](const char *out, int size)
+    {
+        return out && size == (int)expected.size() && !std::memcmp(out, expected.data(), size);
+    };
+
+    int size = -1;
+    char *out = stbi_zlib_decode_noheader_malloc(in, len, &size);
+    bool ok = same(out, size);
+    STBI_FREE(out);
+    if (!ok) { failed = "noheader_malloc"; return false; }
+
+    out = stbi_zlib_decode_malloc_guesssize_headerflag(in, len, 1, &size, 0);
+    ok = same(out, size);
+    STBI_FREE(out);
+    if (!ok) { failed = "guesssize_headerflag"; return false; }
+
+    std::vector<char> buffer(expected.size() + 1);
+    size = stbi_zlib_decode_noheader_buffer(buffer.data(), (int)buffer.size(), in, len);
+    if (!same(size < 0 ? nullptr : buffer.data(), size)) { failed = "noheader_buffer"; return false; }
+
+    out = stbi_zlib_decode_known_size(in, len, (int)expected.size(), 0);
+    ok = same(out, (int)expected.size());
+    STBI_FREE(out);
+    if (!ok) { failed = "known_size"; return false; }
+
+    for (size_t piece : { (size_t)1 << 20, (size_t)7, (size_t)1 })
+    {
+        if (piece == 1 && stream.size() > 4096)
+            continue;
+        StreamCase c = { &stream, 0, piece, {} };
+        const stbi_zlib_io io = { readPiece, writePiece };
+        const int result = stbi_zlib_decode_stream(&io, &c, 0);
+        if (!result || c.output != expected) { failed = "stream/" + std::to_string(piece); return false; }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 3000;
+    uint64_t seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (!std::strcmp(argv[i], "--count"))
+            count = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--seed"))
+            seed = std::strtoull(argv[i + 1], nullptr, 10);
+    }
+
+    static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+    static const char *const strategyNames[] = { "default", "filtered", "huffman", "rle", "fixed" };
+    Random random = { seed * 0x9e3779b97f4a7c15ull + 1 };
+    int failures = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const std::vector<unsigned char> data = makeData(random);
+        const int strategy = (int)random.below(5), level = (int)random.below(10);
+        std::vector<unsigned char> stream;
+        if (!deflateRaw(data, level, strategies[strategy], stream))
+            continue;
+
+        std::string failed;
+        if (!decodesTo(stream, data, failed))
+        {
+            std::printf("FAIL stream %d (%s, level %d, %zu -> %zu bytes): %s: %s\n", i, strategyNames[strategy], level, data.size(),
+                        stream.size(), failed.c_str(), stbi_failure_reason() ? stbi_failure_reason() : "wrong output");
+            ++failures;
+        }
+    }
+    std::printf("%d streams, %d failures\n", count, failures);
+    return failures != 0;
+}
@@ -0,0 +1,195 @@
+// Inflate throughput of stb_image's zlib decoder: every stream is decoded
+// through each entry point and timed as the best of several runs, in MB/s of
+// decoded output:
+//     malloc     stbi_zlib_decode_malloc, output grown from 16KB by realloc
+//     guess      stbi_zlib_decode_malloc_guesssize with the exact size
+//     buffer     stbi_zlib_decode_buffer into caller memory
+//     known      stbi_zlib_decode_known_size
+//     stream     stbi_zlib_decode_stream, fed 64KB at a time
+// The streams are the IDAT data of the tutorial PNGs (written by several
+// different encoders) plus any files given: PNGs have their IDAT chunks
+// joined, anything else is taken to be a zlib stream as it is.
+//
+// build from this folder:
+//     g++ -O2 zlib_inflate.cpp -o zlib_inflate -I../include
+// run from this folder:
+//     ./zlib_inflate [--csv] [--root DIR] [file ...]
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct Stream
+{
+    std::string name;
+    std::vector<char> data;
+    int size = 0;   // decoded
+};
+
+static bool readFile(const std::string &path, std::vector<char> &bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !bytes.empty();
+}
+
+// the zlib stream of a PNG is its IDAT chunks back to back
+static bool pngStream(const std::vector<char> &file, std::vector<char> &stream)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if (file.size() < 8 || std::memcmp(file.data(), signature, 8))
+        return false;
+    stream.clear();
+    size_t at = 8;
+    while (at + 12 <= file.size())
+    {
+        const unsigned char *p = (const unsigned char *)&file[at];
+        const size_t length = (size_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        if (at + 12 + length > file.size())
+            break;
+        if (!std::memcmp(p + 4, "IDAT", 4))
+            stream.insert(stream.end(), file.begin() + at + 8, file.begin() + at + 8 + length);
+        at += 12 + length;
+    }
+    return !stream.empty();
+}
+
+template <typename Function>
+static double bestMs(Function &&function)
+{
+    double best = 1e30, total = 0.0;
+    for (int run = 0; run < 50 && (run < 3 || total < 200.0); ++run)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, ms);
+        total += ms;
+    }
+    return best;
+}
+
+struct Reader
+{
+    const std::vector<char> *data;
+    size_t at;
+    size_t written;
+};
+
+int main(int argc, char *argv[])
+{
+    bool csv = false;
+    std::string root = "..";
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--csv")
+            csv = true;
+        else if (arg == "--root" && i + 1 < argc)
+            root = argv[++i];
+        else
+            paths.push_back(arg);
+    }
+    std::error_code ec;
+    for (const auto &chapter : std::filesystem::directory_iterator(root, ec))
+    {
+        const std::filesystem::path folder = chapter.path() / "image";
+        if (!std::filesystem::is_directory(folder, ec))
+            continue;
+        for (const auto &entry : std::filesystem::directory_iterator(folder, ec))
+            if (entry.path().extension() == ".png")
+                paths.push_back(entry.path().string());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<Stream> streams;
+    for (const std::string &path : paths)
+    {
+        std::vector<char> file;
+        Stream stream;
+        stream.name = path;
+        if (!readFile(path, file))
+        {
+            std::fprintf(stderr, "%s: could not read\n", path.c_str());
+            continue;
+        }
+        if (!pngStream(file, stream.data))
+            stream.data = std::move(file);
+        char *out = stbi_zlib_decode_malloc(stream.data.data(), (int)stream.data.size(), &stream.size);
+        if (!out)
+        {
+            std::fprintf(stderr, "%s: %s\n", path.c_str(), stbi_failure_reason());
+            continue;
+        }
+        std::free(out);
+        streams.push_back(std::move(stream));
+    }
+
+    const char *const methods[] = { "malloc", "guess", "buffer", "known", "stream" };
+    double totalMs[5] = {};
+    size_t totalIn = 0, totalOut = 0;
+    if (csv)
+        std::printf("stream,in_bytes,out_bytes,method,ms,mb_per_s\n");
+    else
+        std::printf("%-60s %8s %9s %8s %8s %8s %8s %8s\n", "stream", "KB in", "KB out", "malloc", "guess", "buffer", "known", "stream");
+    for (const Stream &stream : streams)
+    {
+        const char *in = stream.data.data();
+        const int length = (int)stream.data.size();
+        std::vector<char> buffer(stream.size);
+        double ms[5];
+        ms[0] = bestMs([&] { int size; std::free(stbi_zlib_decode_malloc(in, length, &size)); });
+        ms[1] = bestMs([&] { int size; std::free(stbi_zlib_decode_malloc_guesssize(in, length, stream.size, &size)); });
+        ms[2] = bestMs([&] { stbi_zlib_decode_buffer(buffer.data(), stream.size, in, length); });
+        ms[3] = bestMs([&] { std::free(stbi_zlib_decode_known_size(in, length, stream.size, 1)); });
+        ms[4] = bestMs([&] {
+            Reader reader = { &stream.data, 0, 0 };
+            stbi_zlib_io io;
+            io.read = [](void *user, char *data, int size) {
+                Reader *r = (Reader *)user;
+                const int n = (int)std::min<size_t>(std::min(size, 65536), r->data->size() - r->at);
+                std::memcpy(data, r->data->data() + r->at, n);
+                r->at += n;
+                return n;
+            };
+            io.write = [](void *user, const char *, int size) {
+                ((Reader *)user)->written += size;
+                return 1;
+            };
+            stbi_zlib_decode_stream(&io, &reader, 1);
+        });
+
+        totalIn += length;
+        totalOut += stream.size;
+        for (int m = 0; m < 5; ++m)
+        {
+            totalMs[m] += ms[m];
+            if (csv)
+                std::printf("%s,%d,%d,%s,%.4f,%.2f\n", stream.name.c_str(), length, stream.size, methods[m], ms[m],
+                            stream.size / ms[m] / 1000.0);
+        }
+        if (!csv)
+            std::printf("%-60s %8.1f %9.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", stream.name.c_str(), length / 1024.0,
+                        stream.size / 1024.0, stream.size / ms[0] / 1000.0, stream.size / ms[1] / 1000.0,
+                        stream.size / ms[2] / 1000.0, stream.size / ms[3] / 1000.0, stream.size / ms[4] / 1000.0);
+    }
+    for (int m = 0; m < 5; ++m)
+        if (csv)
+            std::printf("all,%zu,%zu,%s,%.4f,%.2f\n", totalIn, totalOut, methods[m], totalMs[m], totalOut / totalMs[m] / 1000.0);
+    if (!csv)
+        std::printf("%-60s %8.1f %9.1f %8.1f %8.1f %8.1f %8.1f %8.1f  MB/s\n", "all", totalIn / 1024.0, totalOut / 1024.0,
+                    totalOut / totalMs[0] / 1000.0, totalOut / totalMs[1] / 1000.0, totalOut / totalMs[2] / 1000.0,
+                    totalOut / totalMs[3] / 1000.0, totalOut / totalMs[4] / 1000.0);
+    return 0;
+}
@@ -0,0 +1,174 @@
+#ifndef HDR_LOADER_H
+#define HDR_LOADER_H
+
+// stb_image and parallelFor
+#include "texture_support.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// pixel layouts HdrLoader can produce, with the matching glTexImage2D
+// internalformat / format / type
+enum class HdrFormat
+{
+    RGB32F,     // GL_RGB32F,  GL_RGB,  GL_FLOAT
+    RGBA32F,    // GL_RGBA32F, GL_RGBA, GL_FLOAT (alpha 1)
+    RGB16F,     // GL_RGB16F,  GL_RGB,  GL_HALF_FLOAT
+    RGBA16F,    // GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT (alpha 1)
+    RGB9E5      // GL_RGB9_E5, GL_RGB,  GL_UNSIGNED_INT_5_9_9_9_REV
+};
+
+struct HdrImage
+{
+    int width = 0;
+    int height = 0;
+    HdrFormat format = HdrFormat::RGB32F;
+    std::vector<unsigned char> data;    // rows bottom-up if flipping was on
+    std::string error;                  // stbi_failure_reason() on failure
+
+    bool ok() const { return !data.empty(); }
+    int channels() const { return format == HdrFormat::RGBA32F || format == HdrFormat::RGBA16F ? 4 : 3; }
+    size_t bytesPerPixel() const
+    {
+        switch (format)
+        {
+        case HdrFormat::RGB32F:  return 12;
+        case HdrFormat::RGBA32F: return 16;
+        case HdrFormat::RGB16F:  return 6;
+        case HdrFormat::RGBA16F: return 8;
+        default:                 return 4;
+        }
+    }
+};
+
+// Radiance .hdr loading for large environment maps. stb_image expands the
+// run-length coded scanlines into raw RGBE pixels (a byte shuffle), then
+// blocks of rows are converted to the requested format on a pool of threads.
+// The half-float path goes straight from RGBE through a table, never via
+// float; values above the half range are clamped to 65504 rather than
+// becoming infinity, which would poison filtering and mip generation.
+class HdrLoader
+{
+public:
+    // threadCount 0 means one thread per hardware thread
+    // ------------------------------------------------------------------------
+    static HdrImage load(const std::string &path, HdrFormat format = HdrFormat::RGB32F, unsigned int threadCount = 0)
+    {
+        int width = 0, height = 0;
+        stbi_uc *rgbe = stbi_load_rgbe(path.c_str(), &width, &height);
+        return finish(rgbe, width, height, format, threadCount);
+    }
+    // ------------------------------------------------------------------------
+    static HdrImage loadFromMemory(const unsigned char *buffer, int length, HdrFormat format = HdrFormat::RGB32F, unsigned int threadCount = 0)
+    {
+        int width = 0, height = 0;
+        stbi_uc *rgbe = stbi_load_rgbe_from_memory(buffer, length, &width, &height);
+        return finish(rgbe, width, height, format, threadCount);
+    }
+    // convert width*height RGBE pixels (as from stbi_load_rgbe)
+    // ------------------------------------------------------------------------
+    static HdrImage convert(const stbi_uc *rgbe, int width, int height, HdrFormat format, unsigned int threadCount = 0)
+    {
+        HdrImage image;
+        image.width = width;
+        image.height = height;
+        image.format = format;
+        image.data.resize((size_t)width * height * image.bytesPerPixel());
+        if (image.data.empty())
+            return image;
+
+        const int blockRows = std::max(1, 65536 / std::max(1, width));
+        const size_t blocks = ((size_t)height + blockRows - 1) / blockRows;
+        const size_t rowBytes = (size_t)width * image.bytesPerPixel();
+        const uint16_t *halfTable = (format == HdrFormat::RGB16F || format == HdrFormat::RGBA16F) ? halves() : nullptr;
+        parallelFor(blocks, threadCount, [&](size_t block)
+        {
+            const int first = (int)block * blockRows;
+            const int rows = std::min(blockRows, height - first);
+            const size_t count = (size_t)rows * width;
+            const stbi_uc *src = rgbe + (size_t)first * width * 4;
+            unsigned char *dst = image.data.data() + (size_t)first * rowBytes;
+            switch (format)
+            {
+            case HdrFormat::RGB32F:
+            case HdrFormat::RGBA32F:
+                stbi_rgbe_to_float((float *)dst, src, (int)count, image.channels());
+                break;
+            case HdrFormat::RGB16F:
+            case HdrFormat::RGBA16F:
+                toHalf((uint16_t *)dst, src, count, image.channels(), halfTable);
+                break;
+            case HdrFormat::RGB9E5:
+                toRgb9e5((uint32_t *)dst, src, count);
+                break;
+            }
+        });
+        return image;
+    }
+
+private:
+    // ------------------------------------------------------------------------
+    static HdrImage finish(stbi_uc *rgbe, int width, int height, HdrFormat format, unsigned int threadCount)
+    {
+        if (!rgbe)
+        {
+            HdrImage failed;
+            failed.format = format;
+            failed.error = stbi_failure_reason() ? stbi_failure_reason() : "unknown error";
+            return failed;
+        }
+        HdrImage image = convert(rgbe, width, height, format, threadCount);
+        stbi_image_free(rgbe);
+        return image;
+    }
+    // half of mantissa m at exponent byte e, at [e * 256 + m]; exponent 0 is
+    // the all-black pixel
+    // ------------------------------------------------------------------------
+    static const uint16_t *halves()
+    {
+        static const std::vector<uint16_t> table = []()
+        {
+            std::vector<uint16_t> t(256 * 256, 0);
+            for (int e = 1; e < 256; ++e)
+                for (int m = 0; m < 256; ++m)
+                    t[e * 256 + m] = glm::packHalf1x16(std::min(std::ldexp((float)m, e - 136), 65504.0f));
+            return t;
+        }();
+        return table.data();
+    }
+    // ------------------------------------------------------------------------
+    static void toHalf(uint16_t *dst, const stbi_uc *src, size_t count, int channels, const uint16_t *table)
+    {
+        const uint16_t one = 0x3c00;
+        for (size_t i = 0; i < count; ++i, src += 4, dst += channels)
+        {
+            const uint16_t *row = table + src[3] * 256;
+            dst[0] = row[src[0]];
+            dst[1] = row[src[1]];
+            dst[2] = row[src[2]];
+            if (channels == 4)
+                dst[3] = one;
+        }
+    }
+    // ------------------------------------------------------------------------
+    static void toRgb9e5(uint32_t *dst, const stbi_uc *src, size_t count)
+    {
+        float rgb[3 * 256];
+        for (size_t i = 0; i < count; i += 256)
+        {
+            const int n = (int)std::min<size_t>(256, count - i);
+            stbi_rgbe_to_float(rgb, src + i * 4, n, 3);
+            for (int k = 0; k < n; ++k)
+                dst[i + k] = glm::packF3x9_E1x5(glm::vec3(rgb[k * 3], rgb[k * 3 + 1], rgb[k * 3 + 2]));
+        }
+    }
+};
+#endif
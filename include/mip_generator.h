@@ -0,0 +1,400 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/color_space.hpp>
+
+// parallelFor
+#include "texture_support.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATOR_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MIP_GENERATOR_NEON
+#include <arm_neon.h>
+#endif
+
+enum class MipFilter
+{
+    Box,        // average of the texels each one covers; cheap, a little soft
+    Kaiser      // Kaiser-windowed sinc over 6 texels; sharper, can ring slightly
+};
+
+enum class MipWrap
+{
+    Clamp,      // edge texels repeat outwards (GL_CLAMP_TO_EDGE)
+    Repeat      // the image tiles (GL_REPEAT), so the filter wraps around
+};
+
+struct MipOptions
+{
+    MipFilter filter = MipFilter::Box;
+    MipWrap wrap = MipWrap::Clamp;
+    bool srgb = true;               // colour channels are sRGB encoded; alpha is always linear
+    float alphaCutoff = 0.0f;       // for alpha-tested cutouts: keep the share of texels with
+                                    // alpha above this the same in every level (0 = off)
+    int maxLevels = 0;              // 0 = the whole chain down to 1x1
+    unsigned int threadCount = 0;   // 0 = one per hardware thread
+};
+
+struct MipLevel
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;  // tightly packed rows, in the source's channel layout
+};
+
+struct MipChain
+{
+    int components = 0;             // 1 grey, 2 grey alpha, 3 RGB, 4 RGBA, as from stbi_load
+    std::vector<MipLevel> levels;   // [0] is the source image
+
+    bool ok() const { return !levels.empty(); }
+};
+
+// Builds a full mip chain on the CPU, for uploading level by level with
+// glTexImage2D instead of calling glGenerateMipmap, whose filtering varies by
+// driver and which averages sRGB texels as if they were linear. Colour is
+// decoded to linear with glm::convertSRGBToLinear's curve, premultiplied by
+// alpha so transparent texels don't bleed into their neighbours, filtered as
+// 4-float texels (one SSE2/NEON register each), then re-encoded with
+// glm::convertLinearToSRGB's. Every level is filtered from the one above it,
+// with the rows of each pass spread over a pool of threads.
+//
+//     MipChain chain = MipGenerator::generate(image.pixels.get(), image.width, image.height, image.components);
+//     for (size_t level = 0; level < chain.levels.size(); ++level)
+//         glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_SRGB8_ALPHA8, chain.levels[level].width,
+//                      chain.levels[level].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, chain.levels[level].pixels.data());
+class MipGenerator
+{
+public:
+    // pixels: width*height texels of 'components' bytes each (1-4)
+    // ------------------------------------------------------------------------
+    static MipChain generate(const unsigned char *pixels, int width, int height, int components, const MipOptions &options = MipOptions())
+    {
+        MipChain chain;
+        if (!pixels || width <= 0 || height <= 0 || components < 1 || components > 4)
+            return chain;
+        chain.components = components;
+        int levelCount = levels(width, height);
+        if (options.maxLevels > 0)
+            levelCount = std::min(levelCount, options.maxLevels);
+        chain.levels.resize(levelCount);
+        chain.levels[0].width = width;
+        chain.levels[0].height = height;
+        chain.levels[0].pixels.assign(pixels, pixels + (size_t)width * height * components);
+        if (levelCount == 1)
+            return chain;
+
+        const bool alpha = components == 2 || components == 4;
+        const float cutoff = alpha ? options.alphaCutoff : 0.0f;
+        const float targetCoverage = cutoff > 0.0f ? coverage(chain.levels[0].pixels.data(), (size_t)width * height, components, cutoff) : 0.0f;
+
+        std::vector<float> current = toLinear(chain.levels[0].pixels.data(), width, height, components, options);
+        std::vector<float> next, columns;
+        int w = width, h = height;
+        for (int level = 1; level < levelCount; ++level)
+        {
+            const int nextW = std::max(1, w / 2), nextH = std::max(1, h / 2);
+            const Taps across = taps(w, nextW, options), down = taps(h, nextH, options);
+
+            // horizontally into nextW x h, then vertically into nextW x nextH
+            columns.resize((size_t)nextW * h * 4);
+            parallelFor((size_t)h, poolSize(options, (size_t)nextW * h), [&](size_t y)
+            {
+                filterRow(columns.data() + y * nextW * 4, current.data() + y * w * 4, nextW, across);
+            });
+            next.resize((size_t)nextW * nextH * 4);
+            parallelFor((size_t)nextH, poolSize(options, (size_t)nextW * nextH), [&](size_t y)
+            {
+                filterColumn(next.data() + y * nextW * 4, columns.data(), nextW, down, y);
+            });
+
+            MipLevel &out = chain.levels[level];
+            out.width = nextW;
+            out.height = nextH;
+            out.pixels.resize((size_t)nextW * nextH * components);
+            const float scale = cutoff > 0.0f ? coverageScale(next, cutoff, targetCoverage) : 1.0f;
+            parallelFor((size_t)nextH, poolSize(options, (size_t)nextW * nextH), [&](size_t y)
+            {
+                fromLinear(out.pixels.data() + y * nextW * components, next.data() + y * nextW * 4, nextW, components, options.srgb, scale);
+            });
+
+            current.swap(next);
+            w = nextW;
+            h = nextH;
+        }
+        return chain;
+    }
+    // levels in a full chain for a width x height image
+    // ------------------------------------------------------------------------
+    static int levels(int width, int height)
+    {
+        int count = 1;
+        for (int size = std::max(width, height); size > 1; size /= 2)
+            ++count;
+        return count;
+    }
+
+private:
+    // for each output texel along one axis: 'count' source indices (already
+    // wrapped or clamped) and their weights, which sum to 1
+    struct Taps
+    {
+        int count = 0;
+        std::vector<int> index;
+        std::vector<float> weight;
+    };
+
+    // ------------------------------------------------------------------------
+    static Taps taps(int source, int target, const MipOptions &options)
+    {
+        const double scale = (double)source / target;
+        const double radius = options.filter == MipFilter::Box ? 0.5 * scale : 1.5 * scale;
+        Taps result;
+        result.count = (int)std::ceil(2.0 * radius) + 1;
+        result.index.assign((size_t)target * result.count, 0);
+        result.weight.assign((size_t)target * result.count, 0.0f);
+        for (int i = 0; i < target; ++i)
+        {
+            const double center = (i + 0.5) * scale;
+            const int first = (int)std::floor(center - radius);
+            double weights[64] = {};
+            double total = 0.0;
+            for (int k = 0; k < result.count && k < 64; ++k)
+            {
+                const int j = first + k;
+                double w;
+                if (options.filter == MipFilter::Box)
+                    w = std::max(0.0, std::min(center + radius, j + 1.0) - std::max(center - radius, (double)j));
+                else
+                {
+                    const double d = j + 0.5 - center;
+                    w = std::fabs(d) < radius ? sinc(d / scale) * kaiser(d / radius) : 0.0;
+                }
+                weights[k] = w;
+                total += w;
+            }
+            for (int k = 0; k < result.count && k < 64; ++k)
+            {
+                int j = first + k;
+                if (options.wrap == MipWrap::Repeat)
+                    j = ((j % source) + source) % source;
+                else
+                    j = std::min(std::max(j, 0), source - 1);
+                result.index[(size_t)i * result.count + k] = j;
+                result.weight[(size_t)i * result.count + k] = (float)(weights[k] / total);
+            }
+        }
+        return result;
+    }
+    // ------------------------------------------------------------------------
+    static double sinc(double x)
+    {
+        const double pi = 3.14159265358979323846;
+        return x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+    }
+    // Kaiser window on [-1, 1] with alpha 4; I0 by its power series
+    // ------------------------------------------------------------------------
+    static double kaiser(double x)
+    {
+        auto besselI0 = [](double v)
+        {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; k < 32; ++k)
+            {
+                term *= (v / (2.0 * k)) * (v / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        const double alpha = 4.0;
+        return besselI0(alpha * std::sqrt(std::max(0.0, 1.0 - x * x))) / besselI0(alpha);
+    }
+    // ------------------------------------------------------------------------
+    static void filterRow(float *dst, const float *src, int width, const Taps &taps)
+    {
+        const int *index = taps.index.data();
+        const float *weight = taps.weight.data();
+        for (int x = 0; x < width; ++x, dst += 4)
+        {
+#if defined(MIP_GENERATOR_SSE2)
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps.count; ++k, ++index, ++weight)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + *index * 4), _mm_set1_ps(*weight)));
+            _mm_storeu_ps(dst, sum);
+#elif defined(MIP_GENERATOR_NEON)
+            float32x4_t sum = vdupq_n_f32(0.0f);
+            for (int k = 0; k < taps.count; ++k, ++index, ++weight)
+                sum = vmlaq_n_f32(sum, vld1q_f32(src + *index * 4), *weight);
+            vst1q_f32(dst, sum);
+#else
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int k = 0; k < taps.count; ++k, ++index, ++weight)
+                for (int c = 0; c < 4; ++c)
+                    sum[c] += src[*index * 4 + c] * *weight;
+            for (int c = 0; c < 4; ++c)
+                dst[c] = sum[c];
+#endif
+        }
+    }
+    // output row y of a vertical pass over rows of 'width' texels
+    // ------------------------------------------------------------------------
+    static void filterColumn(float *dst, const float *src, int width, const Taps &taps, size_t y)
+    {
+        const int *index = taps.index.data() + y * taps.count;
+        const float *weight = taps.weight.data() + y * taps.count;
+        const size_t floats = (size_t)width * 4;
+        std::fill(dst, dst + floats, 0.0f);
+        for (int k = 0; k < taps.count; ++k)
+        {
+            const float *row = src + (size_t)index[k] * floats;
+            const float w = weight[k];
+            if (w == 0.0f)
+                continue;
+#if defined(MIP_GENERATOR_SSE2)
+            const __m128 vw = _mm_set1_ps(w);
+            for (size_t i = 0; i < floats; i += 4)
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(row + i), vw)));
+#elif defined(MIP_GENERATOR_NEON)
+            for (size_t i = 0; i < floats; i += 4)
+                vst1q_f32(dst + i, vmlaq_n_f32(vld1q_f32(dst + i), vld1q_f32(row + i), w));
+#else
+            for (size_t i = 0; i < floats; ++i)
+                dst[i] += row[i] * w;
+#endif
+        }
+    }
+    // texels to premultiplied linear RGBA floats; grey goes in the first
+    // channel, and images without alpha get 1
+    // ------------------------------------------------------------------------
+    static std::vector<float> toLinear(const unsigned char *pixels, int width, int height, int components, const MipOptions &options)
+    {
+        const float *decode = options.srgb ? srgbToLinear() : unorm();
+        const int colours = components >= 3 ? 3 : 1;
+        const bool alpha = components == 2 || components == 4;
+        std::vector<float> linear((size_t)width * height * 4, 0.0f);
+        parallelFor((size_t)height, poolSize(options, (size_t)width * height), [&](size_t y)
+        {
+            const unsigned char *src = pixels + y * width * components;
+            float *dst = linear.data() + y * width * 4;
+            for (int x = 0; x < width; ++x, src += components, dst += 4)
+            {
+                const float a = alpha ? src[components - 1] * (1.0f / 255.0f) : 1.0f;
+                for (int c = 0; c < colours; ++c)
+                    dst[c] = decode[src[c]] * a;
+                dst[3] = a;
+            }
+        });
+        return linear;
+    }
+    // back to bytes: unpremultiply, scale alpha for coverage, encode
+    // ------------------------------------------------------------------------
+    static void fromLinear(unsigned char *dst, const float *src, int width, int components, bool srgb, float alphaScale)
+    {
+        const uint8_t *encode = linearToSrgb();
+        const int colours = components >= 3 ? 3 : 1;
+        const bool alpha = components == 2 || components == 4;
+        for (int x = 0; x < width; ++x, src += 4, dst += components)
+        {
+            const float a = std::min(std::max(src[3], 0.0f), 1.0f);
+            const float unpremultiply = a > 1.0f / 65536.0f ? 1.0f / a : 0.0f;
+            for (int c = 0; c < colours; ++c)
+            {
+                const float v = std::min(std::max(src[c] * unpremultiply, 0.0f), 1.0f);
+                dst[c] = srgb ? encode[(int)(v * 65535.0f + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+            }
+            if (alpha)
+                dst[components - 1] = (unsigned char)(std::min(a * alphaScale, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+    // share of texels whose alpha is above the cutoff
+    // ------------------------------------------------------------------------
+    static float coverage(const unsigned char *pixels, size_t count, int components, float cutoff)
+    {
+        size_t covered = 0;
+        for (size_t i = 0; i < count; ++i)
+            covered += pixels[i * components + components - 1] * (1.0f / 255.0f) > cutoff;
+        return (float)covered / count;
+    }
+    // the alpha scale that brings a level's coverage closest to the target
+    // ------------------------------------------------------------------------
+    static float coverageScale(const std::vector<float> &level, float cutoff, float target)
+    {
+        const size_t count = level.size() / 4;
+        auto covered = [&](float scale)
+        {
+            size_t n = 0;
+            for (size_t i = 0; i < count; ++i)
+                n += level[i * 4 + 3] * scale > cutoff;
+            return (float)n / count;
+        };
+        float low = 0.0f, high = 4.0f, best = 1.0f, bestError = std::fabs(covered(1.0f) - target);
+        for (int step = 0; step < 16; ++step)
+        {
+            const float scale = 0.5f * (low + high);
+            const float c = covered(scale);
+            if (std::fabs(c - target) < bestError)
+            {
+                best = scale;
+                bestError = std::fabs(c - target);
+            }
+            if (c < target)
+                low = scale;
+            else
+                high = scale;
+        }
+        return best;
+    }
+    // ------------------------------------------------------------------------
+    static const float *srgbToLinear()
+    {
+        static const std::vector<float> table = []()
+        {
+            std::vector<float> t(256);
+            for (int i = 0; i < 256; ++i)
+                t[i] = glm::convertSRGBToLinear(glm::vec3(i / 255.0f)).x;
+            return t;
+        }();
+        return table.data();
+    }
+    // ------------------------------------------------------------------------
+    static const float *unorm()
+    {
+        static const std::vector<float> table = []()
+        {
+            std::vector<float> t(256);
+            for (int i = 0; i < 256; ++i)
+                t[i] = i / 255.0f;
+            return t;
+        }();
+        return table.data();
+    }
+    // sRGB byte of linear value i / 65535: fine enough steps that every byte
+    // survives a decode and encode unchanged, even in the dark linear segment
+    // ------------------------------------------------------------------------
+    static const uint8_t *linearToSrgb()
+    {
+        static const std::vector<uint8_t> table = []()
+        {
+            std::vector<uint8_t> t(65536);
+            for (int i = 0; i < 65536; ++i)
+                t[i] = (uint8_t)(glm::convertLinearToSRGB(glm::vec3(i / 65535.0f)).x * 255.0f + 0.5f);
+            return t;
+        }();
+        return table.data();
+    }
+    // thread count for a pass over 'texels'; small levels aren't worth a pool
+    // ------------------------------------------------------------------------
+    static unsigned int poolSize(const MipOptions &options, size_t texels)
+    {
+        return texels < 16384 ? 1u : options.threadCount;
+    }
+};
+#endif
@@ -6,18 +6,510 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// plain C file calls rather than <filesystem>: every tutorial includes this
+// header, so it has to keep building as C++14
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#ifdef __linux__
+#define SHADER_WATCH_INOTIFY
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// KHR_parallel_shader_compile (and ARB_, same value); the loader lists no
+// extensions, so Shader looks for it in the extension strings itself
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Linked programs kept on disk, so that later runs hand the driver a binary
+// through glProgramBinary instead of compiling GLSL again. Each file is named
+// after a hash of the shader sources and of the GL vendor, renderer and
+// version strings, so an edited shader or a new driver simply misses. A
+// binary the driver refuses anyway (allowed after any driver change) counts
+// as rejected and the program is compiled as usual. Needs GL 4.1 or
+// ARB_get_program_binary with at least one binary format; without them every
+// program is a miss and nothing is written.
+//
+//     Shader shader("5.1.transform.vs", "5.1.transform.fs");
+//     const ProgramBinaryCache::Stats &stats = ProgramBinaryCache::instance().stats();
+//     std::cout << stats.hits << " cached, " << stats.savedMs << " ms saved\n";
+class ProgramBinaryCache
+{
+public:
+    struct Stats
+    {
+        size_t hits = 0;        // programs loaded from a cached binary
+        size_t misses = 0;      // programs compiled from source, rejected ones included
+        size_t rejected = 0;    // cached binaries the driver would not load
+        double hitMs = 0.0;     // total time of the loads served from the cache
+        double missMs = 0.0;    // total time of the compiles and links
+        double savedMs = 0.0;   // compile time stored with each hit's binary, less the time of the hit
+    };
+
+    // the cache every Shader uses; call from the thread that owns the context
+    // ------------------------------------------------------------------------
+    static ProgramBinaryCache &instance()
+    {
+        static ProgramBinaryCache cache;
+        return cache;
+    }
+
+    // ------------------------------------------------------------------------
+    void setDirectory(const std::string &directory) { root = directory; }
+    void setEnabled(bool enable) { enabled = enable; }
+    const Stats &stats() const { return counters; }
+
+    // whether the current context can both hand out and take back binaries
+    // ------------------------------------------------------------------------
+    bool available()
+    {
+        probe();
+        return enabled && formats > 0;
+    }
+    // FNV-1a over the sources, each followed by its length, then the driver
+    // strings; like TextureCache it only has to tell versions apart
+    // ------------------------------------------------------------------------
+    uint64_t keyOf(std::initializer_list<const std::string *> sources)
+    {
+        probe();
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const std::string *source : sources)
+        {
+            hash = mix(hash, source->data(), source->size());
+            const uint64_t size = source->size();
+            hash = mix(hash, &size, sizeof(size));
+        }
+        const uint32_t version = Version;
+        hash = mix(hash, driver.data(), driver.size());
+        return mix(hash, &version, sizeof(version));
+    }
+    // a linked program made from the binary stored for 'key', or 0 when there
+    // is none or the driver rejects it
+    // ------------------------------------------------------------------------
+    GLuint load(uint64_t key)
+    {
+        if (!available())
+            return 0;
+        const auto start = std::chrono::steady_clock::now();
+        std::ifstream file(pathOf(key), std::ios::binary | std::ios::ate);
+        const std::streamoff size = file ? (std::streamoff)file.tellg() : 0;
+        FileHeader header;
+        if (!file || size < (std::streamoff)sizeof(header) || !file.seekg(0) || !file.read((char *)&header, sizeof(header)) ||
+            std::memcmp(header.magic, "PGMB", 4) != 0 || header.version != Version || header.key != key ||
+            header.length == 0 || header.length > (uint64_t)(size - (std::streamoff)sizeof(header)))
+            return 0;
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size()))
+            return 0;
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            glDeleteProgram(program);
+            ++counters.rejected;
+            return 0;
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        ++counters.hits;
+        counters.hitMs += ms;
+        counters.savedMs += header.compileMs - ms;
+        return program;
+    }
+    // call before linking a program that will be passed to store()
+    // ------------------------------------------------------------------------
+    void prepare(GLuint program)
+    {
+        if (available())
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    // count a program compiled in 'compileMs' and, if it linked, save its
+    // binary (via a temporary, so a crash never leaves a partial file)
+    // ------------------------------------------------------------------------
+    void store(uint64_t key, GLuint program, double compileMs)
+    {
+        ++counters.misses;
+        counters.missMs += compileMs;
+        GLint linked = GL_FALSE, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!available() || !linked)
+            return;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+        FileHeader header = {};
+        std::memcpy(header.magic, "PGMB", 4);
+        header.version = Version;
+        header.key = key;
+        header.format = format;
+        header.length = (uint32_t)length;
+        header.compileMs = compileMs;
+
+        createDirectories(root);
+        const std::string path = pathOf(key), temporary = path + ".tmp";
+        FILE *file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return;
+        const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                             std::fwrite(binary.data(), 1, (size_t)length, file) == (size_t)length;
+        if (std::fclose(file) == 0 && written)
+        {
+#ifdef _WIN32
+            // rename() won't replace an existing file there
+            std::remove(path.c_str());
+#endif
+            if (std::rename(temporary.c_str(), path.c_str()) == 0)
+                return;
+        }
+        std::remove(temporary.c_str());
+    }
+
+private:
+    static const uint32_t Version = 1;
+
+    struct FileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;        // as glGetProgramBinary returned it
+        uint32_t length;        // bytes of binary after the header
+        double compileMs;       // what compiling and linking took when it was stored
+    };
+
+    std::string root = "shader_cache";
+    bool enabled = true;
+    bool probed = false;
+    GLint formats = 0;
+    std::string driver;         // vendor, renderer, version and GLSL version
+    Stats counters;
+
+    // ------------------------------------------------------------------------
+    void probe()
+    {
+        if (probed)
+            return;
+        probed = true;
+        if (glProgramBinary && glGetProgramBinary && glProgramParameteri)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION })
+        {
+            const char *value = (const char *)glGetString(name);
+            driver += value ? value : "";
+            driver += '\n';
+        }
+    }
+    // ------------------------------------------------------------------------
+    static uint64_t mix(uint64_t hash, const void *data, size_t size)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        return hash;
+    }
+    // ------------------------------------------------------------------------
+    std::string pathOf(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        if (root.empty())
+            return name;
+        const char last = root.back();
+        return root + (last == '/' || last == '\\' ? "" : "/") + name;
+    }
+    // mkdir every missing folder along the path; failures show up when the
+    // file itself can't be created
+    // ------------------------------------------------------------------------
+    static void createDirectories(const std::string &path)
+    {
+        for (size_t end = 1; end <= path.size(); ++end)
+        {
+            if (end != path.size() && path[end] != '/' && path[end] != '\\')
+                continue;
+            const std::string folder = path.substr(0, end);
+#ifdef _WIN32
+            _mkdir(folder.c_str());
+#else
+            mkdir(folder.c_str(), 0755);
+#endif
+        }
+    }
+};
+
+// A uniform name, taken from a string literal or a std::string without
+// copying it, so the Shader setters never allocate.
+struct UniformName
+{
+    const char *text;
+    UniformName(const char *name) : text(name) {}
+    UniformName(const std::string &name) : text(name.c_str()) {}
+};
+
+// How a C++ value type is uploaded, and which GLSL types it may be set on.
+template <typename T>
+struct UniformTraits;
+
+template <>
+struct UniformTraits<bool>
+{
+    static bool accepts(GLenum type) { return type == GL_BOOL || type == GL_INT; }
+    static void upload(GLint location, bool value) { glUniform1i(location, (int)value); }
+};
+template <>
+struct UniformTraits<int>
+{
+    static bool accepts(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_INT: case GL_BOOL:
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+        case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+        case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+        case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+        case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW: case GL_SAMPLER_BUFFER:
+        case GL_SAMPLER_CUBE_MAP_ARRAY: case GL_SAMPLER_CUBE_MAP_ARRAY_SHADOW:
+        case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE: case GL_INT_SAMPLER_2D_ARRAY:
+        case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D:
+        case GL_UNSIGNED_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+            return true;
+        default:
+            return false;
+        }
+    }
+    static void upload(GLint location, int value) { glUniform1i(location, value); }
+};
+template <>
+struct UniformTraits<float>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT; }
+    static void upload(GLint location, float value) { glUniform1f(location, value); }
+};
+template <>
+struct UniformTraits<glm::vec2>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC2; }
+    static void upload(GLint location, const glm::vec2 &value) { glUniform2fv(location, 1, &value[0]); }
+};
+template <>
+struct UniformTraits<glm::vec3>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC3; }
+    static void upload(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, &value[0]); }
+};
+template <>
+struct UniformTraits<glm::vec4>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC4; }
+    static void upload(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, &value[0]); }
+};
+template <>
+struct UniformTraits<glm::mat2>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT2; }
+    static void upload(GLint location, const glm::mat2 &value) { glUniformMatrix2fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+template <>
+struct UniformTraits<glm::mat3>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT3; }
+    static void upload(GLint location, const glm::mat3 &value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+template <>
+struct UniformTraits<glm::mat4>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT4; }
+    static void upload(GLint location, const glm::mat4 &value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+
+// A uniform looked up once with Shader::uniform<T>(name) and then set with
+// Shader::set(handle, value), with neither a name lookup nor a type check on
+// the way. Only meaningful for the Shader that handed it out; a name that is
+// not an active uniform of type T gives an invalid handle, which set() ignores.
+//
+//     UniformHandle<glm::mat4> model = shader.uniform<glm::mat4>("model");
+//     ...
+//     shader.set(model, transform);
+template <typename T>
+struct UniformHandle
+{
+    int slot = -1;      // index into the Shader's uniform table
+    bool valid() const { return slot >= 0; }
+};
+
+// Watches shader source files from a thread of its own and reads them again
+// whenever one is saved, so that Shader::reload() on the render thread finds
+// the new sources ready instead of reading them itself. On Linux it waits on
+// inotify for writes and renames in the files' folders (editors save either
+// way); elsewhere it compares modification times and sizes four times a
+// second.
+class ShaderWatcher
+{
+    // what the polling fallback compares: st_mtime is only whole seconds on
+    // some systems, so a quick second save is caught by its size
+    struct Stamp
+    {
+        long long time = -1, size = -1;
+        bool operator!=(const Stamp &other) const { return time != other.time || size != other.size; }
+    };
+
+public:
+    // ------------------------------------------------------------------------
+    explicit ShaderWatcher(std::vector<std::string> paths)
+        : files(std::move(paths))
+    {
+        for (const std::string &file : files)
+            times.push_back(modified(file));
+        worker = std::thread(&ShaderWatcher::run, this);
+    }
+    // ------------------------------------------------------------------------
+    ~ShaderWatcher()
+    {
+        stopping = true;
+        worker.join();
+    }
+    ShaderWatcher(const ShaderWatcher &) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+    // the sources read after the latest change, in the order of the paths;
+    // false when nothing changed since the last call
+    // ------------------------------------------------------------------------
+    bool take(std::vector<std::string> &sources)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!changed)
+            return false;
+        changed = false;
+        sources = std::move(latest);
+        return true;
+    }
+
+private:
+    std::vector<std::string> files;
+    std::vector<Stamp> times;
+    std::thread worker;
+    std::atomic<bool> stopping{ false };
+    std::mutex mutex;
+    bool changed = false;
+    std::vector<std::string> latest;
+
+    // ------------------------------------------------------------------------
+    static Stamp modified(const std::string &path)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return Stamp();
+        return Stamp{ (long long)st.st_mtime, (long long)st.st_size };
+    }
+    // read every file again and hand the set over; a file caught half written
+    // simply fails to compile, and its next write triggers another read
+    // ------------------------------------------------------------------------
+    void readAll()
+    {
+        std::vector<std::string> sources;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            times[i] = modified(files[i]);
+            std::ifstream file(files[i], std::ios::binary);
+            std::stringstream stream;
+            stream << file.rdbuf();
+            sources.push_back(stream.str());
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        latest = std::move(sources);
+        changed = true;
+    }
+    // ------------------------------------------------------------------------
+    void run()
+    {
+#ifdef SHADER_WATCH_INOTIFY
+        const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        std::vector<std::string> names;
+        for (const std::string &file : files)
+        {
+            const size_t slash = file.find_last_of('/');
+            const std::string folder = slash == std::string::npos ? "." : slash == 0 ? "/" : file.substr(0, slash);
+            if (fd >= 0)
+                inotify_add_watch(fd, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            names.push_back(slash == std::string::npos ? file : file.substr(slash + 1));
+        }
+        if (fd >= 0)
+        {
+            alignas(struct inotify_event) char buffer[4096];
+            while (!stopping)
+            {
+                pollfd waiting = { fd, POLLIN, 0 };
+                if (poll(&waiting, 1, 100) <= 0)
+                    continue;
+                bool touched = false;
+                ssize_t length;
+                while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+                    for (char *at = buffer; at < buffer + length;)
+                    {
+                        const struct inotify_event *event = (const struct inotify_event *)at;
+                        for (const std::string &name : names)
+                            touched |= event->len != 0 && name == event->name;
+                        at += sizeof(struct inotify_event) + event->len;
+                    }
+                if (touched)
+                    readAll();
+            }
+            close(fd);
+            return;
+        }
+#endif
+        while (!stopping)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            for (size_t i = 0; i < files.size(); ++i)
+                if (modified(files[i]) != times[i])
+                {
+                    readAll();
+                    break;
+                }
+        }
+    }
+};
 
 class Shader
 {
 public:
     unsigned int ID;
+    // how much of the build the constructor waits for: Now checks the compile
+    // and link results before returning; Deferred only hands the sources to
+    // the driver, which may then compile them on its own threads
+    // (KHR_parallel_shader_compile) until finish() is called
+    enum class Build { Now, Deferred };
+
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, Build build = Build::Now)
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -47,100 +539,629 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        vertexFile = vertexPath;
+        fragmentFile = fragmentPath;
+        // 2. reuse the binary an earlier run linked from the same sources, or
+        // 3. compile them; nothing waits for the driver before finish()
+        ID = submit(vertexCode, fragmentCode, pending);
+        if (!pending.building)
+            introspect();
+        else if (build == Build::Now)
+            finish();
+    }
+    // whether finish() would return without waiting for the driver; always
+    // true without KHR_parallel_shader_compile, as there is no way to ask
+    // ------------------------------------------------------------------------
+    bool ready() const
+    {
+        return !pending.building || completed(ID);
+    }
+    // wait for a deferred build, report its errors, store its binary and list
+    // its uniforms; must be called before the Shader is used
+    // ------------------------------------------------------------------------
+    void finish()
+    {
+        if (!pending.building)
+            return;
+        complete(ID, pending);
+        // 5. list the active uniforms, so that setting one never asks the driver
+        introspect();
+    }
 
+    // Hot reload: watch() starts a ShaderWatcher on the two source files, and
+    // reload(), called once per frame, builds a new program whenever they
+    // change. The new program replaces ID only once it has linked; until then,
+    // or if it fails (the errors are printed), the old one stays in use.
+    // Uniforms keep their handles across the swap, and every value last set
+    // through this Shader is set again on the new program. Reloaded programs
+    // bypass ProgramBinaryCache, so reload() does no file IO of its own.
+    // ------------------------------------------------------------------------
+    void watch(bool enable = true)
+    {
+        if (!enable)
+            watcher.reset();
+        else if (!watcher)
+            watcher = std::make_unique<ShaderWatcher>(std::vector<std::string>{ vertexFile, fragmentFile });
+    }
+    // true on the frame a new program was swapped in
+    // ------------------------------------------------------------------------
+    bool reload()
+    {
+        if (next == 0)
+        {
+            std::vector<std::string> sources;
+            if (!watcher || !watcher->take(sources))
+                return false;
+            // edits are short-lived, so they skip the binary cache: no file
+            // IO on this thread, and no binary left behind for each save
+            next = submit(sources[0], sources[1], nextBuild, false);
+        }
+        if (nextBuild.building)
+        {
+            // with parallel compiles, keep drawing with the old program meanwhile
+            if (!completed(next))
+                return false;
+            if (!complete(next, nextBuild))
+            {
+                std::cout << "ERROR::SHADER::RELOAD_FAILED: " << vertexFile << ", " << fragmentFile
+                          << " (keeping the previous program)" << std::endl;
+                glDeleteProgram(next);
+                next = 0;
+                return false;
+            }
+        }
+        replaceProgram(next);
+        next = 0;
+        return true;
+    }
+    // whether the driver compiles shaders on threads of its own, so that a
+    // Build::Deferred shader does not cost the calling thread its compile
+    // ------------------------------------------------------------------------
+    static bool parallelCompile()
+    {
+        State &current = state();
+        if (current.parallel < 0)
+        {
+            current.parallel = 0;
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; ++i)
+            {
+                const char *name = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+                if (name && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                             std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+                    current.parallel = 1;
+            }
+        }
+        return current.parallel == 1;
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
     { 
+        State &current = state();
+        if (current.filtering && current.program == ID)
+        {
+            ++current.counters.programsSkipped;
+            return;
+        }
         glUseProgram(ID); 
+        current.program = ID;
+        ++current.counters.programs;
+    }
+    // location of an active uniform, or -1 (which glUniform* ignores) for any
+    // other name; array elements are found both as "a" and as "a[i]"
+    // ------------------------------------------------------------------------
+    GLint location(UniformName name) const
+    {
+        const int slot = find(name.text);
+        return slot >= 0 ? uniforms[slot].location : -1;
+    }
+    // a typed handle to set the uniform without looking its name up again
+    // ------------------------------------------------------------------------
+    template <typename T>
+    UniformHandle<T> uniform(UniformName name) const
+    {
+        UniformHandle<T> handle;
+        const int slot = find(name.text);
+        if (slot >= 0 && UniformTraits<T>::accepts(uniforms[slot].type))
+            handle.slot = slot;
+        else if (slot >= 0)
+            std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH: " << name.text << std::endl;
+        return handle;
+    }
+    // ------------------------------------------------------------------------
+    template <typename T>
+    void set(UniformHandle<T> handle, const T &value) const
+    {
+        write(handle.slot, value);
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(UniformName name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        write(find(name.text), value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(UniformName name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        write(find(name.text), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(UniformName name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        write(find(name.text), value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(UniformName name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        write(find(name.text), value); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(UniformName name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        write(find(name.text), glm::vec2(x, y)); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(UniformName name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        write(find(name.text), value); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(UniformName name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        write(find(name.text), glm::vec3(x, y, z)); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(UniformName name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        write(find(name.text), value); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    void setVec4(UniformName name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        write(find(name.text), glm::vec4(x, y, z, w)); 
+    }
+    // ------------------------------------------------------------------------
+    void setMat2(UniformName name, const glm::mat2 &mat) const
+    {
+        write(find(name.text), mat);
+    }
+    // ------------------------------------------------------------------------
+    void setMat3(UniformName name, const glm::mat3 &mat) const
+    {
+        write(find(name.text), mat);
+    }
+    // ------------------------------------------------------------------------
+    void setMat4(UniformName name, const glm::mat4 &mat) const
+    {
+        write(find(name.text), mat);
     }
+
+    // Uniform blocks are bound by name: each block name gets one binding
+    // point, shared by every program that declares it, and every Shader
+    // points its blocks there after linking. A UniformRing (uniform_buffer.h)
+    // binds its ranges to the same points.
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    static GLuint blockBinding(UniformName name)
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        std::vector<std::string> &names = state().blocks;
+        for (size_t i = 0; i < names.size(); ++i)
+            if (names[i] == name.text)
+                return (GLuint)i;
+        GLint limit = 0;
+        glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &limit);
+        if ((GLint)names.size() >= limit)
+            std::cout << "ERROR::SHADER::TOO_MANY_UNIFORM_BLOCKS: " << name.text << std::endl;
+        names.push_back(name.text);
+        return (GLuint)(names.size() - 1);
     }
+    // data size of one of this program's active uniform blocks, or -1; it
+    // should equal the size() of the Std140Layout filling it
+    // ------------------------------------------------------------------------
+    GLint blockSize(UniformName name) const
+    {
+        const GLuint index = glGetUniformBlockIndex(ID, name.text);
+        if (index == GL_INVALID_INDEX)
+            return -1;
+        GLint size = 0;
+        glGetActiveUniformBlockiv(ID, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        return size;
+    }
+
+    // Redundant state filtering: use() skips glUseProgram when the program is
+    // already bound, and the setters skip a glUniform* call when the location
+    // already holds the same bytes. Only calls made through Shader are seen,
+    // so code that binds programs or sets uniforms directly must call
+    // invalidateState() afterwards. The counters show how many calls a frame
+    // made and how many were left out.
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    struct StateStats
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        size_t programs = 0;            // glUseProgram calls made
+        size_t programsSkipped = 0;     // use() on the program already bound
+        size_t uniforms = 0;            // glUniform* calls made
+        size_t uniformsSkipped = 0;     // uniforms set to the value they already had
+    };
+    static const StateStats &stateStats() { return state().counters; }
+    static void resetStateStats() { state().counters = StateStats(); }
+    // turn filtering off to compare call counts; every call is made again
+    // ------------------------------------------------------------------------
+    static void setStateFiltering(bool enable)
+    {
+        state().filtering = enable;
+        invalidateState();
     }
+    // forget the bound program and every remembered uniform value
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    static void invalidateState()
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        State &current = state();
+        current.program = NoProgram;
+        ++current.epoch;
     }
 
 private:
+    static const GLuint NoProgram = ~0u;
+
+    // what the context is known to hold, shared by every Shader
+    struct State
+    {
+        GLuint program = NoProgram;
+        bool filtering = true;
+        unsigned int epoch = 0;     // bumped to drop every Shader's remembered values
+        StateStats counters;
+        std::vector<std::string> blocks;    // uniform block names, by binding point
+        int parallel = -1;                  // KHR_parallel_shader_compile: -1 not looked for yet
+    };
+    // a build started by the constructor and not yet finished
+    struct PendingBuild
+    {
+        bool building = false;
+        bool cached = true;         // whether it goes through the binary cache
+        GLuint vertex = 0, fragment = 0;
+        uint64_t key = 0;           // of the sources, for the binary cache
+        double ms = 0.0;            // spent submitting it
+    };
+    struct Uniform
+    {
+        std::string name;
+        uint32_t hash;
+        GLint location;
+        GLenum type;
+        int shadow;                 // index into shadows, shared by "a" and "a[0]"
+    };
+    // the last value written to a location; size 0 when not known
+    struct Shadow
+    {
+        unsigned char bytes[sizeof(glm::mat4)];
+        size_t size;
+    };
+    // every active uniform outside a block, and an open-addressed table of
+    // indices into it (a power of two in size, at most half full, -1 = empty)
+    std::vector<Uniform> uniforms;
+    std::vector<int> buckets;
+    mutable std::vector<Shadow> shadows;
+    mutable unsigned int shadowEpoch = 0;
+    // which shadow indices were ever set through this Shader, whether or not
+    // filtering is on and across invalidateState(): what a reload carries over
+    mutable std::vector<bool> written;
+    PendingBuild pending;
+    // hot reload: the source files, their watcher, and a replacement program
+    // being built
+    std::string vertexFile, fragmentFile;
+    std::unique_ptr<ShaderWatcher> watcher;
+    GLuint next = 0;
+    PendingBuild nextBuild;
+
+    // ------------------------------------------------------------------------
+    static bool completed(GLuint program)
+    {
+        if (!parallelCompile())
+            return true;
+        GLint done = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+    // a program for the sources: loaded from the binary cache (build left
+    // idle), or with its compile and link submitted (build left building).
+    // without 'cached' the cache is neither read now nor written by complete()
+    // ------------------------------------------------------------------------
+    static GLuint submit(const std::string &vertexCode, const std::string &fragmentCode, PendingBuild &build, bool cached = true)
+    {
+        ProgramBinaryCache &cache = ProgramBinaryCache::instance();
+        build.cached = cached;
+        GLuint program = 0;
+        if (cached)
+        {
+            build.key = cache.keyOf({ &vertexCode, &fragmentCode });
+            program = cache.load(build.key);
+            if (program != 0)
+                return program;
+        }
+        const char* vShaderCode = vertexCode.c_str();
+        const char * fShaderCode = fragmentCode.c_str();
+        const auto start = std::chrono::steady_clock::now();
+        // vertex shader
+        build.vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(build.vertex, 1, &vShaderCode, NULL);
+        glCompileShader(build.vertex);
+        // fragment Shader
+        build.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(build.fragment, 1, &fShaderCode, NULL);
+        glCompileShader(build.fragment);
+        // shader Program
+        program = glCreateProgram();
+        if (cached)
+            cache.prepare(program);
+        glAttachShader(program, build.vertex);
+        glAttachShader(program, build.fragment);
+        glLinkProgram(program);
+        build.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        build.building = true;
+        return program;
+    }
+    // wait for a submitted build and report its errors; whether it linked
+    // ------------------------------------------------------------------------
+    static bool complete(GLuint program, PendingBuild &build)
+    {
+        build.building = false;
+        const auto start = std::chrono::steady_clock::now();
+        checkCompileErrors(build.vertex, "VERTEX");
+        checkCompileErrors(build.fragment, "FRAGMENT");
+        checkCompileErrors(program, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessary
+        glDeleteShader(build.vertex);
+        glDeleteShader(build.fragment);
+        build.vertex = build.fragment = 0;
+        // 4. keep its binary for next time, with the time spent waiting on it
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (build.cached)
+            ProgramBinaryCache::instance().store(build.key, program, build.ms + ms);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        return linked == GL_TRUE;
+    }
+    // switch to a linked program: uniforms that are still there keep their
+    // slot (so handles stay good) and get the value they had on the old
+    // program, if one was ever set; the others stay as inert slots. The old
+    // program is deleted
+    // ------------------------------------------------------------------------
+    void replaceProgram(GLuint program)
+    {
+        std::vector<Uniform> previous = std::move(uniforms);
+        std::vector<bool> wasWritten = std::move(written);
+        const GLuint old = ID;
+        ID = program;
+        introspect();
+
+        std::vector<Uniform> fresh = std::move(uniforms);
+        std::vector<bool> kept(fresh.size(), false);
+        uniforms.resize(previous.size());
+        for (size_t slot = 0; slot < previous.size(); ++slot)
+        {
+            Uniform &uniform = uniforms[slot];
+            uniform = previous[slot];
+            uniform.location = -1;
+            for (size_t i = 0; i < fresh.size(); ++i)
+                if (fresh[i].name == previous[slot].name)
+                {
+                    // a handle was checked against the old type, so a new
+                    // type gets a slot of its own
+                    if (fresh[i].type == previous[slot].type)
+                    {
+                        uniform = fresh[i];
+                        kept[i] = true;
+                    }
+                    else
+                        uniform.name.clear();
+                    break;
+                }
+        }
+        for (size_t i = 0; i < fresh.size(); ++i)
+            if (!kept[i])
+                uniforms.push_back(fresh[i]);
+        index();
+
+        // copy the values over from the old program rather than from the
+        // shadows, which filtering off or invalidateState() leave empty. The
+        // new program's shadows start empty. Whatever was bound stays bound
+        // (the new program in place of the old)
+        GLint bound = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &bound);
+        glUseProgram(ID);
+        state().program = ID;
+        for (size_t slot = 0; slot < previous.size(); ++slot)
+            if (previous[slot].location >= 0 && uniforms[slot].location >= 0 && wasWritten[previous[slot].shadow])
+            {
+                copyValue(old, previous[slot].location, uniforms[slot].location, uniforms[slot].type);
+                written[uniforms[slot].shadow] = true;
+            }
+        if ((GLuint)bound != old)
+        {
+            glUseProgram((GLuint)bound);
+            state().program = (GLuint)bound;
+        }
+        glDeleteProgram(old);
+    }
+    // read a uniform of one of the types UniformTraits takes from 'from' and
+    // set it at 'to' on the bound program
+    // ------------------------------------------------------------------------
+    static void copyValue(GLuint from, GLint fromLocation, GLint to, GLenum type)
+    {
+        float floats[16] = {};
+        switch (type)
+        {
+        case GL_FLOAT:      glGetUniformfv(from, fromLocation, floats); glUniform1fv(to, 1, floats); break;
+        case GL_FLOAT_VEC2: glGetUniformfv(from, fromLocation, floats); glUniform2fv(to, 1, floats); break;
+        case GL_FLOAT_VEC3: glGetUniformfv(from, fromLocation, floats); glUniform3fv(to, 1, floats); break;
+        case GL_FLOAT_VEC4: glGetUniformfv(from, fromLocation, floats); glUniform4fv(to, 1, floats); break;
+        case GL_FLOAT_MAT2: glGetUniformfv(from, fromLocation, floats); glUniformMatrix2fv(to, 1, GL_FALSE, floats); break;
+        case GL_FLOAT_MAT3: glGetUniformfv(from, fromLocation, floats); glUniformMatrix3fv(to, 1, GL_FALSE, floats); break;
+        case GL_FLOAT_MAT4: glGetUniformfv(from, fromLocation, floats); glUniformMatrix4fv(to, 1, GL_FALSE, floats); break;
+        default:
+        {
+            // int, bool (set as either) and samplers
+            GLint integer = 0;
+            glGetUniformiv(from, fromLocation, &integer);
+            glUniform1i(to, integer);
+        }
+        }
+    }
+    // ------------------------------------------------------------------------
+    static State &state()
+    {
+        static State current;
+        return current;
+    }
+    // upload 'value' to the uniform in 'slot' unless it is there already; -1
+    // (a name that is not an active uniform) is ignored, as glUniform* would
+    // ------------------------------------------------------------------------
+    template <typename T>
+    void write(int slot, const T &value) const
+    {
+        static_assert(sizeof(T) <= sizeof(Shadow::bytes), "uniform value too large to shadow");
+        if (slot < 0 || uniforms[slot].location < 0)
+            return;
+        written[uniforms[slot].shadow] = true;
+        State &current = state();
+        // a write while another program is bound lands there, so remember nothing
+        if (current.filtering && current.program == ID)
+        {
+            if (shadowEpoch != current.epoch)
+            {
+                for (Shadow &stale : shadows)
+                    stale.size = 0;
+                shadowEpoch = current.epoch;
+            }
+            Shadow &shadow = shadows[uniforms[slot].shadow];
+            if (shadow.size == sizeof(T) && std::memcmp(shadow.bytes, &value, sizeof(T)) == 0)
+            {
+                ++current.counters.uniformsSkipped;
+                return;
+            }
+            std::memcpy(shadow.bytes, &value, sizeof(T));
+            shadow.size = sizeof(T);
+        }
+        UniformTraits<T>::upload(uniforms[slot].location, value);
+        ++current.counters.uniforms;
+    }
+
+    // ------------------------------------------------------------------------
+    static uint32_t hashName(const char *name)
+    {
+        uint32_t hash = 2166136261u;
+        for (; *name; ++name)
+            hash = (hash ^ (unsigned char)*name) * 16777619u;
+        return hash;
+    }
+    // ------------------------------------------------------------------------
+    int find(const char *name) const
+    {
+        if (buckets.empty())
+            return -1;
+        const uint32_t hash = hashName(name);
+        const size_t mask = buckets.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            const int slot = buckets[i];
+            if (slot < 0)
+                return -1;
+            if (uniforms[slot].hash == hash && uniforms[slot].name == name)
+                return slot;
+        }
+    }
+    // ------------------------------------------------------------------------
+    void addUniform(const std::string &name, GLint location, GLenum type)
+    {
+        Uniform uniform;
+        uniform.name = name;
+        uniform.hash = hashName(name.c_str());
+        uniform.location = location;
+        uniform.type = type;
+        // consecutive entries for one location ("a", then "a[0]") share a shadow
+        if (!uniforms.empty() && uniforms.back().location == location)
+            uniform.shadow = uniforms.back().shadow;
+        else
+        {
+            uniform.shadow = (int)shadows.size();
+            shadows.push_back(Shadow());
+            written.push_back(false);
+        }
+        uniforms.push_back(uniform);
+    }
+    // rebuild the open-addressed table over the named uniforms
+    // ------------------------------------------------------------------------
+    void index()
+    {
+        size_t capacity = 8;
+        while (capacity < uniforms.size() * 2)
+            capacity *= 2;
+        buckets.assign(capacity, -1);
+        for (size_t slot = 0; slot < uniforms.size(); ++slot)
+        {
+            if (uniforms[slot].name.empty())
+                continue;
+            size_t i = uniforms[slot].hash & (capacity - 1);
+            while (buckets[i] >= 0)
+                i = (i + 1) & (capacity - 1);
+            buckets[i] = (int)slot;
+        }
+    }
+    // fill the uniform table from the linked program
+    // ------------------------------------------------------------------------
+    void introspect()
+    {
+        uniforms.clear();
+        buckets.clear();
+        shadows.clear();
+        written.clear();
+        shadowEpoch = state().epoch;
+        GLint linked = GL_FALSE, count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+        if (!linked)
+            return;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> buffer(maxLength + 1);
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            const GLint first = glGetUniformLocation(ID, name.c_str());
+            if (first < 0)
+                continue;   // a member of a uniform block, or a built-in
+            // arrays are listed once, as "a[0]"; add "a" and every "a[i]"
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                const std::string base = name.substr(0, name.size() - 3);
+                addUniform(base, first, type);
+                for (GLint element = 0; element < size; ++element)
+                {
+                    name = base + "[" + std::to_string(element) + "]";
+                    addUniform(name, element == 0 ? first : glGetUniformLocation(ID, name.c_str()), type);
+                }
+            }
+            else
+                addUniform(name, first, type);
+        }
+        index();
+        // and point each uniform block at the binding its name was given
+        GLint blocks = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+        buffer.assign(maxLength + 1, 0);
+        for (GLint block = 0; block < blocks; ++block)
+        {
+            GLsizei length = 0;
+            glGetActiveUniformBlockName(ID, (GLuint)block, (GLsizei)buffer.size(), &length, buffer.data());
+            buffer[length] = 0;
+            glUniformBlockBinding(ID, (GLuint)block, blockBinding(buffer.data()));
+        }
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    static void checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -164,5 +1185,76 @@ private:
         }
     }
 };
+
+// A set of shaders compiled side by side. add() only submits a program, so
+// with KHR_parallel_shader_compile the driver compiles every program on its
+// own threads while the application goes on loading its assets; nothing
+// asks for compile or link results until get() first hands a shader out.
+// Without the extension a driver may still compile in the background, and
+// get() is where any wait happens.
+//
+//     ShaderLibrary shaders;
+//     unsigned int box = shaders.add("6.2.coordinate_systems.vs", "6.2.coordinate_systems.fs");
+//     ... load textures ...
+//     Shader &boxShader = shaders.get(box);
+class ShaderLibrary
+{
+public:
+    struct Stats
+    {
+        size_t programs = 0;        // added
+        size_t readyOnUse = 0;      // already compiled when first asked for
+        double waitMs = 0.0;        // spent in get() and finish() waiting for the driver
+    };
+
+    // submit a program; returns the handle to pass to get()
+    // ------------------------------------------------------------------------
+    unsigned int add(const char *vertexPath, const char *fragmentPath)
+    {
+        shaders.push_back(std::make_unique<Shader>(vertexPath, fragmentPath, Shader::Build::Deferred));
+        finished.push_back(false);
+        ++counters.programs;
+        return (unsigned int)(shaders.size() - 1);
+    }
+    // the shader for a handle, finished (waiting for it if need be)
+    // ------------------------------------------------------------------------
+    Shader &get(unsigned int handle)
+    {
+        Shader &shader = *shaders[handle];
+        if (!finished[handle])
+        {
+            if (shader.ready())
+                ++counters.readyOnUse;
+            const auto start = std::chrono::steady_clock::now();
+            shader.finish();
+            counters.waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            finished[handle] = true;
+        }
+        return shader;
+    }
+    // programs whose compile may still be running
+    // ------------------------------------------------------------------------
+    size_t pending() const
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < shaders.size(); ++i)
+            if (!finished[i] && !shaders[i]->ready())
+                ++count;
+        return count;
+    }
+    // finish every program, e.g. behind a loading screen
+    // ------------------------------------------------------------------------
+    void finish()
+    {
+        for (size_t i = 0; i < shaders.size(); ++i)
+            get((unsigned int)i);
+    }
+    const Stats &stats() const { return counters; }
+
+private:
+    std::vector<std::unique_ptr<Shader>> shaders;
+    std::vector<bool> finished;
+    Stats counters;
+};
 #endif
 
@@ -188,6 +188,14 @@ RECENT REVISION HISTORY:
 //   // returns ok=1 and sets x, y, n if image is a supported format,
 //   // 0 otherwise.
 //
+// The format is guessed from the leading magic bytes and that format's header
+// parser is tried first, so a probe normally reads just the header. If you also
+// need to know whether a load would give 16-bit or HDR data, stbi_info_ex
+// answers all of it from one pass over the header:
+//
+//   int x,y,n,is16,ishdr,ok;
+//   ok = stbi_info_ex(filename, &x, &y, &n, &is16, &ishdr);
+//
 // Note that stb_image pervasively uses ints in its public API for sizes,
 // including sizes of memory buffers. This is now part of the API and thus
 // hard to change without causing breakage. As a result, the various image
@@ -253,6 +261,147 @@ RECENT REVISION HISTORY:
 //
 // ===========================================================================
 //
+// Memory-mapped files   (disable by defining STBI_NO_MMAP)
+//
+// stbi_load_mmap, stbi_load_16_mmap and stbi_info_mmap map the whole file
+// into memory and decode it through the same path as stbi_load_from_memory,
+// so there is no FILE* buffering and no copy of the file contents. The
+// mapping is hinted as sequential-access and released before returning.
+// Where memory mapping isn't available (non-POSIX platforms, empty files,
+// files too large for an int length), they fall back to the FILE* versions.
+//
+// ===========================================================================
+//
+// Reduced-size JPEG decoding
+//
+// stbi_set_jpeg_scale_on_load(2, 4 or 8) makes the JPEG decoder produce the
+// image at 1/2, 1/4 or 1/8 size directly: each 8x8 block is inverse-transformed
+// from its low 4x4 or 2x2 coefficients, or just DC at 1/8, and the (already
+// small) planes are then upsampled and color converted as usual. This is
+// several times cheaper than decoding at full size and downsampling.
+// Progressive files still entropy-decode every coefficient.
+//
+// ===========================================================================
+//
+// Incremental decoding
+//
+// To show an image while it is still streaming in, create a decoder with
+// stbi_incremental_begin, hand it each chunk of the file with
+// stbi_incremental_feed as it arrives, and after each feed upload the rows
+// that stbi_incremental_rows reports as changed:
+//
+//   stbi_incremental *d = stbi_incremental_begin(4);
+//   while (more data) {
+//      int r = stbi_incremental_feed(d, chunk, chunk_len, is_last_chunk);
+//      if (stbi_incremental_info(d, &x, &y, &n)) {
+//         stbi_uc *pixels = stbi_incremental_rows(d, &first, &count);
+//         // ... upload rows first..first+count-1 of pixels, if count > 0
+//      }
+//      if (r != 0) break;  // 1 = done, -1 = error
+//   }
+//   pixels = stbi_incremental_end(d, &x, &y, &n);
+//
+// Baseline JPEGs come out a row of MCUs at a time. Progressive JPEGs are
+// shown complete but blurry after each feed that finished a scan, sharpening
+// as later scans arrive. Non-interlaced PNGs come out a deflate block at a
+// time. Rows not decoded yet are zero. Everything else (interlaced PNG, the
+// other formats) is decoded in one go when the last chunk is fed, so the
+// buffer and size only appear then. The vertical flip setting is taken when
+// stbi_incremental_begin is called (changed rows are then reported as they
+// are in the flipped buffer); the other settings, such as reduced-size JPEG
+// decoding, are those in effect for the thread doing the feeding.
+//
+// ===========================================================================
+//
+// Custom allocation
+//
+// Every allocation stb_image makes, including the returned pixels, goes
+// through the allocator set with stbi_set_allocator, or the one set for the
+// calling thread with stbi_set_allocator_thread. stbi_image_free uses the
+// same allocator, so free results before switching to another one.
+//
+// stbi_arena is a ready-made allocator that hands out blocks from a buffer
+// you own: freeing only gives back the most recent block, and reallocating
+// the most recent block grows it in place, which is how zlib's output buffer
+// and PNG's IDAT buffer are grown, so they are never copied. Reset the arena
+// once you are done with the pixels (say, after uploading them):
+//
+//   stbi_arena arena;
+//   stbi_allocator a;
+//   stbi_arena_init(&arena, memory, memory_size);
+//   a = stbi_arena_allocator(&arena);
+//   stbi_set_allocator_thread(&a);
+//   for (each file) {
+//      pixels = stbi_load(file, &x, &y, &n, 4);
+//      ... use pixels, don't free them ...
+//      stbi_arena_reset(&arena);
+//   }
+//   stbi_set_allocator_thread(NULL);
+//
+// Requests that don't fit fall back to STBI_MALLOC and are counted in
+// arena.overflow; the arena frees them itself when asked. To size the buffer
+// up front, stbi_scratch_size_from_memory (and friends) estimate from the
+// header how much a stbi_load with the given desired_channels will allocate
+// in such an arena; arena.peak tells what loads actually used.
+//
+// ===========================================================================
+//
+// Animated GIFs
+//
+// stbi_load_gif_from_memory returns every frame of an animation in one
+// buffer. To play a long animation without holding all of it, step through
+// the frames instead; only the frame being composited and the two before it
+// are kept:
+//
+//   stbi_gif_frames *it = stbi_gif_begin("anim.gif", &x, &y, 4);
+//   while (stbi_gif_next(it, &frame, &delay_ms) > 0) {
+//      // ... upload x*y*4 bytes of frame, show it for delay_ms
+//   }
+//   stbi_gif_end(it);
+//
+// The vertical flip setting is taken when the iterator is created.
+// stbi_gif_begin_from_file reads the GIF from the current position of f and
+// leaves f just past the last byte read when the iterator is ended.
+//
+// ===========================================================================
+//
+// Stage profiling   (enable by defining STBI_PROFILE)
+//
+// With STBI_PROFILE defined next to STB_IMAGE_IMPLEMENTATION (and wherever
+// the header is included for the declarations), every load keeps counters
+// for the stages below, per thread if your compiler has thread-locals:
+//
+//   STBI_STAGE_LOAD          headers, and the formats not broken down further
+//   STBI_STAGE_ZLIB          inflate (PNG IDAT, and the stbi_zlib_* calls)
+//   STBI_STAGE_PNG_UNFILTER  PNG unfiltering, de-interlacing, bit expansion
+//   STBI_STAGE_JPEG_ENTROPY  Huffman decoding; baseline JPEG also does its
+//                            IDCT here, one block at a time
+//   STBI_STAGE_JPEG_FINISH   dequantize and IDCT of progressive JPEGs
+//   STBI_STAGE_JPEG_OUTPUT   JPEG markers, chroma upsampling, colour convert
+//   STBI_STAGE_CONVERT       channel conversion for desired_channels
+//   STBI_STAGE_FLIP          a vertical flip the decoder couldn't fold in
+//
+// Each counts calls, the input bytes the stage read (output bytes for
+// convert and flip), the pixels it covered and nanoseconds spent. Time spent
+// in a stage nested inside another is only counted once, in the inner one,
+// so the stages of a load add up to its total time.
+//
+//   stbi_profile_counter c[STBI_STAGE_COUNT];
+//   stbi_profile_reset();
+//   pixels = stbi_load(file, &x, &y, &n, 4);
+//   stbi_profile_read(c);
+//   for (i = 0; i < STBI_STAGE_COUNT; ++i)
+//      printf("%s: %.3f ms\n", stbi_profile_stage_name(i), c[i].ns / 1e6);
+//
+// stbi_set_profile_callback additionally reports every stage as it ends, on
+// the thread that ran it; keep the callback cheap. Time comes from
+// clock_gettime(CLOCK_MONOTONIC), timespec_get on Windows, or clock() when
+// neither is available; define STBI_PROFILE_NOW as an expression giving
+// nanoseconds to use your own clock.
+// Without STBI_PROFILE none of this is compiled.
+//
+// ===========================================================================
+//
 // SIMD support
 //
 // The JPEG decoder will try to automatically use SIMD kernels on x86 when
@@ -268,6 +417,13 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// The channel conversions done for 'desired_channels' (RGB<->RGBA, grey->RGB,
+// grey->RGBA, grey+alpha->RGBA, at 8 and 16 bits) also have SIMD loops: SSE2
+// where plain unpacks suffice, SSSE3 byte shuffles when compiling with
+// -mssse3 or better, and NEON interleaved loads/stores. The same goes for
+// the BGR->RGB swap of BMP, TGA and iPhone PNG pixels and for the alpha
+// premultiply/unpremultiply passes.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
@@ -307,6 +463,14 @@ RECENT REVISION HISTORY:
 //
 //     stbi_is_hdr(char *filename);
 //
+// To convert on your own schedule (say, split across threads), load the
+// pixels as stored with stbi_load_rgbe, four bytes each, and turn any span
+// of them into floats with stbi_rgbe_to_float; the results are identical to
+// stbi_loadf's:
+//
+//     stbi_uc *rgbe = stbi_load_rgbe(filename, &x, &y);
+//     stbi_rgbe_to_float(floats + first_row*x*3, rgbe + first_row*x*4, rows*x, 3);
+//
 // ===========================================================================
 //
 // iPhone PNG support:
@@ -316,10 +480,23 @@ RECENT REVISION HISTORY:
 // differently. To enable this conversion, call
 // stbi_convert_iphone_png_to_rgb(1).
 //
-// Call stbi_set_unpremultiply_on_load(1) as well to force a divide per
-// pixel to remove any premultiplied alpha *only* if the image file explicitly
-// says there's premultiplied data (currently only happens in iPhone images,
-// and only if iPhone convert-to-rgb processing is on).
+// Call stbi_set_unpremultiply_on_load(1) as well to remove any premultiplied
+// alpha *only* if the image file explicitly says there's premultiplied data
+// (currently only happens in iPhone images, and only if iPhone convert-to-rgb
+// processing is on). This multiplies by a table of 255/alpha instead of
+// dividing, with the same rounding.
+//
+// ===========================================================================
+//
+// Premultiplied alpha:
+//
+// Call stbi_set_premultiply_on_load(1) to get colours already scaled by
+// alpha, ready for glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA) and for
+// filtering without dark fringes, without a second pass over the pixels.
+// It applies to 8- and 16-bit results with grey+alpha or RGBA channels
+// (after any desired_channels conversion), rounds c*a/255 to nearest, and
+// leaves images that are stored premultiplied (iPhone PNGs) as they are.
+// Float results from stbi_loadf are not affected.
 //
 // ===========================================================================
 //
@@ -427,8 +604,41 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+STBIDEF stbi_uc *stbi_load_mmap       (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+// decode into caller-provided memory (e.g. a mapped pixel buffer object) instead
+// of a freshly allocated result. channel conversion and vertical flip are done in
+// the same pass that writes 'buffer'. 'stride' is the distance in bytes between
+// rows (0 means tightly packed); 'buffer_size' must be at least
+// stride*(height-1) + width*channels, which stbi_info can tell you up front.
+// desired_channels==0 writes the channel count stbi_info reports. returns 1 on
+// success, 0 on failure (including a buffer that is too small).
+STBIDEF int stbi_load_into_from_memory   (stbi_uc *buffer, int buffer_size, int stride, stbi_uc           const *data, int len   , int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF int stbi_load_into_from_callbacks(stbi_uc *buffer, int buffer_size, int stride, stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into               (stbi_uc *buffer, int buffer_size, int stride, char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
+
+// animated GIFs one frame at a time (see "Animated GIFs" above). begin reads
+// the header and returns NULL on failure; desired_channels as for stbi_load
+typedef struct stbi_gif_frames stbi_gif_frames;
+
+STBIDEF stbi_gif_frames *stbi_gif_begin_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int desired_channels);
+STBIDEF stbi_gif_frames *stbi_gif_begin_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int desired_channels);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_frames *stbi_gif_begin               (char const *filename, int *x, int *y, int desired_channels);
+STBIDEF stbi_gif_frames *stbi_gif_begin_from_file     (FILE *f, int *x, int *y, int desired_channels);
+#endif
+// decode the next frame. returns 1 and the composited frame (owned by the
+// iterator, valid until the next call) with its delay in milliseconds, 0
+// after the last frame, -1 on failure (see stbi_failure_reason)
+STBIDEF int              stbi_gif_next(stbi_gif_frames *it, stbi_uc **frame, int *delay_ms);
+STBIDEF void             stbi_gif_end (stbi_gif_frames *it);
 #endif
 
 #ifdef STBI_WINDOWS_UTF8
@@ -448,6 +658,10 @@ STBIDEF stbi_us *stbi_load_16          (char const *filename, int *x, int *y, in
 STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
 #endif
 
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+STBIDEF stbi_us *stbi_load_16_mmap     (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
 ////////////////////////////////////
 //
 // float-per-channel interface
@@ -465,6 +679,16 @@ STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_i
 #ifndef STBI_NO_HDR
    STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma);
    STBIDEF void   stbi_hdr_to_ldr_scale(float scale);
+
+   // Radiance .hdr pixels as stored, 4 bytes (RGBE) each; fails for other formats
+   STBIDEF stbi_uc *stbi_load_rgbe_from_memory   (stbi_uc const *buffer, int len, int *x, int *y);
+   STBIDEF stbi_uc *stbi_load_rgbe_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y);
+   #ifndef STBI_NO_STDIO
+   STBIDEF stbi_uc *stbi_load_rgbe          (char const *filename, int *x, int *y);
+   STBIDEF stbi_uc *stbi_load_rgbe_from_file(FILE *f, int *x, int *y);
+   #endif
+   // convert count RGBE pixels to channels (1-4) floats each, as stbi_loadf does
+   STBIDEF void     stbi_rgbe_to_float(float *output, stbi_uc const *rgbe, int count, int channels);
 #endif // STBI_NO_HDR
 
 #ifndef STBI_NO_LINEAR
@@ -485,7 +709,8 @@ STBIDEF int      stbi_is_hdr_from_file(FILE *f);
 // on most compilers (and ALL modern mainstream compilers) this is threadsafe
 STBIDEF const char *stbi_failure_reason  (void);
 
-// free the loaded image -- this is just free()
+// free the loaded image -- this is just free(), or the free_fn of the allocator
+// set with stbi_set_allocator
 STBIDEF void     stbi_image_free      (void *retval_from_stbi_load);
 
 // get image dimensions & components without fully decoding
@@ -493,21 +718,32 @@ STBIDEF int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, i
 STBIDEF int      stbi_info_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp);
 STBIDEF int      stbi_is_16_bit_from_memory(stbi_uc const *buffer, int len);
 STBIDEF int      stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *clbk, void *user);
+STBIDEF int      stbi_info_ex_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int *is_16_bit, int *is_hdr);
+STBIDEF int      stbi_info_ex_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int *is_16_bit, int *is_hdr);
 
 #ifndef STBI_NO_STDIO
 STBIDEF int      stbi_info               (char const *filename,     int *x, int *y, int *comp);
 STBIDEF int      stbi_info_from_file     (FILE *f,                  int *x, int *y, int *comp);
 STBIDEF int      stbi_is_16_bit          (char const *filename);
 STBIDEF int      stbi_is_16_bit_from_file(FILE *f);
+STBIDEF int      stbi_info_ex            (char const *filename,     int *x, int *y, int *comp, int *is_16_bit, int *is_hdr);
+STBIDEF int      stbi_info_ex_from_file  (FILE *f,                  int *x, int *y, int *comp, int *is_16_bit, int *is_hdr);
 #endif
 
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+STBIDEF int      stbi_info_mmap          (char const *filename,     int *x, int *y, int *comp);
+#endif
 
 
 // for image formats that explicitly notate that they have premultiplied alpha,
 // we just return the colors as stored in the file. set this flag to force
-// unpremultiplication. results are undefined if the unpremultiply overflow.
+// unpremultiplication. colors greater than their alpha come out as 255.
 STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply);
 
+// multiply color by alpha in 2- and 4-channel results, so they can be blended
+// as premultiplied; images already stored that way are left alone
+STBIDEF void stbi_set_premultiply_on_load(int flag_true_if_should_premultiply);
+
 // indicate whether we should process iphone images back to canonical format,
 // or just pass them through "as-is"
 STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
@@ -519,9 +755,122 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
+STBIDEF void stbi_set_premultiply_on_load_thread(int flag_true_if_should_premultiply);
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// save and restore the calling thread's flip setting, e.g. around a load that needs
+// a particular orientation: get returns 1 and stores the flag if the thread has its
+// own setting, 0 if it follows stbi_set_flip_vertically_on_load; clear goes back to
+// following it. same thread-local requirement as above
+STBIDEF int  stbi_get_flip_vertically_on_load_thread(int *flag_true_if_should_flip);
+STBIDEF void stbi_clear_flip_vertically_on_load_thread(void);
+
+// decode JPEGs at 1/denominator of their size (denominator 1, 2, 4 or 8; anything
+// else means 1) using reduced IDCTs, e.g. for thumbnails or low mip levels.
+// dimensions round up, and stbi_info reports the scaled size as well.
+// other formats are unaffected
+STBIDEF void stbi_set_jpeg_scale_on_load(int denominator);
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int denominator);
+
+// incremental decoding: feed the file as it arrives and pick up finished rows
+// before the whole image is in (see "Incremental decoding" above)
+typedef struct stbi_incremental stbi_incremental;
+
+// desired_channels as for stbi_load; the output is always 8 bits per channel
+STBIDEF stbi_incremental *stbi_incremental_begin(int desired_channels);
+// append len bytes; set is_last on the final call. returns 1 once the image
+// is complete, 0 if it wants more data, -1 on failure (see stbi_failure_reason)
+STBIDEF int      stbi_incremental_feed(stbi_incremental *d, stbi_uc const *data, int len, int is_last);
+// 1 and the size once the pixel buffer exists, 0 before that
+STBIDEF int      stbi_incremental_info(stbi_incremental *d, int *x, int *y, int *channels_in_file);
+// the pixel buffer (NULL until stbi_incremental_info succeeds), and the rows
+// of it that changed since the previous call
+STBIDEF stbi_uc *stbi_incremental_rows(stbi_incremental *d, int *first_row, int *row_count);
+// free the decoder and hand over the pixels (free with stbi_image_free). after
+// a failure these are the rows decoded up to that point, or NULL
+STBIDEF stbi_uc *stbi_incremental_end(stbi_incremental *d, int *x, int *y, int *channels_in_file);
+
+// allocation hooks (see "Custom allocation" above); leave all three NULL to
+// use STBI_MALLOC/STBI_REALLOC/STBI_FREE
+typedef struct
+{
+   void *(*malloc_fn) (void *user, size_t size);
+   void *(*realloc_fn)(void *user, void *p, size_t oldsize, size_t newsize);
+   void  (*free_fn)   (void *user, void *p);
+   void  *user;
+} stbi_allocator;
+
+// the allocator is copied; NULL restores the default
+STBIDEF void stbi_set_allocator(stbi_allocator const *allocator);
+// as above, but only for the calling thread (NULL goes back to the global
+// one); only available if your compiler supports thread-local variables
+STBIDEF void stbi_set_allocator_thread(stbi_allocator const *allocator);
+
+// a bump allocator over caller-provided memory
+typedef struct
+{
+   stbi_uc *base;
+   size_t size;
+   size_t used;      // bytes handed out since the last reset
+   size_t last;      // offset of the most recent block, which can grow in place
+   size_t peak;      // high-water mark of used, kept across resets
+   size_t overflow;  // bytes that didn't fit and came from STBI_MALLOC instead
+} stbi_arena;
+
+STBIDEF void           stbi_arena_init     (stbi_arena *arena, void *memory, size_t size);
+STBIDEF void           stbi_arena_reset    (stbi_arena *arena);
+STBIDEF stbi_allocator stbi_arena_allocator(stbi_arena *arena);
+
+// how many bytes stbi_load(..., desired_channels) will allocate for this
+// image, including the returned pixels; read from the header only
+STBIDEF int      stbi_scratch_size_from_memory   (stbi_uc const *buffer, int len, int desired_channels, size_t *bytes);
+STBIDEF int      stbi_scratch_size_from_callbacks(stbi_io_callbacks const *clbk, void *user, int desired_channels, size_t *bytes);
+#ifndef STBI_NO_STDIO
+STBIDEF int      stbi_scratch_size               (char const *filename, int desired_channels, size_t *bytes);
+STBIDEF int      stbi_scratch_size_from_file     (FILE *f, int desired_channels, size_t *bytes);
+#endif
+
+#ifdef STBI_PROFILE
+// stage profiling (see "Stage profiling" above)
+enum
+{
+   STBI_STAGE_LOAD,
+   STBI_STAGE_ZLIB,
+   STBI_STAGE_PNG_UNFILTER,
+   STBI_STAGE_JPEG_ENTROPY,
+   STBI_STAGE_JPEG_FINISH,
+   STBI_STAGE_JPEG_OUTPUT,
+   STBI_STAGE_CONVERT,
+   STBI_STAGE_FLIP,
+   STBI_STAGE_COUNT
+};
+
+#ifdef _MSC_VER
+typedef unsigned __int64   stbi_profile_u64;
+#else
+typedef unsigned long long stbi_profile_u64;
+#endif
+
+typedef struct
+{
+   stbi_profile_u64 calls;
+   stbi_profile_u64 bytes;
+   stbi_profile_u64 pixels;
+   stbi_profile_u64 ns;
+} stbi_profile_counter;
+
+// 'sample' holds just the stage that ended, with calls set to 1
+typedef void stbi_profile_callback(void *user, int stage, stbi_profile_counter const *sample);
+
+// copy out or clear the calling thread's counters
+STBIDEF void        stbi_profile_read(stbi_profile_counter counters[STBI_STAGE_COUNT]);
+STBIDEF void        stbi_profile_reset(void);
+STBIDEF const char *stbi_profile_stage_name(int stage);
+// NULL turns the callback off
+STBIDEF void        stbi_set_profile_callback(stbi_profile_callback *callback, void *user);
+#endif
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -532,6 +881,22 @@ STBIDEF int   stbi_zlib_decode_buffer(char *obuffer, int olen, const char *ibuff
 STBIDEF char *stbi_zlib_decode_noheader_malloc(const char *buffer, int len, int *outlen);
 STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
+// when the decoded size is known up front (say, stored next to a packed
+// asset): one allocation, never grown, and NULL unless exactly 'size' bytes
+// come out. The buffer has a few hundred bytes of slack past 'size'
+STBIDEF char *stbi_zlib_decode_known_size(const char *buffer, int len, int size, int parse_header);
+
+// streaming: compressed data is pulled through 'read' and decoded data
+// pushed through 'write' in pieces, using about 112KB whatever the size
+typedef struct
+{
+   int (*read) (void *user, char *data, int size);        // fill 'data' with up to 'size' bytes; return the count, 0 at the end
+   int (*write)(void *user, char const *data, int size);  // take 'size' decoded bytes; return 0 to stop decoding
+} stbi_zlib_io;
+
+// returns 1 once the whole stream is decoded and written, 0 on failure
+STBIDEF int   stbi_zlib_decode_stream(stbi_zlib_io const *io, void *user, int parse_header);
+
 
 #ifdef __cplusplus
 }
@@ -589,13 +954,25 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #include <limits.h>
 
 #if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR)
-#include <math.h>  // ldexp, pow
+#include <math.h>  // pow
 #endif
 
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif
 
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define STBI__HAS_MMAP
+#endif
+
+#if defined(STBI_PROFILE) && !defined(STBI_PROFILE_NOW)
+#include <time.h>
+#endif
+
 #ifndef STBI_ASSERT
 #include <assert.h>
 #define STBI_ASSERT(x) assert(x)
@@ -772,6 +1149,13 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// SSSE3 byte shuffles are only used when the compiler is already allowed to
+// emit them (-mssse3 or higher, /arch:AVX); there is no run-time detection
+#if defined(STBI_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+#define STBI__SSSE3
+#include <tmmintrin.h>
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -901,6 +1285,8 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int vertically_flipped; // loader already wrote rows bottom-up, skip the flip pass
+   int premultiplied;      // colours are already scaled by alpha, skip the premultiply pass
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -980,9 +1366,237 @@ static int stbi__err(const char *str)
 }
 #endif
 
+#ifdef STBI_PROFILE
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+stbi_profile_counter stbi__profile_counters[STBI_STAGE_COUNT];
+
+// time spent in stages nested inside the one now running, which that one
+// takes off its own time when it ends
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+stbi_profile_u64 stbi__profile_nested;
+
+static stbi_profile_callback *stbi__profile_callback;
+static void *stbi__profile_user;
+
+#ifdef STBI_PROFILE_NOW
+#define stbi__profile_now()  ((stbi_profile_u64) (STBI_PROFILE_NOW))
+#else
+static stbi_profile_u64 stbi__profile_now(void)
+{
+#if defined(CLOCK_MONOTONIC) || (defined(_WIN32) && defined(TIME_UTC))
+   struct timespec t;
+#ifdef CLOCK_MONOTONIC
+   clock_gettime(CLOCK_MONOTONIC, &t);
+#else
+   timespec_get(&t, TIME_UTC);
+#endif
+   return (stbi_profile_u64) t.tv_sec * 1000000000u + (stbi_profile_u64) t.tv_nsec;
+#else
+   // strict ISO C without POSIX timers: processor time, coarser
+   return (stbi_profile_u64) clock() * 1000000000u / CLOCKS_PER_SEC;
+#endif
+}
+#endif
+
+typedef struct
+{
+   stbi_profile_u64 start;
+   stbi_profile_u64 outer_nested;
+} stbi__profile_scope;
+
+static void stbi__profile_begin(stbi__profile_scope *scope)
+{
+   scope->outer_nested = stbi__profile_nested;
+   stbi__profile_nested = 0;
+   scope->start = stbi__profile_now();
+}
+
+static void stbi__profile_end(stbi__profile_scope *scope, int stage, stbi_profile_u64 bytes, stbi_profile_u64 pixels)
+{
+   stbi_profile_u64 elapsed = stbi__profile_now() - scope->start;
+   stbi_profile_counter sample, *c = &stbi__profile_counters[stage];
+   sample.calls  = 1;
+   sample.bytes  = bytes;
+   sample.pixels = pixels;
+   sample.ns     = elapsed > stbi__profile_nested ? elapsed - stbi__profile_nested : 0;
+   c->calls  += 1;
+   c->bytes  += bytes;
+   c->pixels += pixels;
+   c->ns     += sample.ns;
+   stbi__profile_nested = scope->outer_nested + elapsed;
+   if (stbi__profile_callback)
+      stbi__profile_callback(stbi__profile_user, stage, &sample);
+}
+
+STBIDEF void stbi_profile_read(stbi_profile_counter counters[STBI_STAGE_COUNT])
+{
+   memcpy(counters, stbi__profile_counters, sizeof(stbi__profile_counters));
+}
+
+STBIDEF void stbi_profile_reset(void)
+{
+   memset(stbi__profile_counters, 0, sizeof(stbi__profile_counters));
+}
+
+STBIDEF const char *stbi_profile_stage_name(int stage)
+{
+   static const char *names[STBI_STAGE_COUNT] = {
+      "load", "zlib", "png_unfilter", "jpeg_entropy", "jpeg_finish", "jpeg_output", "convert", "flip"
+   };
+   return stage >= 0 && stage < STBI_STAGE_COUNT ? names[stage] : "unknown";
+}
+
+STBIDEF void stbi_set_profile_callback(stbi_profile_callback *callback, void *user)
+{
+   stbi__profile_callback = callback;
+   stbi__profile_user = user;
+}
+#endif // STBI_PROFILE
+
+// all allocations go through these, so they can be sent to the allocator set
+// with stbi_set_allocator / stbi_set_allocator_thread instead of STBI_MALLOC
+static stbi_allocator stbi__allocator_global; // all NULL: use STBI_MALLOC etc.
+
+STBIDEF void stbi_set_allocator(stbi_allocator const *allocator)
+{
+   if (allocator)
+      stbi__allocator_global = *allocator;
+   else
+      memset(&stbi__allocator_global, 0, sizeof(stbi__allocator_global));
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__allocator  (&stbi__allocator_global)
+#else
+static STBI_THREAD_LOCAL stbi_allocator stbi__allocator_local;
+static STBI_THREAD_LOCAL int stbi__allocator_set;
+
+STBIDEF void stbi_set_allocator_thread(stbi_allocator const *allocator)
+{
+   if (allocator)
+      stbi__allocator_local = *allocator;
+   stbi__allocator_set = allocator != NULL;
+}
+
+#define stbi__allocator  (stbi__allocator_set         \
+                          ? &stbi__allocator_local    \
+                          : &stbi__allocator_global)
+#endif // STBI_THREAD_LOCAL
+
 static void *stbi__malloc(size_t size)
 {
-    return STBI_MALLOC(size);
+   stbi_allocator const *a = stbi__allocator;
+   if (a->malloc_fn) return a->malloc_fn(a->user, size);
+   return STBI_MALLOC(size);
+}
+
+static void *stbi__realloc_sized(void *p, size_t oldsz, size_t newsz)
+{
+   stbi_allocator const *a = stbi__allocator;
+   if (a->realloc_fn) return a->realloc_fn(a->user, p, oldsz, newsz);
+   STBI_NOTUSED(oldsz);
+   return STBI_REALLOC_SIZED(p, oldsz, newsz);
+}
+
+static void stbi__free(void *p)
+{
+   stbi_allocator const *a = stbi__allocator;
+   if (a->free_fn) a->free_fn(a->user, p);
+   else STBI_FREE(p);
+}
+
+#define STBI__ARENA_NONE  ((size_t) -1)
+
+STBIDEF void stbi_arena_init(stbi_arena *arena, void *memory, size_t size)
+{
+   memset(arena, 0, sizeof(*arena));
+   arena->base = (stbi_uc *) memory;
+   arena->size = memory ? size : 0;
+   arena->last = STBI__ARENA_NONE;
+}
+
+STBIDEF void stbi_arena_reset(stbi_arena *arena)
+{
+   arena->used = 0;
+   arena->last = STBI__ARENA_NONE;
+}
+
+static int stbi__arena_owns(stbi_arena *arena, void *p)
+{
+   return p != NULL && (stbi_uc *) p >= arena->base && (stbi_uc *) p < arena->base + arena->size;
+}
+
+static void *stbi__arena_malloc(void *user, size_t size)
+{
+   stbi_arena *arena = (stbi_arena *) user;
+   // 16-byte aligned, for the SIMD paths
+   size_t start = arena->used + ((16 - ((size_t) (arena->base + arena->used) & 15)) & 15);
+   if (size == 0) size = 1; // so every block lies inside the arena
+   if (start <= arena->size && size <= arena->size - start) {
+      arena->last = start;
+      arena->used = start + size;
+      if (arena->used > arena->peak) arena->peak = arena->used;
+      return arena->base + start;
+   }
+   arena->overflow += size;
+   return STBI_MALLOC(size);
+}
+
+static void *stbi__arena_realloc(void *user, void *p, size_t oldsize, size_t newsize)
+{
+   stbi_arena *arena = (stbi_arena *) user;
+   size_t offset;
+   void *q;
+   if (p == NULL) return stbi__arena_malloc(user, newsize);
+   if (!stbi__arena_owns(arena, p)) {
+      if (newsize > oldsize) arena->overflow += newsize - oldsize;
+      return STBI_REALLOC_SIZED(p, oldsize, newsize);
+   }
+   offset = (size_t) ((stbi_uc *) p - arena->base);
+   if (offset == arena->last && newsize <= arena->size - offset) {
+      arena->used = offset + (newsize ? newsize : 1);
+      if (arena->used > arena->peak) arena->peak = arena->used;
+      return p;
+   }
+   if (newsize <= oldsize) return p;
+   q = stbi__arena_malloc(user, newsize);
+   if (q) {
+      memcpy(q, p, oldsize);
+      if (offset == arena->last) { // it moved out to the heap
+         arena->used = offset;
+         arena->last = STBI__ARENA_NONE;
+      }
+   }
+   return q;
+}
+
+static void stbi__arena_free(void *user, void *p)
+{
+   stbi_arena *arena = (stbi_arena *) user;
+   if (!stbi__arena_owns(arena, p)) {
+      STBI_FREE(p);
+      return;
+   }
+   if ((size_t) ((stbi_uc *) p - arena->base) == arena->last) {
+      arena->used = arena->last;
+      arena->last = STBI__ARENA_NONE;
+   }
+}
+
+STBIDEF stbi_allocator stbi_arena_allocator(stbi_arena *arena)
+{
+   stbi_allocator a;
+   a.malloc_fn = stbi__arena_malloc;
+   a.realloc_fn = stbi__arena_realloc;
+   a.free_fn = stbi__arena_free;
+   a.user = arena;
+   return a;
 }
 
 // stb_image uses ints pervasively, including for offset calculations.
@@ -1098,7 +1712,7 @@ static int stbi__mul2shorts_valid(short a, short b)
 
 STBIDEF void stbi_image_free(void *retval_from_stbi_load)
 {
-   STBI_FREE(retval_from_stbi_load);
+   stbi__free(retval_from_stbi_load);
 }
 
 #ifndef STBI_NO_LINEAR
@@ -1109,6 +1723,9 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
 static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
 
+static int stbi__convert_row(unsigned char *dest, unsigned char const *src, int img_n, int req_comp, unsigned int x);
+static int stbi__is_16_main(stbi__context *s);
+
 static int stbi__vertically_flip_on_load_global = 0;
 
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
@@ -1127,11 +1744,46 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
    stbi__vertically_flip_on_load_set = 1;
 }
 
+STBIDEF int stbi_get_flip_vertically_on_load_thread(int *flag_true_if_should_flip)
+{
+   if (stbi__vertically_flip_on_load_set && flag_true_if_should_flip)
+      *flag_true_if_should_flip = stbi__vertically_flip_on_load_local;
+   return stbi__vertically_flip_on_load_set;
+}
+
+STBIDEF void stbi_clear_flip_vertically_on_load_thread(void)
+{
+   stbi__vertically_flip_on_load_set = 0;
+}
+
 #define stbi__vertically_flip_on_load  (stbi__vertically_flip_on_load_set       \
                                          ? stbi__vertically_flip_on_load_local  \
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__premultiply_on_load_global = 0;
+
+STBIDEF void stbi_set_premultiply_on_load(int flag_true_if_should_premultiply)
+{
+   stbi__premultiply_on_load_global = flag_true_if_should_premultiply;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__premultiply_on_load  stbi__premultiply_on_load_global
+#else
+static STBI_THREAD_LOCAL int stbi__premultiply_on_load_local, stbi__premultiply_on_load_set;
+
+STBIDEF void stbi_set_premultiply_on_load_thread(int flag_true_if_should_premultiply)
+{
+   stbi__premultiply_on_load_local = flag_true_if_should_premultiply;
+   stbi__premultiply_on_load_set = 1;
+}
+
+#define stbi__premultiply_on_load  (stbi__premultiply_on_load_set               \
+                                     ? stbi__premultiply_on_load_local          \
+                                     : stbi__premultiply_on_load_global)
+#endif // STBI_THREAD_LOCAL
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1185,6 +1837,27 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
 }
 
+#ifdef STBI_PROFILE
+// bytes read from the context so far
+static stbi_profile_u64 stbi__profile_tell(stbi__context *s)
+{
+   return (stbi_profile_u64) s->callback_already_read + (stbi_profile_u64) (s->img_buffer - s->img_buffer_original);
+}
+
+static void *stbi__load_main_profiled(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
+{
+   stbi__profile_scope scope;
+   stbi_profile_u64 start = stbi__profile_tell(s), end;
+   void *result;
+   stbi__profile_begin(&scope);
+   result = stbi__load_main(s, x, y, comp, req_comp, ri, bpc);
+   end = stbi__profile_tell(s);
+   stbi__profile_end(&scope, STBI_STAGE_LOAD, end > start ? end - start : 0, result ? (stbi_profile_u64) *x * *y : 0);
+   return result;
+}
+#define stbi__load_main  stbi__load_main_profiled
+#endif
+
 static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
 {
    int i;
@@ -1197,7 +1870,7 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return reduced;
 }
 
@@ -1213,7 +1886,7 @@ static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return enlarged;
 }
 
@@ -1241,6 +1914,17 @@ static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
    }
 }
 
+#ifdef STBI_PROFILE
+static void stbi__vertical_flip_profiled(void *image, int w, int h, int bytes_per_pixel)
+{
+   stbi__profile_scope scope;
+   stbi__profile_begin(&scope);
+   stbi__vertical_flip(image, w, h, bytes_per_pixel);
+   stbi__profile_end(&scope, STBI_STAGE_FLIP, (stbi_profile_u64) w * h * bytes_per_pixel, (stbi_profile_u64) w * h);
+}
+#define stbi__vertical_flip  stbi__vertical_flip_profiled
+#endif
+
 #ifndef STBI_NO_GIF
 static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int bytes_per_pixel)
 {
@@ -1255,39 +1939,257 @@ static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int byt
 }
 #endif
 
-static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+// scale colour by alpha, rounding to nearest: c*a/255 is done as
+// t = c*a + 128, (t + (t >> 8)) >> 8, which is exact for 8-bit inputs
+static stbi_uc stbi__mul_alpha(int c, int a)
 {
-   stbi__result_info ri;
-   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
-
-   if (result == NULL)
-      return NULL;
-
-   // it is the responsibility of the loaders to make sure we get either 8 or 16 bit.
-   STBI_ASSERT(ri.bits_per_channel == 8 || ri.bits_per_channel == 16);
+   int t = c * a + 128;
+   return (stbi_uc) ((t + (t >> 8)) >> 8);
+}
 
-   if (ri.bits_per_channel != 8) {
-      result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
-      ri.bits_per_channel = 8;
+// premultiply x pixels of n components in place; only grey+alpha and rgba
+// have anything to do
+static void stbi__premultiply_row(stbi_uc *p, int n, unsigned int x)
+{
+   unsigned int i = 0;
+#ifdef STBI_SSE2
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(128);
+   if (n == 4) {
+      // alpha broadcast over its pixel's 16-bit lanes, 255 in the alpha lane itself
+      __m128i colour = _mm_setr_epi16(-1,-1,-1,0, -1,-1,-1,0);
+      __m128i keep   = _mm_setr_epi16(0,0,0,255, 0,0,0,255);
+      for (; i + 4 <= x; i += 4) {
+         __m128i v  = _mm_loadu_si128((__m128i const *) (p + i*4));
+         __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+         __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+         __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+         lo = _mm_add_epi16(_mm_mullo_epi16(lo, _mm_or_si128(_mm_and_si128(alo, colour), keep)), bias);
+         hi = _mm_add_epi16(_mm_mullo_epi16(hi, _mm_or_si128(_mm_and_si128(ahi, colour), keep)), bias);
+         lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+         hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+         _mm_storeu_si128((__m128i *) (p + i*4), _mm_packus_epi16(lo, hi));
+      }
+   } else if (n == 2) {
+      __m128i colour = _mm_setr_epi16(-1,0, -1,0, -1,0, -1,0);
+      __m128i keep   = _mm_setr_epi16(0,255, 0,255, 0,255, 0,255);
+      for (; i + 8 <= x; i += 8) {
+         __m128i v  = _mm_loadu_si128((__m128i const *) (p + i*2));
+         __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+         __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xf5), 0xf5);
+         __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xf5), 0xf5);
+         lo = _mm_add_epi16(_mm_mullo_epi16(lo, _mm_or_si128(_mm_and_si128(alo, colour), keep)), bias);
+         hi = _mm_add_epi16(_mm_mullo_epi16(hi, _mm_or_si128(_mm_and_si128(ahi, colour), keep)), bias);
+         lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+         hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+         _mm_storeu_si128((__m128i *) (p + i*2), _mm_packus_epi16(lo, hi));
+      }
    }
-
-   // @TODO: move stbi__convert_format to here
-
-   if (stbi__vertically_flip_on_load) {
-      int channels = req_comp ? req_comp : *comp;
-      stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+#elif defined(STBI_NEON)
+   // vraddhn(t, (t + 128) >> 8) is the same rounding as stbi__mul_alpha
+   #define STBI__NEON_MUL_ALPHA(c, a)                                                        \
+      vcombine_u8(vraddhn_u16(vmull_u8(vget_low_u8(c), vget_low_u8(a)),                     \
+                              vrshrq_n_u16(vmull_u8(vget_low_u8(c), vget_low_u8(a)), 8)),   \
+                  vraddhn_u16(vmull_u8(vget_high_u8(c), vget_high_u8(a)),                   \
+                              vrshrq_n_u16(vmull_u8(vget_high_u8(c), vget_high_u8(a)), 8)))
+   if (n == 4) {
+      for (; i + 16 <= x; i += 16) {
+         uint8x16x4_t v = vld4q_u8(p + i*4);
+         v.val[0] = STBI__NEON_MUL_ALPHA(v.val[0], v.val[3]);
+         v.val[1] = STBI__NEON_MUL_ALPHA(v.val[1], v.val[3]);
+         v.val[2] = STBI__NEON_MUL_ALPHA(v.val[2], v.val[3]);
+         vst4q_u8(p + i*4, v);
+      }
+   } else if (n == 2) {
+      for (; i + 16 <= x; i += 16) {
+         uint8x16x2_t v = vld2q_u8(p + i*2);
+         v.val[0] = STBI__NEON_MUL_ALPHA(v.val[0], v.val[1]);
+         vst2q_u8(p + i*2, v);
+      }
+   }
+   #undef STBI__NEON_MUL_ALPHA
+#endif
+   if (n != 2 && n != 4) return;
+   for (p += i*n; i < x; ++i, p += n) {
+      int a = p[n-1];
+      p[0] = stbi__mul_alpha(p[0], a);
+      if (n == 4) {
+         p[1] = stbi__mul_alpha(p[1], a);
+         p[2] = stbi__mul_alpha(p[2], a);
+      }
    }
-
-   return (unsigned char *) result;
 }
 
-static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+static void stbi__premultiply_row16(stbi__uint16 *p, int n, unsigned int x)
 {
-   stbi__result_info ri;
-   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
+   unsigned int i;
+   int c;
+   if (n != 2 && n != 4) return;
+   for (i=0; i < x; ++i, p += n) {
+      stbi__uint32 a = p[n-1];
+      for (c=0; c < n-1; ++c) {
+         stbi__uint32 t = p[c] * a + 32768;
+         p[c] = (stbi__uint16) ((t + (t >> 16)) >> 16);
+      }
+   }
+}
 
-   if (result == NULL)
-      return NULL;
+static void stbi__premultiply(void *image, int w, int h, int channels, int bits_per_channel)
+{
+   if (bits_per_channel == 16)
+      stbi__premultiply_row16((stbi__uint16 *) image, channels, (unsigned int) w * h);
+   else
+      stbi__premultiply_row((stbi_uc *) image, channels, (unsigned int) w * h);
+}
+
+#if !defined(STBI_NO_PNG) || !defined(STBI_NO_BMP) || !defined(STBI_NO_TGA)
+// convert x BGR(A) pixels with src_n components to RGB(A) with dest_n,
+// filling alpha with 255 when it is added; dest may equal src when
+// src_n == dest_n
+static void stbi__swap_rb_row(stbi_uc *dest, stbi_uc const *src, int src_n, int dest_n, unsigned int x)
+{
+   unsigned int i = 0;
+#ifdef STBI_SSE2
+   if (src_n == 4 && dest_n == 4) {
+      #ifdef STBI__SSSE3
+      __m128i m = _mm_setr_epi8(2,1,0,3, 6,5,4,7, 10,9,8,11, 14,13,12,15);
+      for (; i + 4 <= x; i += 4)
+         _mm_storeu_si128((__m128i *) (dest + i*4), _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4)), m));
+      #else
+      __m128i ga = _mm_set1_epi32((int) 0xff00ff00), lowbyte = _mm_set1_epi32(0xff);
+      for (; i + 4 <= x; i += 4) {
+         __m128i v = _mm_loadu_si128((__m128i const *) (src + i*4));
+         __m128i rb = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, lowbyte), 16), _mm_and_si128(_mm_srli_epi32(v, 16), lowbyte));
+         _mm_storeu_si128((__m128i *) (dest + i*4), _mm_or_si128(_mm_and_si128(v, ga), rb));
+      }
+      #endif
+   }
+   #ifdef STBI__SSSE3
+   else if (src_n == 3 && dest_n == 3) {
+      // 16 pixels as four 12-byte groups, all loaded before anything is stored
+      // so that working in place never reads back a store; the last load
+      // reaches 4 bytes past the group
+      __m128i m = _mm_setr_epi8(2,1,0, 5,4,3, 8,7,6, 11,10,9, -1,-1,-1,-1);
+      for (; i*3 + 52 <= x*3; i += 16) {
+         __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*3     )), m);
+         __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*3 + 12)), m);
+         __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*3 + 24)), m);
+         __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*3 + 36)), m);
+         _mm_storeu_si128((__m128i *) (dest + i*3     ), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+         _mm_storeu_si128((__m128i *) (dest + i*3 + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+         _mm_storeu_si128((__m128i *) (dest + i*3 + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+      }
+   } else if (src_n == 3 && dest_n == 4) {
+      __m128i m = _mm_setr_epi8(2,1,0,-1, 5,4,3,-1, 8,7,6,-1, 11,10,9,-1);
+      __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+      for (; i + 16 <= x; i += 16) {
+         __m128i a = _mm_loadu_si128((__m128i const *) (src + i*3));
+         __m128i b = _mm_loadu_si128((__m128i const *) (src + i*3 + 16));
+         __m128i c = _mm_loadu_si128((__m128i const *) (src + i*3 + 32));
+         _mm_storeu_si128((__m128i *) (dest + i*4     ), _mm_or_si128(_mm_shuffle_epi8(a, m), alpha));
+         _mm_storeu_si128((__m128i *) (dest + i*4 + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), m), alpha));
+         _mm_storeu_si128((__m128i *) (dest + i*4 + 32), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), m), alpha));
+         _mm_storeu_si128((__m128i *) (dest + i*4 + 48), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), m), alpha));
+      }
+   } else if (src_n == 4 && dest_n == 3) {
+      __m128i m = _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1);
+      for (; i + 16 <= x; i += 16) {
+         __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4     )), m);
+         __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 16)), m);
+         __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 32)), m);
+         __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 48)), m);
+         _mm_storeu_si128((__m128i *) (dest + i*3     ), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+         _mm_storeu_si128((__m128i *) (dest + i*3 + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+         _mm_storeu_si128((__m128i *) (dest + i*3 + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+      }
+   }
+   #endif // STBI__SSSE3
+#elif defined(STBI_NEON)
+   if (src_n == 4) {
+      for (; i + 16 <= x; i += 16) {
+         uint8x16x4_t v = vld4q_u8(src + i*4);
+         uint8x16_t t = v.val[0];
+         v.val[0] = v.val[2];
+         v.val[2] = t;
+         if (dest_n == 4) {
+            vst4q_u8(dest + i*4, v);
+         } else {
+            uint8x16x3_t o;
+            o.val[0] = v.val[0]; o.val[1] = v.val[1]; o.val[2] = v.val[2];
+            vst3q_u8(dest + i*3, o);
+         }
+      }
+   } else {
+      for (; i + 16 <= x; i += 16) {
+         uint8x16x3_t v = vld3q_u8(src + i*3);
+         if (dest_n == 3) {
+            uint8x16_t t = v.val[0];
+            v.val[0] = v.val[2];
+            v.val[2] = t;
+            vst3q_u8(dest + i*3, v);
+         } else {
+            uint8x16x4_t o;
+            o.val[0] = v.val[2]; o.val[1] = v.val[1]; o.val[2] = v.val[0]; o.val[3] = vdupq_n_u8(255);
+            vst4q_u8(dest + i*4, o);
+         }
+      }
+   }
+#endif
+   src  += i * src_n;
+   dest += i * dest_n;
+   if (src == dest) {
+      for (; i < x; ++i, dest += dest_n) {
+         stbi_uc t = dest[0];
+         dest[0] = dest[2];
+         dest[2] = t;
+      }
+   } else {
+      for (; i < x; ++i, src += src_n, dest += dest_n) {
+         dest[0] = src[2];
+         dest[1] = src[1];
+         dest[2] = src[0];
+         if (dest_n == 4) dest[3] = src_n == 4 ? src[3] : 255;
+      }
+   }
+}
+#endif
+
+static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__result_info ri;
+   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+
+   if (result == NULL)
+      return NULL;
+
+   // it is the responsibility of the loaders to make sure we get either 8 or 16 bit.
+   STBI_ASSERT(ri.bits_per_channel == 8 || ri.bits_per_channel == 16);
+
+   if (ri.bits_per_channel != 8) {
+      result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
+      ri.bits_per_channel = 8;
+   }
+
+   // @TODO: move stbi__convert_format to here
+
+   if (stbi__vertically_flip_on_load && !ri.vertically_flipped) {
+      int channels = req_comp ? req_comp : *comp;
+      stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+   }
+
+   if (stbi__premultiply_on_load && !ri.premultiplied)
+      stbi__premultiply(result, *x, *y, req_comp ? req_comp : *comp, 8);
+
+   return (unsigned char *) result;
+}
+
+static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__result_info ri;
+   void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
+
+   if (result == NULL)
+      return NULL;
 
    // it is the responsibility of the loaders to make sure we get either 8 or 16 bit.
    STBI_ASSERT(ri.bits_per_channel == 8 || ri.bits_per_channel == 16);
@@ -1300,11 +2202,14 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
    // @TODO: move stbi__convert_format16 to here
    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load && !ri.vertically_flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
    }
 
+   if (stbi__premultiply_on_load && !ri.premultiplied)
+      stbi__premultiply(result, *x, *y, req_comp ? req_comp : *comp, 16);
+
    return (stbi__uint16 *) result;
 }
 
@@ -1407,6 +2312,77 @@ STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, i
    return result;
 }
 
+#ifndef STBI_NO_MMAP
+typedef struct
+{
+   stbi_uc *data;
+   size_t len;
+} stbi__mapped_file;
+
+// returns 1 and fills 'm' if the file could be mapped; 0 means the caller
+// should fall back to reading through stdio
+static int stbi__map_file(stbi__mapped_file *m, char const *filename, int sequential)
+{
+#ifdef STBI__HAS_MMAP
+   struct stat st;
+   void *p;
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0) return 0;
+   if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > (off_t) INT_MAX) {
+      close(fd);
+      return 0;
+   }
+   p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd); // the mapping keeps its own reference to the file
+   if (p == MAP_FAILED) return 0;
+   #ifdef MADV_SEQUENTIAL
+   if (sequential) madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL);
+   #else
+   STBI_NOTUSED(sequential);
+   #endif
+   m->data = (stbi_uc *) p;
+   m->len = (size_t) st.st_size;
+   return 1;
+#else
+   STBI_NOTUSED(m);
+   STBI_NOTUSED(filename);
+   STBI_NOTUSED(sequential);
+   return 0;
+#endif
+}
+
+static void stbi__unmap_file(stbi__mapped_file *m)
+{
+#ifdef STBI__HAS_MMAP
+   munmap(m->data, m->len);
+#else
+   STBI_NOTUSED(m);
+#endif
+}
+
+STBIDEF stbi_uc *stbi_load_mmap(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__mapped_file m;
+   stbi_uc *result;
+   if (!stbi__map_file(&m, filename, 1))
+      return stbi_load(filename,x,y,comp,req_comp);
+   result = stbi_load_from_memory(m.data, (int) m.len, x,y,comp,req_comp);
+   stbi__unmap_file(&m);
+   return result;
+}
+
+STBIDEF stbi_us *stbi_load_16_mmap(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__mapped_file m;
+   stbi_us *result;
+   if (!stbi__map_file(&m, filename, 1))
+      return stbi_load_16(filename,x,y,comp,req_comp);
+   result = stbi_load_16_from_memory(m.data, (int) m.len, x,y,comp,req_comp);
+   stbi__unmap_file(&m);
+   return result;
+}
+#endif // !STBI_NO_MMAP
+
 
 #endif //!STBI_NO_STDIO
 
@@ -1438,6 +2414,109 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+// decoders are asked for their native layout so they don't run their own
+// stbi__convert_format pass; the single pass below then narrows, converts,
+// flips and applies the caller's stride while writing the destination.
+static int stbi__load_into_main(stbi__context *s, stbi_uc *buffer, int buffer_size, int stride, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__result_info ri;
+   void *result;
+   stbi_uc *src;
+   int decode_comp = 0, w, h, n, out_n, j, file_comp;
+
+   if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+
+   #ifndef STBI_NO_JPEG
+   // jpeg produces any channel count directly in its color conversion (and
+   // computes grey from luma rather than from RGB), so let it do that
+   if (stbi__jpeg_test(s)) decode_comp = req_comp;
+   #endif
+   // likewise grey from 16-bit or float sources is computed at full precision
+   if ((req_comp == 1 || req_comp == 2) && !decode_comp) {
+      #ifndef STBI_NO_HDR
+      if (stbi__hdr_test(s)) decode_comp = req_comp;
+      #endif
+      if (stbi__is_16_main(s)) decode_comp = req_comp;
+      stbi__rewind(s);
+   }
+
+   result = stbi__load_main(s, &w, &h, &file_comp, decode_comp, &ri, 8);
+   if (result == NULL)
+      return 0;
+
+   n = decode_comp ? decode_comp : (ri.num_channels ? ri.num_channels : file_comp);
+   out_n = req_comp ? req_comp : file_comp;
+   if (stride == 0) stride = w * out_n;
+   if (stride < w * out_n || (double) stride * (h-1) + (double) w * out_n > (double) buffer_size) {
+      stbi__free(result);
+      return stbi__err("buffer too small", "Destination buffer too small for image");
+   }
+
+   src = (stbi_uc *) result;
+   if (ri.bits_per_channel != 8) {
+      // narrow in place; the 8-bit row i never overtakes the 16-bit row i it reads from
+      stbi__uint16 *wide = (stbi__uint16 *) result;
+      size_t i, img_len = (size_t) w * h * n;
+      for (i = 0; i < img_len; ++i)
+         src[i] = (stbi_uc)((wide[i] >> 8) & 0xFF);
+   }
+
+   for (j=0; j < h; ++j) {
+      int row = stbi__vertically_flip_on_load && !ri.vertically_flipped ? h - 1 - j : j;
+      if (!stbi__convert_row(buffer + (size_t) row * stride, src + (size_t) j * w * n, n, out_n, w)) {
+         stbi__free(result);
+         return stbi__err("unsupported", "Unsupported format conversion");
+      }
+      if (stbi__premultiply_on_load && !ri.premultiplied)
+         stbi__premultiply_row(buffer + (size_t) row * stride, out_n, w);
+   }
+
+   stbi__free(result);
+   *x = w;
+   *y = h;
+   if (comp) *comp = file_comp;
+   return 1;
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc *buffer, int buffer_size, int stride, stbi_uc const *data, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_mem(&s,data,len);
+   return stbi__load_into_main(&s,buffer,buffer_size,stride,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_load_into_from_callbacks(stbi_uc *buffer, int buffer_size, int stride, stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_into_main(&s,buffer,buffer_size,stride,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into(stbi_uc *buffer, int buffer_size, int stride, char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   int result;
+   FILE *f;
+   #ifndef STBI_NO_MMAP
+   stbi__mapped_file m;
+   if (stbi__map_file(&m, filename, 1)) {
+      result = stbi_load_into_from_memory(buffer, buffer_size, stride, m.data, (int) m.len, x,y,comp,req_comp);
+      stbi__unmap_file(&m);
+      return result;
+   }
+   #endif
+   f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   {
+      stbi__context s;
+      stbi__start_file(&s,f);
+      result = stbi__load_into_main(&s,buffer,buffer_size,stride,x,y,comp,req_comp);
+   }
+   fclose(f);
+   return result;
+}
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1446,22 +2525,45 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
    stbi__start_mem(&s,buffer,len);
 
    result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
-   if (stbi__vertically_flip_on_load) {
-      stbi__vertical_flip_slices( result, *x, *y, *z, *comp );
+   if (result && stbi__vertically_flip_on_load) {
+      // the slices are in the requested format, not the file's 4 channels
+      stbi__vertical_flip_slices( result, *x, *y, *z, req_comp ? req_comp : *comp );
    }
+   if (result && stbi__premultiply_on_load)
+      stbi__premultiply(result, *x, *y * *z, req_comp ? req_comp : *comp, 8);
 
    return result;
 }
 #endif
 
 #ifndef STBI_NO_LINEAR
+#if defined(STBI_PROFILE) && !defined(STBI_NO_HDR)
+// float loads of .hdr files don't go through stbi__load_main, so they are
+// timed as a load here
+static float *stbi__hdr_load_profiled(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+   stbi__profile_scope scope;
+   stbi_profile_u64 start = stbi__profile_tell(s), end;
+   float *result;
+   stbi__profile_begin(&scope);
+   result = stbi__hdr_load(s, x, y, comp, req_comp, ri);
+   end = stbi__profile_tell(s);
+   stbi__profile_end(&scope, STBI_STAGE_LOAD, end > start ? end - start : 0, result ? (stbi_profile_u64) *x * *y : 0);
+   return result;
+}
+#endif
+
 static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
    unsigned char *data;
    #ifndef STBI_NO_HDR
    if (stbi__hdr_test(s)) {
       stbi__result_info ri;
+      #ifdef STBI_PROFILE
+      float *hdr_data = stbi__hdr_load_profiled(s,x,y,comp,req_comp, &ri);
+      #else
       float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
+      #endif
       if (hdr_data)
          stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
       return hdr_data;
@@ -1658,7 +2760,7 @@ static void stbi__skip(stbi__context *s, int n)
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_TGA) && defined(STBI_NO_HDR) && defined(STBI_NO_PNM)
+#if defined(STBI_NO_PNG) && defined(STBI_NO_TGA) && defined(STBI_NO_HDR) && defined(STBI_NO_PNM) && defined(STBI_NO_BMP)
 // nothing
 #else
 static int stbi__getn(stbi__context *s, stbi_uc *buffer, int n)
@@ -1686,6 +2788,28 @@ static int stbi__getn(stbi__context *s, stbi_uc *buffer, int n)
 }
 #endif
 
+#ifndef STBI_NO_BMP
+// stbi__getn for data that may be cut short: keeps whatever bytes are there
+// and zero-fills the rest, as reading them one stbi__get8 at a time would
+static void stbi__getn_zerofill(stbi__context *s, stbi_uc *buffer, int n)
+{
+   int got = (int) (s->img_buffer_end - s->img_buffer);
+   if (got < 0) got = 0; // stbi__skip can step past the end
+   if (got >= n) {
+      memcpy(buffer, s->img_buffer, n);
+      s->img_buffer += n;
+      return;
+   }
+   memcpy(buffer, s->img_buffer, got);
+   s->img_buffer = s->img_buffer_end;
+   if (s->io.read) {
+      int count = (s->io.read)(s->io_user_data, (char*) buffer + got, n - got);
+      if (count > 0) got += count;
+   }
+   memset(buffer + got, 0, n - got);
+}
+#endif
+
 #if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_PSD) && defined(STBI_NO_PIC)
 // nothing
 #else
@@ -1727,9 +2851,6 @@ static stbi__uint32 stbi__get32le(stbi__context *s)
 
 #define STBI__BYTECAST(x)  ((stbi_uc) ((x) & 255))  // truncate int to byte without warnings
 
-#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
-// nothing
-#else
 //////////////////////////////////////////////////////////////////////////////
 //
 //  generic converter from built-in img_n to req_comp
@@ -1745,14 +2866,296 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 {
    return (stbi_uc) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
+
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+// SIMD versions of the common expansions/contractions; each handles a whole
+// number of 16-pixel groups and returns how many pixels it converted, the
+// scalar loop does the rest
+static unsigned int stbi__convert_row_simd(unsigned char *dest, unsigned char const *src, int img_n, int req_comp, unsigned int x)
+{
+   unsigned int i = 0;
+#ifdef STBI_SSE2
+   switch (STBI__COMBO(img_n, req_comp)) {
+      case STBI__COMBO(1,2): {
+         __m128i alpha = _mm_set1_epi8((char) 255);
+         for (; i + 16 <= x; i += 16) {
+            __m128i g = _mm_loadu_si128((__m128i const *) (src + i));
+            _mm_storeu_si128((__m128i *) (dest + i*2     ), _mm_unpacklo_epi8(g, alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*2 + 16), _mm_unpackhi_epi8(g, alpha));
+         }
+         break;
+      }
+      case STBI__COMBO(1,4): {
+         __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+         for (; i + 16 <= x; i += 16) {
+            __m128i g  = _mm_loadu_si128((__m128i const *) (src + i));
+            __m128i lo = _mm_unpacklo_epi8(g, g), hi = _mm_unpackhi_epi8(g, g);
+            _mm_storeu_si128((__m128i *) (dest + i*4     ), _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 16), _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 32), _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 48), _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+         }
+         break;
+      }
+   #ifdef STBI__SSSE3
+      case STBI__COMBO(1,3): {
+         __m128i m0 = _mm_setr_epi8(0,0,0,1,1,1,2,2,2,3,3,3,4,4,4,5);
+         __m128i m1 = _mm_setr_epi8(5,5,6,6,6,7,7,7,8,8,8,9,9,9,10,10);
+         __m128i m2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+         for (; i + 16 <= x; i += 16) {
+            __m128i g = _mm_loadu_si128((__m128i const *) (src + i));
+            _mm_storeu_si128((__m128i *) (dest + i*3     ), _mm_shuffle_epi8(g, m0));
+            _mm_storeu_si128((__m128i *) (dest + i*3 + 16), _mm_shuffle_epi8(g, m1));
+            _mm_storeu_si128((__m128i *) (dest + i*3 + 32), _mm_shuffle_epi8(g, m2));
+         }
+         break;
+      }
+      case STBI__COMBO(2,4): {
+         __m128i m = _mm_setr_epi8(0,0,0,1, 2,2,2,3, 4,4,4,5, 6,6,6,7);
+         for (; i + 16 <= x; i += 16) {
+            __m128i a = _mm_loadu_si128((__m128i const *) (src + i*2));
+            __m128i b = _mm_loadu_si128((__m128i const *) (src + i*2 + 16));
+            _mm_storeu_si128((__m128i *) (dest + i*4     ), _mm_shuffle_epi8(a, m));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 16), _mm_shuffle_epi8(_mm_srli_si128(a, 8), m));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 32), _mm_shuffle_epi8(b, m));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 48), _mm_shuffle_epi8(_mm_srli_si128(b, 8), m));
+         }
+         break;
+      }
+      case STBI__COMBO(3,4): {
+         // 16 pixels = 48 bytes in, split into four 12-byte groups of 4 pixels
+         __m128i m = _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+         __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+         for (; i + 16 <= x; i += 16) {
+            __m128i a = _mm_loadu_si128((__m128i const *) (src + i*3));
+            __m128i b = _mm_loadu_si128((__m128i const *) (src + i*3 + 16));
+            __m128i c = _mm_loadu_si128((__m128i const *) (src + i*3 + 32));
+            _mm_storeu_si128((__m128i *) (dest + i*4     ), _mm_or_si128(_mm_shuffle_epi8(a, m), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), m), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 32), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), m), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 48), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), m), alpha));
+         }
+         break;
+      }
+      case STBI__COMBO(4,3): {
+         __m128i m = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+         for (; i + 16 <= x; i += 16) {
+            __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4     )), m);
+            __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 16)), m);
+            __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 32)), m);
+            __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 48)), m);
+            _mm_storeu_si128((__m128i *) (dest + i*3     ), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+            _mm_storeu_si128((__m128i *) (dest + i*3 + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+            _mm_storeu_si128((__m128i *) (dest + i*3 + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+         }
+         break;
+      }
+   #endif // STBI__SSSE3
+      default: break;
+   }
+#else // STBI_NEON
+   uint8x16_t alpha = vdupq_n_u8(255);
+   switch (STBI__COMBO(img_n, req_comp)) {
+      case STBI__COMBO(1,2):
+         for (; i + 16 <= x; i += 16) {
+            uint8x16x2_t o;
+            o.val[0] = vld1q_u8(src + i);
+            o.val[1] = alpha;
+            vst2q_u8(dest + i*2, o);
+         }
+         break;
+      case STBI__COMBO(1,3):
+         for (; i + 16 <= x; i += 16) {
+            uint8x16x3_t o;
+            o.val[0] = o.val[1] = o.val[2] = vld1q_u8(src + i);
+            vst3q_u8(dest + i*3, o);
+         }
+         break;
+      case STBI__COMBO(1,4):
+         for (; i + 16 <= x; i += 16) {
+            uint8x16x4_t o;
+            o.val[0] = o.val[1] = o.val[2] = vld1q_u8(src + i);
+            o.val[3] = alpha;
+            vst4q_u8(dest + i*4, o);
+         }
+         break;
+      case STBI__COMBO(2,4):
+         for (; i + 16 <= x; i += 16) {
+            uint8x16x2_t ga = vld2q_u8(src + i*2);
+            uint8x16x4_t o;
+            o.val[0] = o.val[1] = o.val[2] = ga.val[0];
+            o.val[3] = ga.val[1];
+            vst4q_u8(dest + i*4, o);
+         }
+         break;
+      case STBI__COMBO(3,4):
+         for (; i + 16 <= x; i += 16) {
+            uint8x16x3_t rgb = vld3q_u8(src + i*3);
+            uint8x16x4_t o;
+            o.val[0] = rgb.val[0];
+            o.val[1] = rgb.val[1];
+            o.val[2] = rgb.val[2];
+            o.val[3] = alpha;
+            vst4q_u8(dest + i*4, o);
+         }
+         break;
+      case STBI__COMBO(4,3):
+         for (; i + 16 <= x; i += 16) {
+            uint8x16x4_t rgba = vld4q_u8(src + i*4);
+            uint8x16x3_t o;
+            o.val[0] = rgba.val[0];
+            o.val[1] = rgba.val[1];
+            o.val[2] = rgba.val[2];
+            vst3q_u8(dest + i*3, o);
+         }
+         break;
+      default: break;
+   }
+#endif
+   return i;
+}
+
+#if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
+// nothing
+#else
+// 16-bit versions; 8 pixels per group
+static unsigned int stbi__convert_row16_simd(stbi__uint16 *dest, stbi__uint16 const *src, int img_n, int req_comp, unsigned int x)
+{
+   unsigned int i = 0;
+#ifdef STBI_SSE2
+   switch (STBI__COMBO(img_n, req_comp)) {
+      case STBI__COMBO(1,4): {
+         __m128i alpha = _mm_set_epi16(-1,0,0,0,-1,0,0,0);
+         for (; i + 8 <= x; i += 8) {
+            __m128i g  = _mm_loadu_si128((__m128i const *) (src + i));
+            __m128i lo = _mm_unpacklo_epi16(g, g), hi = _mm_unpackhi_epi16(g, g);
+            _mm_storeu_si128((__m128i *) (dest + i*4     ), _mm_or_si128(_mm_unpacklo_epi32(lo, lo), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 +  8), _mm_or_si128(_mm_unpackhi_epi32(lo, lo), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 16), _mm_or_si128(_mm_unpacklo_epi32(hi, hi), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 24), _mm_or_si128(_mm_unpackhi_epi32(hi, hi), alpha));
+         }
+         break;
+      }
+   #ifdef STBI__SSSE3
+      case STBI__COMBO(3,4): {
+         // 8 pixels = 48 bytes in, split into four 12-byte groups of 2 pixels
+         __m128i m = _mm_setr_epi8(0,1,2,3,4,5,-1,-1, 6,7,8,9,10,11,-1,-1);
+         __m128i alpha = _mm_set_epi16(-1,0,0,0,-1,0,0,0);
+         for (; i + 8 <= x; i += 8) {
+            __m128i a = _mm_loadu_si128((__m128i const *) (src + i*3));
+            __m128i b = _mm_loadu_si128((__m128i const *) (src + i*3 +  8));
+            __m128i c = _mm_loadu_si128((__m128i const *) (src + i*3 + 16));
+            _mm_storeu_si128((__m128i *) (dest + i*4     ), _mm_or_si128(_mm_shuffle_epi8(a, m), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 +  8), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), m), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), m), alpha));
+            _mm_storeu_si128((__m128i *) (dest + i*4 + 24), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), m), alpha));
+         }
+         break;
+      }
+      case STBI__COMBO(4,3): {
+         __m128i m = _mm_setr_epi8(0,1,2,3,4,5, 8,9,10,11,12,13, -1,-1,-1,-1);
+         for (; i + 8 <= x; i += 8) {
+            __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4     )), m);
+            __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 +  8)), m);
+            __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 16)), m);
+            __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + i*4 + 24)), m);
+            _mm_storeu_si128((__m128i *) (dest + i*3     ), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+            _mm_storeu_si128((__m128i *) (dest + i*3 +  8), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+            _mm_storeu_si128((__m128i *) (dest + i*3 + 16), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+         }
+         break;
+      }
+   #endif // STBI__SSSE3
+      default: break;
+   }
+#else // STBI_NEON
+   uint16x8_t alpha = vdupq_n_u16(0xffff);
+   switch (STBI__COMBO(img_n, req_comp)) {
+      case STBI__COMBO(1,4):
+         for (; i + 8 <= x; i += 8) {
+            uint16x8x4_t o;
+            o.val[0] = o.val[1] = o.val[2] = vld1q_u16(src + i);
+            o.val[3] = alpha;
+            vst4q_u16(dest + i*4, o);
+         }
+         break;
+      case STBI__COMBO(3,4):
+         for (; i + 8 <= x; i += 8) {
+            uint16x8x3_t rgb = vld3q_u16(src + i*3);
+            uint16x8x4_t o;
+            o.val[0] = rgb.val[0];
+            o.val[1] = rgb.val[1];
+            o.val[2] = rgb.val[2];
+            o.val[3] = alpha;
+            vst4q_u16(dest + i*4, o);
+         }
+         break;
+      case STBI__COMBO(4,3):
+         for (; i + 8 <= x; i += 8) {
+            uint16x8x4_t rgba = vld4q_u16(src + i*4);
+            uint16x8x3_t o;
+            o.val[0] = rgba.val[0];
+            o.val[1] = rgba.val[1];
+            o.val[2] = rgba.val[2];
+            vst3q_u16(dest + i*3, o);
+         }
+         break;
+      default: break;
+   }
+#endif
+   return i;
+}
 #endif
+#endif // STBI_SSE2 || STBI_NEON
+
+// convert one scanline of x pixels with img_n components to req_comp components;
+// returns 0 for an unsupported combination
+static int stbi__convert_row(unsigned char *dest, unsigned char const *src, int img_n, int req_comp, unsigned int x)
+{
+   int i;
+   #if defined(STBI_SSE2) || defined(STBI_NEON)
+   {
+      unsigned int done = stbi__convert_row_simd(dest, src, img_n, req_comp, x);
+      src  += done * img_n;
+      dest += done * req_comp;
+      x    -= done;
+   }
+   #endif
+
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   // avoid switch per pixel, so use switch per scanline and massive macros
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
+      default:
+         if (img_n != req_comp) return 0;
+         memcpy(dest, src, (size_t) x * img_n);
+         break;
+   }
+   #undef STBI__CASE
+   return 1;
+}
 
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
-static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+// if 'ri' is given and a vertical flip is still pending, rows are written in
+// flipped order and the flip is marked as done
+static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y, stbi__result_info *ri)
 {
-   int i,j;
+   int j, flip;
    unsigned char *good;
 
    if (req_comp == img_n) return data;
@@ -1760,39 +3163,37 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 
    good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return stbi__errpuc("outofmem", "Out of memory");
    }
 
+   flip = ri && stbi__vertically_flip_on_load && !ri->vertically_flipped;
    for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
-      }
-      #undef STBI__CASE
-   }
-
-   STBI_FREE(data);
+      int row = flip ? (int) y - 1 - j : j;
+      // convert source image with img_n components to one with req_comp components
+      if (!stbi__convert_row(good + row * x * req_comp, data + j * x * img_n, img_n, req_comp, x)) {
+         STBI_ASSERT(0); stbi__free(data); stbi__free(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+      }
+   }
+   if (flip) ri->vertically_flipped = 1;
+
+   stbi__free(data);
    return good;
 }
+
+#ifdef STBI_PROFILE
+static unsigned char *stbi__convert_format_profiled(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y, stbi__result_info *ri)
+{
+   stbi__profile_scope scope;
+   unsigned char *result;
+   if (req_comp == img_n) return data;
+   stbi__profile_begin(&scope);
+   result = stbi__convert_format(data, img_n, req_comp, x, y, ri);
+   stbi__profile_end(&scope, STBI_STAGE_CONVERT, (stbi_profile_u64) x * y * req_comp, (stbi_profile_u64) x * y);
+   return result;
+}
+#define stbi__convert_format  stbi__convert_format_profiled
+#endif
 #endif
 
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
@@ -1807,9 +3208,47 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
 // nothing
 #else
-static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+// 16-bit version of stbi__convert_row
+static int stbi__convert_row16(stbi__uint16 *dest, stbi__uint16 const *src, int img_n, int req_comp, unsigned int x)
 {
-   int i,j;
+   int i;
+   #if defined(STBI_SSE2) || defined(STBI_NEON)
+   {
+      unsigned int done = stbi__convert_row16_simd(dest, src, img_n, req_comp, x);
+      src  += done * img_n;
+      dest += done * req_comp;
+      x    -= done;
+   }
+   #endif
+
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   // convert source image with img_n components to one with req_comp components;
+   // avoid switch per pixel, so use switch per scanline and massive macros
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
+      default:
+         if (img_n != req_comp) return 0;
+         memcpy(dest, src, (size_t) x * img_n * 2);
+         break;
+   }
+   #undef STBI__CASE
+   return 1;
+}
+
+static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y, stbi__result_info *ri)
+{
+   int j,flip;
    stbi__uint16 *good;
 
    if (req_comp == img_n) return data;
@@ -1817,39 +3256,36 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
    }
 
+   flip = ri && stbi__vertically_flip_on_load && !ri->vertically_flipped;
    for (j=0; j < (int) y; ++j) {
-      stbi__uint16 *src  = data + j * x * img_n   ;
-      stbi__uint16 *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
-      }
-      #undef STBI__CASE
-   }
-
-   STBI_FREE(data);
-   return good;
-}
+      stbi__uint16 *dest = good + (flip ? (int) y - 1 - j : j) * x * req_comp;
+      if (!stbi__convert_row16(dest, data + j * x * img_n, img_n, req_comp, x)) {
+         STBI_ASSERT(0); stbi__free(data); stbi__free(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+      }
+   }
+   if (flip) ri->vertically_flipped = 1;
+
+   stbi__free(data);
+   return good;
+}
+
+#ifdef STBI_PROFILE
+static stbi__uint16 *stbi__convert_format16_profiled(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y, stbi__result_info *ri)
+{
+   stbi__profile_scope scope;
+   stbi__uint16 *result;
+   if (req_comp == img_n) return data;
+   stbi__profile_begin(&scope);
+   result = stbi__convert_format16(data, img_n, req_comp, x, y, ri);
+   stbi__profile_end(&scope, STBI_STAGE_CONVERT, (stbi_profile_u64) x * y * req_comp * 2, (stbi_profile_u64) x * y);
+   return result;
+}
+#define stbi__convert_format16  stbi__convert_format16_profiled
+#endif
 #endif
 
 #ifndef STBI_NO_LINEAR
@@ -1859,12 +3295,22 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
    float *output;
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
-   for (i=0; i < x*y; ++i) {
-      for (k=0; k < n; ++k) {
-         output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+   if (x*y*n >= 256) {
+      // only 256 possible inputs, so call pow once per value instead of once per sample
+      float table[256];
+      for (i=0; i < 256; ++i)
+         table[i] = (float) (pow(i/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+      for (i=0; i < x*y; ++i)
+         for (k=0; k < n; ++k)
+            output[i*comp + k] = table[data[i*comp+k]];
+   } else {
+      for (i=0; i < x*y; ++i) {
+         for (k=0; k < n; ++k) {
+            output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+         }
       }
    }
    if (n < comp) {
@@ -1872,28 +3318,74 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
          output[i*comp + n] = data[i*comp + n]/255.0f;
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
 
 #ifndef STBI_NO_HDR
 #define stbi__float2int(x)   ((int) (x))
+static stbi_uc stbi__hdr_to_ldr_value(float v)
+{
+   float z = (float) pow(v*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 255 + 0.5f;
+   if (z < 0) z = 0;
+   if (z > 255) z = 255;
+   return (stbi_uc) stbi__float2int(z);
+}
+
+// for positive scale and gamma the mapping above is monotonic, so it can be
+// replaced by a table of the smallest input producing each output value,
+// found by bisecting on the float bit pattern (positive floats order like
+// their bits) with the very same function, which makes the result exact
+static void stbi__hdr_to_ldr_thresholds(float *t)
+{
+   int k;
+   t[0] = 0;
+   for (k=1; k < 256; ++k) {
+      stbi__uint32 lo = 0, hi = 0x7f800000; // [+0, +inf]
+      float v;
+      while (lo < hi) {
+         stbi__uint32 mid = lo + (hi - lo) / 2;
+         memcpy(&v, &mid, 4);
+         if (stbi__hdr_to_ldr_value(v) >= k) hi = mid; else lo = mid+1;
+      }
+      memcpy(&v, &lo, 4);
+      t[k] = v;
+   }
+}
+
 static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
 {
-   int i,k,n;
+   int i,k,n,use_table;
+   float table[256];
    stbi_uc *output;
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
+   // building the table costs ~8000 pow calls, so only bother for big images
+   use_table = x*y*n >= 65536 && stbi__h2l_scale_i > 0 && stbi__h2l_gamma_i > 0;
+   if (use_table)
+      stbi__hdr_to_ldr_thresholds(table);
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         float z = (float) pow(data[i*comp+k]*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 255 + 0.5f;
-         if (z < 0) z = 0;
-         if (z > 255) z = 255;
-         output[i*comp + k] = (stbi_uc) stbi__float2int(z);
+         float v = data[i*comp+k];
+         if (use_table && v > 0) {
+            // branchless binary search over the 256 thresholds
+            int j = 0;
+            j += (v >= table[j+128]) << 7;
+            j += (v >= table[j+ 64]) << 6;
+            j += (v >= table[j+ 32]) << 5;
+            j += (v >= table[j+ 16]) << 4;
+            j += (v >= table[j+  8]) << 3;
+            j += (v >= table[j+  4]) << 2;
+            j += (v >= table[j+  2]) << 1;
+            j += (v >= table[j+  1]);
+            output[i*comp + k] = (stbi_uc) j;
+         } else {
+            output[i*comp + k] = stbi__hdr_to_ldr_value(v);
+         }
       }
       if (k < comp) {
          float z = data[i*comp+k] * 255 + 0.5f;
@@ -1902,7 +3394,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (stbi_uc) stbi__float2int(z);
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1991,6 +3483,7 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale_shift;  // output 8>>scale_shift pixels per block side
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -2521,6 +4014,63 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced IDCTs for scaled decoding. An n-point IDCT of the lowest n
+// coefficients gives the 8-point IDCT sampled at the centers of groups of
+// 8/n pixels, so these produce a downscaled block directly. Same 12-bit
+// fixed point as above; the column pass keeps one extra bit of precision.
+#define STBI__IDCT_4(s0,s1,s2,s3) \
+   int e0,e1,o0,o1;                                    \
+   e0 = ((s0) + (s2)) * stbi__f2f(0.353553391f);       \
+   e1 = ((s0) - (s2)) * stbi__f2f(0.353553391f);       \
+   o0 = (s1) * stbi__f2f(0.461939766f) + (s3) * stbi__f2f(0.191341716f); \
+   o1 = (s1) * stbi__f2f(0.191341716f) - (s3) * stbi__f2f(0.461939766f);
+
+// 1/2 scale: 4x4 IDCT of the top-left coefficients
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   int i,v[16],*t;
+   short *d = data;
+   for (i=0; i < 4; ++i, ++d) {
+      STBI__IDCT_4(d[0],d[8],d[16],d[24])
+      v[ 0+i] = (e0 + o0 + 1024) >> 11;
+      v[ 4+i] = (e1 + o1 + 1024) >> 11;
+      v[ 8+i] = (e1 - o1 + 1024) >> 11;
+      v[12+i] = (e0 - o0 + 1024) >> 11;
+   }
+   for (i=0, t=v; i < 4; ++i, t += 4, out += out_stride) {
+      STBI__IDCT_4(t[0],t[1],t[2],t[3])
+      // remove the 1<<13 scale, round, and add 128
+      e0 += 4096 + (128<<13);
+      e1 += 4096 + (128<<13);
+      out[0] = stbi__clamp((e0 + o0) >> 13);
+      out[1] = stbi__clamp((e1 + o1) >> 13);
+      out[2] = stbi__clamp((e1 - o1) >> 13);
+      out[3] = stbi__clamp((e0 - o0) >> 13);
+   }
+}
+
+// 1/4 scale: 2x2 IDCT of the top-left coefficients
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   int c = stbi__f2f(0.353553391f);
+   int r0c0 = ((data[0] + data[8]) * c + 1024) >> 11;
+   int r0c1 = ((data[1] + data[9]) * c + 1024) >> 11;
+   int r1c0 = ((data[0] - data[8]) * c + 1024) >> 11;
+   int r1c1 = ((data[1] - data[9]) * c + 1024) >> 11;
+   int bias = 4096 + (128<<13);
+   out[0]            = stbi__clamp(((r0c0 + r0c1) * c + bias) >> 13);
+   out[1]            = stbi__clamp(((r0c0 - r0c1) * c + bias) >> 13);
+   out[out_stride  ] = stbi__clamp(((r1c0 + r1c1) * c + bias) >> 13);
+   out[out_stride+1] = stbi__clamp(((r1c0 - r1c1) * c + bias) >> 13);
+}
+
+// 1/8 scale: the block average is just the DC term
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2944,67 +4494,82 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
-{
-   stbi__jpeg_reset(z);
-   if (!z->progressive) {
-      if (z->scan_n == 1) {
-         int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
-         int n = z->order[0];
-         // non-interleaved data, we just need to process one block at a time,
-         // in trivial scanline order
-         // number of blocks to do just depends on how many actual "pixels" this
-         // component has, independent of interleaved MCU blocking and such
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-               // every data block is an MCU, so countdown the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  // if it's NOT a restart, then just bail, so we get corrupt data
-                  // rather than no data
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
-               }
-            }
+// number of rows stbi__jpeg_decode_baseline_row has to be called for
+static int stbi__jpeg_baseline_rows(stbi__jpeg *z)
+{
+   if (z->scan_n == 1)
+      return (z->img_comp[z->order[0]].y+7) >> 3;
+   return z->img_mcu_y;
+}
+
+// decode one row of a baseline scan: a row of interleaved MCUs, or for a
+// non-interleaved scan a row of blocks. returns 0 on error, 1 to continue,
+// and 2 if the data stopped early (we then keep what was decoded)
+static int stbi__jpeg_decode_baseline_row(stbi__jpeg *z, int j)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   int bs = 8 >> z->scale_shift;
+   if (z->scan_n == 1) {
+      int i;
+      int n = z->order[0];
+      // non-interleaved data, we just need to process one block at a time,
+      // in trivial scanline order
+      // number of blocks to do just depends on how many actual "pixels" this
+      // component has, independent of interleaved MCU blocking and such
+      int w = (z->img_comp[n].x+7) >> 3;
+      for (i=0; i < w; ++i) {
+         int ha = z->img_comp[n].ha;
+         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         z->idct_block_kernel(z->img_comp[n].data+(z->img_comp[n].w2*j+i)*bs, z->img_comp[n].w2, data);
+         // every data block is an MCU, so countdown the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            // if it's NOT a restart, then just bail, so we get corrupt data
+            // rather than no data
+            if (!STBI__RESTART(z->marker)) return 2;
+            stbi__jpeg_reset(z);
          }
-         return 1;
-      } else { // interleaved
-         int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
-         for (j=0; j < z->img_mcu_y; ++j) {
-            for (i=0; i < z->img_mcu_x; ++i) {
-               // scan an interleaved mcu... process scan_n components in order
-               for (k=0; k < z->scan_n; ++k) {
-                  int n = z->order[k];
-                  // scan out an mcu's worth of this component; that's just determined
-                  // by the basic H and V specified for the component
-                  for (y=0; y < z->img_comp[n].v; ++y) {
-                     for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                     }
-                  }
-               }
-               // after all interleaved components, that's an interleaved MCU,
-               // so now count down the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
+      }
+   } else { // interleaved
+      int i,k,x,y;
+      for (i=0; i < z->img_mcu_x; ++i) {
+         // scan an interleaved mcu... process scan_n components in order
+         for (k=0; k < z->scan_n; ++k) {
+            int n = z->order[k];
+            // scan out an mcu's worth of this component; that's just determined
+            // by the basic H and V specified for the component
+            for (y=0; y < z->img_comp[n].v; ++y) {
+               for (x=0; x < z->img_comp[n].h; ++x) {
+                  int x2 = (i*z->img_comp[n].h + x)*bs;
+                  int y2 = (j*z->img_comp[n].v + y)*bs;
+                  int ha = z->img_comp[n].ha;
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                }
             }
          }
-         return 1;
+         // after all interleaved components, that's an interleaved MCU,
+         // so now count down the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            if (!STBI__RESTART(z->marker)) return 2;
+            stbi__jpeg_reset(z);
+         }
+      }
+   }
+   return 1;
+}
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+{
+   stbi__jpeg_reset(z);
+   if (!z->progressive) {
+      int j, rows = stbi__jpeg_baseline_rows(z);
+      for (j=0; j < rows; ++j) {
+         int r = stbi__jpeg_decode_baseline_row(z, j);
+         if (r != 1) return r != 0;
       }
+      return 1;
    } else {
       if (z->scan_n == 1) {
          int i,j;
@@ -3068,32 +4633,62 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
    }
 }
 
-static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
+#ifdef STBI_PROFILE
+static int stbi__parse_entropy_coded_data_profiled(stbi__jpeg *z)
+{
+   stbi__profile_scope scope;
+   stbi_profile_u64 start = stbi__profile_tell(z->s), end;
+   int result;
+   stbi__profile_begin(&scope);
+   result = stbi__parse_entropy_coded_data(z);
+   end = stbi__profile_tell(z->s);
+   stbi__profile_end(&scope, STBI_STAGE_JPEG_ENTROPY, end > start ? end - start : 0, (stbi_profile_u64) z->s->img_x * z->s->img_y);
+   return result;
+}
+#define stbi__parse_entropy_coded_data  stbi__parse_entropy_coded_data_profiled
+#endif
+
+static void stbi__jpeg_dequantize(short *out, short const *data, stbi__uint16 const *dequant)
 {
    int i;
    for (i=0; i < 64; ++i)
-      data[i] *= dequant[i];
+      out[i] = (short) (data[i] * dequant[i]);
 }
 
+// the coefficients are left as they are, so this can also be run to preview
+// a progressive image whose remaining scans haven't arrived yet
 static void stbi__jpeg_finish(stbi__jpeg *z)
 {
    if (z->progressive) {
       // dequantize and idct the data
       int i,j,n;
+      STBI_SIMD_ALIGN(short, data[64]);
       for (n=0; n < z->s->img_n; ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               short *coeff = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+               stbi__jpeg_dequantize(data, coeff, z->dequant[z->img_comp[n].tq]);
+               z->idct_block_kernel(z->img_comp[n].data+(z->img_comp[n].w2*j+i)*(8>>z->scale_shift), z->img_comp[n].w2, data);
             }
          }
       }
    }
 }
 
+#ifdef STBI_PROFILE
+static void stbi__jpeg_finish_profiled(stbi__jpeg *z)
+{
+   stbi__profile_scope scope;
+   if (!z->progressive) return; // nothing left to do for baseline
+   stbi__profile_begin(&scope);
+   stbi__jpeg_finish(z);
+   stbi__profile_end(&scope, STBI_STAGE_JPEG_FINISH, 0, (stbi_profile_u64) z->s->img_x * z->s->img_y);
+}
+#define stbi__jpeg_finish  stbi__jpeg_finish_profiled
+#endif
+
 static int stbi__process_marker(stbi__jpeg *z, int m)
 {
    int L;
@@ -3242,17 +4837,17 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    int i;
    for (i=0; i < ncomp; ++i) {
       if (z->img_comp[i].raw_data) {
-         STBI_FREE(z->img_comp[i].raw_data);
+         stbi__free(z->img_comp[i].raw_data);
          z->img_comp[i].raw_data = NULL;
          z->img_comp[i].data = NULL;
       }
       if (z->img_comp[i].raw_coeff) {
-         STBI_FREE(z->img_comp[i].raw_coeff);
+         stbi__free(z->img_comp[i].raw_coeff);
          z->img_comp[i].raw_coeff = 0;
          z->img_comp[i].coeff = 0;
       }
       if (z->img_comp[i].linebuf) {
-         STBI_FREE(z->img_comp[i].linebuf);
+         stbi__free(z->img_comp[i].linebuf);
          z->img_comp[i].linebuf = NULL;
       }
    }
@@ -3326,9 +4921,11 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
-      // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // so these muls can't overflow with 32-bit ints (which we require).
+      // when decoding at reduced scale each block only produces 8>>scale_shift
+      // pixels per side
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3338,10 +4935,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // coefficients are kept for every block regardless of scale
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3815,6 +5412,39 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+static int stbi__jpeg_scale_shift_global = 0;
+
+static int stbi__jpeg_denominator_to_shift(int denominator)
+{
+   switch (denominator) {
+      case 2:  return 1;
+      case 4:  return 2;
+      case 8:  return 3;
+      default: return 0;
+   }
+}
+
+STBIDEF void stbi_set_jpeg_scale_on_load(int denominator)
+{
+   stbi__jpeg_scale_shift_global = stbi__jpeg_denominator_to_shift(denominator);
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_scale_shift  stbi__jpeg_scale_shift_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_scale_shift_local, stbi__jpeg_scale_shift_set;
+
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int denominator)
+{
+   stbi__jpeg_scale_shift_local = stbi__jpeg_denominator_to_shift(denominator);
+   stbi__jpeg_scale_shift_set = 1;
+}
+
+#define stbi__jpeg_scale_shift  (stbi__jpeg_scale_shift_set          \
+                                 ? stbi__jpeg_scale_shift_local      \
+                                 : stbi__jpeg_scale_shift_global)
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
@@ -3835,6 +5465,11 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 #endif
+
+   j->scale_shift = stbi__jpeg_scale_shift;
+   if      (j->scale_shift == 1) j->idct_block_kernel = stbi__idct_block_4x4;
+   else if (j->scale_shift == 2) j->idct_block_kernel = stbi__idct_block_2x2;
+   else if (j->scale_shift == 3) j->idct_block_kernel = stbi__idct_block_1x1;
 }
 
 // clean up the temporary component buffers
@@ -3860,205 +5495,283 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// state for turning the decoded component planes into output pixels; it is
+// kept across calls so rows can be produced while the planes are still being
+// decoded (stbi_incremental)
+typedef struct
 {
+   stbi__resample res_comp[4];
    int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+   int w, h;        // output size, after any reduced-size decoding
+   int comp_y[4];   // rows in each component plane, likewise
+   int ready[4];    // rows of each plane that hold final data
+   int row;         // next output row
+} stbi__jpeg_output;
 
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+// restart the output at row 0, e.g. after another progressive scan
+static void stbi__jpeg_output_rewind(stbi__jpeg *z, stbi__jpeg_output *o)
+{
+   int k;
+   for (k=0; k < o->decode_n; ++k) {
+      stbi__resample *r = &o->res_comp[k];
+      r->ystep = r->vs >> 1;
+      r->ypos  = 0;
+      r->line0 = r->line1 = z->img_comp[k].data;
+   }
+   o->row = 0;
+}
 
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+// set up the output once the frame header is known; returns 0 with the
+// error set on failure, leaving cleanup to the caller
+static int stbi__jpeg_output_begin(stbi__jpeg *z, stbi__jpeg_output *o, int req_comp)
+{
+   int k, round = (1 << z->scale_shift) - 1;
+
+   // from here on only the reduced planes are used
+   o->w = (z->s->img_x + round) >> z->scale_shift;
+   o->h = (z->s->img_y + round) >> z->scale_shift;
 
    // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+   o->n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   o->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
 
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
+   if (z->s->img_n == 3 && o->n < 3 && !o->is_rgb)
+      o->decode_n = 1;
    else
-      decode_n = z->s->img_n;
+      o->decode_n = z->s->img_n;
 
    // nothing to do if no components requested; check this now to avoid
    // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+   if (o->decode_n <= 0) return 0;
 
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-      stbi__resample res_comp[4];
-
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
-      }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
+   for (k=0; k < o->decode_n; ++k) {
+      stbi__resample *r = &o->res_comp[k];
+
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(o->w + 3);
+      if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+      o->comp_y[k] = (z->img_comp[k].y + round) >> z->scale_shift;
+      o->ready[k]  = o->comp_y[k];
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->w_lores = (o->w + r->hs-1) / r->hs;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+   stbi__jpeg_output_rewind(z, o);
+   return 1;
+}
+
+// resample and color-convert rows o->row..row_end-1 into output (o->n
+// components, o->w wide, o->h rows, plus one byte of slack at the end),
+// stopping early at a row that needs plane rows that aren't ready yet
+static void stbi__jpeg_output_rows(stbi__jpeg *z, stbi__jpeg_output *o, stbi_uc *output, int row_end, int flip)
+{
+   int i,k;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   for (; o->row < row_end; ++o->row) {
+      int j = o->row;
+      stbi_uc *out = output + o->n * o->w * (flip ? o->h - 1 - j : j);
+      stbi_uc *row_end_ptr, row_end_byte;
+      for (k=0; k < o->decode_n; ++k) {
+         stbi__resample *r = &o->res_comp[k];
+         // line1 is the lower of the two plane rows this output row reads
+         if ((int) ((r->line1 - z->img_comp[k].data) / z->img_comp[k].w2) >= o->ready[k])
+            return;
+      }
+      // the n==3 converters store a 4th byte past the last pixel; when rows are
+      // written bottom-up (or out of order) that byte belongs to another row
+      row_end_ptr = out + o->n * o->w;
+      row_end_byte = *row_end_ptr;
+      for (k=0; k < o->decode_n; ++k) {
+         stbi__resample *r = &o->res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(z->img_comp[k].linebuf,
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < o->comp_y[k])
+               r->line1 += z->img_comp[k].w2;
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
+      }
+      if (o->n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (o->is_rgb) {
+               for (i=0; i < o->w; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += o->n;
                }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], o->w, o->n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < o->w; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += o->n;
                }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], o->w, o->n);
+               for (i=0; i < o->w; ++i) {
                   stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += o->n;
                }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], o->w, o->n);
+            }
+         } else
+            for (i=0; i < o->w; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += o->n;
+            }
+      } else {
+         if (o->is_rgb) {
+            if (o->n == 1)
+               for (i=0; i < o->w; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < o->w; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
                   out[1] = 255;
-                  out += n;
                }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
             }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < o->w; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += o->n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < o->w; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += o->n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (o->n == 1)
+               for (i=0; i < o->w; ++i) out[i] = y[i];
+            else
+               for (i=0; i < o->w; ++i) { *out++ = y[i]; *out++ = 255; }
          }
       }
-      stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
+      *row_end_ptr = row_end_byte;
    }
 }
 
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, int flip)
+{
+   stbi__jpeg_output o;
+   stbi_uc *output;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   if (!stbi__jpeg_output_begin(z, &o, req_comp)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   // can't error after this so, this is safe
+   output = (stbi_uc *) stbi__malloc_mad3(o.n, o.w, o.h, 1);
+   if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+   // now go ahead and resample
+   stbi__jpeg_output_rows(z, &o, output, o.h, flip);
+   stbi__cleanup_jpeg(z);
+   *out_x = o.w;
+   *out_y = o.h;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return output;
+}
+
+#ifdef STBI_PROFILE
+static stbi_uc *load_jpeg_image_profiled(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, int flip)
+{
+   stbi__profile_scope scope;
+   stbi_profile_u64 start = stbi__profile_tell(z->s), end;
+   stbi_uc *result;
+   stbi__profile_begin(&scope);
+   result = load_jpeg_image(z, out_x, out_y, comp, req_comp, flip);
+   end = stbi__profile_tell(z->s);
+   stbi__profile_end(&scope, STBI_STAGE_JPEG_OUTPUT, end > start ? end - start : 0, result ? (stbi_profile_u64) *out_x * *out_y : 0);
+   return result;
+}
+#define load_jpeg_image  load_jpeg_image_profiled
+#endif
+
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    unsigned char* result;
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    if (!j) return stbi__errpuc("outofmem", "Out of memory");
    memset(j, 0, sizeof(stbi__jpeg));
-   STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
-   result = load_jpeg_image(j, x,y,comp,req_comp);
-   STBI_FREE(j);
+   ri->vertically_flipped = stbi__vertically_flip_on_load;
+   result = load_jpeg_image(j, x,y,comp,req_comp, ri->vertically_flipped);
+   stbi__free(j);
    return result;
 }
 
 static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
-   stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+   stbi__jpeg* j;
+   // anything not starting with a marker byte can't be a JPEG; this saves
+   // allocating a decoder for every file tested after the JPEG test
+   r = stbi__get8(s) == 0xff;
+   stbi__rewind(s);
+   if (!r) return 0;
+   j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
    if (!j) return stbi__err("outofmem", "Out of memory");
    memset(j, 0, sizeof(stbi__jpeg));
    j->s = s;
    stbi__setup_jpeg(j);
    r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
    stbi__rewind(s);
-   STBI_FREE(j);
+   stbi__free(j);
    return r;
 }
 
 static int stbi__jpeg_info_raw(stbi__jpeg *j, int *x, int *y, int *comp)
 {
+   int shift = stbi__jpeg_scale_shift, round = (1 << shift) - 1;
    if (!stbi__decode_jpeg_header(j, STBI__SCAN_header)) {
       stbi__rewind( j->s );
       return 0;
    }
-   if (x) *x = j->s->img_x;
-   if (y) *y = j->s->img_y;
+   if (x) *x = (j->s->img_x + round) >> shift;
+   if (y) *y = (j->s->img_y + round) >> shift;
    if (comp) *comp = j->s->img_n >= 3 ? 3 : 1;
    return 1;
 }
@@ -4071,17 +5784,63 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    memset(j, 0, sizeof(stbi__jpeg));
    j->s = s;
    result = stbi__jpeg_info_raw(j, x, y, comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
+
+// the blocks stbi__jpeg_load allocates: the decoder, the component planes
+// (plus coefficients when progressive), line buffers and the result
+static int stbi__jpeg_scratch(stbi__context *s, int req_comp, size_t *bytes)
+{
+   int i, h_max = 1, v_max = 1, mcu_x, mcu_y, bs, w, h, n;
+   size_t total;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__err("outofmem", "Out of memory");
+   memset(j, 0, sizeof(stbi__jpeg));
+   j->s = s;
+   stbi__setup_jpeg(j);
+   if (!stbi__decode_jpeg_header(j, STBI__SCAN_header)) {
+      stbi__free(j);
+      return 0;
+   }
+   if (!stbi__mad3sizes_valid(s->img_x, s->img_y, 4, 0)) {
+      stbi__free(j);
+      return stbi__err("too large", "Image too large to decode");
+   }
+   for (i=0; i < s->img_n; ++i) {
+      if (j->img_comp[i].h > h_max) h_max = j->img_comp[i].h;
+      if (j->img_comp[i].v > v_max) v_max = j->img_comp[i].v;
+   }
+   mcu_x = (s->img_x + h_max*8-1) / (h_max*8);
+   mcu_y = (s->img_y + v_max*8-1) / (v_max*8);
+   bs = 8 >> j->scale_shift;
+   w = (s->img_x + (1 << j->scale_shift) - 1) >> j->scale_shift;
+   h = (s->img_y + (1 << j->scale_shift) - 1) >> j->scale_shift;
+   n = req_comp ? req_comp : s->img_n >= 3 ? 3 : 1;
+   total = sizeof(stbi__jpeg) + 16;
+   for (i=0; i < s->img_n; ++i) {
+      size_t blocks = (size_t) mcu_x * j->img_comp[i].h * mcu_y * j->img_comp[i].v;
+      total += blocks * bs * bs + 15 + 16;
+      if (j->progressive)
+         total += blocks * 64 * sizeof(short) + 15 + 16;
+      total += w + 3 + 16;
+   }
+   total += (size_t) w * h * n + 16;
+   stbi__free(j);
+   *bytes = total;
+   return 1;
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
 //    simple implementation
-//      - all input must be provided in an upfront buffer
-//      - all output is written to a single output buffer (can malloc/realloc)
+//      - input comes from an upfront buffer, or in chunks from a read callback
+//      - output goes to a single output buffer (can malloc/realloc), or
+//        through a 32K window to a write callback
 //    performance
 //      - fast huffman
+//      - while there's room on both sides, a fast loop refills the bit
+//        buffer a word at a time and copies matches a word at a time
 
 #ifndef STBI_NO_ZLIB
 
@@ -4176,6 +5935,7 @@ typedef struct
 {
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
+   int hit_zeof_once;
    stbi__uint32 code_buffer;
 
    char *zout;
@@ -4184,12 +5944,42 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+
+   // stbi_zlib_decode_stream only; io is NULL otherwise
+   stbi_zlib_io const *io;
+   void *io_user;
+   stbi_uc *zorigin;      // start of the current input chunk
+   size_t zretired;       // input bytes in the chunks before it
+   char *zflushed;        // output before this has gone to io->write
 } stbi__zbuf;
 
+#define STBI__ZSTREAM_IN   16384
+#define STBI__ZSTREAM_OUT  65536 // on top of the 32K window
+
+// stream mode: the current input chunk is used up, read the next one
+static int stbi__zrefill(stbi__zbuf *z)
+{
+   int n;
+   if (!z->io) return 0;
+   z->zretired += (size_t) (z->zbuffer_end - z->zorigin);
+   n = z->io->read(z->io_user, (char *) z->zorigin, STBI__ZSTREAM_IN);
+   z->zbuffer = z->zorigin;
+   z->zbuffer_end = z->zorigin + (n > 0 ? n : 0);
+   return n > 0;
+}
+
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
 {
-   return (z->zbuffer >= z->zbuffer_end);
+   return (z->zbuffer >= z->zbuffer_end) && !stbi__zrefill(z);
+}
+
+#ifdef STBI_PROFILE
+// input bytes consumed so far
+static size_t stbi__ztell(stbi__zbuf *z)
+{
+   return z->zretired + (size_t) (z->zbuffer - z->zorigin);
 }
+#endif
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 {
@@ -4237,14 +6027,42 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    return z->value[b];
 }
 
+// as above, for the fast loop's own bit buffer: returns the symbol and sets
+// *size to its code length, or returns -1
+static int stbi__zhuffman_decode_bits(stbi__zhuffman *z, unsigned int bits, int *size)
+{
+   int b,s,k;
+   k = stbi__bit_reverse(bits & 0xffff, 16);
+   for (s=STBI__ZFAST_BITS+1; ; ++s)
+      if (k < z->maxcode[s])
+         break;
+   if (s >= 16) return -1;
+   b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
+   if (b >= STBI__ZNSYMS) return -1;
+   if (z->size[b] != s) return -1;
+   *size = s;
+   return z->value[b];
+}
+
 stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
 {
    int b,s;
    if (a->num_bits < 16) {
       if (stbi__zeof(a)) {
-         return -1;   /* report error for unexpected end of data. */
+         if (!a->hit_zeof_once) {
+            // This is the first time we hit eof, insert 16 extra padding btis
+            // to allow us to keep going; if we actually consume any of them
+            // though, that is invalid data. This is caught later.
+            a->hit_zeof_once = 1;
+            a->num_bits += 16; // add 16 implicit zero bits
+         } else {
+            // We already inserted our extra 16 padding bits and are again
+            // out, this stream is actually prematurely terminated.
+            return -1;
+         }
+      } else {
+         stbi__fill_bits(a);
       }
-      stbi__fill_bits(a);
    }
    b = z->fast[a->code_buffer & STBI__ZFAST_MASK];
    if (b) {
@@ -4256,11 +6074,30 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
    return stbi__zhuffman_decode_slowpath(a, z);
 }
 
+// stream mode: hand what has been decoded to io->write, then keep only the
+// last 32K, the furthest a match can reach back, at the start of the buffer
+static int stbi__zflush(stbi__zbuf *z, char *zout)
+{
+   ptrdiff_t keep = zout - z->zout_start;
+   if (zout > z->zflushed && !z->io->write(z->io_user, z->zflushed, (int) (zout - z->zflushed)))
+      return stbi__err("write failed", "Output callback stopped decoding");
+   if (keep > 32768) keep = 32768;
+   memmove(z->zout_start, zout - keep, (size_t) keep);
+   z->zout = z->zout_start + keep;
+   z->zflushed = z->zout;
+   return 1;
+}
+
 static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room for n bytes
 {
    char *q;
    unsigned int cur, limit, old_limit;
    z->zout = zout;
+   if (z->io) { // n is at most 32K, which always fits after a flush
+      if (!stbi__zflush(z, zout)) return 0;
+      STBI_ASSERT(z->zout + n <= z->zout_end);
+      return 1;
+   }
    if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
    cur   = (unsigned int) (z->zout - z->zout_start);
    limit = old_limit = (unsigned) (z->zout_end - z->zout_start);
@@ -4269,7 +6106,7 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
       if(limit > UINT_MAX / 2) return stbi__err("outofmem", "Out of memory");
       limit *= 2;
    }
-   q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
+   q = (char *) stbi__realloc_sized(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
    z->zout_start = q;
@@ -4292,12 +6129,149 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
-static int stbi__parse_huffman_block(stbi__zbuf *a)
+#if defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET) || defined(_M_ARM) || defined(_M_ARM64) \
+  || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define STBI__LITTLE_ENDIAN
+#endif
+
+// the fast loop's bit buffer: as wide as a register
+typedef size_t stbi__zword;
+#define STBI__ZWORD_BITS  ((int) sizeof(stbi__zword) * 8)
+
+// the next sizeof(stbi__zword) input bytes, first byte lowest
+stbi_inline static stbi__zword stbi__zload_word(const stbi_uc *p)
 {
-   char *zout = a->zout;
-   for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
-      if (z < 256) {
+   stbi__zword w = 0;
+#ifdef STBI__LITTLE_ENDIAN
+   memcpy(&w, p, sizeof(w));
+#else
+   int i;
+   for (i = (int) sizeof(w) - 1; i >= 0; --i)
+      w = (w << 8) | p[i];
+#endif
+   return w;
+}
+
+// the fast loop runs while a step can't reach past either end: up to three
+// word refills, and a 258-byte match copied in words
+#define STBI__ZFAST_IN   (4 * sizeof(stbi__zword))
+#define STBI__ZFAST_OUT  (258 + 2 * sizeof(stbi__zword))
+
+// bring the bit buffer up to at least n bits (n <= 20), reading a whole word
+// and keeping the bytes that fit; bits above nbits are then the next input
+// bits rather than zero, which the next refill ORs in again unchanged
+#define STBI__ZNEED(n)                                                  \
+   if (nbits < (n)) {                                                   \
+      bits |= stbi__zload_word(in) << nbits;                            \
+      in += (STBI__ZWORD_BITS - 1 - nbits) >> 3;                        \
+      nbits |= STBI__ZWORD_BITS - 8;                                    \
+   }
+
+// decode symbols with a word-sized bit buffer until the block ends (1), the
+// data is bad (0), or the input or output gets too close to its end (2)
+static int stbi__parse_huffman_fast(stbi__zbuf *a, char **pzout)
+{
+   stbi_uc *in = a->zbuffer, *in_start = a->zbuffer;
+   stbi_uc *in_limit = a->zbuffer_end - STBI__ZFAST_IN;
+   char *zout = *pzout, *out_limit = a->zout_end - STBI__ZFAST_OUT;
+   stbi__zword bits = a->code_buffer;
+   int nbits = a->num_bits, result = 2, back;
+
+   while (in <= in_limit && zout <= out_limit) {
+      int z, s, len, dist;
+      STBI__ZNEED(20) // a length code and its extra bits
+      z = a->z_length.fast[bits & STBI__ZFAST_MASK];
+      if (z) {
+         s = z >> 9;
+         z &= 511;
+      } else {
+         z = stbi__zhuffman_decode_bits(&a->z_length, (unsigned int) bits, &s);
+         if (z < 0) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      }
+      bits >>= s;
+      nbits -= s;
+      if (z < 256) {
+         *zout++ = (char) z;
+         continue;
+      }
+      if (z == 256) { result = 1; break; }
+      if (z >= 286) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      z -= 257;
+      len = stbi__zlength_base[z] + (int) (bits & ((1u << stbi__zlength_extra[z]) - 1));
+      bits >>= stbi__zlength_extra[z];
+      nbits -= stbi__zlength_extra[z];
+
+      STBI__ZNEED(15)
+      z = a->z_distance.fast[bits & STBI__ZFAST_MASK];
+      if (z) {
+         s = z >> 9;
+         z &= 511;
+      } else {
+         z = stbi__zhuffman_decode_bits(&a->z_distance, (unsigned int) bits, &s);
+      }
+      if (z < 0 || z >= 30) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      bits >>= s;
+      nbits -= s;
+      STBI__ZNEED(13)
+      dist = stbi__zdist_base[z] + (int) (bits & ((1u << stbi__zdist_extra[z]) - 1));
+      bits >>= stbi__zdist_extra[z];
+      nbits -= stbi__zdist_extra[z];
+      if (zout - a->zout_start < dist) { result = stbi__err("bad dist","Corrupt PNG"); break; }
+
+      if (dist == 1) { // run of one byte; common in images.
+         memset(zout, zout[-1], len);
+         zout += len;
+      } else {
+         char *p = zout - dist, *end = zout + len;
+         // a short distance repeats a pattern: copy whole repeats until the
+         // copy runs at least a word behind, doubling the repeat each time
+         while (dist < (int) sizeof(stbi__zword) && zout < end) {
+            int n = (int) (end - zout) < dist ? (int) (end - zout) : dist;
+            memcpy(zout, p, n);
+            zout += n;
+            dist += dist;
+         }
+         // then a word at a time, which may write up to a word past 'end';
+         // the margin allows for that and later output overwrites it
+         while (zout < end) {
+            memcpy(zout, p, sizeof(stbi__zword));
+            zout += sizeof(stbi__zword);
+            p += sizeof(stbi__zword);
+         }
+         zout = end;
+      }
+   }
+
+   // return whole unused bytes to the input; no more than were read here,
+   // which leaves at most the 32 bits there were on entry
+   back = nbits >> 3;
+   if (back > in - in_start) back = (int) (in - in_start);
+   in -= back;
+   nbits -= back * 8;
+   if (nbits < STBI__ZWORD_BITS) bits &= ((stbi__zword) 1 << nbits) - 1;
+   a->zbuffer = in;
+   a->code_buffer = (stbi__uint32) bits;
+   a->num_bits = nbits;
+   *pzout = zout;
+   return result;
+}
+
+static int stbi__parse_huffman_block(stbi__zbuf *a)
+{
+   char *zout = a->zout;
+   for(;;) {
+      int z;
+      if (a->zbuffer_end - a->zbuffer >= (ptrdiff_t) STBI__ZFAST_IN && a->zout_end - zout >= (ptrdiff_t) STBI__ZFAST_OUT) {
+         z = stbi__parse_huffman_fast(a, &zout);
+         if (z != 2) {
+            a->zout = zout;
+            if (z == 1 && a->hit_zeof_once && a->num_bits < 16)
+               return stbi__err("unexpected end","Corrupt PNG");
+            return z;
+         }
+      }
+      z = stbi__zhuffman_decode(a, &a->z_length);
+      if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
             if (!stbi__zexpand(a, zout, 1)) return 0;
@@ -4309,6 +6283,13 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          int len,dist;
          if (z == 256) {
             a->zout = zout;
+            if (a->hit_zeof_once && a->num_bits < 16) {
+               // The first time we hit zeof, we inserted 16 extra zero bits into our bit
+               // buffer so the decoder can just do its speculative decoding. But if we
+               // actually consumed any of those bits (which is the case when num_bits < 16),
+               // the stream actually read past the end so it is malformed.
+               return stbi__err("unexpected end","Corrupt PNG");
+            }
             return 1;
          }
          if (z >= 286) return stbi__err("bad huffman code","Corrupt PNG"); // per DEFLATE, length codes 286 and 287 must not appear in compressed data
@@ -4405,12 +6386,19 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
-   if (a->zout + len > a->zout_end)
-      if (!stbi__zexpand(a, a->zout, len)) return 0;
-   memcpy(a->zout, a->zbuffer, len);
-   a->zbuffer += len;
-   a->zout += len;
+   // in pieces, since stream mode has the input in chunks and a bounded
+   // output window
+   while (len > 0) {
+      int n = len > 32768 ? 32768 : len;
+      if (stbi__zeof(a)) return stbi__err("read past buffer","Corrupt PNG");
+      if (n > a->zbuffer_end - a->zbuffer) n = (int) (a->zbuffer_end - a->zbuffer);
+      if (a->zout + n > a->zout_end)
+         if (!stbi__zexpand(a, a->zout, n)) return 0;
+      memcpy(a->zout, a->zbuffer, n);
+      a->zbuffer += n;
+      a->zout += n;
+      len -= n;
+   }
    return 1;
 }
 
@@ -4457,40 +6445,66 @@ Init algorithm:
 }
 */
 
+// decode one deflate block; *final is set if it was the last one
+static int stbi__parse_zlib_block(stbi__zbuf *a, int *final)
+{
+   int type;
+   *final = stbi__zreceive(a,1);
+   type = stbi__zreceive(a,2);
+   if (type == 0) {
+      if (!stbi__parse_uncompressed_block(a)) return 0;
+   } else if (type == 3) {
+      return 0;
+   } else {
+      if (type == 1) {
+         // use fixed code lengths
+         if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , STBI__ZNSYMS)) return 0;
+         if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+      } else {
+         if (!stbi__compute_huffman_codes(a)) return 0;
+      }
+      if (!stbi__parse_huffman_block(a)) return 0;
+   }
+   return 1;
+}
+
 static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 {
-   int final, type;
+   int final;
    if (parse_header)
       if (!stbi__parse_zlib_header(a)) return 0;
    a->num_bits = 0;
    a->code_buffer = 0;
+   a->hit_zeof_once = 0;
    do {
-      final = stbi__zreceive(a,1);
-      type = stbi__zreceive(a,2);
-      if (type == 0) {
-         if (!stbi__parse_uncompressed_block(a)) return 0;
-      } else if (type == 3) {
-         return 0;
-      } else {
-         if (type == 1) {
-            // use fixed code lengths
-            if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , STBI__ZNSYMS)) return 0;
-            if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
-         } else {
-            if (!stbi__compute_huffman_codes(a)) return 0;
-         }
-         if (!stbi__parse_huffman_block(a)) return 0;
-      }
+      if (!stbi__parse_zlib_block(a, &final)) return 0;
    } while (!final);
    return 1;
 }
 
+#ifdef STBI_PROFILE
+static int stbi__parse_zlib_profiled(stbi__zbuf *a, int parse_header)
+{
+   stbi__profile_scope scope;
+   size_t start = stbi__ztell(a);
+   int result;
+   stbi__profile_begin(&scope);
+   result = stbi__parse_zlib(a, parse_header);
+   stbi__profile_end(&scope, STBI_STAGE_ZLIB, (stbi_profile_u64) (stbi__ztell(a) - start), 0);
+   return result;
+}
+#define stbi__parse_zlib  stbi__parse_zlib_profiled
+#endif
+
 static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse_header)
 {
    a->zout_start = obuf;
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->io = NULL;
+   a->zorigin = a->zbuffer;
+   a->zretired = 0;
 
    return stbi__parse_zlib(a, parse_header);
 }
@@ -4506,7 +6520,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4527,7 +6541,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4554,11 +6568,53 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
 
+STBIDEF char *stbi_zlib_decode_known_size(const char *buffer, int len, int size, int parse_header)
+{
+   stbi__zbuf a;
+   char *p;
+   int ok;
+   if (size < 0 || size > INT_MAX - (int) STBI__ZFAST_OUT) return (char *) stbi__errpuc("too large", "Output too large");
+   // the slack lets the fast loop run right up to 'size'
+   p = (char *) stbi__malloc(size + STBI__ZFAST_OUT);
+   if (p == NULL) return (char *) stbi__errpuc("outofmem", "Out of memory");
+   a.zbuffer = (stbi_uc *) buffer;
+   a.zbuffer_end = (stbi_uc *) buffer + len;
+   ok = stbi__do_zlib(&a, p, size + (int) STBI__ZFAST_OUT, 0, parse_header);
+   if (ok && a.zout - a.zout_start == size)
+      return p;
+   stbi__free(p);
+   return ok ? (char *) stbi__errpuc("size mismatch", "Decoded size differs from the expected size") : NULL;
+}
+
+STBIDEF int stbi_zlib_decode_stream(stbi_zlib_io const *io, void *user, int parse_header)
+{
+   stbi__zbuf a;
+   int ok;
+   stbi_uc *in = (stbi_uc *) stbi__malloc(STBI__ZSTREAM_IN);
+   char *out = (char *) stbi__malloc(32768 + STBI__ZSTREAM_OUT);
+   if (in == NULL || out == NULL) {
+      stbi__free(in);
+      stbi__free(out);
+      return stbi__err("outofmem", "Out of memory");
+   }
+   a.io = io;
+   a.io_user = user;
+   a.zbuffer = a.zbuffer_end = a.zorigin = in;
+   a.zretired = 0;
+   a.zout_start = a.zout = a.zflushed = out;
+   a.zout_end = out + 32768 + STBI__ZSTREAM_OUT;
+   a.z_expandable = 1;
+   ok = stbi__parse_zlib(&a, parse_header) && stbi__zflush(&a, a.zout);
+   stbi__free(in);
+   stbi__free(out);
+   return ok;
+}
+
 STBIDEF int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen)
 {
    stbi__zbuf a;
@@ -4610,6 +6666,15 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   int flip; // write rows bottom-up (stbi_set_flip_vertically_on_load)
+
+   // what the chunks seen so far have told us; kept here rather than in
+   // locals so the chunks can also be parsed one at a time
+   stbi_uc palette[1024], pal_img_n;
+   stbi_uc has_trans, tc[3];
+   stbi__uint16 tc16[3];
+   stbi__uint32 ioff, idata_limit, pal_len;
+   int first, interlace, color, is_iphone;
 } stbi__png;
 
 
@@ -4646,13 +6711,15 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
-// create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+// unfilter scanlines j0..j1-1 into a->out, which holds all y rows; raw points
+// at the filter byte of scanline j0. rows are left packed (depth < 8) or
+// big-endian (depth 16) until stbi__png_finish_rows has been run on them
+static int stbi__png_unfilter_rows(stbi__png *a, stbi_uc *raw, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, stbi__uint32 j0, stbi__uint32 j1, int flip)
 {
    int bytes = (depth == 16? 2 : 1);
    stbi__context *s = a->s;
    stbi__uint32 i,j,stride = x*out_n*bytes;
-   stbi__uint32 img_len, img_width_bytes;
+   stbi__uint32 img_width_bytes;
    int k;
    int img_n = s->img_n; // copy it into a local for later
 
@@ -4660,21 +6727,12 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int filter_bytes = img_n*bytes;
    int width = x;
 
-   STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
-   if (!a->out) return stbi__err("outofmem", "Out of memory");
-
-   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
    img_width_bytes = (((img_n * x * depth) + 7) >> 3);
-   img_len = (img_width_bytes + 1) * y;
-
-   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
-   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
-   // so just check for raw_len < img_len always.
-   if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
 
-   for (j=0; j < y; ++j) {
-      stbi_uc *cur = a->out + stride*j;
+   for (j=j0; j < j1; ++j) {
+      // when flipping, scanline j lands in row y-1-j and its predecessor is the row below
+      stbi__uint32 row = flip ? y-1-j : j;
+      stbi_uc *cur = a->out + stride*row;
       stbi_uc *prior;
       int filter = *raw++;
 
@@ -4687,7 +6745,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          filter_bytes = 1;
          width = img_width_bytes;
       }
-      prior = cur - stride; // bugfix: need to compute this after 'cur +=' computation above
+      prior = flip ? cur + stride : cur - stride; // bugfix: need to compute this after 'cur +=' computation above
 
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
@@ -4763,7 +6821,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          // the loop above sets the high byte of the pixels' alpha, but for
          // 16 bit png files we also need the low byte set. we'll do that here.
          if (depth == 16) {
-            cur = a->out + stride*j; // start at the beginning of the row again
+            cur = a->out + stride*row; // start at the beginning of the row again
             for (i=0; i < x; ++i,cur+=output_bytes) {
                cur[filter_bytes+1] = 255;
             }
@@ -4771,13 +6829,28 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       }
    }
 
+   return 1;
+}
+
+// turn unfiltered scanlines j0..j1-1 into final samples: expand 1/2/4-bit
+// samples to bytes and swap 16-bit samples to native order. both rewrite the
+// row in place, so a scanline may only be finished once the scanline after it
+// has been unfiltered
+static void stbi__png_finish_rows(stbi__png *a, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color, stbi__uint32 j0, stbi__uint32 j1, int flip)
+{
+   int img_n = a->s->img_n;
+   stbi__uint32 i,j,stride = x*out_n*(depth == 16 ? 2 : 1);
+   stbi__uint32 img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+   int k;
+
    // we make a separate pass to expand bits to pixels; for performance,
    // this could run two scanlines behind the above code, so it won't
    // intefere with filtering but will still be in the cache.
    if (depth < 8) {
-      for (j=0; j < y; ++j) {
-         stbi_uc *cur = a->out + stride*j;
-         stbi_uc *in  = a->out + stride*j + x*out_n - img_width_bytes;
+      for (j=j0; j < j1; ++j) {
+         stbi__uint32 row = flip ? y-1-j : j;
+         stbi_uc *cur = a->out + stride*row;
+         stbi_uc *in  = a->out + stride*row + x*out_n - img_width_bytes;
          // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
          // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
          stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
@@ -4826,7 +6899,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          if (img_n != out_n) {
             int q;
             // insert alpha = 255
-            cur = a->out + stride*j;
+            cur = a->out + stride*row;
             if (img_n == 1) {
                for (q=x-1; q >= 0; --q) {
                   cur[q*2+1] = 255;
@@ -4846,16 +6919,40 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    } else if (depth == 16) {
       // force the image data from big-endian to platform-native.
       // this is done in a separate pass due to the decoding relying
-      // on the data being untouched, but could probably be done
-      // per-line during decode if care is taken.
-      stbi_uc *cur = a->out;
-      stbi__uint16 *cur16 = (stbi__uint16*)cur;
+      // on the data being untouched
+      for (j=j0; j < j1; ++j) {
+         stbi_uc *cur = a->out + stride*(flip ? y-1-j : j);
+         stbi__uint16 *cur16 = (stbi__uint16*)cur;
 
-      for(i=0; i < x*y*out_n; ++i,cur16++,cur+=2) {
-         *cur16 = (cur[0] << 8) | cur[1];
+         for(i=0; i < x*out_n; ++i,cur16++,cur+=2) {
+            *cur16 = (cur[0] << 8) | cur[1];
+         }
       }
    }
+}
+
+// create the png data from post-deflated data
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color, int flip)
+{
+   int bytes = (depth == 16? 2 : 1);
+   int img_n = a->s->img_n;
+   stbi__uint32 img_len, img_width_bytes;
+
+   STBI_ASSERT(out_n == img_n || out_n == img_n+1);
+   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, out_n*bytes, 0); // extra bytes to write off the end into
+   if (!a->out) return stbi__err("outofmem", "Out of memory");
+
+   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+   img_len = (img_width_bytes + 1) * y;
+
+   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
+   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
+   // so just check for raw_len < img_len always.
+   if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
 
+   if (!stbi__png_unfilter_rows(a, raw, out_n, x, y, depth, 0, y, flip)) return 0;
+   stbi__png_finish_rows(a, out_n, x, y, depth, color, 0, y, flip);
    return 1;
 }
 
@@ -4866,7 +6963,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    stbi_uc *final;
    int p;
    if (!interlaced)
-      return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
+      return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color, a->flip);
 
    // de-interlacing
    final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
@@ -4882,19 +6979,20 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
-         if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-            STBI_FREE(final);
+         if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color, 0)) {
+            stbi__free(final);
             return 0;
          }
          for (j=0; j < y; ++j) {
             for (i=0; i < x; ++i) {
                int out_y = j*yspc[p]+yorig[p];
                int out_x = i*xspc[p]+xorig[p];
+               if (a->flip) out_y = a->s->img_y - 1 - out_y;
                memcpy(final + out_y*a->s->img_x*out_bytes + out_x*out_bytes,
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
          }
-         STBI_FREE(a->out);
+         stbi__free(a->out);
          image_data += img_len;
          image_data_len -= img_len;
       }
@@ -4904,11 +7002,22 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+#ifdef STBI_PROFILE
+static int stbi__create_png_image_profiled(stbi__png *a, stbi_uc *image_data, stbi__uint32 image_data_len, int out_n, int depth, int color, int interlaced)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+   stbi__profile_scope scope;
+   int result;
+   stbi__profile_begin(&scope);
+   result = stbi__create_png_image(a, image_data, image_data_len, out_n, depth, color, interlaced);
+   stbi__profile_end(&scope, STBI_STAGE_PNG_UNFILTER, image_data_len, (stbi_profile_u64) a->s->img_x * a->s->img_y);
+   return result;
+}
+#define stbi__create_png_image  stbi__create_png_image_profiled
+#endif
+
+static int stbi__compute_transparency(stbi_uc *p, stbi__uint32 pixel_count, stbi_uc tc[3], int out_n)
+{
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 255 as the alpha value in the output
@@ -4929,11 +7038,9 @@ static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
    return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n)
+static int stbi__compute_transparency16(stbi__uint16 *p, stbi__uint32 pixel_count, stbi__uint16 tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi__uint16 *p = (stbi__uint16*) z->out;
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 65535 as the alpha value in the output
@@ -4954,17 +7061,9 @@ static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int ou
    return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+static void stbi__expand_png_palette_pixels(stbi_uc *p, stbi_uc const *orig, stbi__uint32 pixel_count, stbi_uc const *palette, int pal_img_n)
 {
-   stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-   stbi_uc *p, *temp_out, *orig = a->out;
-
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-   if (p == NULL) return stbi__err("outofmem", "Out of memory");
-
-   // between here and free(out) below, exitting would leak
-   temp_out = p;
-
+   stbi__uint32 i;
    if (pal_img_n == 3) {
       for (i=0; i < pixel_count; ++i) {
          int n = orig[i]*4;
@@ -4983,7 +7082,18 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
-   STBI_FREE(a->out);
+}
+
+static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+{
+   stbi__uint32 pixel_count = a->s->img_x * a->s->img_y;
+   stbi_uc *temp_out;
+
+   temp_out = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+   if (temp_out == NULL) return stbi__err("outofmem", "Out of memory");
+
+   stbi__expand_png_palette_pixels(temp_out, a->out, pixel_count, palette, pal_img_n);
+   stbi__free(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -5031,239 +7141,314 @@ STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_conve
                                 : stbi__de_iphone_flag_global)
 #endif // STBI_THREAD_LOCAL
 
+// 255/a, so unpremultiplying is a multiply instead of a divide per channel;
+// alpha 0 leaves the colour as stored
+#define STBI__UNPREMUL1(a)   255.0f/(a)
+#define STBI__UNPREMUL4(a)   STBI__UNPREMUL1(a), STBI__UNPREMUL1(a+1), STBI__UNPREMUL1(a+2), STBI__UNPREMUL1(a+3)
+#define STBI__UNPREMUL16(a)  STBI__UNPREMUL4(a), STBI__UNPREMUL4(a+4), STBI__UNPREMUL4(a+8), STBI__UNPREMUL4(a+12)
+#define STBI__UNPREMUL64(a)  STBI__UNPREMUL16(a), STBI__UNPREMUL16(a+16), STBI__UNPREMUL16(a+32), STBI__UNPREMUL16(a+48)
+static const float stbi__unpremultiply_scale[256] =
+{
+   1.0f, STBI__UNPREMUL1(1), STBI__UNPREMUL1(2), STBI__UNPREMUL1(3),
+   STBI__UNPREMUL4(4), STBI__UNPREMUL4(8), STBI__UNPREMUL4(12),
+   STBI__UNPREMUL16(16), STBI__UNPREMUL16(32), STBI__UNPREMUL16(48),
+   STBI__UNPREMUL64(64), STBI__UNPREMUL64(128), STBI__UNPREMUL64(192)
+};
+#undef STBI__UNPREMUL1
+#undef STBI__UNPREMUL4
+#undef STBI__UNPREMUL16
+#undef STBI__UNPREMUL64
+
+// c*255/a rounded half up, like (c*255 + a/2) / a: a true half rounds up
+// through the extra 1/1024, and every other result is at least 1/510 away
+// from a half, far more than the float error. colours above alpha saturate
+#define STBI__UNPREMUL_ROUND  (0.5f + 1.0f/1024)
+
+static stbi_uc stbi__unpremul(int c, float scale)
+{
+   int v = (int) (c * scale + STBI__UNPREMUL_ROUND);
+   return (stbi_uc) (v > 255 ? 255 : v);
+}
+
+// undo premultiplied alpha on x rgba pixels in place
+static void stbi__unpremultiply_row(stbi_uc *p, unsigned int x)
+{
+   unsigned int i = 0;
+#ifdef STBI_SSE2
+   __m128i zero = _mm_setzero_si128();
+   __m128 round = _mm_set1_ps(STBI__UNPREMUL_ROUND);
+   for (; i + 4 <= x; i += 4) {
+      stbi_uc *q = p + i*4;
+      __m128i v  = _mm_loadu_si128((__m128i const *) q);
+      __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+      __m128 s0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_setr_ps(stbi__unpremultiply_scale[q[ 3]], stbi__unpremultiply_scale[q[ 3]], stbi__unpremultiply_scale[q[ 3]], 1.0f));
+      __m128 s1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), _mm_setr_ps(stbi__unpremultiply_scale[q[ 7]], stbi__unpremultiply_scale[q[ 7]], stbi__unpremultiply_scale[q[ 7]], 1.0f));
+      __m128 s2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_setr_ps(stbi__unpremultiply_scale[q[11]], stbi__unpremultiply_scale[q[11]], stbi__unpremultiply_scale[q[11]], 1.0f));
+      __m128 s3 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), _mm_setr_ps(stbi__unpremultiply_scale[q[15]], stbi__unpremultiply_scale[q[15]], stbi__unpremultiply_scale[q[15]], 1.0f));
+      lo = _mm_packs_epi32(_mm_cvttps_epi32(_mm_add_ps(s0, round)), _mm_cvttps_epi32(_mm_add_ps(s1, round)));
+      hi = _mm_packs_epi32(_mm_cvttps_epi32(_mm_add_ps(s2, round)), _mm_cvttps_epi32(_mm_add_ps(s3, round)));
+      _mm_storeu_si128((__m128i *) q, _mm_packus_epi16(lo, hi));
+   }
+#elif defined(STBI_NEON)
+   float32x4_t round = vdupq_n_f32(STBI__UNPREMUL_ROUND);
+   for (; i + 8 <= x; i += 8) {
+      float scale[8];
+      float32x4_t slo, shi;
+      uint8x8x4_t v = vld4_u8(p + i*4);
+      int j, c;
+      for (j=0; j < 8; ++j)
+         scale[j] = stbi__unpremultiply_scale[p[(i+j)*4 + 3]];
+      slo = vld1q_f32(scale);
+      shi = vld1q_f32(scale + 4);
+      for (c=0; c < 3; ++c) {
+         uint16x8_t w = vmovl_u8(v.val[c]);
+         float32x4_t flo = vaddq_f32(vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(w))), slo), round);
+         float32x4_t fhi = vaddq_f32(vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(w))), shi), round);
+         v.val[c] = vqmovn_u16(vcombine_u16(vqmovn_u32(vcvtq_u32_f32(flo)), vqmovn_u32(vcvtq_u32_f32(fhi))));
+      }
+      vst4_u8(p + i*4, v);
+   }
+#endif
+   for (p += i*4; i < x; ++i, p += 4) {
+      float scale = stbi__unpremultiply_scale[p[3]];
+      p[0] = stbi__unpremul(p[0], scale);
+      p[1] = stbi__unpremul(p[1], scale);
+      p[2] = stbi__unpremul(p[2], scale);
+   }
+}
+
 static void stbi__de_iphone(stbi__png *z)
 {
    stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
+   stbi__uint32 j, row_len = s->img_x;
+   int n = s->img_out_n;
    stbi_uc *p = z->out;
 
-   if (s->img_out_n == 3) {  // convert bgr to rgb
-      for (i=0; i < pixel_count; ++i) {
-         stbi_uc t = p[0];
-         p[0] = p[2];
-         p[2] = t;
-         p += 3;
-      }
-   } else {
-      STBI_ASSERT(s->img_out_n == 4);
-      if (stbi__unpremultiply_on_load) {
-         // convert bgr to rgb and unpremultiply
-         for (i=0; i < pixel_count; ++i) {
-            stbi_uc a = p[3];
-            stbi_uc t = p[0];
-            if (a) {
-               stbi_uc half = a / 2;
-               p[0] = (p[2] * 255 + half) / a;
-               p[1] = (p[1] * 255 + half) / a;
-               p[2] = ( t   * 255 + half) / a;
-            } else {
-               p[0] = p[2];
-               p[2] = t;
-            }
-            p += 4;
-         }
-      } else {
-         // convert bgr to rgb
-         for (i=0; i < pixel_count; ++i) {
-            stbi_uc t = p[0];
-            p[0] = p[2];
-            p[2] = t;
-            p += 4;
-         }
-      }
+   STBI_ASSERT(n == 3 || n == 4);
+   // convert bgr to rgb, a row at a time so unpremultiplying finds it in cache;
+   // skip the unpremultiply when the caller wants premultiplied pixels anyway
+   for (j=0; j < s->img_y; ++j, p += (size_t) row_len * n) {
+      stbi__swap_rb_row(p, p, n, n, row_len);
+      if (n == 4 && stbi__unpremultiply_on_load && !stbi__premultiply_on_load)
+         stbi__unpremultiply_row(p, row_len);
    }
 }
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
-static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
+static void stbi__png_begin(stbi__png *z)
 {
-   stbi_uc palette[1024], pal_img_n=0;
-   stbi_uc has_trans=0, tc[3]={0};
-   stbi__uint16 tc16[3];
-   stbi__uint32 ioff=0, idata_limit=0, i, pal_len=0;
-   int first=1,k,interlace=0, color=0, is_iphone=0;
-   stbi__context *s = z->s;
-
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->pal_img_n = 0;
+   z->has_trans = 0;
+   z->tc[0] = z->tc[1] = z->tc[2] = 0;
+   z->ioff = z->idata_limit = z->pal_len = 0;
+   z->first = 1;
+   z->interlace = z->color = z->is_iphone = 0;
+}
+
+// make room for n more bytes of IDAT data
+static int stbi__png_grow_idata(stbi__png *z, stbi__uint32 n)
+{
+   if (n > (1u << 30)) return stbi__err("IDAT size limit", "IDAT section larger than 2^30 bytes");
+   if ((int)(z->ioff + n) < (int)z->ioff) return 0;
+   if (z->ioff + n > z->idata_limit) {
+      stbi__uint32 idata_limit_old = z->idata_limit;
+      stbi_uc *p;
+      if (z->idata_limit == 0) z->idata_limit = n > 4096 ? n : 4096;
+      while (z->ioff + n > z->idata_limit)
+         z->idata_limit *= 2;
+      STBI_NOTUSED(idata_limit_old);
+      p = (stbi_uc *) stbi__realloc_sized(z->idata, idata_limit_old, z->idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+      z->idata = p;
+   }
+   return 1;
+}
 
-   if (!stbi__check_png_header(s)) return 0;
+// parse one chunk whose header has just been read, including its CRC.
+// returns 0 on error, 1 to go on with the next chunk, and 2 when the
+// parse is finished (IEND, or a header scan found what it needs)
+static int stbi__png_parse_chunk(stbi__png *z, stbi__pngchunk c, int scan, int req_comp)
+{
+   stbi__uint32 i;
+   int k;
+   stbi__context *s = z->s;
+   switch (c.type) {
+      case STBI__PNG_TYPE('C','g','B','I'):
+         z->is_iphone = 1;
+         stbi__skip(s, c.length);
+         break;
+      case STBI__PNG_TYPE('I','H','D','R'): {
+         int comp,filter;
+         if (!z->first) return stbi__err("multiple IHDR","Corrupt PNG");
+         z->first = 0;
+         if (c.length != 13) return stbi__err("bad IHDR len","Corrupt PNG");
+         s->img_x = stbi__get32be(s);
+         s->img_y = stbi__get32be(s);
+         if (s->img_y > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
+         if (s->img_x > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
+         z->depth = stbi__get8(s);  if (z->depth != 1 && z->depth != 2 && z->depth != 4 && z->depth != 8 && z->depth != 16)  return stbi__err("1/2/4/8/16-bit only","PNG not supported: 1/2/4/8/16-bit only");
+         z->color = stbi__get8(s);  if (z->color > 6)         return stbi__err("bad ctype","Corrupt PNG");
+         if (z->color == 3 && z->depth == 16)                  return stbi__err("bad ctype","Corrupt PNG");
+         if (z->color == 3) z->pal_img_n = 3; else if (z->color & 1) return stbi__err("bad ctype","Corrupt PNG");
+         comp  = stbi__get8(s);  if (comp) return stbi__err("bad comp method","Corrupt PNG");
+         filter= stbi__get8(s);  if (filter) return stbi__err("bad filter method","Corrupt PNG");
+         z->interlace = stbi__get8(s); if (z->interlace>1) return stbi__err("bad interlace method","Corrupt PNG");
+         if (!s->img_x || !s->img_y) return stbi__err("0-pixel image","Corrupt PNG");
+         if (!z->pal_img_n) {
+            s->img_n = (z->color & 2 ? 3 : 1) + (z->color & 4 ? 1 : 0);
+            if ((1 << 30) / s->img_x / s->img_n < s->img_y) return stbi__err("too large", "Image too large to decode");
+         } else {
+            // if paletted, then pal_n is our final components, and
+            // img_n is # components to decompress/filter.
+            s->img_n = 1;
+            if ((1 << 30) / s->img_x / 4 < s->img_y) return stbi__err("too large","Corrupt PNG");
+         }
+         // even with SCAN_header, have to scan to see if we have a tRNS
+         break;
+      }
 
-   if (scan == STBI__SCAN_type) return 1;
+      case STBI__PNG_TYPE('P','L','T','E'):  {
+         if (z->first) return stbi__err("first not IHDR", "Corrupt PNG");
+         if (c.length > 256*3) return stbi__err("invalid PLTE","Corrupt PNG");
+         z->pal_len = c.length / 3;
+         if (z->pal_len * 3 != c.length) return stbi__err("invalid PLTE","Corrupt PNG");
+         for (i=0; i < z->pal_len; ++i) {
+            z->palette[i*4+0] = stbi__get8(s);
+            z->palette[i*4+1] = stbi__get8(s);
+            z->palette[i*4+2] = stbi__get8(s);
+            z->palette[i*4+3] = 255;
+         }
+         break;
+      }
 
-   for (;;) {
-      stbi__pngchunk c = stbi__get_chunk_header(s);
-      switch (c.type) {
-         case STBI__PNG_TYPE('C','g','B','I'):
-            is_iphone = 1;
-            stbi__skip(s, c.length);
-            break;
-         case STBI__PNG_TYPE('I','H','D','R'): {
-            int comp,filter;
-            if (!first) return stbi__err("multiple IHDR","Corrupt PNG");
-            first = 0;
-            if (c.length != 13) return stbi__err("bad IHDR len","Corrupt PNG");
-            s->img_x = stbi__get32be(s);
-            s->img_y = stbi__get32be(s);
-            if (s->img_y > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
-            if (s->img_x > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
-            z->depth = stbi__get8(s);  if (z->depth != 1 && z->depth != 2 && z->depth != 4 && z->depth != 8 && z->depth != 16)  return stbi__err("1/2/4/8/16-bit only","PNG not supported: 1/2/4/8/16-bit only");
-            color = stbi__get8(s);  if (color > 6)         return stbi__err("bad ctype","Corrupt PNG");
-            if (color == 3 && z->depth == 16)                  return stbi__err("bad ctype","Corrupt PNG");
-            if (color == 3) pal_img_n = 3; else if (color & 1) return stbi__err("bad ctype","Corrupt PNG");
-            comp  = stbi__get8(s);  if (comp) return stbi__err("bad comp method","Corrupt PNG");
-            filter= stbi__get8(s);  if (filter) return stbi__err("bad filter method","Corrupt PNG");
-            interlace = stbi__get8(s); if (interlace>1) return stbi__err("bad interlace method","Corrupt PNG");
-            if (!s->img_x || !s->img_y) return stbi__err("0-pixel image","Corrupt PNG");
-            if (!pal_img_n) {
-               s->img_n = (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
-               if ((1 << 30) / s->img_x / s->img_n < s->img_y) return stbi__err("too large", "Image too large to decode");
+      case STBI__PNG_TYPE('t','R','N','S'): {
+         if (z->first) return stbi__err("first not IHDR", "Corrupt PNG");
+         if (z->idata) return stbi__err("tRNS after IDAT","Corrupt PNG");
+         if (z->pal_img_n) {
+            if (scan == STBI__SCAN_header) { s->img_n = 4; return 2; }
+            if (z->pal_len == 0) return stbi__err("tRNS before PLTE","Corrupt PNG");
+            if (c.length > z->pal_len) return stbi__err("bad tRNS len","Corrupt PNG");
+            z->pal_img_n = 4;
+            for (i=0; i < c.length; ++i)
+               z->palette[i*4+3] = stbi__get8(s);
+         } else {
+            if (!(s->img_n & 1)) return stbi__err("tRNS with alpha","Corrupt PNG");
+            if (c.length != (stbi__uint32) s->img_n*2) return stbi__err("bad tRNS len","Corrupt PNG");
+            z->has_trans = 1;
+            // non-paletted with tRNS = constant alpha. if header-scanning, we can stop now.
+            if (scan == STBI__SCAN_header) { ++s->img_n; return 2; }
+            if (z->depth == 16) {
+               for (k = 0; k < s->img_n; ++k) z->tc16[k] = (stbi__uint16)stbi__get16be(s); // copy the values as-is
             } else {
-               // if paletted, then pal_n is our final components, and
-               // img_n is # components to decompress/filter.
-               s->img_n = 1;
-               if ((1 << 30) / s->img_x / 4 < s->img_y) return stbi__err("too large","Corrupt PNG");
+               for (k = 0; k < s->img_n; ++k) z->tc[k] = (stbi_uc)(stbi__get16be(s) & 255) * stbi__depth_scale_table[z->depth]; // non 8-bit images will be larger
             }
-            // even with SCAN_header, have to scan to see if we have a tRNS
-            break;
          }
+         break;
+      }
 
-         case STBI__PNG_TYPE('P','L','T','E'):  {
-            if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-            if (c.length > 256*3) return stbi__err("invalid PLTE","Corrupt PNG");
-            pal_len = c.length / 3;
-            if (pal_len * 3 != c.length) return stbi__err("invalid PLTE","Corrupt PNG");
-            for (i=0; i < pal_len; ++i) {
-               palette[i*4+0] = stbi__get8(s);
-               palette[i*4+1] = stbi__get8(s);
-               palette[i*4+2] = stbi__get8(s);
-               palette[i*4+3] = 255;
-            }
-            break;
+      case STBI__PNG_TYPE('I','D','A','T'): {
+         if (z->first) return stbi__err("first not IHDR", "Corrupt PNG");
+         if (z->pal_img_n && !z->pal_len) return stbi__err("no PLTE","Corrupt PNG");
+         if (scan == STBI__SCAN_header) {
+            // header scan definitely stops at first IDAT
+            if (z->pal_img_n)
+               s->img_n = z->pal_img_n;
+            return 2;
          }
+         if (!stbi__png_grow_idata(z, c.length)) return 0;
+         if (!stbi__getn(s, z->idata+z->ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
+         z->ioff += c.length;
+         break;
+      }
 
-         case STBI__PNG_TYPE('t','R','N','S'): {
-            if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-            if (z->idata) return stbi__err("tRNS after IDAT","Corrupt PNG");
-            if (pal_img_n) {
-               if (scan == STBI__SCAN_header) { s->img_n = 4; return 1; }
-               if (pal_len == 0) return stbi__err("tRNS before PLTE","Corrupt PNG");
-               if (c.length > pal_len) return stbi__err("bad tRNS len","Corrupt PNG");
-               pal_img_n = 4;
-               for (i=0; i < c.length; ++i)
-                  palette[i*4+3] = stbi__get8(s);
+      case STBI__PNG_TYPE('I','E','N','D'): {
+         stbi__uint32 raw_len, bpl;
+         if (z->first) return stbi__err("first not IHDR", "Corrupt PNG");
+         if (scan != STBI__SCAN_load) return 2;
+         if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
+         // initial guess for decoded data size to avoid unnecessary reallocs
+         bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
+         raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+         z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, z->ioff, raw_len, (int *) &raw_len, !z->is_iphone);
+         if (z->expanded == NULL) return 0; // zlib should set error
+         stbi__free(z->idata); z->idata = NULL;
+         if ((req_comp == s->img_n+1 && req_comp != 3 && !z->pal_img_n) || z->has_trans)
+            s->img_out_n = s->img_n+1;
+         else
+            s->img_out_n = s->img_n;
+         if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, z->color, z->interlace)) return 0;
+         if (z->has_trans) {
+            if (z->depth == 16) {
+               if (!stbi__compute_transparency16((stbi__uint16 *) z->out, s->img_x * s->img_y, z->tc16, s->img_out_n)) return 0;
             } else {
-               if (!(s->img_n & 1)) return stbi__err("tRNS with alpha","Corrupt PNG");
-               if (c.length != (stbi__uint32) s->img_n*2) return stbi__err("bad tRNS len","Corrupt PNG");
-               has_trans = 1;
-               // non-paletted with tRNS = constant alpha. if header-scanning, we can stop now.
-               if (scan == STBI__SCAN_header) { ++s->img_n; return 1; }
-               if (z->depth == 16) {
-                  for (k = 0; k < s->img_n; ++k) tc16[k] = (stbi__uint16)stbi__get16be(s); // copy the values as-is
-               } else {
-                  for (k = 0; k < s->img_n; ++k) tc[k] = (stbi_uc)(stbi__get16be(s) & 255) * stbi__depth_scale_table[z->depth]; // non 8-bit images will be larger
-               }
+               if (!stbi__compute_transparency(z->out, s->img_x * s->img_y, z->tc, s->img_out_n)) return 0;
             }
-            break;
          }
-
-         case STBI__PNG_TYPE('I','D','A','T'): {
-            if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-            if (pal_img_n && !pal_len) return stbi__err("no PLTE","Corrupt PNG");
-            if (scan == STBI__SCAN_header) {
-               // header scan definitely stops at first IDAT
-               if (pal_img_n)
-                  s->img_n = pal_img_n;
-               return 1;
-            }
-            if (c.length > (1u << 30)) return stbi__err("IDAT size limit", "IDAT section larger than 2^30 bytes");
-            if ((int)(ioff + c.length) < (int)ioff) return 0;
-            if (ioff + c.length > idata_limit) {
-               stbi__uint32 idata_limit_old = idata_limit;
-               stbi_uc *p;
-               if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
-               while (ioff + c.length > idata_limit)
-                  idata_limit *= 2;
-               STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
-               z->idata = p;
-            }
-            if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
-            ioff += c.length;
-            break;
+         if (z->is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
+            stbi__de_iphone(z);
+         if (z->pal_img_n) {
+            // pal_img_n == 3 or 4
+            s->img_n = z->pal_img_n; // record the actual colors we had
+            s->img_out_n = z->pal_img_n;
+            if (req_comp >= 3) s->img_out_n = req_comp;
+            if (!stbi__expand_png_palette(z, z->palette, z->pal_len, s->img_out_n))
+               return 0;
+         } else if (z->has_trans) {
+            // non-paletted image with tRNS -> source image has (constant) alpha
+            ++s->img_n;
          }
+         stbi__free(z->expanded); z->expanded = NULL;
+         // end of PNG chunk, read and skip CRC
+         stbi__get32be(s);
+         return 2;
+      }
 
-         case STBI__PNG_TYPE('I','E','N','D'): {
-            stbi__uint32 raw_len, bpl;
-            if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-            if (scan != STBI__SCAN_load) return 1;
-            if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
-            // initial guess for decoded data size to avoid unnecessary reallocs
-            bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-            raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
-            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
-               s->img_out_n = s->img_n+1;
-            else
-               s->img_out_n = s->img_n;
-            if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
-            if (has_trans) {
-               if (z->depth == 16) {
-                  if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
-               } else {
-                  if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
-               }
-            }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
-               stbi__de_iphone(z);
-            if (pal_img_n) {
-               // pal_img_n == 3 or 4
-               s->img_n = pal_img_n; // record the actual colors we had
-               s->img_out_n = pal_img_n;
-               if (req_comp >= 3) s->img_out_n = req_comp;
-               if (!stbi__expand_png_palette(z, palette, pal_len, s->img_out_n))
-                  return 0;
-            } else if (has_trans) {
-               // non-paletted image with tRNS -> source image has (constant) alpha
-               ++s->img_n;
-            }
-            STBI_FREE(z->expanded); z->expanded = NULL;
-            // end of PNG chunk, read and skip CRC
-            stbi__get32be(s);
-            return 1;
+      default:
+         // if critical, fail
+         if (z->first) return stbi__err("first not IHDR", "Corrupt PNG");
+         if ((c.type & (1 << 29)) == 0) {
+            #ifndef STBI_NO_FAILURE_STRINGS
+            // not threadsafe
+            static char invalid_chunk[] = "XXXX PNG chunk not known";
+            invalid_chunk[0] = STBI__BYTECAST(c.type >> 24);
+            invalid_chunk[1] = STBI__BYTECAST(c.type >> 16);
+            invalid_chunk[2] = STBI__BYTECAST(c.type >>  8);
+            invalid_chunk[3] = STBI__BYTECAST(c.type >>  0);
+            #endif
+            return stbi__err(invalid_chunk, "PNG not supported: unknown PNG chunk type");
          }
+         stbi__skip(s, c.length);
+         break;
+}
+   // end of PNG chunk, read and skip CRC
+   stbi__get32be(s);
+   return 1;
+}
 
-         default:
-            // if critical, fail
-            if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-            if ((c.type & (1 << 29)) == 0) {
-               #ifndef STBI_NO_FAILURE_STRINGS
-               // not threadsafe
-               static char invalid_chunk[] = "XXXX PNG chunk not known";
-               invalid_chunk[0] = STBI__BYTECAST(c.type >> 24);
-               invalid_chunk[1] = STBI__BYTECAST(c.type >> 16);
-               invalid_chunk[2] = STBI__BYTECAST(c.type >>  8);
-               invalid_chunk[3] = STBI__BYTECAST(c.type >>  0);
-               #endif
-               return stbi__err(invalid_chunk, "PNG not supported: unknown PNG chunk type");
-            }
-            stbi__skip(s, c.length);
-            break;
-      }
-      // end of PNG chunk, read and skip CRC
-      stbi__get32be(s);
-   }
+static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
+{
+   int r;
+   stbi__png_begin(z);
+   if (!stbi__check_png_header(z->s)) return 0;
+   if (scan == STBI__SCAN_type) return 1;
+   do {
+      r = stbi__png_parse_chunk(z, stbi__get_chunk_header(z->s), scan, req_comp);
+   } while (r == 1);
+   return r != 0;
 }
 
 static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, stbi__result_info *ri)
 {
    void *result=NULL;
    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   p->flip = stbi__vertically_flip_on_load;
    if (stbi__parse_png_file(p, STBI__SCAN_load, req_comp)) {
+      ri->vertically_flipped = p->flip;
+      // iPhone PNGs store premultiplied colour, unless de_iphone divided it out
+      ri->premultiplied = p->is_iphone && !(stbi__de_iphone_flag && stbi__unpremultiply_on_load && !stbi__premultiply_on_load);
       if (p->depth <= 8)
          ri->bits_per_channel = 8;
       else if (p->depth == 16)
@@ -5274,19 +7459,20 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       p->out = NULL;
       if (req_comp && req_comp != p->s->img_out_n) {
          if (ri->bits_per_channel == 8)
-            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y, ri);
          else
-            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y, ri);
          p->s->img_out_n = req_comp;
          if (result == NULL) return result;
       }
       *x = p->s->img_x;
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
+      ri->num_channels = p->s->img_out_n; // can differ from img_n, e.g. tRNS adds alpha
    }
-   STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__free(p->out);      p->out      = NULL;
+   stbi__free(p->expanded); p->expanded = NULL;
+   stbi__free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -5325,6 +7511,44 @@ static int stbi__png_info(stbi__context *s, int *x, int *y, int *comp)
    return stbi__png_info_raw(&p, x, y, comp);
 }
 
+// the blocks stbi__do_png allocates: IDAT (which doubles as it grows), the
+// inflated scanlines, the unfiltered image and the conversions after it.
+// file_len is 0 if unknown
+static int stbi__png_scratch(stbi__context *s, int req_comp, size_t file_len, size_t *bytes)
+{
+   stbi__png p;
+   size_t px, raw, idata, total;
+   int raw_n, out_n, final_n, bpc;
+   p.s = s;
+   if (!stbi__png_info_raw(&p, NULL, NULL, NULL)) return 0;
+   if (!stbi__mad3sizes_valid(s->img_x, s->img_y, 4, 0)) return stbi__err("too large", "Image too large to decode");
+   px = (size_t) s->img_x * s->img_y;
+   bpc = p.depth == 16 ? 2 : 1;
+   // the header scan has counted the alpha a tRNS chunk adds into img_n
+   if (p.pal_img_n) {
+      raw_n = out_n = 1;
+      final_n = req_comp >= 3 ? req_comp : s->img_n;
+   } else {
+      raw_n = s->img_n - p.has_trans;
+      out_n = p.has_trans || (req_comp == raw_n+1 && req_comp != 3) ? raw_n+1 : raw_n;
+      final_n = out_n;
+   }
+   raw = (((size_t) s->img_x * raw_n * p.depth + 7) / 8 + 1) * s->img_y;
+   idata = 2 * (file_len ? file_len : raw + raw / 256) + 4096;
+   total = idata + raw + px * out_n * bpc + 64;
+   if (p.interlace) // zlib's guess is short by the extra pass rows, and each pass has its own buffer
+      total += raw + px * out_n * bpc;
+   if (p.pal_img_n)
+      total += px * final_n + 16;
+   // channels are converted at full depth, then stbi_load drops to 8 bits
+   if (req_comp && req_comp != final_n)
+      total += px * req_comp * bpc + 16;
+   if (bpc == 2)
+      total += px * (req_comp ? req_comp : final_n) + 16;
+   *bytes = total;
+   return 1;
+}
+
 static int stbi__png_is16(stbi__context *s)
 {
    stbi__png p;
@@ -5597,7 +7821,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (info.bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = stbi__get8(s);
          pal[i][1] = stbi__get8(s);
@@ -5609,7 +7833,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) width = (s->img_x + 7) >> 3;
       else if (info.bpp == 4) width = (s->img_x + 1) >> 1;
       else if (info.bpp == 8) width = s->img_x;
-      else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
@@ -5654,6 +7878,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       int rshift=0,gshift=0,bshift=0,ashift=0,rcount=0,gcount=0,bcount=0,acount=0;
       int z = 0;
       int easy=0;
+      stbi_uc *row = NULL;
       stbi__skip(s, info.offset - info.extra_read - info.hsz);
       if (info.bpp == 24) width = 3 * s->img_x;
       else if (info.bpp == 16) width = 2*s->img_x;
@@ -5666,28 +7891,37 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
          gshift = stbi__high_bit(mg)-7; gcount = stbi__bitcount(mg);
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
-         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
       }
-      for (j=0; j < (int) s->img_y; ++j) {
-         if (easy) {
-            for (i=0; i < (int) s->img_x; ++i) {
-               unsigned char a;
-               out[z+2] = stbi__get8(s);
-               out[z+1] = stbi__get8(s);
-               out[z+0] = stbi__get8(s);
-               z += 3;
-               a = (easy == 2 ? stbi__get8(s) : 255);
-               all_a |= a;
-               if (target == 4) out[z++] = a;
-            }
-         } else {
-            int bpp = info.bpp;
+      if (easy) {
+         // read whole rows and swap them to RGB(A); only a 3 <-> 4 channel
+         // change needs somewhere else to read into
+         int src_n = easy == 2 ? 4 : 3;
+         if (src_n != target) {
+            row = (stbi_uc *) stbi__malloc_mad3(s->img_x, src_n, 1, 0);
+            if (!row) { stbi__free(out); return stbi__errpuc("outofmem", "Out of memory"); }
+         }
+         if (easy == 1) all_a = 255;
+         for (j=0; j < (int) s->img_y; ++j, z += s->img_x * target) {
+            stbi_uc *src = row ? row : out + z;
+            stbi__getn_zerofill(s, src, s->img_x * src_n);
+            // an alpha channel that is all 0 is ignored, so only look until one isn't
+            if (easy == 2)
+               for (i=0; !all_a && i < (int) s->img_x; ++i)
+                  all_a |= src[i*4 + 3];
+            stbi__swap_rb_row(out + z, src, src_n, target, s->img_x);
+            stbi__skip(s, pad);
+         }
+         stbi__free(row);
+      } else {
+         int bpp = info.bpp;
+         for (j=0; j < (int) s->img_y; ++j) {
             for (i=0; i < (int) s->img_x; ++i) {
                stbi__uint32 v = (bpp == 16 ? (stbi__uint32) stbi__get16le(s) : stbi__get32le(s));
                unsigned int a;
@@ -5698,8 +7932,8 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
                all_a |= a;
                if (target == 4) out[z++] = STBI__BYTECAST(a);
             }
+            stbi__skip(s, pad);
          }
-         stbi__skip(s, pad);
       }
    }
 
@@ -5708,6 +7942,12 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       for (i=4*s->img_x*s->img_y-1; i >= 0; i -= 4)
          out[i] = 255;
 
+   // bmp is usually stored bottom-up, so a requested flip often cancels out
+   if (stbi__vertically_flip_on_load) {
+      flip_vertically = !flip_vertically;
+      ri->vertically_flipped = 1;
+   }
+
    if (flip_vertically) {
       stbi_uc t;
       for (j=0; j < (int) s->img_y>>1; ++j) {
@@ -5720,7 +7960,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    }
 
    if (req_comp && req_comp != target) {
-      out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y);
+      out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y, ri);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
    }
 
@@ -5907,6 +8147,11 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       tga_is_RLE = 1;
    }
    tga_inverted = 1 - ((tga_inverted >> 5) & 1);
+   // fold a requested flip into the origin handling below
+   if (stbi__vertically_flip_on_load) {
+      tga_inverted = !tga_inverted;
+      ri->vertically_flipped = 1;
+   }
 
    //   If I'm paletted, then I'll use the number of bits from the palette
    if ( tga_indexed ) tga_comp = stbi__tga_get_comp(tga_palette_bits, 0, &tga_rgb16);
@@ -5940,7 +8185,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       if ( tga_indexed)
       {
          if (tga_palette_len == 0) {  /* you have to have at least one entry! */
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("bad palette", "Corrupt TGA");
          }
 
@@ -5949,7 +8194,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
          //   load the palette
          tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
          if (!tga_palette) {
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("outofmem", "Out of memory");
          }
          if (tga_rgb16) {
@@ -5960,8 +8205,8 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                pal_entry += tga_comp;
             }
          } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-               STBI_FREE(tga_data);
-               STBI_FREE(tga_palette);
+               stbi__free(tga_data);
+               stbi__free(tga_palette);
                return stbi__errpuc("bad palette", "Corrupt TGA");
          }
       }
@@ -6042,26 +8287,17 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       //   clear my palette, if I had one
       if ( tga_palette != NULL )
       {
-         STBI_FREE( tga_palette );
+         stbi__free( tga_palette );
       }
    }
 
    // swap RGB - if the source data was RGB16, it already is in the right order
    if (tga_comp >= 3 && !tga_rgb16)
-   {
-      unsigned char* tga_pixel = tga_data;
-      for (i=0; i < tga_width * tga_height; ++i)
-      {
-         unsigned char temp = tga_pixel[0];
-         tga_pixel[0] = tga_pixel[2];
-         tga_pixel[2] = temp;
-         tga_pixel += tga_comp;
-      }
-   }
+      stbi__swap_rb_row(tga_data, tga_data, tga_comp, tga_comp, (unsigned int) tga_width * tga_height);
 
    // convert to target component count
    if (req_comp && req_comp != tga_comp)
-      tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height);
+      tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height, ri);
 
    //   the things I do to get rid of an error message, and yet keep
    //   Microsoft's C compilers happy... [8^(
@@ -6234,7 +8470,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
          } else {
             // Read the RLE data.
             if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-               STBI_FREE(out);
+               stbi__free(out);
                return stbi__errpuc("corrupt", "bad RLE data");
             }
          }
@@ -6310,9 +8546,9 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
    // convert to desired output format
    if (req_comp && req_comp != 4) {
       if (ri->bits_per_channel == 16)
-         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, 4, req_comp, w, h);
+         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, 4, req_comp, w, h, ri);
       else
-         out = stbi__convert_format(out, 4, req_comp, w, h);
+         out = stbi__convert_format(out, 4, req_comp, w, h, ri);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
    }
 
@@ -6526,13 +8762,13 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
    memset(result, 0xff, x*y*4);
 
    if (!stbi__pic_load_core(s,x,y,comp, result)) {
-      STBI_FREE(result);
+      stbi__free(result);
       result=0;
    }
    *px = x;
    *py = y;
    if (req_comp == 0) req_comp = *comp;
-   result=stbi__convert_format(result,4,req_comp,x,y);
+   result=stbi__convert_format(result,4,req_comp,x,y,ri);
 
    return result;
 }
@@ -6549,12 +8785,9 @@ static int stbi__pic_test(stbi__context *s)
 // GIF loader -- public domain by Jean-Marc Lienher -- simplified/shrunk by stb
 
 #ifndef STBI_NO_GIF
-typedef struct
-{
-   stbi__int16 prefix;
-   stbi_uc first;
-   stbi_uc suffix;
-} stbi__gif_lzw;
+// codes are at most 12 bits, so only the first 4096 table entries can ever
+// be referenced, and no string is longer than that
+#define STBI__GIF_CODES  4096
 
 typedef struct
 {
@@ -6563,9 +8796,16 @@ typedef struct
    stbi_uc *background;          // The current "background" as far as a gif is concerned
    stbi_uc *history;
    int flags, bgindex, ratio, transparent, eflags;
+   int frames;                   // frames returned so far
    stbi_uc  pal[256][4];
    stbi_uc lpal[256][4];
-   stbi__gif_lzw codes[8192];
+   // LZW string table, one array per field: each code is its prefix code
+   // plus one suffix byte; length is the length of the whole string
+   stbi__int16 prefix[STBI__GIF_CODES];
+   stbi__uint16 length[STBI__GIF_CODES];
+   stbi_uc first[STBI__GIF_CODES];
+   stbi_uc suffix[STBI__GIF_CODES];
+   stbi_uc string[STBI__GIF_CODES]; // the current code's string, in order
    stbi_uc *color_table;
    int parse, step;
    int lflags;
@@ -6640,49 +8880,55 @@ static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
    stbi__gif* g = (stbi__gif*) stbi__malloc(sizeof(stbi__gif));
    if (!g) return stbi__err("outofmem", "Out of memory");
    if (!stbi__gif_header(s, g, comp, 1)) {
-      STBI_FREE(g);
+      stbi__free(g);
       stbi__rewind( s );
       return 0;
    }
    if (x) *x = g->w;
    if (y) *y = g->h;
-   STBI_FREE(g);
+   stbi__free(g);
    return 1;
 }
 
-static void stbi__out_gif_code(stbi__gif *g, stbi__uint16 code)
+static void stbi__out_gif_code(stbi__gif *g, int code)
 {
-   stbi_uc *p, *c;
-   int idx;
+   int i, n = g->length[code];
 
-   // recurse to decode the prefixes, since the linked-list is backwards,
-   // and working backwards through an interleaved image would be nasty
-   if (g->codes[code].prefix >= 0)
-      stbi__out_gif_code(g, g->codes[code].prefix);
+   // the prefix chain runs from the last byte back to the first, so unwind
+   // it into the string buffer back to front (this used to recurse instead)
+   for (i = n-1; i >= 0; --i) {
+      g->string[i] = g->suffix[code];
+      code = g->prefix[code];
+   }
 
-   if (g->cur_y >= g->max_y) return;
+   for (i = 0; i < n; ++i) {
+      stbi_uc *p, *c;
+      int idx;
 
-   idx = g->cur_x + g->cur_y;
-   p = &g->out[idx];
-   g->history[idx / 4] = 1;
+      if (g->cur_y >= g->max_y) return;
 
-   c = &g->color_table[g->codes[code].suffix * 4];
-   if (c[3] > 128) { // don't render transparent pixels;
-      p[0] = c[2];
-      p[1] = c[1];
-      p[2] = c[0];
-      p[3] = c[3];
-   }
-   g->cur_x += 4;
+      idx = g->cur_x + g->cur_y;
+      p = &g->out[idx];
+      g->history[idx / 4] = 1;
+
+      c = &g->color_table[g->string[i] * 4];
+      if (c[3] > 128) { // don't render transparent pixels;
+         p[0] = c[2];
+         p[1] = c[1];
+         p[2] = c[0];
+         p[3] = c[3];
+      }
+      g->cur_x += 4;
 
-   if (g->cur_x >= g->max_x) {
-      g->cur_x = g->start_x;
-      g->cur_y += g->step;
+      if (g->cur_x >= g->max_x) {
+         g->cur_x = g->start_x;
+         g->cur_y += g->step;
 
-      while (g->cur_y >= g->max_y && g->parse > 0) {
-         g->step = (1 << g->parse) * g->line_size;
-         g->cur_y = g->start_y + (g->step >> 1);
-         --g->parse;
+         while (g->cur_y >= g->max_y && g->parse > 0) {
+            g->step = (1 << g->parse) * g->line_size;
+            g->cur_y = g->start_y + (g->step >> 1);
+            --g->parse;
+         }
       }
    }
 }
@@ -6693,7 +8939,6 @@ static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
    stbi__int32 len, init_code;
    stbi__uint32 first;
    stbi__int32 codesize, codemask, avail, oldcode, bits, valid_bits, clear;
-   stbi__gif_lzw *p;
 
    lzw_cs = stbi__get8(s);
    if (lzw_cs > 12) return NULL;
@@ -6704,9 +8949,10 @@ static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
    bits = 0;
    valid_bits = 0;
    for (init_code = 0; init_code < clear; init_code++) {
-      g->codes[init_code].prefix = -1;
-      g->codes[init_code].first = (stbi_uc) init_code;
-      g->codes[init_code].suffix = (stbi_uc) init_code;
+      g->prefix[init_code] = -1;
+      g->length[init_code] = 1;
+      g->first[init_code] = (stbi_uc) init_code;
+      g->suffix[init_code] = (stbi_uc) init_code;
    }
 
    // support no starting clear code
@@ -6746,18 +8992,21 @@ static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
             }
 
             if (oldcode >= 0) {
-               p = &g->codes[avail++];
-               if (avail > 8192) {
+               // entries past the 12-bit range are never referenced, but
+               // still count towards the limit
+               if (avail < STBI__GIF_CODES) {
+                  g->prefix[avail] = (stbi__int16) oldcode;
+                  g->length[avail] = (stbi__uint16) (g->length[oldcode] + 1);
+                  g->first[avail] = g->first[oldcode];
+                  g->suffix[avail] = (code == avail) ? g->first[oldcode] : g->first[code];
+               }
+               if (++avail > 8192) {
                   return stbi__errpuc("too many codes", "Corrupt GIF");
                }
-
-               p->prefix = (stbi__int16) oldcode;
-               p->first = g->codes[oldcode].first;
-               p->suffix = (code == avail) ? p->first : g->codes[code].first;
             } else if (code == avail)
                return stbi__errpuc("illegal code in raster", "Corrupt GIF");
 
-            stbi__out_gif_code(g, (stbi__uint16) code);
+            stbi__out_gif_code(g, code);
 
             if ((avail & codemask) == 0 && avail <= 0x0FFF) {
                codesize++;
@@ -6772,6 +9021,30 @@ static stbi_uc *stbi__process_gif_raster(stbi__context *s, stbi__gif *g)
    }
 }
 
+// reads the header and sets up the frame buffers
+static int stbi__gif_begin(stbi__context *s, stbi__gif *g, int *comp)
+{
+   int pcount;
+   if (!stbi__gif_header(s, g, comp,0)) return 0; // stbi__g_failure_reason set by stbi__gif_header
+   if (!stbi__mad3sizes_valid(4, g->w, g->h, 0))
+      return stbi__err("too large", "GIF image is too large");
+   pcount = g->w * g->h;
+   g->out = (stbi_uc *) stbi__malloc(4 * pcount);
+   g->background = (stbi_uc *) stbi__malloc(4 * pcount);
+   g->history = (stbi_uc *) stbi__malloc(pcount);
+   if (!g->out || !g->background || !g->history)
+      return stbi__err("outofmem", "Out of memory");
+
+   // image is treated as "transparent" at the start - ie, nothing overwrites the current background;
+   // background colour is only used for pixels that are not rendered first frame, after that "background"
+   // color refers to the color that was there the previous frame.
+   memset(g->out, 0x00, 4 * pcount);
+   memset(g->background, 0x00, 4 * pcount); // state of the background (starts transparent)
+   memset(g->history, 0x00, pcount);        // pixels that were affected previous frame
+   g->frames = 0;
+   return 1;
+}
+
 // this function is designed to support animated gifs, although stb_image doesn't support it
 // two back is the image from two frames ago, used for a very specific disposal format
 static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, int req_comp, stbi_uc *two_back)
@@ -6782,27 +9055,12 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
    int pcount;
    STBI_NOTUSED(req_comp);
 
+   if (g->out == 0 && !stbi__gif_begin(s, g, comp))
+      return 0;
+
    // on first frame, any non-written pixels get the background colour (non-transparent)
-   first_frame = 0;
-   if (g->out == 0) {
-      if (!stbi__gif_header(s, g, comp,0)) return 0; // stbi__g_failure_reason set by stbi__gif_header
-      if (!stbi__mad3sizes_valid(4, g->w, g->h, 0))
-         return stbi__errpuc("too large", "GIF image is too large");
-      pcount = g->w * g->h;
-      g->out = (stbi_uc *) stbi__malloc(4 * pcount);
-      g->background = (stbi_uc *) stbi__malloc(4 * pcount);
-      g->history = (stbi_uc *) stbi__malloc(pcount);
-      if (!g->out || !g->background || !g->history)
-         return stbi__errpuc("outofmem", "Out of memory");
-
-      // image is treated as "transparent" at the start - ie, nothing overwrites the current background;
-      // background colour is only used for pixels that are not rendered first frame, after that "background"
-      // color refers to the color that was there the previous frame.
-      memset(g->out, 0x00, 4 * pcount);
-      memset(g->background, 0x00, 4 * pcount); // state of the background (starts transparent)
-      memset(g->history, 0x00, pcount);        // pixels that were affected previous frame
-      first_frame = 1;
-   } else {
+   first_frame = g->frames == 0;
+   if (!first_frame) {
       // second frame - how do we dispose of the previous one?
       dispose = (g->eflags & 0x1C) >> 2;
       pcount = g->w * g->h;
@@ -6901,6 +9159,7 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
                }
             }
 
+            ++g->frames;
             return o;
          }
 
@@ -6950,12 +9209,12 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
 
 static void *stbi__load_gif_main_outofmem(stbi__gif *g, stbi_uc *out, int **delays)
 {
-   STBI_FREE(g->out);
-   STBI_FREE(g->history);
-   STBI_FREE(g->background);
+   stbi__free(g->out);
+   stbi__free(g->history);
+   stbi__free(g->background);
 
-   if (out) STBI_FREE(out);
-   if (delays && *delays) STBI_FREE(*delays);
+   if (out) stbi__free(out);
+   if (delays && *delays) stbi__free(*delays);
    return stbi__errpuc("outofmem", "Out of memory");
 }
 
@@ -6963,16 +9222,12 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
 {
    if (stbi__gif_test(s)) {
       int layers = 0;
+      int capacity = 0;
       stbi_uc *u = 0;
       stbi_uc *out = 0;
       stbi_uc *two_back = 0;
       stbi__gif g;
-      int stride;
-      int out_size = 0;
-      int delays_size = 0;
-
-      STBI_NOTUSED(out_size);
-      STBI_NOTUSED(delays_size);
+      size_t stride = 0;
 
       memset(&g, 0, sizeof(g));
       if (delays) {
@@ -6986,56 +9241,62 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
          if (u) {
             *x = g.w;
             *y = g.h;
-            ++layers;
-            stride = g.w * g.h * 4;
+            stride = (size_t) g.w * g.h * 4;
+
+            if (layers == capacity) {
+               // grow by doubling, so a long animation isn't copied once per frame
+               int new_capacity = capacity ? capacity * 2 : 4;
+               void *tmp;
+               if (!stbi__mad3sizes_valid(new_capacity, g.w * g.h, 4, 0))
+                  new_capacity = capacity + 1;
+               if (!stbi__mad3sizes_valid(new_capacity, g.w * g.h, 4, 0))
+                  return stbi__load_gif_main_outofmem(&g, out, delays);
 
-            if (out) {
-               void *tmp = (stbi_uc*) STBI_REALLOC_SIZED( out, out_size, layers * stride );
+               tmp = stbi__realloc_sized( out, capacity * stride, new_capacity * stride );
                if (!tmp)
                   return stbi__load_gif_main_outofmem(&g, out, delays);
-               else {
-                   out = (stbi_uc*) tmp;
-                   out_size = layers * stride;
-               }
+               out = (stbi_uc*) tmp;
 
                if (delays) {
-                  int *new_delays = (int*) STBI_REALLOC_SIZED( *delays, delays_size, sizeof(int) * layers );
+                  int *new_delays = (int*) stbi__realloc_sized( *delays, sizeof(int) * capacity, sizeof(int) * new_capacity );
                   if (!new_delays)
                      return stbi__load_gif_main_outofmem(&g, out, delays);
                   *delays = new_delays;
-                  delays_size = layers * sizeof(int);
-               }
-            } else {
-               out = (stbi_uc*)stbi__malloc( layers * stride );
-               if (!out)
-                  return stbi__load_gif_main_outofmem(&g, out, delays);
-               out_size = layers * stride;
-               if (delays) {
-                  *delays = (int*) stbi__malloc( layers * sizeof(int) );
-                  if (!*delays)
-                     return stbi__load_gif_main_outofmem(&g, out, delays);
-                  delays_size = layers * sizeof(int);
                }
+               capacity = new_capacity;
             }
-            memcpy( out + ((layers - 1) * stride), u, stride );
-            if (layers >= 2) {
-               two_back = out - 2 * stride;
+            memcpy( out + layers * stride, u, stride );
+            if (delays) {
+               (*delays)[layers] = g.delay;
             }
+            ++layers;
 
-            if (delays) {
-               (*delays)[layers - 1U] = g.delay;
+            // the frame before the one just stored, for the next frame's
+            // dispose-to-previous (it used to point in front of the buffer)
+            if (layers >= 2) {
+               two_back = out + (layers - 2) * stride;
             }
          }
       } while (u != 0);
 
       // free temp buffer;
-      STBI_FREE(g.out);
-      STBI_FREE(g.history);
-      STBI_FREE(g.background);
+      stbi__free(g.out);
+      stbi__free(g.history);
+      stbi__free(g.background);
+
+      // give back the unused tail of the last doubling
+      if (layers < capacity) {
+         void *tmp = stbi__realloc_sized( out, capacity * stride, layers * stride );
+         if (tmp) out = (stbi_uc*) tmp;
+         if (delays) {
+            tmp = stbi__realloc_sized( *delays, sizeof(int) * capacity, sizeof(int) * layers );
+            if (tmp) *delays = (int*) tmp;
+         }
+      }
 
       // do the final conversion after loading everything;
-      if (req_comp && req_comp != 4)
-         out = stbi__convert_format(out, 4, req_comp, layers * g.w, g.h);
+      if (out && req_comp && req_comp != 4)
+         out = stbi__convert_format(out, 4, req_comp, layers * g.w, g.h, NULL);
 
       *z = layers;
       return out;
@@ -7060,15 +9321,15 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
       // moved conversion to after successful load so that the same
       // can be done for multiple frames.
       if (req_comp && req_comp != 4)
-         u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
+         u = stbi__convert_format(u, 4, req_comp, g.w, g.h, ri);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
-      STBI_FREE(g.out);
+      stbi__free(g.out);
    }
 
    // free buffers needed for multiple frame loading;
-   STBI_FREE(g.history);
-   STBI_FREE(g.background);
+   stbi__free(g.history);
+   stbi__free(g.background);
 
    return u;
 }
@@ -7077,6 +9338,166 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
 }
+
+struct stbi_gif_frames
+{
+   stbi__context s;
+   stbi__gif g;
+   stbi_uc *keep[2];    // the previous two frames as composited, for dispose-to-previous
+   stbi_uc *frame;      // the returned frame, when it needs converting or flipping
+   int count;           // frames returned so far
+   int req_comp;
+   int flip;
+   int state;           // 0 while decoding, 1 after the last frame, -1 after a failure
+   #ifndef STBI_NO_STDIO
+   FILE *f;
+   int close_file;
+   #endif
+};
+
+static stbi_gif_frames *stbi__gif_frames_alloc(void)
+{
+   stbi_gif_frames *it = (stbi_gif_frames *) stbi__malloc(sizeof(*it));
+   if (!it) return (stbi_gif_frames *) stbi__errpuc("outofmem", "Out of memory");
+   memset(it, 0, sizeof(*it));
+   return it;
+}
+
+// it->s has been started; reads the header and sets up the buffers
+static stbi_gif_frames *stbi__gif_frames_start(stbi_gif_frames *it, int *x, int *y, int req_comp)
+{
+   int out_n = req_comp ? req_comp : 4;
+   if (req_comp < 0 || req_comp > 4) {
+      stbi_gif_end(it);
+      return (stbi_gif_frames *) stbi__errpuc("bad req_comp", "Internal error");
+   }
+   if (!stbi__gif_begin(&it->s, &it->g, NULL)) {
+      stbi_gif_end(it);
+      return NULL;
+   }
+   it->req_comp = req_comp;
+   it->flip = stbi__vertically_flip_on_load;
+   it->keep[0] = (stbi_uc *) stbi__malloc_mad3(4, it->g.w, it->g.h, 0);
+   it->keep[1] = (stbi_uc *) stbi__malloc_mad3(4, it->g.w, it->g.h, 0);
+   if (out_n != 4 || it->flip)
+      it->frame = (stbi_uc *) stbi__malloc_mad3(out_n, it->g.w, it->g.h, 0);
+   if (!it->keep[0] || !it->keep[1] || ((out_n != 4 || it->flip) && !it->frame)) {
+      stbi_gif_end(it);
+      return (stbi_gif_frames *) stbi__errpuc("outofmem", "Out of memory");
+   }
+   if (x) *x = it->g.w;
+   if (y) *y = it->g.h;
+   return it;
+}
+
+STBIDEF stbi_gif_frames *stbi_gif_begin_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int desired_channels)
+{
+   stbi_gif_frames *it = stbi__gif_frames_alloc();
+   if (!it) return NULL;
+   stbi__start_mem(&it->s, buffer, len);
+   return stbi__gif_frames_start(it, x, y, desired_channels);
+}
+
+STBIDEF stbi_gif_frames *stbi_gif_begin_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int desired_channels)
+{
+   stbi_gif_frames *it = stbi__gif_frames_alloc();
+   if (!it) return NULL;
+   stbi__start_callbacks(&it->s, (stbi_io_callbacks *) clbk, user);
+   return stbi__gif_frames_start(it, x, y, desired_channels);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_frames *stbi_gif_begin_from_file(FILE *f, int *x, int *y, int desired_channels)
+{
+   stbi_gif_frames *it = stbi__gif_frames_alloc();
+   if (!it) return NULL;
+   it->f = f;
+   stbi__start_file(&it->s, f);
+   return stbi__gif_frames_start(it, x, y, desired_channels);
+}
+
+STBIDEF stbi_gif_frames *stbi_gif_begin(char const *filename, int *x, int *y, int desired_channels)
+{
+   stbi_gif_frames *it;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return (stbi_gif_frames *) stbi__errpuc("can't fopen", "Unable to open file");
+   it = stbi__gif_frames_alloc();
+   if (!it) {
+      fclose(f);
+      return NULL;
+   }
+   it->f = f;
+   it->close_file = 1;
+   stbi__start_file(&it->s, f);
+   return stbi__gif_frames_start(it, x, y, desired_channels);
+}
+#endif
+
+STBIDEF int stbi_gif_next(stbi_gif_frames *it, stbi_uc **frame, int *delay_ms)
+{
+   stbi__gif *g = &it->g;
+   stbi_uc *u, *two_back = 0;
+   size_t stride = (size_t) g->w * g->h * 4;
+   int out_n = it->req_comp ? it->req_comp : 4;
+   int j;
+
+   if (frame) *frame = NULL;
+   if (it->state != 0) return it->state > 0 ? 0 : -1;
+
+   // g->out still holds the previous frame, which the one after this may
+   // need to go back to
+   if (it->count > 0) {
+      memcpy(it->keep[(it->count - 1) & 1], g->out, stride);
+      if (it->count > 1)
+         two_back = it->keep[(it->count - 2) & 1];
+   }
+
+   u = stbi__gif_load_next(&it->s, g, NULL, it->req_comp, two_back);
+   if (u == (stbi_uc *) &it->s) {
+      it->state = 1;
+      return 0;
+   }
+   if (!u) {
+      it->state = -1;
+      return -1;
+   }
+   ++it->count;
+
+   if (it->frame) {
+      size_t row_bytes = (size_t) g->w * out_n;
+      for (j = 0; j < g->h; ++j) {
+         stbi_uc *dest = it->frame + (size_t) (it->flip ? g->h - 1 - j : j) * row_bytes;
+         stbi_uc const *src = g->out + (size_t) j * g->w * 4;
+         if (out_n == 4)
+            memcpy(dest, src, row_bytes);
+         else
+            stbi__convert_row(dest, src, 4, out_n, g->w);
+      }
+      u = it->frame;
+   }
+   if (frame) *frame = u;
+   if (delay_ms) *delay_ms = g->delay;
+   return 1;
+}
+
+STBIDEF void stbi_gif_end(stbi_gif_frames *it)
+{
+   if (!it) return;
+   stbi__free(it->g.out);
+   stbi__free(it->g.history);
+   stbi__free(it->g.background);
+   stbi__free(it->keep[0]);
+   stbi__free(it->keep[1]);
+   stbi__free(it->frame);
+   #ifndef STBI_NO_STDIO
+   if (it->close_file)
+      fclose(it->f);
+   else if (it->f)
+      // 'unget' what is still in the IO buffer, as stbi_load_from_file does
+      fseek(it->f, - (int) (it->s.img_buffer_end - it->s.img_buffer), SEEK_CUR);
+   #endif
+   stbi__free(it);
+}
 #endif
 
 // *************************************************************************************************
@@ -7127,12 +9548,22 @@ static char *stbi__hdr_gettoken(stbi__context *z, char *buffer)
    return buffer;
 }
 
-static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
+// 2^(e-136), the weight of an 8-bit mantissa with exponent byte e (1..255),
+// built straight from the float bits; exact for every e, the smallest ones
+// being denormals, so it matches the ldexp this used to call per pixel
+static float stbi__hdr_scale(int e)
+{
+   union { stbi__uint32 u; float f; } v;
+   v.u = e >= 10 ? (stbi__uint32) (e - 9) << 23 : (stbi__uint32) 1 << (e + 13);
+   return v.f;
+}
+
+static void stbi__hdr_convert(float *output, stbi_uc const *input, int req_comp)
 {
    if ( input[3] != 0 ) {
       float f1;
       // Exponent
-      f1 = (float) ldexp(1.0f, input[3] - (int)(128 + 8));
+      f1 = stbi__hdr_scale(input[3]);
       if (req_comp <= 2)
          output[0] = (input[0] + input[1] + input[2]) * f1 / 3;
       else {
@@ -7154,24 +9585,102 @@ static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
    }
 }
 
-static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+// 4 pixels at a time for 3 and 4 components; the scale comes from shifting
+// the exponents into place. groups holding a denormal scale (exponent 1..9)
+// are left to the scalar code, so results are bit-identical. with 3
+// components each pixel is stored as 4 floats, the last overwritten by the
+// next pixel, so the final pixel of the row is always left to the scalar code
+static int stbi__hdr_convert_row_simd(float *output, stbi_uc const *input, int req_comp, int count)
+{
+   int i = 0, k;
+   int end = req_comp == 4 ? count : count - 1;
+#ifdef STBI_SSE2
+   __m128i zero = _mm_setzero_si128();
+   __m128 alpha_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+   __m128 alpha = _mm_setr_ps(0, 0, 0, 1);
+   for (; i + 4 <= end; i += 4) {
+      __m128i v = _mm_loadu_si128((__m128i const *) (input + i*4));
+      __m128i e = _mm_srli_epi32(v, 24);
+      __m128i none = _mm_cmpeq_epi32(e, zero);
+      __m128i denormal = _mm_andnot_si128(none, _mm_cmplt_epi32(e, _mm_set1_epi32(10)));
+      __m128i lo, hi;
+      __m128 scale, p[4];
+      if (_mm_movemask_epi8(denormal))
+         break;
+      scale = _mm_castsi128_ps(_mm_andnot_si128(none, _mm_slli_epi32(_mm_sub_epi32(e, _mm_set1_epi32(9)), 23)));
+      lo = _mm_unpacklo_epi8(v, zero);
+      hi = _mm_unpackhi_epi8(v, zero);
+      p[0] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_shuffle_ps(scale, scale, 0x00));
+      p[1] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), _mm_shuffle_ps(scale, scale, 0x55));
+      p[2] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_shuffle_ps(scale, scale, 0xaa));
+      p[3] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), _mm_shuffle_ps(scale, scale, 0xff));
+      for (k = 0; k < 4; ++k)
+         _mm_storeu_ps(output + (i + k) * req_comp, _mm_or_ps(_mm_and_ps(p[k], alpha_mask), alpha));
+   }
+#else
+   uint32x4_t nine = vdupq_n_u32(9), ten = vdupq_n_u32(10);
+   uint32x4_t alpha_mask = vsetq_lane_u32(0, vdupq_n_u32(0xffffffffu), 3);
+   uint32x4_t alpha = vreinterpretq_u32_f32(vsetq_lane_f32(1.0f, vdupq_n_f32(0), 3));
+   for (; i + 4 <= end; i += 4) {
+      uint8x16_t v = vld1q_u8(input + i*4);
+      uint32x4_t e = vshrq_n_u32(vreinterpretq_u32_u8(v), 24);
+      uint32x4_t none = vceqq_u32(e, vdupq_n_u32(0));
+      uint32x4_t denormal = vbicq_u32(vcltq_u32(e, ten), none);
+      uint32x2_t any = vorr_u32(vget_low_u32(denormal), vget_high_u32(denormal));
+      uint16x8_t lo, hi;
+      float32x4_t scale, p[4];
+      if (vget_lane_u32(any, 0) | vget_lane_u32(any, 1))
+         break;
+      scale = vreinterpretq_f32_u32(vbicq_u32(vshlq_n_u32(vsubq_u32(e, nine), 23), none));
+      lo = vmovl_u8(vget_low_u8(v));
+      hi = vmovl_u8(vget_high_u8(v));
+      p[0] = vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), vgetq_lane_f32(scale, 0));
+      p[1] = vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), vgetq_lane_f32(scale, 1));
+      p[2] = vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), vgetq_lane_f32(scale, 2));
+      p[3] = vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), vgetq_lane_f32(scale, 3));
+      for (k = 0; k < 4; ++k)
+         vst1q_f32(output + (i + k) * req_comp, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(p[k]), alpha_mask), alpha)));
+   }
+#endif
+   return i;
+}
+#endif // STBI_SSE2 || STBI_NEON
+
+// convert count RGBE pixels to req_comp floats each
+static void stbi__hdr_convert_row(float *output, stbi_uc const *input, int req_comp, int count)
+{
+   int i = 0;
+   while (i < count) {
+      #if defined(STBI_SSE2) || defined(STBI_NEON)
+      if (req_comp >= 3) {
+         int done = stbi__hdr_convert_row_simd(output + i * req_comp, input + i * 4, req_comp, count - i);
+         i += done;
+         if (i >= count) break;
+         // the pixels that stopped the SIMD loop (or the row's tail)
+         for (done = i + 4; i < done && i < count; ++i)
+            stbi__hdr_convert(output + i * req_comp, input + i * 4, req_comp);
+         continue;
+      }
+      #endif
+      stbi__hdr_convert(output + i * req_comp, input + i * 4, req_comp);
+      ++i;
+   }
+}
+
+// header up to and including the resolution line
+static int stbi__hdr_parse_header(stbi__context *s, int *x, int *y)
 {
    char buffer[STBI__HDR_BUFLEN];
    char *token;
    int valid = 0;
    int width, height;
-   stbi_uc *scanline;
-   float *hdr_data;
-   int len;
-   unsigned char count, value;
-   int i, j, k, c1,c2, z;
    const char *headerToken;
-   STBI_NOTUSED(ri);
 
    // Check identifier
    headerToken = stbi__hdr_gettoken(s,buffer);
    if (strcmp(headerToken, "#?RADIANCE") != 0 && strcmp(headerToken, "#?RGBE") != 0)
-      return stbi__errpf("not HDR", "Corrupt HDR image");
+      return stbi__err("not HDR", "Corrupt HDR image");
 
    // Parse header
    for(;;) {
@@ -7180,21 +9689,101 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
       if (strcmp(token, "FORMAT=32-bit_rle_rgbe") == 0) valid = 1;
    }
 
-   if (!valid)    return stbi__errpf("unsupported format", "Unsupported HDR format");
+   if (!valid)    return stbi__err("unsupported format", "Unsupported HDR format");
 
    // Parse width and height
    // can't use sscanf() if we're not using stdio!
    token = stbi__hdr_gettoken(s,buffer);
-   if (strncmp(token, "-Y ", 3))  return stbi__errpf("unsupported data layout", "Unsupported HDR format");
+   if (strncmp(token, "-Y ", 3))  return stbi__err("unsupported data layout", "Unsupported HDR format");
    token += 3;
    height = (int) strtol(token, &token, 10);
    while (*token == ' ') ++token;
-   if (strncmp(token, "+X ", 3))  return stbi__errpf("unsupported data layout", "Unsupported HDR format");
+   if (strncmp(token, "+X ", 3))  return stbi__err("unsupported data layout", "Unsupported HDR format");
    token += 3;
    width = (int) strtol(token, NULL, 10);
 
-   if (height > STBI_MAX_DIMENSIONS) return stbi__errpf("too large","Very large image (corrupt?)");
-   if (width > STBI_MAX_DIMENSIONS) return stbi__errpf("too large","Very large image (corrupt?)");
+   if (height > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
+   if (width > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
+
+   *x = width;
+   *y = height;
+   return 1;
+}
+
+// reads one scanline of width RGBE pixels into out. planes is width*4 bytes
+// of scratch. *flat starts out 0 for widths that may be run-length encoded
+// and becomes 1 once a scanline turns out not to be; from then on the rest of
+// the file is plain pixels
+static int stbi__hdr_read_scanline(stbi__context *s, stbi_uc *out, stbi_uc *planes, int width, int *flat)
+{
+   int len, i, k;
+   stbi_uc count, value;
+
+   if (!*flat) {
+      int c1 = stbi__get8(s);
+      int c2 = stbi__get8(s);
+      len = stbi__get8(s);
+      if (c1 != 2 || c2 != 2 || (len & 0x80)) {
+         // not run-length encoded, so we have to actually use THIS data as a decoded
+         // pixel (note this can't be a valid pixel--one of RGB must be >= 128)
+         out[0] = (stbi_uc) c1;
+         out[1] = (stbi_uc) c2;
+         out[2] = (stbi_uc) len;
+         out[3] = (stbi_uc) stbi__get8(s);
+         *flat = 1;
+         if (!stbi__getn(s, out + 4, (width - 1) * 4))
+            memset(out + 4, 0, (size_t) (width - 1) * 4); // truncated
+         return 1;
+      }
+      len <<= 8;
+      len |= stbi__get8(s);
+      if (len != width) return stbi__err("invalid decoded scanline length", "corrupt HDR");
+
+      // each channel is coded separately, so expand them into their own
+      // planes, where runs are a memset and dumps a plain read
+      for (k = 0; k < 4; ++k) {
+         stbi_uc *plane = planes + k * width;
+         int nleft;
+         i = 0;
+         while ((nleft = width - i) > 0) {
+            count = stbi__get8(s);
+            if (count > 128) {
+               // Run
+               value = stbi__get8(s);
+               count -= 128;
+               if ((count == 0) || (count > nleft)) return stbi__err("corrupt", "bad RLE data in HDR");
+               memset(plane + i, value, count);
+            } else {
+               // Dump
+               if ((count == 0) || (count > nleft)) return stbi__err("corrupt", "bad RLE data in HDR");
+               if (!stbi__getn(s, plane + i, count))
+                  memset(plane + i, 0, count);
+            }
+            i += count;
+         }
+      }
+      for (i = 0; i < width; ++i) {
+         out[i*4+0] = planes[i];
+         out[i*4+1] = planes[i + width];
+         out[i*4+2] = planes[i + width*2];
+         out[i*4+3] = planes[i + width*3];
+      }
+      return 1;
+   }
+   if (!stbi__getn(s, out, width * 4))
+      memset(out, 0, (size_t) width * 4);
+   return 1;
+}
+
+static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+   int width, height, j, flat;
+   stbi_uc *scanline;
+   float *hdr_data;
+   STBI_NOTUSED(ri);
+
+   if (!stbi__hdr_parse_header(s, &width, &height))
+      return NULL;
 
    *x = width;
    *y = height;
@@ -7209,80 +9798,106 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
    hdr_data = (float *) stbi__malloc_mad4(width, height, req_comp, sizeof(float), 0);
    if (!hdr_data)
       return stbi__errpf("outofmem", "Out of memory");
+   // one RGBE scanline followed by the planes it's expanded from
+   scanline = (stbi_uc *) stbi__malloc_mad2(width, 8, 0);
+   if (!scanline) {
+      stbi__free(hdr_data);
+      return stbi__errpf("outofmem", "Out of memory");
+   }
 
-   // Load image data
-   // image data is stored as some number of sca
-   if ( width < 8 || width >= 32768) {
-      // Read flat data
-      for (j=0; j < height; ++j) {
-         for (i=0; i < width; ++i) {
-            stbi_uc rgbe[4];
-           main_decode_loop:
-            stbi__getn(s, rgbe, 4);
-            stbi__hdr_convert(hdr_data + j * width * req_comp + i * req_comp, rgbe, req_comp);
-         }
+   // scanlines are run-length encoded unless the width is out of range
+   // or the first bytes of a scanline say otherwise
+   flat = width < 8 || width >= 32768;
+   for (j = 0; j < height; ++j) {
+      if (!stbi__hdr_read_scanline(s, scanline, scanline + (size_t) width * 4, width, &flat)) {
+         stbi__free(scanline);
+         stbi__free(hdr_data);
+         return NULL;
       }
-   } else {
-      // Read RLE-encoded data
-      scanline = NULL;
-
-      for (j = 0; j < height; ++j) {
-         c1 = stbi__get8(s);
-         c2 = stbi__get8(s);
-         len = stbi__get8(s);
-         if (c1 != 2 || c2 != 2 || (len & 0x80)) {
-            // not run-length encoded, so we have to actually use THIS data as a decoded
-            // pixel (note this can't be a valid pixel--one of RGB must be >= 128)
-            stbi_uc rgbe[4];
-            rgbe[0] = (stbi_uc) c1;
-            rgbe[1] = (stbi_uc) c2;
-            rgbe[2] = (stbi_uc) len;
-            rgbe[3] = (stbi_uc) stbi__get8(s);
-            stbi__hdr_convert(hdr_data, rgbe, req_comp);
-            i = 1;
-            j = 0;
-            STBI_FREE(scanline);
-            goto main_decode_loop; // yes, this makes no sense
-         }
-         len <<= 8;
-         len |= stbi__get8(s);
-         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) {
-            scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
-            if (!scanline) {
-               STBI_FREE(hdr_data);
-               return stbi__errpf("outofmem", "Out of memory");
-            }
-         }
+      stbi__hdr_convert_row(hdr_data + (size_t) j * width * req_comp, scanline, req_comp, width);
+   }
+   stbi__free(scanline);
 
-         for (k = 0; k < 4; ++k) {
-            int nleft;
-            i = 0;
-            while ((nleft = width - i) > 0) {
-               count = stbi__get8(s);
-               if (count > 128) {
-                  // Run
-                  value = stbi__get8(s);
-                  count -= 128;
-                  if ((count == 0) || (count > nleft)) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                  for (z = 0; z < count; ++z)
-                     scanline[i++ * 4 + k] = value;
-               } else {
-                  // Dump
-                  if ((count == 0) || (count > nleft)) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                  for (z = 0; z < count; ++z)
-                     scanline[i++ * 4 + k] = stbi__get8(s);
-               }
-            }
-         }
-         for (i=0; i < width; ++i)
-            stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
+   return hdr_data;
+}
+
+// the file's pixels without conversion, 4 bytes each
+static stbi_uc *stbi__hdr_load_rgbe(stbi__context *s, int *x, int *y)
+{
+   int width, height, j, flat;
+   stbi_uc *planes, *out;
+
+   if (!stbi__hdr_test(s))
+      return stbi__errpuc("not HDR", "Image not of any known type, or corrupt");
+   if (!stbi__hdr_parse_header(s, &width, &height))
+      return NULL;
+   out = (stbi_uc *) stbi__malloc_mad3(width, height, 4, 0);
+   if (!out)
+      return stbi__errpuc("outofmem", "Out of memory");
+   planes = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
+   if (!planes) {
+      stbi__free(out);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
+   flat = width < 8 || width >= 32768;
+   for (j = 0; j < height; ++j) {
+      if (!stbi__hdr_read_scanline(s, out + (size_t) j * width * 4, planes, width, &flat)) {
+         stbi__free(planes);
+         stbi__free(out);
+         return NULL;
       }
-      if (scanline)
-         STBI_FREE(scanline);
    }
+   stbi__free(planes);
+   *x = width;
+   *y = height;
+   if (stbi__vertically_flip_on_load)
+      stbi__vertical_flip(out, width, height, 4);
+   return out;
+}
 
-   return hdr_data;
+STBIDEF stbi_uc *stbi_load_rgbe_from_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__hdr_load_rgbe(&s,x,y);
+}
+
+STBIDEF stbi_uc *stbi_load_rgbe_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__hdr_load_rgbe(&s,x,y);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_rgbe(char const *filename, int *x, int *y)
+{
+   stbi_uc *result;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_load_rgbe_from_file(f,x,y);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_load_rgbe_from_file(FILE *f, int *x, int *y)
+{
+   stbi_uc *result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   result = stbi__hdr_load_rgbe(&s,x,y);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+#endif
+
+STBIDEF void stbi_rgbe_to_float(float *output, stbi_uc const *rgbe, int count, int channels)
+{
+   if (channels >= 1 && channels <= 4 && count > 0)
+      stbi__hdr_convert_row(output, rgbe, channels, count);
 }
 
 static int stbi__hdr_info(stbi__context *s, int *x, int *y, int *comp)
@@ -7343,7 +9958,7 @@ static int stbi__bmp_info(stbi__context *s, int *x, int *y, int *comp)
       return 0;
    }
    if (x) *x = s->img_x;
-   if (y) *y = s->img_y;
+   if (y) *y = abs((int) s->img_y); // negative for top-down files
    if (comp) {
       if (info.bpp == 24 && info.ma == 0xff000000)
          *comp = 3;
@@ -7524,15 +10139,15 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
    out = (stbi_uc *) stbi__malloc_mad4(s->img_n, s->img_x, s->img_y, ri->bits_per_channel / 8, 0);
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (!stbi__getn(s, out, s->img_n * s->img_x * s->img_y * (ri->bits_per_channel / 8))) {
-      STBI_FREE(out);
+      stbi__free(out);
       return stbi__errpuc("bad PNM", "PNM file truncated");
    }
 
    if (req_comp && req_comp != s->img_n) {
       if (ri->bits_per_channel == 16) {
-         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, s->img_n, req_comp, s->img_x, s->img_y);
+         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, s->img_n, req_comp, s->img_x, s->img_y, ri);
       } else {
-         out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y);
+         out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y, ri);
       }
       if (out == NULL) return out; // stbi__convert_format frees input on failure
    }
@@ -7628,46 +10243,182 @@ static int stbi__pnm_is16(stbi__context *s)
 }
 #endif
 
-static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
+// formats in the order stbi__info_main tries them when the magic bytes
+// don't identify the file
+enum
 {
-   #ifndef STBI_NO_JPEG
-   if (stbi__jpeg_info(s, x, y, comp)) return 1;
-   #endif
-
-   #ifndef STBI_NO_PNG
-   if (stbi__png_info(s, x, y, comp))  return 1;
-   #endif
-
-   #ifndef STBI_NO_GIF
-   if (stbi__gif_info(s, x, y, comp))  return 1;
-   #endif
+   STBI__FORMAT_UNKNOWN,
+   STBI__FORMAT_JPEG,
+   STBI__FORMAT_PNG,
+   STBI__FORMAT_GIF,
+   STBI__FORMAT_BMP,
+   STBI__FORMAT_PSD,
+   STBI__FORMAT_PIC,
+   STBI__FORMAT_PNM,
+   STBI__FORMAT_HDR,
+   STBI__FORMAT_TGA  // test tga last because it's a crappy test!
+};
 
-   #ifndef STBI_NO_BMP
-   if (stbi__bmp_info(s, x, y, comp))  return 1;
-   #endif
+// peek at the first bytes; this only guesses, the format's own header
+// parser still has the final word
+static int stbi__guess_format(stbi__context *s)
+{
+   stbi_uc m[4];
+   int i, fmt = STBI__FORMAT_UNKNOWN;
+   for (i=0; i < 4; ++i)
+      m[i] = stbi__get8(s);
+   stbi__rewind(s);
+   if      (m[0] == 0xff && m[1] == 0xd8)                                     fmt = STBI__FORMAT_JPEG;
+   else if (m[0] == 0x89 && m[1] == 'P' && m[2] == 'N' && m[3] == 'G')        fmt = STBI__FORMAT_PNG;
+   else if (m[0] == 'G' && m[1] == 'I' && m[2] == 'F' && m[3] == '8')         fmt = STBI__FORMAT_GIF;
+   else if (m[0] == 'B' && m[1] == 'M')                                       fmt = STBI__FORMAT_BMP;
+   else if (m[0] == '8' && m[1] == 'B' && m[2] == 'P' && m[3] == 'S')         fmt = STBI__FORMAT_PSD;
+   else if (m[0] == 0x53 && m[1] == 0x80 && m[2] == 0xf6 && m[3] == 0x34)     fmt = STBI__FORMAT_PIC;
+   else if (m[0] == 'P' && (m[1] == '5' || m[1] == '6'))                      fmt = STBI__FORMAT_PNM;
+   else if (m[0] == '#' && m[1] == '?')                                       fmt = STBI__FORMAT_HDR;
+   return fmt;
+}
+
+static int stbi__info_format(stbi__context *s, int fmt, int *x, int *y, int *comp)
+{
+   switch (fmt) {
+      #ifndef STBI_NO_JPEG
+      case STBI__FORMAT_JPEG: return stbi__jpeg_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_PNG
+      case STBI__FORMAT_PNG:  return stbi__png_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_GIF
+      case STBI__FORMAT_GIF:  return stbi__gif_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_BMP
+      case STBI__FORMAT_BMP:  return stbi__bmp_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_PSD
+      case STBI__FORMAT_PSD:  return stbi__psd_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_PIC
+      case STBI__FORMAT_PIC:  return stbi__pic_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_PNM
+      case STBI__FORMAT_PNM:  return stbi__pnm_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_HDR
+      case STBI__FORMAT_HDR:  return stbi__hdr_info(s, x, y, comp);
+      #endif
+      #ifndef STBI_NO_TGA
+      case STBI__FORMAT_TGA:  return stbi__tga_info(s, x, y, comp);
+      #endif
+      default: return 0;
+   }
+}
 
-   #ifndef STBI_NO_PSD
-   if (stbi__psd_info(s, x, y, comp))  return 1;
-   #endif
+// try the guessed format first so the common case is a single header parse,
+// then everything else in the usual order
+static int stbi__info_main_format(stbi__context *s, int *x, int *y, int *comp, int *format)
+{
+   int fmt, guess = stbi__guess_format(s);
+   if (guess != STBI__FORMAT_UNKNOWN && stbi__info_format(s, guess, x, y, comp)) {
+      *format = guess;
+      return 1;
+   }
+   for (fmt = STBI__FORMAT_JPEG; fmt <= STBI__FORMAT_TGA; ++fmt) {
+      if (fmt != guess && stbi__info_format(s, fmt, x, y, comp)) {
+         *format = fmt;
+         return 1;
+      }
+   }
+   return stbi__err("unknown image type", "Image not of any known type, or corrupt");
+}
 
-   #ifndef STBI_NO_PIC
-   if (stbi__pic_info(s, x, y, comp))  return 1;
-   #endif
+static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
+{
+   int format;
+   return stbi__info_main_format(s, x, y, comp, &format);
+}
 
-   #ifndef STBI_NO_PNM
-   if (stbi__pnm_info(s, x, y, comp))  return 1;
-   #endif
+static int stbi__info_ex_main(stbi__context *s, int *x, int *y, int *comp, int *is_16_bit, int *is_hdr)
+{
+   int format, is16 = 0;
+   if (!stbi__info_main_format(s, x, y, comp, &format)) return 0;
+   // only these formats can carry 16-bit samples; the info call above has
+   // already validated the header, so this re-read stays in the first buffer
+   switch (format) {
+      #ifndef STBI_NO_PNG
+      case STBI__FORMAT_PNG: stbi__rewind(s); is16 = stbi__png_is16(s); break;
+      #endif
+      #ifndef STBI_NO_PSD
+      case STBI__FORMAT_PSD: stbi__rewind(s); is16 = stbi__psd_is16(s); break;
+      #endif
+      #ifndef STBI_NO_PNM
+      case STBI__FORMAT_PNM: stbi__rewind(s); is16 = stbi__pnm_is16(s); break;
+      #endif
+      default: break;
+   }
+   if (is_16_bit) *is_16_bit = is16;
+   if (is_hdr)    *is_hdr    = (format == STBI__FORMAT_HDR);
+   return 1;
+}
 
-   #ifndef STBI_NO_HDR
-   if (stbi__hdr_info(s, x, y, comp))  return 1;
+// the formats with more than a couple of allocations estimate for
+// themselves; the rest decode into one buffer and convert that if needed
+static int stbi__scratch_main(stbi__context *s, int req_comp, size_t file_len, size_t *bytes)
+{
+   int x, y, n, format = stbi__guess_format(s), native_n, bpc = 1;
+   size_t px, total;
+   if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+   #ifndef STBI_NO_JPEG
+   if (format == STBI__FORMAT_JPEG) return stbi__jpeg_scratch(s, req_comp, bytes);
    #endif
-
-   // test tga last because it's a crappy test!
-   #ifndef STBI_NO_TGA
-   if (stbi__tga_info(s, x, y, comp))
-       return 1;
+   #ifndef STBI_NO_PNG
+   if (format == STBI__FORMAT_PNG) return stbi__png_scratch(s, req_comp, file_len, bytes);
    #endif
-   return stbi__err("unknown image type", "Image not of any known type, or corrupt");
+   STBI_NOTUSED(file_len);
+   if (!stbi__info_main_format(s, &x, &y, &n, &format)) return 0;
+   if (!stbi__mad3sizes_valid(x, y, 4, 0)) return stbi__err("too large", "Image too large to decode");
+   px = (size_t) x * y;
+   native_n = n;
+   total = 64;
+   switch (format) {
+      #ifndef STBI_NO_GIF
+      case STBI__FORMAT_GIF: // frame, background and per-pixel history
+         native_n = 4;
+         total += px * 5 + 32;
+         break;
+      #endif
+      #ifndef STBI_NO_HDR
+      case STBI__FORMAT_HDR: // floats and a scanline with its planes, then the 8-bit result below
+         native_n = req_comp ? req_comp : n;
+         total += px * native_n * sizeof(float) + (size_t) x * 8 + 32;
+         break;
+      #endif
+      #ifndef STBI_NO_PNM
+      case STBI__FORMAT_PNM:
+         stbi__rewind(s);
+         if (stbi__pnm_is16(s)) bpc = 2;
+         break;
+      #endif
+      case STBI__FORMAT_BMP: // up to 4 channels depending on req_comp, and a row to swizzle from
+         native_n = 4;
+         total += (size_t) x * 4 + 16;
+         break;
+      case STBI__FORMAT_PSD:
+      case STBI__FORMAT_PIC:
+         native_n = 4;
+         break;
+      case STBI__FORMAT_TGA: // a colormap of up to 256 entries
+         total += 256 * 4 + 16;
+         break;
+      default:
+         break;
+   }
+   total += px * native_n * bpc + 16;
+   if (bpc == 2)
+      total += px * native_n + 16;
+   if (req_comp && req_comp != native_n)
+      total += px * req_comp + 16;
+   *bytes = total;
+   return 1;
 }
 
 static int stbi__is_16_main(stbi__context *s)
@@ -7728,6 +10479,65 @@ STBIDEF int stbi_is_16_bit_from_file(FILE *f)
    fseek(f,pos,SEEK_SET);
    return r;
 }
+
+STBIDEF int stbi_info_ex(char const *filename, int *x, int *y, int *comp, int *is_16_bit, int *is_hdr)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_info_ex_from_file(f, x, y, comp, is_16_bit, is_hdr);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_info_ex_from_file(FILE *f, int *x, int *y, int *comp, int *is_16_bit, int *is_hdr)
+{
+   int r;
+   stbi__context s;
+   long pos = ftell(f);
+   stbi__start_file(&s, f);
+   r = stbi__info_ex_main(&s,x,y,comp,is_16_bit,is_hdr);
+   fseek(f,pos,SEEK_SET);
+   return r;
+}
+
+STBIDEF int stbi_scratch_size(char const *filename, int desired_channels, size_t *bytes)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_scratch_size_from_file(f, desired_channels, bytes);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_scratch_size_from_file(FILE *f, int desired_channels, size_t *bytes)
+{
+   int r;
+   stbi__context s;
+   long pos = ftell(f), len;
+   fseek(f,0,SEEK_END);
+   len = ftell(f) - pos;
+   fseek(f,pos,SEEK_SET);
+   stbi__start_file(&s, f);
+   r = stbi__scratch_main(&s,desired_channels,len > 0 ? (size_t) len : 0,bytes);
+   fseek(f,pos,SEEK_SET);
+   return r;
+}
+
+#ifndef STBI_NO_MMAP
+STBIDEF int stbi_info_mmap(char const *filename, int *x, int *y, int *comp)
+{
+   // header probes only touch the first few pages, so don't ask for readahead
+   stbi__mapped_file m;
+   int result;
+   if (!stbi__map_file(&m, filename, 0))
+      return stbi_info(filename,x,y,comp);
+   result = stbi_info_from_memory(m.data, (int) m.len, x,y,comp);
+   stbi__unmap_file(&m);
+   return result;
+}
+#endif // !STBI_NO_MMAP
 #endif // !STBI_NO_STDIO
 
 STBIDEF int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
@@ -7758,6 +10568,700 @@ STBIDEF int stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *c, void *user
    return stbi__is_16_main(&s);
 }
 
+STBIDEF int stbi_info_ex_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int *is_16_bit, int *is_hdr)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__info_ex_main(&s,x,y,comp,is_16_bit,is_hdr);
+}
+
+STBIDEF int stbi_info_ex_from_callbacks(stbi_io_callbacks const *c, void *user, int *x, int *y, int *comp, int *is_16_bit, int *is_hdr)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) c, user);
+   return stbi__info_ex_main(&s,x,y,comp,is_16_bit,is_hdr);
+}
+
+STBIDEF int stbi_scratch_size_from_memory(stbi_uc const *buffer, int len, int desired_channels, size_t *bytes)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__scratch_main(&s,desired_channels,(size_t) len,bytes);
+}
+
+STBIDEF int stbi_scratch_size_from_callbacks(stbi_io_callbacks const *c, void *user, int desired_channels, size_t *bytes)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) c, user);
+   return stbi__scratch_main(&s,desired_channels,0,bytes);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  incremental decoding
+//
+//  All data fed so far is kept in one growing buffer, which a memory context
+//  reads from like any other stbi_load_from_memory call; the decoders' own
+//  state structures (stbi__jpeg, stbi__png + stbi__zbuf) carry over between
+//  feeds. Anything that can't be resumed partway waits until the data it
+//  needs is all there, and formats other than baseline/progressive JPEG and
+//  non-interlaced PNG are simply decoded once the last chunk arrives.
+//
+//  The step functions return 0 on error (with the failure reason set), 1 when
+//  they need more data, and 2 once the image is complete.
+
+enum
+{
+   STBI__INC_DETECT,   // waiting for enough bytes to see the magic number
+   STBI__INC_WHOLE,    // waiting for the last chunk, then stbi_load_from_memory
+   STBI__INC_JPEG,
+   STBI__INC_PNG
+};
+
+enum
+{
+   STBI__INC_JPEG_HEADER,   // markers before the frame header
+   STBI__INC_JPEG_MARKERS,  // markers between scans
+   STBI__INC_JPEG_ROWS,     // baseline scan, decoded a row of MCUs at a time
+   STBI__INC_JPEG_SCAN      // any other scan, decoded once it is all there
+};
+
+struct stbi_incremental
+{
+   stbi__context s;        // memory context over data[0..len)
+   stbi_uc *data;
+   int len, cap;
+   int req_comp, flip, premultiply;
+   int mode, status;       // status as stbi_incremental_feed returns it
+   int x, y, comp, out_n;  // size, channels in file, channels in pixels
+   stbi_uc *pixels;
+   int dirty0, dirty1;     // pixel rows changed since stbi_incremental_rows
+
+#ifndef STBI_NO_JPEG
+   stbi__jpeg *jpeg;
+   stbi__jpeg_output jout;
+   int jpeg_state, seen_soi, after_scan, preview;
+   int mcu_row, mcu_rows, search, retry;
+#endif
+
+#ifndef STBI_NO_PNG
+   stbi__png png;
+   stbi__zbuf zbuf;
+   stbi_uc *scratch;       // one row of conversion space
+   int png_out_n;          // channels in png.out (s->img_out_n of a normal load)
+   int idat_left, crc_left, idat_done;
+   int zstate, zpos, zretry;
+   stbi__uint32 unfiltered, finished;
+#endif
+};
+
+#if !defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)
+static void stbi__incremental_dirty(stbi_incremental *d, int r0, int r1)
+{
+   if (r0 >= r1) return;
+   if (d->flip) {
+      int t = d->y - r1;
+      r1 = d->y - r0;
+      r0 = t;
+   }
+   if (d->dirty0 == d->dirty1) {
+      d->dirty0 = r0;
+      d->dirty1 = r1;
+   } else {
+      if (r0 < d->dirty0) d->dirty0 = r0;
+      if (r1 > d->dirty1) d->dirty1 = r1;
+   }
+}
+
+static int stbi__incremental_alloc_pixels(stbi_incremental *d)
+{
+   if (!stbi__mad3sizes_valid(d->x, d->y, d->out_n, 1)) return stbi__err("too large", "Image too large to decode");
+   // one byte of slack for the JPEG color converters
+   d->pixels = (stbi_uc *) stbi__malloc_mad3(d->x, d->y, d->out_n, 1);
+   if (!d->pixels) return stbi__err("outofmem", "Out of memory");
+   // rows that haven't arrived yet read as black rather than garbage
+   memset(d->pixels, 0, (size_t) d->x * d->y * d->out_n);
+   return 1;
+}
+#endif
+
+static int stbi__incremental_whole(stbi_incremental *d)
+{
+   stbi__result_info ri;
+   stbi__context s;
+   int channels;
+   void *result;
+   stbi__start_mem(&s, d->data, d->len);
+   result = stbi__load_main(&s, &d->x, &d->y, &d->comp, d->req_comp, &ri, 8);
+   if (result == NULL) return 0;
+   channels = d->req_comp ? d->req_comp : d->comp;
+   if (ri.bits_per_channel != 8)
+      result = stbi__convert_16_to_8((stbi__uint16 *) result, d->x, d->y, channels);
+   if (result == NULL) return 0;
+   if (ri.vertically_flipped != d->flip)
+      stbi__vertical_flip(result, d->x, d->y, channels);
+   if (d->premultiply && !ri.premultiplied)
+      stbi__premultiply(result, d->x, d->y, channels, 8);
+   d->pixels = (stbi_uc *) result;
+   d->out_n = channels;
+   d->dirty0 = 0;
+   d->dirty1 = d->y;
+   return 2;
+}
+
+#ifndef STBI_NO_JPEG
+// look for the next marker segment without consuming anything. returns the
+// marker, STBI__MARKER_none for a byte that isn't one, or -1 if the segment
+// (marker plus any length-prefixed payload) isn't all buffered yet
+static int stbi__incremental_jpeg_peek(stbi_incremental *d)
+{
+   stbi_uc *p = d->s.img_buffer, *end = d->s.img_buffer_end;
+   int m;
+   if (d->jpeg->marker != STBI__MARKER_none) {
+      m = d->jpeg->marker;
+   } else {
+      if (p >= end) return -1;
+      if (*p != 0xff) return STBI__MARKER_none;
+      do {
+         if (++p >= end) return -1;
+      } while (*p == 0xff);
+      m = *p++;
+   }
+   if (stbi__SOI(m) || stbi__EOI(m) || STBI__RESTART(m)) return m;
+   if (end - p < 2 || end - p < ((p[0] << 8) | p[1])) return -1;
+   return m;
+}
+
+// after a scan: find the next marker like stbi__skip_jpeg_junk_at_end does,
+// but only once it is buffered. returns 0 if more data is needed
+static int stbi__incremental_jpeg_junk(stbi_incremental *d, int is_last)
+{
+   stbi_uc *p = d->s.img_buffer, *end = d->s.img_buffer_end;
+   for (; p < end; ++p) {
+      if (*p == 0xff) {
+         while (p+1 < end && p[1] == 0xff) ++p;
+         if (p+1 >= end) break;
+         if (p[1] != 0x00) {
+            d->jpeg->marker = stbi__skip_jpeg_junk_at_end(d->jpeg);
+            return 1;
+         }
+      }
+   }
+   if (is_last) {
+      d->jpeg->marker = stbi__skip_jpeg_junk_at_end(d->jpeg);
+      return 1;
+   }
+   d->s.img_buffer = p; // don't scan the junk again
+   return 0;
+}
+
+// is all of the current scan's entropy-coded data buffered?
+static int stbi__incremental_jpeg_scan_complete(stbi_incremental *d)
+{
+   stbi_uc *p = d->data + d->search, *end = d->s.img_buffer_end;
+   for (; p+1 < end; ++p)
+      if (p[0] == 0xff && p[1] != 0x00 && p[1] != 0xff && !STBI__RESTART(p[1]))
+         return 1;
+   d->search = (int) (p - d->data);
+   return 0;
+}
+
+static int stbi__incremental_jpeg_begin_output(stbi_incremental *d)
+{
+   stbi__jpeg *z = d->jpeg;
+   int k;
+   if (!stbi__jpeg_output_begin(z, &d->jout, d->req_comp)) return 0;
+   for (k=0; k < d->jout.decode_n; ++k)
+      d->jout.ready[k] = 0;
+   d->x = d->jout.w;
+   d->y = d->jout.h;
+   d->comp = z->s->img_n >= 3 ? 3 : 1;
+   d->out_n = d->jout.n;
+   return stbi__incremental_alloc_pixels(d);
+}
+
+static void stbi__incremental_jpeg_output(stbi_incremental *d)
+{
+   int r0 = d->jout.row;
+   stbi__jpeg_output_rows(d->jpeg, &d->jout, d->pixels, d->jout.h, d->flip);
+   stbi__incremental_dirty(d, r0, d->jout.row);
+}
+
+// all scans are in: produce whatever rows are still missing
+static int stbi__incremental_jpeg_finish(stbi_incremental *d)
+{
+   int k;
+   stbi__jpeg *z = d->jpeg;
+   if (z->progressive) {
+      stbi__jpeg_finish(z);
+      stbi__jpeg_output_rewind(z, &d->jout);
+   }
+   for (k=0; k < d->jout.decode_n; ++k)
+      d->jout.ready[k] = d->jout.comp_y[k];
+   stbi__incremental_jpeg_output(d);
+   return 2;
+}
+
+// decode MCU rows of a baseline scan for as long as the data lasts. a row
+// that runs off the end of the buffer is undone and decoded again later
+static int stbi__incremental_jpeg_rows(stbi_incremental *d, int is_last)
+{
+   stbi__jpeg *z = d->jpeg;
+   int bs = 8 >> z->scale_shift;
+   // after running dry, wait for a quarter more data than that attempt
+   // covered, so feeding tiny chunks doesn't redecode a row for every byte
+   if (!is_last && d->len < d->retry) return 1;
+   while (d->mcu_row < d->mcu_rows) {
+      stbi_uc *pos = z->s->img_buffer;
+      stbi__uint32 code_buffer = z->code_buffer;
+      int code_bits = z->code_bits, nomore = z->nomore, todo = z->todo, eob_run = z->eob_run;
+      unsigned char marker = z->marker;
+      int k, r, dc_pred[4];
+      for (k=0; k < 4; ++k) dc_pred[k] = z->img_comp[k].dc_pred;
+
+      r = stbi__jpeg_decode_baseline_row(z, d->mcu_row);
+      if (!is_last && z->marker == STBI__MARKER_none && z->s->img_buffer >= z->s->img_buffer_end) {
+         z->s->img_buffer = pos;
+         z->code_buffer = code_buffer;
+         z->code_bits = code_bits;
+         z->nomore = nomore;
+         z->todo = todo;
+         z->eob_run = eob_run;
+         z->marker = marker;
+         for (k=0; k < 4; ++k) z->img_comp[k].dc_pred = dc_pred[k];
+         d->retry = d->len + (int) (z->s->img_buffer_end - pos) / 4 + 1;
+         return 1;
+      }
+      if (r == 0) return 0;
+      ++d->mcu_row;
+      for (k=0; k < d->jout.decode_n; ++k) {
+         int rows = d->mcu_row * bs * (z->scan_n == 1 ? 1 : z->img_comp[k].v);
+         d->jout.ready[k] = rows < d->jout.comp_y[k] ? rows : d->jout.comp_y[k];
+      }
+      if (r == 2) break;
+   }
+   d->jpeg_state = STBI__INC_JPEG_MARKERS;
+   d->after_scan = 1;
+   return 2;
+}
+
+static int stbi__incremental_jpeg(stbi_incremental *d, int is_last)
+{
+   stbi__jpeg *z = d->jpeg;
+   int m, r;
+   for (;;) {
+      if (d->jpeg_state == STBI__INC_JPEG_ROWS) {
+         r = stbi__incremental_jpeg_rows(d, is_last);
+         stbi__incremental_jpeg_output(d);
+         if (r != 2) return r;
+         continue;
+      }
+      if (d->jpeg_state == STBI__INC_JPEG_SCAN) {
+         if (!is_last && !stbi__incremental_jpeg_scan_complete(d)) break;
+         if (!stbi__parse_entropy_coded_data(z)) return 0;
+         d->jpeg_state = STBI__INC_JPEG_MARKERS;
+         d->after_scan = 1;
+         d->preview = z->progressive;
+         continue;
+      }
+      if (d->after_scan && z->marker == STBI__MARKER_none) {
+         if (!stbi__incremental_jpeg_junk(d, is_last)) break;
+      }
+      d->after_scan = 0;
+      if (stbi__incremental_jpeg_peek(d) < 0 && !is_last) break;
+      m = stbi__get_marker(z);
+
+      if (d->jpeg_state == STBI__INC_JPEG_HEADER) {
+         // same rules as stbi__decode_jpeg_header
+         if (!d->seen_soi) {
+            if (!stbi__SOI(m)) return stbi__err("no SOI","Corrupt JPEG");
+            d->seen_soi = 1;
+         } else if (stbi__SOF(m)) {
+            z->progressive = stbi__SOF_progressive(m);
+            if (!stbi__process_frame_header(z, STBI__SCAN_load)) return 0;
+            if (!stbi__incremental_jpeg_begin_output(d)) return 0;
+            d->jpeg_state = STBI__INC_JPEG_MARKERS;
+         } else if (m == STBI__MARKER_none) {
+            // some files have extra padding after their blocks
+            if (stbi__at_eof(z->s)) return stbi__err("no SOF", "Corrupt JPEG");
+         } else {
+            if (!stbi__process_marker(z, m)) return 0;
+         }
+         continue;
+      }
+
+      // same rules as stbi__decode_jpeg_image
+      if (stbi__EOI(m)) {
+         return stbi__incremental_jpeg_finish(d);
+      } else if (STBI__RESTART(m)) {
+         // stray restart marker after a scan
+      } else if (stbi__SOS(m)) {
+         if (!stbi__process_scan_header(z)) return 0;
+         stbi__jpeg_reset(z);
+         if (!z->progressive && z->scan_n == z->s->img_n) {
+            d->jpeg_state = STBI__INC_JPEG_ROWS;
+            d->mcu_row = 0;
+            d->mcu_rows = stbi__jpeg_baseline_rows(z);
+         } else {
+            d->jpeg_state = STBI__INC_JPEG_SCAN;
+            d->search = (int) (z->s->img_buffer - d->data);
+         }
+      } else if (stbi__DNL(m)) {
+         int Ld = stbi__get16be(z->s);
+         stbi__uint32 NL = stbi__get16be(z->s);
+         if (Ld != 4) return stbi__err("bad DNL len", "Corrupt JPEG");
+         if (NL != z->s->img_y) return stbi__err("bad DNL height", "Corrupt JPEG");
+      } else {
+         // a normal load stops at anything unexpected and keeps what it has
+         if (!stbi__process_marker(z, m)) return stbi__incremental_jpeg_finish(d);
+      }
+   }
+
+   if (is_last) return stbi__incremental_jpeg_finish(d);
+   // show what the progressive scans so far add up to
+   if (d->preview) {
+      int k;
+      stbi__jpeg_finish(z);
+      stbi__jpeg_output_rewind(z, &d->jout);
+      for (k=0; k < d->jout.decode_n; ++k)
+         d->jout.ready[k] = d->jout.comp_y[k];
+      stbi__incremental_jpeg_output(d);
+      d->preview = 0;
+   }
+   return 1;
+}
+#endif // STBI_NO_JPEG
+
+#ifndef STBI_NO_PNG
+// first IDAT: the header chunks are all in, so set up the row pipeline
+static int stbi__incremental_png_begin(stbi_incremental *d)
+{
+   stbi__png *z = &d->png;
+   stbi__context *s = z->s;
+   stbi__uint32 img_width_bytes, img_len;
+   int bytes = z->depth == 16 ? 2 : 1;
+
+   if ((d->req_comp == s->img_n+1 && d->req_comp != 3 && !z->pal_img_n) || z->has_trans)
+      d->png_out_n = s->img_n+1;
+   else
+      d->png_out_n = s->img_n;
+   d->x = s->img_x;
+   d->y = s->img_y;
+   d->comp = z->pal_img_n ? z->pal_img_n : s->img_n + z->has_trans;
+   d->out_n = d->req_comp ? d->req_comp : z->pal_img_n ? z->pal_img_n : d->png_out_n;
+
+   if (!stbi__mad3sizes_valid(s->img_n, s->img_x, z->depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   img_width_bytes = (((s->img_n * s->img_x * z->depth) + 7) >> 3);
+   if (!stbi__mad2sizes_valid(img_width_bytes + 1, s->img_y, 0)) return stbi__err("too large", "Corrupt PNG");
+   img_len = (img_width_bytes + 1) * s->img_y;
+
+   z->out = (stbi_uc *) stbi__malloc_mad3(s->img_x, s->img_y, d->png_out_n*bytes, 0);
+   d->scratch = (stbi_uc *) stbi__malloc_mad2(s->img_x, 8, 0);
+   d->zbuf.zout_start = (char *) stbi__malloc(img_len);
+   if (!z->out || !d->scratch || !d->zbuf.zout_start) return stbi__err("outofmem", "Out of memory");
+   d->zbuf.zout = d->zbuf.zout_start;
+   d->zbuf.zout_end = d->zbuf.zout_start + img_len;
+   d->zbuf.z_expandable = 1;
+   return stbi__incremental_alloc_pixels(d);
+}
+
+// copy finished scanline j from png.out to the pixels, converted the same way
+// stbi__do_png and stbi__load_and_postprocess_8bit would
+static void stbi__incremental_png_emit(stbi_incremental *d, stbi__uint32 j)
+{
+   stbi__png *z = &d->png;
+   stbi__uint32 i, x = d->x, row = d->flip ? d->y - 1 - j : j;
+   int n = d->png_out_n;
+   stbi_uc *src = z->out + (size_t) row * x * n * (z->depth == 16 ? 2 : 1);
+   stbi_uc *dest = d->pixels + (size_t) row * x * d->out_n;
+
+   if (z->depth == 16) {
+      stbi__uint16 *src16 = (stbi__uint16 *) src;
+      if (z->has_trans) stbi__compute_transparency16(src16, x, z->tc16, n);
+      if (n != d->out_n) {
+         stbi__convert_row16((stbi__uint16 *) d->scratch, src16, n, d->out_n, x);
+         src16 = (stbi__uint16 *) d->scratch;
+      }
+      for (i=0; i < x * d->out_n; ++i)
+         dest[i] = (stbi_uc) (src16[i] >> 8);
+   } else if (z->pal_img_n) {
+      int pal_n = d->req_comp >= 3 ? d->req_comp : z->pal_img_n;
+      if (pal_n == d->out_n) {
+         stbi__expand_png_palette_pixels(dest, src, x, z->palette, pal_n);
+      } else {
+         stbi__expand_png_palette_pixels(d->scratch, src, x, z->palette, pal_n);
+         stbi__convert_row(dest, d->scratch, pal_n, d->out_n, x);
+      }
+   } else {
+      if (z->has_trans) stbi__compute_transparency(src, x, z->tc, n);
+      stbi__convert_row(dest, src, n, d->out_n, x);
+   }
+   if (d->premultiply)
+      stbi__premultiply_row(dest, d->out_n, x);
+}
+
+// inflate whatever whole deflate blocks are buffered, then unfilter and emit
+// the scanlines they complete. a block that runs off the end of the data is
+// undone and retried once a good deal more has arrived
+static int stbi__incremental_png_rows(stbi_incremental *d)
+{
+   stbi__png *z = &d->png;
+   stbi__zbuf *a = &d->zbuf;
+   stbi__uint32 x = d->x, y = d->y, rows, finish_end;
+   stbi__uint32 stride = (((z->s->img_n * x * z->depth) + 7) >> 3) + 1;
+
+   a->zbuffer = z->idata + d->zpos;
+   a->zbuffer_end = z->idata + z->ioff;
+   if (d->zstate == 0) {
+      // stbi__parse_zlib_header wants to see a byte past the header
+      if (z->ioff < 3 && !d->idat_done) return 1;
+      if (!stbi__parse_zlib_header(a)) return 0;
+      a->num_bits = 0;
+      a->code_buffer = 0;
+      a->hit_zeof_once = 0;
+      d->zstate = 1;
+   }
+   while (d->zstate == 1 && (d->idat_done || (int) z->ioff >= d->zretry)) {
+      stbi_uc *start = a->zbuffer;
+      stbi__uint32 code_buffer = a->code_buffer;
+      int num_bits = a->num_bits, hit_zeof_once = a->hit_zeof_once, final;
+      ptrdiff_t zout = a->zout - a->zout_start;
+      int ok = stbi__parse_zlib_block(a, &final);
+      if (!d->idat_done && (!ok || a->zbuffer >= a->zbuffer_end)) {
+         a->zbuffer = start;
+         a->code_buffer = code_buffer;
+         a->num_bits = num_bits;
+         a->hit_zeof_once = hit_zeof_once;
+         a->zout = a->zout_start + zout;
+         d->zretry = (int) z->ioff + (int) (a->zbuffer_end - start) / 4 + 1;
+         break;
+      }
+      if (!ok) return 0;
+      if (final) d->zstate = 2;
+   }
+   d->zpos = (int) (a->zbuffer - z->idata);
+
+   rows = (stbi__uint32) ((a->zout - a->zout_start) / stride);
+   if (rows > y) rows = y;
+   if (rows > d->unfiltered) {
+      if (!stbi__png_unfilter_rows(z, (stbi_uc *) a->zout_start + d->unfiltered * stride, d->png_out_n, x, y, z->depth, d->unfiltered, rows, d->flip))
+         return 0;
+      d->unfiltered = rows;
+   }
+   // finishing rewrites a row in place, so stay one behind the unfiltering
+   finish_end = d->unfiltered == y ? y : d->unfiltered ? d->unfiltered - 1 : 0;
+   if (finish_end > d->finished) {
+      stbi__uint32 j;
+      stbi__png_finish_rows(z, d->png_out_n, x, y, z->depth, z->color, d->finished, finish_end, d->flip);
+      for (j=d->finished; j < finish_end; ++j)
+         stbi__incremental_png_emit(d, j);
+      stbi__incremental_dirty(d, d->finished, finish_end);
+      d->finished = finish_end;
+   }
+   if (d->idat_done) {
+      if (d->finished < y) return stbi__err("not enough pixels","Corrupt PNG");
+      return 2;
+   }
+   return 1;
+}
+
+static int stbi__incremental_png(stbi_incremental *d, int is_last)
+{
+   stbi__png *z = &d->png;
+   stbi__context *s = &d->s;
+   int fed = 0;
+   if (z->first && s->img_buffer == s->img_buffer_original) {
+      if (d->len < 8 && !is_last) return 1;
+      if (!stbi__check_png_header(s)) return 0;
+   }
+   for (;;) {
+      int avail = (int) (s->img_buffer_end - s->img_buffer);
+      if (d->idat_left) {
+         int n = avail < d->idat_left ? avail : d->idat_left;
+         if (n == 0) break;
+         if (!stbi__png_grow_idata(z, n)) return 0;
+         memcpy(z->idata + z->ioff, s->img_buffer, n);
+         s->img_buffer += n;
+         z->ioff += n;
+         d->idat_left -= n;
+         fed = 1;
+      } else if (d->crc_left) {
+         int n = avail < d->crc_left ? avail : d->crc_left;
+         if (n == 0) break;
+         s->img_buffer += n;
+         d->crc_left -= n;
+      } else {
+         stbi__uint32 length, type;
+         if (avail < 8) break;
+         length = ((stbi__uint32) s->img_buffer[0] << 24) | (s->img_buffer[1] << 16) | (s->img_buffer[2] << 8) | s->img_buffer[3];
+         type   = ((stbi__uint32) s->img_buffer[4] << 24) | (s->img_buffer[5] << 16) | (s->img_buffer[6] << 8) | s->img_buffer[7];
+         if (type == STBI__PNG_TYPE('I','D','A','T')) {
+            if (z->first) return stbi__err("first not IHDR", "Corrupt PNG");
+            if (z->pal_img_n && !z->pal_len) return stbi__err("no PLTE","Corrupt PNG");
+            if (length > (1u << 30)) return stbi__err("IDAT size limit", "IDAT section larger than 2^30 bytes");
+            if (!z->out) {
+               // Apple's variant and interlaced files are only decoded once complete
+               if (z->is_iphone || z->interlace) {
+                  d->mode = STBI__INC_WHOLE;
+                  return 1;
+               }
+               if (!stbi__incremental_png_begin(d)) return 0;
+            }
+            s->img_buffer += 8;
+            d->idat_left = (int) length;
+            d->crc_left = 4;
+         } else if (type == STBI__PNG_TYPE('I','E','N','D')) {
+            if (z->first) return stbi__err("first not IHDR", "Corrupt PNG");
+            if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
+            d->idat_done = 1;
+            break;
+         } else {
+            if ((avail < 12 || (stbi__uint32) (avail - 12) < length) && !is_last) break;
+            if (!stbi__png_parse_chunk(z, stbi__get_chunk_header(s), STBI__SCAN_load, d->req_comp)) return 0;
+         }
+      }
+   }
+   if (is_last && !d->idat_done) {
+      if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
+      d->idat_done = 1;
+   }
+   if (fed || d->idat_done)
+      return stbi__incremental_png_rows(d);
+   return 1;
+}
+#endif // STBI_NO_PNG
+
+static int stbi__incremental_run(stbi_incremental *d, int is_last)
+{
+   if (d->mode == STBI__INC_DETECT) {
+      int format;
+      if (d->len < 4 && !is_last) return 1;
+      format = stbi__guess_format(&d->s);
+      STBI_NOTUSED(format); // when neither JPEG nor PNG is compiled in
+      d->mode = STBI__INC_WHOLE;
+      #ifndef STBI_NO_JPEG
+      if (format == STBI__FORMAT_JPEG) {
+         d->jpeg = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+         if (!d->jpeg) return stbi__err("outofmem", "Out of memory");
+         memset(d->jpeg, 0, sizeof(stbi__jpeg));
+         d->jpeg->s = &d->s;
+         stbi__setup_jpeg(d->jpeg);
+         d->jpeg->jfif = 0;
+         d->jpeg->app14_color_transform = -1; // valid values are 0,1,2
+         d->jpeg->marker = STBI__MARKER_none;
+         d->mode = STBI__INC_JPEG;
+      }
+      #endif
+      #ifndef STBI_NO_PNG
+      if (format == STBI__FORMAT_PNG) {
+         d->png.s = &d->s;
+         d->png.flip = d->flip;
+         stbi__png_begin(&d->png);
+         d->mode = STBI__INC_PNG;
+      }
+      #endif
+   }
+   switch (d->mode) {
+      #ifndef STBI_NO_JPEG
+      case STBI__INC_JPEG: return stbi__incremental_jpeg(d, is_last);
+      #endif
+      #ifndef STBI_NO_PNG
+      case STBI__INC_PNG: {
+         int r = stbi__incremental_png(d, is_last);
+         if (d->mode != STBI__INC_WHOLE) return r;
+         break;
+      }
+      #endif
+      default:
+         break;
+   }
+   return is_last ? stbi__incremental_whole(d) : 1;
+}
+
+STBIDEF stbi_incremental *stbi_incremental_begin(int desired_channels)
+{
+   stbi_incremental *d;
+   if (desired_channels < 0 || desired_channels > 4) return (stbi_incremental *) stbi__errpuc("bad req_comp", "Internal error");
+   d = (stbi_incremental *) stbi__malloc(sizeof(stbi_incremental));
+   if (!d) return (stbi_incremental *) stbi__errpuc("outofmem", "Out of memory");
+   memset(d, 0, sizeof(*d));
+   d->req_comp = desired_channels;
+   d->flip = stbi__vertically_flip_on_load;
+   d->premultiply = stbi__premultiply_on_load;
+   stbi__start_mem(&d->s, NULL, 0);
+   return d;
+}
+
+STBIDEF int stbi_incremental_feed(stbi_incremental *d, stbi_uc const *data, int len, int is_last)
+{
+   int r;
+   if (d->status) return d->status;
+   if (len > 0) {
+      ptrdiff_t pos = d->s.img_buffer - d->s.img_buffer_original;
+      if (len > INT_MAX - d->len) { d->status = -1; (void) stbi__err("too large", "Image too large to decode"); return -1; }
+      if (d->len + len > d->cap) {
+         int cap = d->cap ? d->cap : 65536;
+         stbi_uc *p;
+         while (cap < d->len + len)
+            cap = cap > INT_MAX / 2 ? INT_MAX : cap * 2;
+         p = (stbi_uc *) stbi__realloc_sized(d->data, d->cap, cap);
+         if (!p) { d->status = -1; (void) stbi__err("outofmem", "Out of memory"); return -1; }
+         d->data = p;
+         d->cap = cap;
+      }
+      memcpy(d->data + d->len, data, len);
+      d->len += len;
+      d->s.img_buffer_original = d->data;
+      d->s.img_buffer = d->data + pos;
+      d->s.img_buffer_end = d->s.img_buffer_original_end = d->data + d->len;
+   }
+   r = stbi__incremental_run(d, is_last);
+   if (r == 1 && is_last)
+      r = stbi__err("truncated", "Corrupt image");
+   d->status = r == 2 ? 1 : r == 1 ? 0 : -1;
+   return d->status;
+}
+
+STBIDEF int stbi_incremental_info(stbi_incremental *d, int *x, int *y, int *channels_in_file)
+{
+   if (!d->pixels) return 0;
+   if (x) *x = d->x;
+   if (y) *y = d->y;
+   if (channels_in_file) *channels_in_file = d->comp;
+   return 1;
+}
+
+STBIDEF stbi_uc *stbi_incremental_rows(stbi_incremental *d, int *first_row, int *row_count)
+{
+   if (first_row) *first_row = d->dirty0;
+   if (row_count) *row_count = d->dirty1 - d->dirty0;
+   d->dirty0 = d->dirty1 = 0;
+   return d->pixels;
+}
+
+STBIDEF stbi_uc *stbi_incremental_end(stbi_incremental *d, int *x, int *y, int *channels_in_file)
+{
+   stbi_uc *pixels = d->pixels;
+   if (x) *x = pixels ? d->x : 0;
+   if (y) *y = pixels ? d->y : 0;
+   if (channels_in_file) *channels_in_file = pixels ? d->comp : 0;
+   #ifndef STBI_NO_JPEG
+   if (d->jpeg) {
+      stbi__cleanup_jpeg(d->jpeg);
+      stbi__free(d->jpeg);
+   }
+   #endif
+   #ifndef STBI_NO_PNG
+   stbi__free(d->png.idata);
+   stbi__free(d->png.out);
+   stbi__free(d->zbuf.zout_start);
+   stbi__free(d->scratch);
+   #endif
+   stbi__free(d->data);
+   stbi__free(d);
+   return pixels;
+}
+
 #endif // STB_IMAGE_IMPLEMENTATION
 
 /*
@@ -0,0 +1,432 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+// brings in texture_support.h (and with it stb_image.h) and mip_generator.h
+#include "texture_compressor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TEXTURE_CACHE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// how TextureCache stores the pixels of each level
+enum class CacheEncoding
+{
+    Raw,    // 8 bits per channel, as decoded
+    BC1,    // block compressed by TextureCompressor; BC1 and BC3 need
+    BC3,    // GL_EXT_texture_compression_s3tc to upload
+    BC7
+};
+
+struct TextureCacheSettings
+{
+    CacheEncoding encoding = CacheEncoding::Raw;
+    int desiredChannels = 0;        // as for stbi_load
+    bool flipVertically = true;
+    bool srgb = false;              // sRGB internal format; mips are filtered in linear light either way
+    bool mipmaps = true;
+    MipOptions mips;                // filter, wrap and alpha cutoff of the chain
+};
+
+// a texture as TextureCache hands it out: GL-ready levels that point into
+// the cache file's mapping, which 'storage' keeps alive
+struct CachedTexture
+{
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+    };
+
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int components = 0;                 // channels of the decoded image
+    bool compressed = false;
+    unsigned int internalFormat = 0;    // for glTexImage2D or glCompressedTexImage2D
+    unsigned int format = 0;            // pixel format and type for glTexImage2D; 0 if compressed
+    unsigned int type = 0;
+    std::vector<Level> levels;
+    bool hit = false;                   // read from the cache rather than decoded
+    double milliseconds = 0.0;          // wall time of load(), hashing the source included
+    std::string error;
+    std::shared_ptr<const void> storage;
+
+    bool ok() const { return !levels.empty(); }
+};
+
+// Skips decoding at startup. The first load() of an image decodes it with
+// stb_image, builds its mips with MipGenerator, optionally block compresses
+// them, and writes the result as one GPU-ready file under the cache
+// directory, named after a hash of the image file's bytes and the settings.
+// Later loads of unchanged bytes with the same settings map that file and
+// hand its levels straight to upload(); editing the image changes the hash,
+// so stale entries are never read (they are left on disk). stats() keeps
+// the cold (decoded) and warm (cached) timings apart.
+//
+//     TextureCache cache;
+//     unsigned int texture = TextureCache::upload(cache.load("container.jpg"));
+//     std::cout << cache.stats().hits << " cached, " << cache.stats().misses << " decoded\n";
+class TextureCache
+{
+public:
+    struct Stats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        double hitMs = 0.0;     // total time of the loads served from the cache
+        double missMs = 0.0;    // total time of the loads that decoded
+    };
+
+    // ------------------------------------------------------------------------
+    explicit TextureCache(const std::string &directory = "texture_cache")
+        : root(directory)
+    {
+    }
+
+    // ------------------------------------------------------------------------
+    CachedTexture load(const std::string &path, const TextureCacheSettings &settings = TextureCacheSettings())
+    {
+        const auto start = std::chrono::steady_clock::now();
+        CachedTexture texture;
+        std::shared_ptr<const Mapping> source = map(path);
+        if (!source)
+            texture.error = "can't open " + path;
+        else
+        {
+            const uint64_t key = keyOf(source->data, source->size, settings);
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.tex", (unsigned long long)key);
+            const std::string blobPath = (std::filesystem::path(root) / name).string();
+
+            std::shared_ptr<const Mapping> blob = map(blobPath);
+            if (blob && parse(texture, blob->data, blob->size, key))
+            {
+                texture.storage = blob;
+                texture.hit = true;
+            }
+            else
+                bake(texture, *source, settings, key, blobPath);
+        }
+        texture.path = path;
+        texture.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (texture.hit)
+        {
+            ++counters.hits;
+            counters.hitMs += texture.milliseconds;
+        }
+        else
+        {
+            ++counters.misses;
+            counters.missMs += texture.milliseconds;
+        }
+        return texture;
+    }
+    // ------------------------------------------------------------------------
+    const Stats &stats() const { return counters; }
+
+    // create a GL texture holding every level; returns 0 if there is nothing
+    // to upload. leaves the texture bound to GL_TEXTURE_2D
+    // ------------------------------------------------------------------------
+    static unsigned int upload(const CachedTexture &texture, GLint wrap = GL_REPEAT)
+    {
+        if (!texture.ok())
+            return 0;
+        unsigned int id = 0;
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+        if (!texture.compressed && texture.components <= 2)
+        {
+            // grey and grey-alpha sample as stbi_load's channels read
+            const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, texture.components == 2 ? GL_GREEN : GL_ONE };
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        }
+        GLint alignment = 4;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < texture.levels.size(); ++i)
+        {
+            const CachedTexture::Level &level = texture.levels[i];
+            if (texture.compressed)
+                glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, texture.internalFormat, level.width, level.height, 0, (GLsizei)level.size, level.data);
+            else
+                glTexImage2D(GL_TEXTURE_2D, (GLint)i, (GLint)texture.internalFormat, level.width, level.height, 0, texture.format, texture.type, level.data);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        return id;
+    }
+
+private:
+    static const uint32_t Version = 1;
+
+    // cache file layout: the header, one entry per level, then the levels,
+    // each starting on a 16-byte boundary
+    struct BlobHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t width, height, components, compressed;
+        uint32_t internalFormat, format, type, levelCount;
+    };
+    struct BlobLevel
+    {
+        uint32_t width, height;
+        uint64_t offset, size;
+    };
+
+    // a whole file, mapped where possible, otherwise read into memory
+    struct Mapping
+    {
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+        std::vector<unsigned char> copy;
+
+        ~Mapping()
+        {
+#ifdef TEXTURE_CACHE_MMAP
+            if (mapped)
+                munmap((void *)data, size);
+#endif
+        }
+    };
+
+    // ------------------------------------------------------------------------
+    static std::shared_ptr<const Mapping> map(const std::string &path)
+    {
+        auto mapping = std::make_shared<Mapping>();
+#ifdef TEXTURE_CACHE_MMAP
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                mapping->data = (const unsigned char *)p;
+                mapping->size = (size_t)st.st_size;
+                mapping->mapped = true;
+            }
+        }
+        close(fd);
+        if (mapping->mapped)
+            return mapping;
+#endif
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return nullptr;
+        unsigned char chunk[65536];
+        for (size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) > 0;)
+            mapping->copy.insert(mapping->copy.end(), chunk, chunk + n);
+        std::fclose(file);
+        if (mapping->copy.empty())
+            return nullptr;
+        mapping->data = mapping->copy.data();
+        mapping->size = mapping->copy.size();
+        return mapping;
+    }
+    // FNV-1a over 64-bit words of the file, then the settings. it only has to
+    // tell versions of an asset apart, not resist tampering
+    // ------------------------------------------------------------------------
+    static uint64_t keyOf(const unsigned char *bytes, size_t size, const TextureCacheSettings &settings)
+    {
+        const uint64_t prime = 0x100000001b3ull;
+        uint64_t hash = 0xcbf29ce484222325ull;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            hash = (hash ^ word) * prime;
+        }
+        for (; i < size; ++i)
+            hash = (hash ^ bytes[i]) * prime;
+        uint32_t cutoff;
+        std::memcpy(&cutoff, &settings.mips.alphaCutoff, 4);
+        const uint64_t fields[] = { Version, size, (uint64_t)settings.encoding, (uint64_t)settings.desiredChannels,
+                                    settings.flipVertically, settings.srgb, settings.mipmaps, (uint64_t)settings.mips.filter,
+                                    (uint64_t)settings.mips.wrap, cutoff, (uint64_t)settings.mips.maxLevels };
+        for (uint64_t field : fields)
+            hash = (hash ^ field) * prime;
+        return hash;
+    }
+    // bytes of a width x height level in the header's encoding: 8-bit texels,
+    // or 4x4 blocks of 8 (BC1) or 16 (BC3, BC7) bytes; 0 for anything else
+    // ------------------------------------------------------------------------
+    static uint64_t levelBytes(const BlobHeader &header, uint32_t width, uint32_t height)
+    {
+        if (!header.compressed)
+            return header.type == GL_UNSIGNED_BYTE ? (uint64_t)width * height * header.components : 0;
+        uint64_t blockBytes;
+        switch (header.internalFormat)
+        {
+        case 0x83F0: case 0x83F1: case 0x8C4C: case 0x8C4D: blockBytes = 8; break;
+        case 0x83F3: case 0x8C4F: case 0x8E8C: case 0x8E8D: blockBytes = 16; break;
+        default: return 0;
+        }
+        return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+    }
+    // point 'texture' at the levels of a cache file held in memory; false if
+    // it isn't a complete cache file for 'key'. every level must be the next
+    // step of the mip chain and hold exactly its data, so a damaged file is
+    // decoded again rather than uploaded
+    // ------------------------------------------------------------------------
+    static bool parse(CachedTexture &texture, const unsigned char *data, size_t size, uint64_t key)
+    {
+        BlobHeader header;
+        if (size < sizeof(header))
+            return false;
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, "TXCB", 4) != 0 || header.version != Version || header.key != key ||
+            header.width == 0 || header.height == 0 || header.components < 1 || header.components > 4 ||
+            header.levelCount == 0 || header.levelCount > 32 || size < sizeof(header) + (size_t)header.levelCount * sizeof(BlobLevel))
+            return false;
+        std::vector<CachedTexture::Level> levels(header.levelCount);
+        for (uint32_t i = 0; i < header.levelCount; ++i)
+        {
+            BlobLevel entry;
+            std::memcpy(&entry, data + sizeof(header) + i * sizeof(BlobLevel), sizeof(entry));
+            const uint32_t width = std::max(1u, header.width >> i), height = std::max(1u, header.height >> i);
+            const uint64_t expected = levelBytes(header, width, height);
+            if (entry.width != width || entry.height != height || expected == 0 || entry.size != expected ||
+                entry.offset > size || entry.size > size - entry.offset)
+                return false;
+            levels[i].width = (int)entry.width;
+            levels[i].height = (int)entry.height;
+            levels[i].data = data + entry.offset;
+            levels[i].size = (size_t)entry.size;
+        }
+        texture.width = (int)header.width;
+        texture.height = (int)header.height;
+        texture.components = (int)header.components;
+        texture.compressed = header.compressed != 0;
+        texture.internalFormat = header.internalFormat;
+        texture.format = header.format;
+        texture.type = header.type;
+        texture.levels.swap(levels);
+        return true;
+    }
+    // the cold path: decode, build mips, encode, then write the cache file
+    // (via a temporary, so a crash never leaves a partial one behind). the
+    // texture is served from the in-memory copy, even if writing failed
+    // ------------------------------------------------------------------------
+    static void bake(CachedTexture &texture, const Mapping &source, const TextureCacheSettings &settings, uint64_t key, const std::string &blobPath)
+    {
+        int width = 0, height = 0, channels = 0;
+        unsigned char *pixels;
+        {
+            // the calling thread's own flip setting comes back afterwards
+            FlipOnLoad flip(settings.flipVertically);
+            pixels = stbi_load_from_memory(source.data, (int)source.size, &width, &height, &channels, settings.desiredChannels);
+        }
+        if (!pixels)
+        {
+            texture.error = stbi_failure_reason() ? stbi_failure_reason() : "unknown error";
+            return;
+        }
+        const int components = settings.desiredChannels ? settings.desiredChannels : channels;
+        MipOptions options = settings.mips;
+        options.srgb = settings.srgb;
+        if (!settings.mipmaps)
+            options.maxLevels = 1;
+        MipChain chain = MipGenerator::generate(pixels, width, height, components, options);
+        stbi_image_free(pixels);
+
+        BlobHeader header = {};
+        std::memcpy(header.magic, "TXCB", 4);
+        header.version = Version;
+        header.key = key;
+        header.width = (uint32_t)width;
+        header.height = (uint32_t)height;
+        header.components = (uint32_t)components;
+        std::vector<std::pair<const unsigned char *, size_t>> levelData;
+        std::vector<std::pair<int, int>> sizes;
+        CompressedTexture blocks;
+        if (settings.encoding == CacheEncoding::Raw)
+        {
+            static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+            static const GLenum linear[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+            static const GLenum srgb[] = { GL_R8, GL_RG8, GL_SRGB8, GL_SRGB8_ALPHA8 };
+            header.internalFormat = (settings.srgb ? srgb : linear)[components - 1];
+            header.format = formats[components - 1];
+            header.type = GL_UNSIGNED_BYTE;
+            for (const MipLevel &level : chain.levels)
+            {
+                levelData.emplace_back(level.pixels.data(), level.pixels.size());
+                sizes.emplace_back(level.width, level.height);
+            }
+        }
+        else
+        {
+            static const BlockFormat blockFormats[] = { BlockFormat::BC1, BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC7 };
+            blocks = TextureCompressor::compress(chain, blockFormats[(int)settings.encoding], settings.srgb, settings.mips.threadCount);
+            header.compressed = 1;
+            header.internalFormat = blocks.glInternalFormat();
+            for (const CompressedLevel &level : blocks.levels)
+            {
+                levelData.emplace_back(level.data.data(), level.data.size());
+                sizes.emplace_back(level.width, level.height);
+            }
+        }
+        header.levelCount = (uint32_t)levelData.size();
+
+        auto blob = std::make_shared<std::vector<unsigned char>>();
+        size_t offset = (sizeof(header) + levelData.size() * sizeof(BlobLevel) + 15) & ~(size_t)15;
+        std::vector<BlobLevel> entries;
+        for (size_t i = 0; i < levelData.size(); ++i)
+        {
+            entries.push_back(BlobLevel{ (uint32_t)sizes[i].first, (uint32_t)sizes[i].second, offset, levelData[i].second });
+            offset = (offset + levelData[i].second + 15) & ~(size_t)15;
+        }
+        blob->assign(offset, 0);
+        std::memcpy(blob->data(), &header, sizeof(header));
+        std::memcpy(blob->data() + sizeof(header), entries.data(), entries.size() * sizeof(BlobLevel));
+        for (size_t i = 0; i < levelData.size(); ++i)
+            std::memcpy(blob->data() + entries[i].offset, levelData[i].first, levelData[i].second);
+
+        parse(texture, blob->data(), blob->size(), key);
+        texture.storage = blob;
+
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(blobPath).parent_path(), ec);
+        const std::string temporary = blobPath + ".tmp";
+        FILE *file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return;
+        const bool written = std::fwrite(blob->data(), 1, blob->size(), file) == blob->size();
+        if (std::fclose(file) == 0 && written)
+            std::filesystem::rename(temporary, blobPath, ec);
+        else
+            std::filesystem::remove(temporary, ec);
+    }
+
+    std::string root;
+    Stats counters;
+};
+#endif
@@ -0,0 +1,1255 @@
+#ifndef TEXTURE_COMPRESSOR_H
+#define TEXTURE_COMPRESSOR_H
+
+// stb_image and parallelFor
+#include "texture_support.h"
+
+#include "mip_generator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_COMPRESSOR_SSE2
+#include <emmintrin.h>
+#endif
+
+// block formats TextureCompressor writes, each 4x4 texels per block
+enum class BlockFormat
+{
+    BC1,    // 8 bytes/block, RGB plus 1-bit alpha (GL_EXT_texture_compression_s3tc DXT1)
+    BC3,    // 16 bytes/block, BC1 colour plus interpolated alpha (s3tc DXT5)
+    BC7     // 16 bytes/block, high quality RGBA (GL_ARB_texture_compression_bptc, core since 4.2)
+};
+
+struct CompressedLevel
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> data;    // blocks left to right, then top to bottom
+};
+
+struct CompressedTexture
+{
+    BlockFormat format = BlockFormat::BC1;
+    bool srgb = false;
+    bool alpha = false;                 // whether the source had an alpha channel
+    std::vector<CompressedLevel> levels;
+    std::string mips;                   // how the chain was built, as cached() records it; may be empty
+    std::string error;
+
+    bool ok() const { return !levels.empty(); }
+    int width() const { return levels.empty() ? 0 : levels[0].width; }
+    int height() const { return levels.empty() ? 0 : levels[0].height; }
+    // the internalformat for glCompressedTexImage2D. BC1 and BC3 need the
+    // s3tc extension (and EXT_texture_sRGB for the sRGB variants), which glad
+    // doesn't load, so the values are spelled out
+    unsigned int glInternalFormat() const
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1: return srgb ? (alpha ? 0x8C4D : 0x8C4C) : (alpha ? 0x83F1 : 0x83F0);
+        case BlockFormat::BC3: return srgb ? 0x8C4F : 0x83F3;
+        default:               return srgb ? 0x8E8D : 0x8E8C;
+        }
+    }
+};
+
+// CPU block compression for textures that would otherwise go up as raw RGB8
+// or RGBA8 from stbi_load: BC1 is 1/4 (RGBA) to 1/3 (RGB) of that memory and
+// BC3/BC7 1/4 of RGBA. BC1 and BC3 take the fast route: endpoints along the
+// block's principal axis, refined twice by least squares. BC7 is the quality
+// mode: it tries mode 6 (one RGBA line, 16 levels) and then, for opaque
+// blocks, mode 1 on the most promising of its 64 two-region partitions, or
+// for blocks with alpha, mode 5 (alpha indexed apart from colour), and keeps
+// the best. Blocks are spread over a pool of threads, and the search for each
+// texel's nearest palette entry runs on SSE2 where available.
+//
+// Results can be saved as KTX 1.1 files, which the usual texture tools read,
+// and cached() keeps a compressed copy next to the source image.
+//
+//     CompressedTexture texture = TextureCompressor::cached("container.jpg", BlockFormat::BC7);
+//     for (size_t level = 0; level < texture.levels.size(); ++level)
+//         glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, texture.glInternalFormat(), texture.levels[level].width,
+//                                texture.levels[level].height, 0, (GLsizei)texture.levels[level].data.size(), texture.levels[level].data.data());
+class TextureCompressor
+{
+public:
+    // compress one image of 1-4 components per texel (as from stbi_load);
+    // edge blocks of sizes that aren't multiples of 4 repeat the last texels
+    // ------------------------------------------------------------------------
+    static CompressedLevel compress(const unsigned char *pixels, int width, int height, int components, BlockFormat format, unsigned int threadCount = 0)
+    {
+        CompressedLevel level;
+        level.width = width;
+        level.height = height;
+        if (!pixels || width <= 0 || height <= 0 || components < 1 || components > 4)
+            return level;
+        const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        const size_t blockBytes = format == BlockFormat::BC1 ? 8 : 16;
+        level.data.assign((size_t)blocksX * blocksY * blockBytes, 0);
+        parallelFor((size_t)blocksY, (size_t)blocksX * blocksY < 64 ? 1 : threadCount, [&](size_t by)
+        {
+            uint8_t block[64];
+            for (int bx = 0; bx < blocksX; ++bx)
+            {
+                loadBlock(block, pixels, width, height, components, bx * 4, (int)by * 4);
+                unsigned char *out = level.data.data() + (by * blocksX + bx) * blockBytes;
+                switch (format)
+                {
+                case BlockFormat::BC1: encodeBC1(out, block, components == 2 || components == 4); break;
+                case BlockFormat::BC3: encodeBC3(out, block); break;
+                case BlockFormat::BC7: encodeBC7(out, block); break;
+                }
+            }
+        });
+        return level;
+    }
+    // compress every level of a mip chain
+    // ------------------------------------------------------------------------
+    static CompressedTexture compress(const MipChain &chain, BlockFormat format, bool srgb = false, unsigned int threadCount = 0)
+    {
+        CompressedTexture texture;
+        texture.format = format;
+        texture.srgb = srgb;
+        texture.alpha = chain.components == 2 || chain.components == 4;
+        for (const MipLevel &level : chain.levels)
+            texture.levels.push_back(compress(level.pixels.data(), level.width, level.height, chain.components, format, threadCount));
+        return texture;
+    }
+    // decode a level back to RGBA8, to measure quality. BC7 decoding covers
+    // the modes this encoder writes (1, 5 and 6); other blocks come out black
+    // ------------------------------------------------------------------------
+    static std::vector<unsigned char> decompress(const CompressedLevel &level, BlockFormat format)
+    {
+        std::vector<unsigned char> rgba((size_t)level.width * level.height * 4, 0);
+        const int blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+        const size_t blockBytes = format == BlockFormat::BC1 ? 8 : 16;
+        if (level.data.size() < (size_t)blocksX * blocksY * blockBytes)
+            return rgba;
+        for (int by = 0; by < blocksY; ++by)
+            for (int bx = 0; bx < blocksX; ++bx)
+            {
+                uint8_t block[64];
+                const unsigned char *in = level.data.data() + ((size_t)by * blocksX + bx) * blockBytes;
+                switch (format)
+                {
+                case BlockFormat::BC1: decodeBC1(block, in, true); break;
+                case BlockFormat::BC3: decodeBC3(block, in); break;
+                case BlockFormat::BC7: decodeBC7(block, in); break;
+                }
+                for (int y = 0; y < 4 && by * 4 + y < level.height; ++y)
+                    for (int x = 0; x < 4 && bx * 4 + x < level.width; ++x)
+                        std::memcpy(&rgba[((size_t)(by * 4 + y) * level.width + bx * 4 + x) * 4], block + (y * 4 + x) * 4, 4);
+            }
+        return rgba;
+    }
+    // peak signal-to-noise ratio in dB over 'channels' bytes per texel of two
+    // images laid out alike; 99 for identical images
+    // ------------------------------------------------------------------------
+    static double psnr(const unsigned char *a, int aStride, const unsigned char *b, int bStride, size_t texels, int channels)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < texels; ++i)
+            for (int c = 0; c < channels; ++c)
+            {
+                const double d = (double)a[i * aStride + c] - b[i * bStride + c];
+                sum += d * d;
+            }
+        if (sum == 0.0)
+            return 99.0;
+        return 10.0 * std::log10(255.0 * 255.0 * texels * channels / sum);
+    }
+
+    // writes KTX 1.1; a non-empty texture.mips goes in as the value of a
+    // "mips" key
+    // ------------------------------------------------------------------------
+    static bool saveKtx(const CompressedTexture &texture, const std::string &path)
+    {
+        FILE *file = std::fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        std::vector<unsigned char> keyValues;
+        if (!texture.mips.empty())
+        {
+            const uint32_t pairBytes = (uint32_t)(sizeof(MipsKey) + texture.mips.size() + 1);
+            keyValues.resize(4 + ((pairBytes + 3) & ~3u), 0);
+            std::memcpy(keyValues.data(), &pairBytes, 4);
+            std::memcpy(keyValues.data() + 4, MipsKey, sizeof(MipsKey));
+            std::memcpy(keyValues.data() + 4 + sizeof(MipsKey), texture.mips.c_str(), texture.mips.size() + 1);
+        }
+        const uint32_t header[13] = { 0x04030201, 0, 1, 0, texture.glInternalFormat(), texture.alpha || texture.format != BlockFormat::BC1 ? 0x1908u : 0x1907u,
+                                      (uint32_t)texture.width(), (uint32_t)texture.height(), 0, 0, 1, (uint32_t)texture.levels.size(),
+                                      (uint32_t)keyValues.size() };
+        bool ok = std::fwrite(ktxIdentifier(), 1, 12, file) == 12 && std::fwrite(header, 4, 13, file) == 13 &&
+                  std::fwrite(keyValues.data(), 1, keyValues.size(), file) == keyValues.size();
+        for (const CompressedLevel &level : texture.levels)
+        {
+            const uint32_t size = (uint32_t)level.data.size();
+            ok = ok && std::fwrite(&size, 4, 1, file) == 1 && std::fwrite(level.data.data(), 1, size, file) == size;
+        }
+        return std::fclose(file) == 0 && ok;
+    }
+    // reads KTX 1.1 files as saveKtx writes them: one 2D texture in one of the
+    // three block formats, native byte order. the level count and every
+    // level's length are checked against the image size and the file size
+    // before anything is allocated
+    // ------------------------------------------------------------------------
+    static CompressedTexture loadKtx(const std::string &path)
+    {
+        CompressedTexture texture;
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            texture.error = "can't open " + path;
+            return texture;
+        }
+        std::fseek(file, 0, SEEK_END);
+        const long fileBytes = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+        unsigned char identifier[12];
+        uint32_t header[13];
+        if (std::fread(identifier, 1, 12, file) != 12 || std::memcmp(identifier, ktxIdentifier(), 12) != 0 ||
+            std::fread(header, 4, 13, file) != 13 || header[0] != 0x04030201 || !formatOf(header[4], texture) ||
+            header[6] == 0 || header[6] > MaxDimension || header[7] > MaxDimension ||
+            header[11] > (uint32_t)MipGenerator::levels((int)header[6], (int)std::max(1u, header[7])) ||
+            fileBytes < 0 || header[12] > (uint64_t)fileBytes - std::ftell(file))
+        {
+            std::fclose(file);
+            texture.error = "not a block-compressed KTX file";
+            return texture;
+        }
+        std::vector<unsigned char> keyValues(header[12]);
+        if (std::fread(keyValues.data(), 1, keyValues.size(), file) != keyValues.size())
+            keyValues.clear();
+        texture.mips = findKtxValue(keyValues, MipsKey);
+        const size_t blockBytes = texture.format == BlockFormat::BC1 ? 8 : 16;
+        int width = (int)header[6], height = (int)std::max(1u, header[7]);
+        for (uint32_t i = 0; i < std::max(1u, header[11]); ++i)
+        {
+            CompressedLevel level;
+            level.width = width;
+            level.height = height;
+            uint32_t size = 0;
+            if (std::fread(&size, 4, 1, file) != 1 || size != (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes ||
+                size > (uint64_t)fileBytes - std::ftell(file))
+                break;
+            level.data.resize(size);
+            if (std::fread(level.data.data(), 1, size, file) != size)
+                break;
+            texture.levels.push_back(std::move(level));
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        std::fclose(file);
+        if (texture.levels.size() != std::max(1u, header[11]))
+        {
+            texture.levels.clear();
+            texture.error = "truncated KTX file";
+        }
+        return texture;
+    }
+    // load the compressed texture for an image file from <path>.<format>.ktx
+    // next to it when that is newer than the image and was built with the
+    // same srgb and MipOptions (recorded in the file); otherwise decode the
+    // image (flipped for OpenGL), build its mips, compress and save them there
+    // ------------------------------------------------------------------------
+    static CompressedTexture cached(const std::string &path, BlockFormat format, bool srgb = false, const MipOptions &mips = MipOptions(), unsigned int threadCount = 0)
+    {
+        static const char *const suffixes[] = { ".bc1.ktx", ".bc3.ktx", ".bc7.ktx" };
+        const std::string cachePath = path + suffixes[(int)format];
+        MipOptions options = mips;
+        options.srgb = srgb;
+        options.threadCount = threadCount;
+        const std::string described = describe(options);
+        std::error_code ec, cacheEc;
+        const auto sourceTime = std::filesystem::last_write_time(path, ec);
+        const auto cacheTime = std::filesystem::last_write_time(cachePath, cacheEc);
+        if (!ec && !cacheEc && cacheTime >= sourceTime)
+        {
+            CompressedTexture texture = loadKtx(cachePath);
+            if (texture.ok() && texture.format == format && texture.srgb == srgb && texture.mips == described)
+                return texture;
+        }
+
+        CompressedTexture texture;
+        texture.format = format;
+        int width = 0, height = 0, components = 0;
+        unsigned char *pixels;
+        {
+            // flipped regardless of stbi_set_flip_vertically_on_load, which
+            // is left as it was
+            FlipOnLoad flip(true);
+            pixels = stbi_load(path.c_str(), &width, &height, &components, 0);
+        }
+        if (!pixels)
+        {
+            texture.error = stbi_failure_reason() ? stbi_failure_reason() : "unknown error";
+            return texture;
+        }
+        texture = compress(MipGenerator::generate(pixels, width, height, components, options), format, srgb, threadCount);
+        stbi_image_free(pixels);
+        texture.mips = described;
+        saveKtx(texture, cachePath);
+        return texture;
+    }
+
+private:
+    static constexpr char MipsKey[] = "mips";
+    static const uint32_t MaxDimension = 1 << 24;
+
+    // the MipOptions that change the chain (threadCount doesn't), as text for
+    // the KTX key/value data
+    // ------------------------------------------------------------------------
+    static std::string describe(const MipOptions &options)
+    {
+        char text[96];
+        std::snprintf(text, sizeof(text), "filter %d wrap %d srgb %d cutoff %.9g levels %d", (int)options.filter, (int)options.wrap,
+                      options.srgb ? 1 : 0, (double)options.alphaCutoff, options.maxLevels);
+        return text;
+    }
+    // the value stored under 'key' in KTX key/value data, or "" if absent
+    // or malformed
+    // ------------------------------------------------------------------------
+    static std::string findKtxValue(const std::vector<unsigned char> &keyValues, const char *key)
+    {
+        const size_t keyBytes = std::strlen(key) + 1;
+        size_t at = 0;
+        while (keyValues.size() - at >= 4)
+        {
+            uint32_t pairBytes;
+            std::memcpy(&pairBytes, keyValues.data() + at, 4);
+            at += 4;
+            if (pairBytes > keyValues.size() - at)
+                break;
+            const char *pair = (const char *)keyValues.data() + at;
+            if (pairBytes > keyBytes && std::memcmp(pair, key, keyBytes) == 0)
+                return std::string(pair + keyBytes, std::find(pair + keyBytes, pair + pairBytes, '\0'));
+            at += (pairBytes + 3) & ~(size_t)3;
+            if (at > keyValues.size())
+                break;
+        }
+        return std::string();
+    }
+    // ------------------------------------------------------------------------
+    static const unsigned char *ktxIdentifier()
+    {
+        static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        return identifier;
+    }
+    // ------------------------------------------------------------------------
+    static bool formatOf(uint32_t internalFormat, CompressedTexture &texture)
+    {
+        switch (internalFormat)
+        {
+        case 0x83F0: texture.format = BlockFormat::BC1; texture.srgb = false; texture.alpha = false; return true;
+        case 0x83F1: texture.format = BlockFormat::BC1; texture.srgb = false; texture.alpha = true;  return true;
+        case 0x8C4C: texture.format = BlockFormat::BC1; texture.srgb = true;  texture.alpha = false; return true;
+        case 0x8C4D: texture.format = BlockFormat::BC1; texture.srgb = true;  texture.alpha = true;  return true;
+        case 0x83F3: texture.format = BlockFormat::BC3; texture.srgb = false; texture.alpha = true;  return true;
+        case 0x8C4F: texture.format = BlockFormat::BC3; texture.srgb = true;  texture.alpha = true;  return true;
+        case 0x8E8C: texture.format = BlockFormat::BC7; texture.srgb = false; texture.alpha = true;  return true;
+        case 0x8E8D: texture.format = BlockFormat::BC7; texture.srgb = true;  texture.alpha = true;  return true;
+        default:     return false;
+        }
+    }
+    // the 4x4 texels at (x, y) as RGBA, clamped at the image edges
+    // ------------------------------------------------------------------------
+    static void loadBlock(uint8_t *block, const unsigned char *pixels, int width, int height, int components, int x, int y)
+    {
+        for (int j = 0; j < 4; ++j)
+            for (int i = 0; i < 4; ++i, block += 4)
+            {
+                const unsigned char *p = pixels + ((size_t)std::min(y + j, height - 1) * width + std::min(x + i, width - 1)) * components;
+                if (components >= 3)
+                {
+                    block[0] = p[0];
+                    block[1] = p[1];
+                    block[2] = p[2];
+                }
+                else
+                    block[0] = block[1] = block[2] = p[0];
+                block[3] = components == 2 || components == 4 ? p[components - 1] : 255;
+            }
+    }
+
+    // nearest of 'count' RGBA palette entries for each of the 16 texels, by
+    // squared distance; returns the per-texel errors in 'errors'
+    // ------------------------------------------------------------------------
+    static void nearest(const uint8_t *block, const uint8_t (*palette)[4], int count, uint8_t *indices, uint32_t *errors)
+    {
+#if defined(TEXTURE_COMPRESSOR_SSE2)
+        // texels as 16-bit lanes, two per register
+        const __m128i zero = _mm_setzero_si128();
+        __m128i texels[8];
+        for (int i = 0; i < 4; ++i)
+        {
+            const __m128i bytes = _mm_loadu_si128((const __m128i *)(block + i * 16));
+            texels[i * 2] = _mm_unpacklo_epi8(bytes, zero);
+            texels[i * 2 + 1] = _mm_unpackhi_epi8(bytes, zero);
+        }
+        __m128i best[4], bestIndex[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            best[i] = _mm_set1_epi32(0x7fffffff);
+            bestIndex[i] = zero;
+        }
+        for (int p = 0; p < count; ++p)
+        {
+            uint32_t packed;
+            std::memcpy(&packed, palette[p], 4);
+            const __m128i entry = _mm_unpacklo_epi8(_mm_set1_epi32((int)packed), zero);
+            const __m128i index = _mm_set1_epi32(p);
+            for (int i = 0; i < 4; ++i)
+            {
+                // [rg, ba] sums for texels 4i..4i+3, then folded to one per texel
+                const __m128i d0 = _mm_sub_epi16(texels[i * 2], entry), d1 = _mm_sub_epi16(texels[i * 2 + 1], entry);
+                const __m128 s0 = _mm_castsi128_ps(_mm_madd_epi16(d0, d0)), s1 = _mm_castsi128_ps(_mm_madd_epi16(d1, d1));
+                const __m128i error = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0))),
+                                                    _mm_castps_si128(_mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1))));
+                const __m128i closer = _mm_cmplt_epi32(error, best[i]);
+                best[i] = _mm_or_si128(_mm_and_si128(closer, error), _mm_andnot_si128(closer, best[i]));
+                bestIndex[i] = _mm_or_si128(_mm_and_si128(closer, index), _mm_andnot_si128(closer, bestIndex[i]));
+            }
+        }
+        uint32_t idx[16];
+        for (int i = 0; i < 4; ++i)
+        {
+            _mm_storeu_si128((__m128i *)(errors + i * 4), best[i]);
+            _mm_storeu_si128((__m128i *)(idx + i * 4), bestIndex[i]);
+        }
+        for (int i = 0; i < 16; ++i)
+            indices[i] = (uint8_t)idx[i];
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            const uint8_t *t = block + i * 4;
+            uint32_t best = 0xffffffff;
+            for (int p = 0; p < count; ++p)
+            {
+                uint32_t error = 0;
+                for (int c = 0; c < 4; ++c)
+                {
+                    const int d = (int)t[c] - palette[p][c];
+                    error += (uint32_t)(d * d);
+                }
+                if (error < best)
+                {
+                    best = error;
+                    indices[i] = (uint8_t)p;
+                }
+            }
+            errors[i] = best;
+        }
+#endif
+    }
+    // endpoints spanning the texels in 'mask' along their principal axis, over
+    // the first 'channels' channels (the rest copy the mean)
+    // ------------------------------------------------------------------------
+    static void principalEndpoints(const uint8_t *block, uint32_t mask, int channels, float *e0, float *e1)
+    {
+        float mean[4] = {}, n = 0.0f;
+        for (int i = 0; i < 16; ++i)
+            if (mask >> i & 1)
+            {
+                for (int c = 0; c < 4; ++c)
+                    mean[c] += block[i * 4 + c];
+                n += 1.0f;
+            }
+        for (int c = 0; c < 4; ++c)
+            mean[c] = n > 0.0f ? mean[c] / n : 0.0f;
+        float cov[4][4] = {};
+        for (int i = 0; i < 16; ++i)
+            if (mask >> i & 1)
+                for (int a = 0; a < channels; ++a)
+                    for (int b = 0; b < channels; ++b)
+                        cov[a][b] += (block[i * 4 + a] - mean[a]) * (block[i * 4 + b] - mean[b]);
+        float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = {}, length = 0.0f;
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = 0; b < channels; ++b)
+                    next[a] += cov[a][b] * axis[b];
+                length = std::max(length, std::fabs(next[a]));
+            }
+            if (length < 1e-6f)
+                break;
+            for (int a = 0; a < channels; ++a)
+                axis[a] = next[a] / length;
+        }
+        float low = 0.0f, high = 0.0f, norm = 0.0f;
+        for (int a = 0; a < channels; ++a)
+            norm += axis[a] * axis[a];
+        if (norm > 0.0f)
+            for (int i = 0; i < 16; ++i)
+                if (mask >> i & 1)
+                {
+                    float t = 0.0f;
+                    for (int a = 0; a < channels; ++a)
+                        t += (block[i * 4 + a] - mean[a]) * axis[a];
+                    low = std::min(low, t / norm);
+                    high = std::max(high, t / norm);
+                }
+        for (int c = 0; c < 4; ++c)
+        {
+            const float direction = c < channels ? axis[c] : 0.0f;
+            e0[c] = std::min(std::max(mean[c] + direction * low, 0.0f), 255.0f);
+            e1[c] = std::min(std::max(mean[c] + direction * high, 0.0f), 255.0f);
+        }
+    }
+    // sum of squared distances of a region's texels from their best-fit line,
+    // from its RGB moments (sums of r, g, b, rr, rg, rb, gg, gb, bb): the
+    // spread (covariance trace) less the part along the principal axis
+    // ------------------------------------------------------------------------
+    static float lineError(const float *sums, float n)
+    {
+        if (n < 2.0f)
+            return 0.0f;
+        const float cov[3][3] = {
+            { sums[3] - sums[0] * sums[0] / n, sums[4] - sums[0] * sums[1] / n, sums[5] - sums[0] * sums[2] / n },
+            { sums[4] - sums[0] * sums[1] / n, sums[6] - sums[1] * sums[1] / n, sums[7] - sums[1] * sums[2] / n },
+            { sums[5] - sums[0] * sums[2] / n, sums[7] - sums[1] * sums[2] / n, sums[8] - sums[2] * sums[2] / n } };
+        float axis[3] = { 1.0f, 1.0f, 1.0f }, largest = 0.0f;
+        for (int iteration = 0; iteration < 4; ++iteration)
+        {
+            float next[3], length = 0.0f;
+            for (int a = 0; a < 3; ++a)
+            {
+                next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+                length += next[a] * next[a];
+            }
+            if (length < 1e-12f)
+                break;
+            length = std::sqrt(length);
+            for (int a = 0; a < 3; ++a)
+                axis[a] = next[a] / length;
+            largest = length;
+        }
+        return std::max(0.0f, cov[0][0] + cov[1][1] + cov[2][2] - largest);
+    }
+    // least-squares endpoints for the texels in 'mask' given their indices;
+    // weights[i] is where index i sits between e0 (0) and e1 (1)
+    // ------------------------------------------------------------------------
+    static void refit(const uint8_t *block, uint32_t mask, const uint8_t *indices, const float *weights, int channels, float *e0, float *e1)
+    {
+        float a = 0.0f, b = 0.0f, c = 0.0f, x0[4] = {}, x1[4] = {};
+        for (int i = 0; i < 16; ++i)
+            if (mask >> i & 1)
+            {
+                const float w = weights[indices[i]], v = 1.0f - w;
+                a += v * v;
+                b += v * w;
+                c += w * w;
+                for (int k = 0; k < channels; ++k)
+                {
+                    x0[k] += v * block[i * 4 + k];
+                    x1[k] += w * block[i * 4 + k];
+                }
+            }
+        const float det = a * c - b * b;
+        if (std::fabs(det) < 1e-3f)
+            return;
+        for (int k = 0; k < channels; ++k)
+        {
+            e0[k] = std::min(std::max((c * x0[k] - b * x1[k]) / det, 0.0f), 255.0f);
+            e1[k] = std::min(std::max((a * x1[k] - b * x0[k]) / det, 0.0f), 255.0f);
+        }
+    }
+
+    // BC1 ----------------------------------------------------------------------
+    static uint16_t to565(const float *c)
+    {
+        const int r = (int)(c[0] * 31.0f / 255.0f + 0.5f), g = (int)(c[1] * 63.0f / 255.0f + 0.5f), b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)(r << 11 | g << 5 | b);
+    }
+    static void from565(uint8_t *out, uint16_t c)
+    {
+        const int r = c >> 11, g = c >> 5 & 63, b = c & 31;
+        out[0] = (uint8_t)(r << 3 | r >> 2);
+        out[1] = (uint8_t)(g << 2 | g >> 4);
+        out[2] = (uint8_t)(b << 3 | b >> 2);
+        out[3] = 255;
+    }
+    static void paletteBC1(uint8_t (*palette)[4], uint16_t c0, uint16_t c1, bool fourColours)
+    {
+        from565(palette[0], c0);
+        from565(palette[1], c1);
+        for (int c = 0; c < 3; ++c)
+        {
+            if (fourColours)
+            {
+                palette[2][c] = (uint8_t)((2 * palette[0][c] + palette[1][c]) / 3);
+                palette[3][c] = (uint8_t)((palette[0][c] + 2 * palette[1][c]) / 3);
+            }
+            else
+            {
+                palette[2][c] = (uint8_t)((palette[0][c] + palette[1][c]) / 2);
+                palette[3][c] = 0;
+            }
+        }
+        palette[2][3] = 255;
+        palette[3][3] = fourColours ? 255 : 0;
+    }
+    // colour block; with punchThrough, texels with alpha below 128 become
+    // transparent black (three-colour mode). BC3 passes false: its colour
+    // block is always read in four-colour mode
+    // ------------------------------------------------------------------------
+    static void encodeBC1(unsigned char *out, const uint8_t *source, bool punchThrough)
+    {
+        uint8_t block[64];
+        uint32_t opaque = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            std::memcpy(block + i * 4, source + i * 4, 3);
+            block[i * 4 + 3] = 255;
+            if (!punchThrough || source[i * 4 + 3] >= 128)
+                opaque |= 1u << i;
+        }
+        const bool fourColours = opaque == 0xffff;
+        if (opaque == 0)
+        {
+            const uint32_t allTransparent = 0xffffffff;
+            std::memset(out, 0, 4);
+            std::memcpy(out + 4, &allTransparent, 4);
+            return;
+        }
+
+        static const float weights4[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        static const float weights3[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+        float e0[4], e1[4];
+        principalEndpoints(block, opaque, 3, e0, e1);
+        uint64_t bestError = ~0ull;
+        uint16_t bestC0 = 0, bestC1 = 0;
+        uint8_t bestIndices[16] = {};
+        for (int iteration = 0; iteration < 3; ++iteration)
+        {
+            uint16_t c0 = to565(e0), c1 = to565(e1);
+            // four-colour mode needs c0 > c1 and three-colour c0 <= c1
+            if (fourColours ? c0 < c1 : c0 > c1)
+            {
+                std::swap(c0, c1);
+                std::swap(e0, e1);
+            }
+            uint8_t palette[4][4], indices[16];
+            uint32_t errors[16];
+            paletteBC1(palette, c0, c1, fourColours);
+            nearest(block, palette, fourColours ? 4 : 3, indices, errors);
+            uint64_t error = 0;
+            for (int i = 0; i < 16; ++i)
+                if (opaque >> i & 1)
+                    error += errors[i];
+                else
+                    indices[i] = 3;
+            if (error < bestError)
+            {
+                bestError = error;
+                bestC0 = c0;
+                bestC1 = c1;
+                std::memcpy(bestIndices, indices, 16);
+            }
+            if (error == 0 || c0 == c1)
+                break;
+            refit(block, opaque, indices, fourColours ? weights4 : weights3, 3, e0, e1);
+        }
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; ++i)
+            bits |= (uint32_t)bestIndices[i] << (i * 2);
+        out[0] = (unsigned char)bestC0;
+        out[1] = (unsigned char)(bestC0 >> 8);
+        out[2] = (unsigned char)bestC1;
+        out[3] = (unsigned char)(bestC1 >> 8);
+        std::memcpy(out + 4, &bits, 4);
+    }
+    static void decodeBC1(uint8_t *block, const unsigned char *in, bool allowThreeColour)
+    {
+        const uint16_t c0 = (uint16_t)(in[0] | in[1] << 8), c1 = (uint16_t)(in[2] | in[3] << 8);
+        uint32_t bits;
+        std::memcpy(&bits, in + 4, 4);
+        uint8_t palette[4][4];
+        paletteBC1(palette, c0, c1, c0 > c1 || !allowThreeColour);
+        for (int i = 0; i < 16; ++i)
+            std::memcpy(block + i * 4, palette[bits >> (i * 2) & 3], 4);
+    }
+
+    // BC3 ----------------------------------------------------------------------
+    static void paletteAlpha(uint8_t *palette, uint8_t a0, uint8_t a1)
+    {
+        palette[0] = a0;
+        palette[1] = a1;
+        if (a0 > a1)
+            for (int i = 1; i < 7; ++i)
+                palette[i + 1] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+        else
+        {
+            for (int i = 1; i < 5; ++i)
+                palette[i + 1] = (uint8_t)(((5 - i) * a0 + i * a1) / 5);
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+    // alpha block: the eight-value ramp between the extremes, or the six-value
+    // one between the extremes other than 0 and 255 when those appear exactly
+    // ------------------------------------------------------------------------
+    static void encodeAlpha(unsigned char *out, const uint8_t *block)
+    {
+        int low = 255, high = 0, innerLow = 255, innerHigh = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            const int a = block[i * 4 + 3];
+            low = std::min(low, a);
+            high = std::max(high, a);
+            if (a != 0 && a != 255)
+            {
+                innerLow = std::min(innerLow, a);
+                innerHigh = std::max(innerHigh, a);
+            }
+        }
+        const uint8_t candidates[2][2] = { { (uint8_t)high, (uint8_t)low }, { (uint8_t)std::min(innerLow, innerHigh), (uint8_t)innerHigh } };
+        uint32_t bestError = 0xffffffff;
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            if (mode == 1 && (innerLow > innerHigh || (low != 0 && high != 255)))
+                break;
+            uint8_t palette[8], indices[16];
+            paletteAlpha(palette, candidates[mode][0], candidates[mode][1]);
+            uint32_t error = 0;
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 256 * 256;
+                for (int p = 0; p < 8; ++p)
+                {
+                    const int d = (int)block[i * 4 + 3] - palette[p];
+                    if (d * d < best)
+                    {
+                        best = d * d;
+                        indices[i] = (uint8_t)p;
+                    }
+                }
+                error += (uint32_t)best;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                out[0] = palette[0];
+                out[1] = palette[1];
+                uint64_t bits = 0;
+                for (int i = 0; i < 16; ++i)
+                    bits |= (uint64_t)indices[i] << (i * 3);
+                for (int i = 0; i < 6; ++i)
+                    out[2 + i] = (unsigned char)(bits >> (i * 8));
+            }
+        }
+    }
+    static void encodeBC3(unsigned char *out, const uint8_t *block)
+    {
+        encodeAlpha(out, block);
+        encodeBC1(out + 8, block, false);
+    }
+    static void decodeBC3(uint8_t *block, const unsigned char *in)
+    {
+        decodeBC1(block, in + 8, false);
+        uint8_t palette[8];
+        paletteAlpha(palette, in[0], in[1]);
+        uint64_t bits = 0;
+        for (int i = 0; i < 6; ++i)
+            bits |= (uint64_t)in[2 + i] << (i * 8);
+        for (int i = 0; i < 16; ++i)
+            block[i * 4 + 3] = palette[bits >> (i * 3) & 7];
+    }
+
+    // BC7 ----------------------------------------------------------------------
+    // subset of each texel (bit i) for the 64 two-region partitions, and the
+    // texel whose index drops its top bit in the second region
+    static const uint16_t *partitions()
+    {
+        static const uint16_t table[64] = {
+            0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80, 0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+            0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce, 0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+            0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a, 0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+            0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c, 0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22 };
+        return table;
+    }
+    static const uint8_t *anchors()
+    {
+        static const uint8_t table[64] = {
+            15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+            15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+            15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+             6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15 };
+        return table;
+    }
+    static const int *weights(int bits)
+    {
+        static const int two[4] = { 0, 21, 43, 64 };
+        static const int three[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+        static const int four[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+        return bits == 2 ? two : bits == 3 ? three : four;
+    }
+    static uint8_t interpolate(int e0, int e1, int weight)
+    {
+        return (uint8_t)(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+    }
+
+    struct BitWriter
+    {
+        unsigned char *out;
+        int position = 0;
+        void put(uint32_t value, int bits)
+        {
+            for (int i = 0; i < bits; ++i, ++position)
+                out[position >> 3] |= (unsigned char)((value >> i & 1) << (position & 7));
+        }
+    };
+    struct BitReader
+    {
+        const unsigned char *in;
+        int position = 0;
+        uint32_t get(int bits)
+        {
+            uint32_t value = 0;
+            for (int i = 0; i < bits; ++i, ++position)
+                value |= (uint32_t)(in[position >> 3] >> (position & 7) & 1) << i;
+            return value;
+        }
+    };
+
+    // endpoints quantized to 'bits' bits plus a p-bit each (or one shared by
+    // the pair): each 8-bit value is (q << 1 | p) widened with its top bits.
+    // picks the p-bits that land closest and returns the squared error.
+    // keepOpaque allows only p-bits of 1, so alpha 255 stays exactly 255
+    // ------------------------------------------------------------------------
+    static float quantizePair(const float *e0, const float *e1, int channels, int bits, bool sharedPbit, bool keepOpaque, int q[2][4], int p[2], uint8_t out[2][4])
+    {
+        const float *ends[2] = { e0, e1 };
+        const int levels = (1 << bits) - 1, total = bits + 1;
+        float best = 1e30f;
+        p[0] = p[1] = 1;
+        for (int pair = keepOpaque ? 3 : 0; pair < (sharedPbit ? 2 : 4); ++pair)
+        {
+            const int pbits[2] = { sharedPbit ? pair : pair & 1, sharedPbit ? pair : pair >> 1 };
+            float error = 0.0f;
+            int tq[2][4];
+            uint8_t values[2][4];
+            for (int e = 0; e < 2; ++e)
+                for (int c = 0; c < 4; ++c)
+                {
+                    if (c >= channels)
+                    {
+                        tq[e][c] = levels;
+                        values[e][c] = 255;
+                        continue;
+                    }
+                    const float step = 256.0f / (1 << total);
+                    int v = (int)std::floor((ends[e][c] / step - pbits[e]) / 2.0f + 0.5f);
+                    v = std::min(std::max(v, 0), levels);
+                    tq[e][c] = v;
+                    const int full = v << 1 | pbits[e];
+                    values[e][c] = (uint8_t)(full << (8 - total) | full >> (2 * total - 8));
+                    const float d = values[e][c] - ends[e][c];
+                    error += d * d;
+                }
+            if (error < best)
+            {
+                best = error;
+                std::memcpy(q, tq, sizeof(tq));
+                std::memcpy(out, values, sizeof(values));
+                p[0] = pbits[0];
+                p[1] = pbits[1];
+            }
+        }
+        return best;
+    }
+    // mode 6: one region, RGBA 7 bits + p-bit per endpoint, 4-bit indices
+    // ------------------------------------------------------------------------
+    static uint64_t encodeMode6(unsigned char *out, const uint8_t *block, bool opaque)
+    {
+        float e0[4], e1[4], w[16];
+        const int *table = weights(4);
+        for (int i = 0; i < 16; ++i)
+            w[i] = table[i] / 64.0f;
+        principalEndpoints(block, 0xffff, 4, e0, e1);
+        uint64_t bestError = ~0ull;
+        int bestQ[2][4] = {}, bestP[2] = {};
+        uint8_t bestIndices[16] = {};
+        for (int iteration = 0; iteration < 3; ++iteration)
+        {
+            int q[2][4] = {}, p[2] = {};
+            uint8_t ends[2][4], palette[16][4], indices[16];
+            uint32_t errors[16];
+            quantizePair(e0, e1, 4, 7, false, opaque, q, p, ends);
+            for (int i = 0; i < 16; ++i)
+                for (int c = 0; c < 4; ++c)
+                    palette[i][c] = interpolate(ends[0][c], ends[1][c], table[i]);
+            nearest(block, palette, 16, indices, errors);
+            uint64_t error = 0;
+            for (int i = 0; i < 16; ++i)
+                error += errors[i];
+            if (error < bestError)
+            {
+                bestError = error;
+                std::memcpy(bestQ, q, sizeof(q));
+                std::memcpy(bestP, p, sizeof(p));
+                std::memcpy(bestIndices, indices, 16);
+            }
+            if (error == 0)
+                break;
+            refit(block, 0xffff, indices, w, 4, e0, e1);
+        }
+        // the first texel's index must have its top bit clear
+        if (bestIndices[0] & 8)
+        {
+            std::swap(bestQ[0], bestQ[1]);
+            std::swap(bestP[0], bestP[1]);
+            for (uint8_t &index : bestIndices)
+                index = (uint8_t)(15 - index);
+        }
+        std::memset(out, 0, 16);
+        BitWriter bits{ out };
+        bits.put(1 << 6, 7);
+        for (int c = 0; c < 4; ++c)
+        {
+            bits.put((uint32_t)bestQ[0][c], 7);
+            bits.put((uint32_t)bestQ[1][c], 7);
+        }
+        bits.put((uint32_t)bestP[0], 1);
+        bits.put((uint32_t)bestP[1], 1);
+        for (int i = 0; i < 16; ++i)
+            bits.put(bestIndices[i], i == 0 ? 3 : 4);
+        return bestError;
+    }
+    // mode 5: RGB 7 bits and alpha 8 bits per endpoint, with separate 2-bit
+    // indices for colour and alpha, so alpha needn't follow the colour line
+    // ------------------------------------------------------------------------
+    static uint64_t encodeMode5(unsigned char *out, const uint8_t *block)
+    {
+        const int *table = weights(2);
+        float w[4];
+        for (int i = 0; i < 4; ++i)
+            w[i] = table[i] / 64.0f;
+
+        uint8_t colour[64];
+        for (int i = 0; i < 16; ++i)
+        {
+            std::memcpy(colour + i * 4, block + i * 4, 3);
+            colour[i * 4 + 3] = 255;
+        }
+        float e0[4], e1[4];
+        principalEndpoints(colour, 0xffff, 3, e0, e1);
+        uint64_t colourError = ~0ull;
+        int q[2][3] = {};
+        uint8_t colourIndices[16] = {};
+        for (int iteration = 0; iteration < 3; ++iteration)
+        {
+            int tq[2][3];
+            uint8_t palette[4][4], indices[16];
+            uint32_t errors[16];
+            for (int e = 0; e < 2; ++e)
+                for (int c = 0; c < 3; ++c)
+                    tq[e][c] = std::min(127, (int)((e == 0 ? e0 : e1)[c] * 127.0f / 255.0f + 0.5f));
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int c = 0; c < 3; ++c)
+                    palette[i][c] = interpolate(tq[0][c] << 1 | tq[0][c] >> 6, tq[1][c] << 1 | tq[1][c] >> 6, table[i]);
+                palette[i][3] = 255;
+            }
+            nearest(colour, palette, 4, indices, errors);
+            uint64_t error = 0;
+            for (int i = 0; i < 16; ++i)
+                error += errors[i];
+            if (error < colourError)
+            {
+                colourError = error;
+                std::memcpy(q, tq, sizeof(tq));
+                std::memcpy(colourIndices, indices, 16);
+            }
+            if (error == 0)
+                break;
+            refit(colour, 0xffff, indices, w, 3, e0, e1);
+        }
+
+        int a0 = 255, a1 = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            a0 = std::min(a0, (int)block[i * 4 + 3]);
+            a1 = std::max(a1, (int)block[i * 4 + 3]);
+        }
+        uint64_t alphaError = 0;
+        uint8_t alphaIndices[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 256 * 256;
+            for (int k = 0; k < 4; ++k)
+            {
+                const int d = (int)block[i * 4 + 3] - interpolate(a0, a1, table[k]);
+                if (d * d < best)
+                {
+                    best = d * d;
+                    alphaIndices[i] = (uint8_t)k;
+                }
+            }
+            alphaError += (uint64_t)best;
+        }
+
+        // the first texel's indices must have their top bit clear
+        if (colourIndices[0] & 2)
+        {
+            std::swap(q[0], q[1]);
+            for (uint8_t &index : colourIndices)
+                index = (uint8_t)(3 - index);
+        }
+        if (alphaIndices[0] & 2)
+        {
+            std::swap(a0, a1);
+            for (uint8_t &index : alphaIndices)
+                index = (uint8_t)(3 - index);
+        }
+        std::memset(out, 0, 16);
+        BitWriter bits{ out };
+        bits.put(1 << 5, 6);
+        bits.put(0, 2);
+        for (int c = 0; c < 3; ++c)
+        {
+            bits.put((uint32_t)q[0][c], 7);
+            bits.put((uint32_t)q[1][c], 7);
+        }
+        bits.put((uint32_t)a0, 8);
+        bits.put((uint32_t)a1, 8);
+        for (int i = 0; i < 16; ++i)
+            bits.put(colourIndices[i], i == 0 ? 1 : 2);
+        for (int i = 0; i < 16; ++i)
+            bits.put(alphaIndices[i], i == 0 ? 1 : 2);
+        return colourError + alphaError;
+    }
+    // mode 1: two regions, RGB 6 bits + a p-bit per region, 3-bit indices
+    // ------------------------------------------------------------------------
+    static uint64_t encodeMode1(unsigned char *out, const uint8_t *block, int partition)
+    {
+        const uint32_t masks[2] = { (uint32_t)(~partitions()[partition] & 0xffff), partitions()[partition] };
+        const int *table = weights(3);
+        float w[8];
+        for (int i = 0; i < 8; ++i)
+            w[i] = table[i] / 64.0f;
+        uint64_t total = 0;
+        int q[2][2][4] = {}, p[2] = {};
+        uint8_t indices[16] = {};
+        for (int s = 0; s < 2; ++s)
+        {
+            float e0[4], e1[4];
+            principalEndpoints(block, masks[s], 3, e0, e1);
+            uint64_t bestError = ~0ull;
+            for (int iteration = 0; iteration < 3; ++iteration)
+            {
+                int tq[2][4] = {}, tp[2] = {};
+                uint8_t ends[2][4], palette[8][4], subsetIndices[16];
+                uint32_t errors[16];
+                quantizePair(e0, e1, 3, 6, true, false, tq, tp, ends);
+                for (int i = 0; i < 8; ++i)
+                    for (int c = 0; c < 4; ++c)
+                        palette[i][c] = interpolate(ends[0][c], ends[1][c], table[i]);
+                nearest(block, palette, 8, subsetIndices, errors);
+                uint64_t error = 0;
+                for (int i = 0; i < 16; ++i)
+                    if (masks[s] >> i & 1)
+                        error += errors[i];
+                if (error < bestError)
+                {
+                    bestError = error;
+                    std::memcpy(q[s], tq, sizeof(tq));
+                    p[s] = tp[0];
+                    for (int i = 0; i < 16; ++i)
+                        if (masks[s] >> i & 1)
+                            indices[i] = subsetIndices[i];
+                }
+                if (error == 0)
+                    break;
+                refit(block, masks[s], subsetIndices, w, 3, e0, e1);
+            }
+            total += bestError;
+        }
+        // each region's anchor texel must have its index's top bit clear
+        const int anchor[2] = { 0, anchors()[partition] };
+        for (int s = 0; s < 2; ++s)
+            if (indices[anchor[s]] & 4)
+            {
+                std::swap(q[s][0], q[s][1]);
+                for (int i = 0; i < 16; ++i)
+                    if (masks[s] >> i & 1)
+                        indices[i] = (uint8_t)(7 - indices[i]);
+            }
+        std::memset(out, 0, 16);
+        BitWriter bits{ out };
+        bits.put(1 << 1, 2);
+        bits.put((uint32_t)partition, 6);
+        for (int c = 0; c < 3; ++c)
+            for (int s = 0; s < 2; ++s)
+            {
+                bits.put((uint32_t)q[s][0][c], 6);
+                bits.put((uint32_t)q[s][1][c], 6);
+            }
+        bits.put((uint32_t)p[0], 1);
+        bits.put((uint32_t)p[1], 1);
+        for (int i = 0; i < 16; ++i)
+            bits.put(indices[i], i == anchor[0] || i == anchor[1] ? 2 : 3);
+        return total;
+    }
+    // ------------------------------------------------------------------------
+    static void encodeBC7(unsigned char *out, const uint8_t *block)
+    {
+        bool opaque = true;
+        for (int i = 0; i < 16; ++i)
+            opaque = opaque && block[i * 4 + 3] == 255;
+        uint64_t best = encodeMode6(out, block, opaque);
+        if (best == 0)
+            return;
+        unsigned char trial[16];
+        if (!opaque)
+        {
+            const uint64_t error = encodeMode5(trial, block);
+            if (error < best)
+                std::memcpy(out, trial, 16);
+            return;
+        }
+
+        // mode 1 on the partitions whose regions each lie closest to a line
+        float moments[16][9], total[9] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            const float r = block[i * 4], g = block[i * 4 + 1], b = block[i * 4 + 2];
+            const float m[9] = { r, g, b, r * r, r * g, r * b, g * g, g * b, b * b };
+            for (int k = 0; k < 9; ++k)
+            {
+                moments[i][k] = m[k];
+                total[k] += m[k];
+            }
+        }
+        const int candidates = 4;
+        float scores[candidates];
+        int chosen[candidates];
+        for (int i = 0; i < candidates; ++i)
+        {
+            scores[i] = 1e30f;
+            chosen[i] = -1;
+        }
+        for (int partition = 0; partition < 64; ++partition)
+        {
+            const uint32_t mask = partitions()[partition];
+            float second[9] = {}, first[9], n = 0.0f;
+            for (int i = 0; i < 16; ++i)
+                if (mask >> i & 1)
+                {
+                    for (int k = 0; k < 9; ++k)
+                        second[k] += moments[i][k];
+                    n += 1.0f;
+                }
+            for (int k = 0; k < 9; ++k)
+                first[k] = total[k] - second[k];
+            const float score = lineError(first, 16.0f - n) + lineError(second, n);
+            for (int i = 0; i < candidates; ++i)
+                if (score < scores[i])
+                {
+                    for (int j = candidates - 1; j > i; --j)
+                    {
+                        scores[j] = scores[j - 1];
+                        chosen[j] = chosen[j - 1];
+                    }
+                    scores[i] = score;
+                    chosen[i] = partition;
+                    break;
+                }
+        }
+        for (int i = 0; i < candidates; ++i)
+        {
+            const uint64_t error = encodeMode1(trial, block, chosen[i]);
+            if (error < best)
+            {
+                best = error;
+                std::memcpy(out, trial, 16);
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    static void decodeBC7(uint8_t *block, const unsigned char *in)
+    {
+        std::memset(block, 0, 64);
+        BitReader bits{ in };
+        if (in[0] & 0x40 && !(in[0] & 0x3f))
+        {
+            bits.get(7);
+            int q[2][4];
+            for (int c = 0; c < 4; ++c)
+            {
+                q[0][c] = (int)bits.get(7);
+                q[1][c] = (int)bits.get(7);
+            }
+            const int p0 = (int)bits.get(1), p1 = (int)bits.get(1);
+            for (int i = 0; i < 16; ++i)
+            {
+                const int weight = weights(4)[bits.get(i == 0 ? 3 : 4)];
+                for (int c = 0; c < 4; ++c)
+                    block[i * 4 + c] = interpolate(q[0][c] << 1 | p0, q[1][c] << 1 | p1, weight);
+            }
+        }
+        else if ((in[0] & 0x3f) == 0x20)
+        {
+            bits.get(8);
+            int e[2][4];
+            for (int c = 0; c < 3; ++c)
+            {
+                e[0][c] = (int)bits.get(7);
+                e[1][c] = (int)bits.get(7);
+                e[0][c] = e[0][c] << 1 | e[0][c] >> 6;
+                e[1][c] = e[1][c] << 1 | e[1][c] >> 6;
+            }
+            e[0][3] = (int)bits.get(8);
+            e[1][3] = (int)bits.get(8);
+            for (int i = 0; i < 16; ++i)
+            {
+                const int weight = weights(2)[bits.get(i == 0 ? 1 : 2)];
+                for (int c = 0; c < 3; ++c)
+                    block[i * 4 + c] = interpolate(e[0][c], e[1][c], weight);
+            }
+            for (int i = 0; i < 16; ++i)
+                block[i * 4 + 3] = interpolate(e[0][3], e[1][3], weights(2)[bits.get(i == 0 ? 1 : 2)]);
+        }
+        else if ((in[0] & 3) == 2)
+        {
+            bits.get(2);
+            const int partition = (int)bits.get(6);
+            int e[2][2][3];
+            for (int c = 0; c < 3; ++c)
+                for (int s = 0; s < 2; ++s)
+                {
+                    e[s][0][c] = (int)bits.get(6);
+                    e[s][1][c] = (int)bits.get(6);
+                }
+            const int p[2] = { (int)bits.get(1), (int)bits.get(1) };
+            for (int s = 0; s < 2; ++s)
+                for (int k = 0; k < 2; ++k)
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        const int full = e[s][k][c] << 1 | p[s];
+                        e[s][k][c] = full << 1 | full >> 6;
+                    }
+            for (int i = 0; i < 16; ++i)
+            {
+                const int s = partitions()[partition] >> i & 1;
+                const int weight = weights(3)[bits.get(i == 0 || i == anchors()[partition] ? 2 : 3)];
+                for (int c = 0; c < 3; ++c)
+                    block[i * 4 + c] = interpolate(e[s][0][c], e[s][1][c], weight);
+                block[i * 4 + 3] = 255;
+            }
+        }
+    }
+};
+#endif
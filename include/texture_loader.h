@@ -0,0 +1,238 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+// stb_image (see the note there)
+#include "texture_support.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// one decoded file, as handed back by TextureLoader
+struct LoadedTexture
+{
+    struct PixelDeleter
+    {
+        void operator()(unsigned char *pixels) const { stbi_image_free(pixels); }
+    };
+
+    std::string path;
+    size_t index = 0;           // order of submission
+    int width = 0;
+    int height = 0;
+    int channelsInFile = 0;
+    int components = 0;         // channels per pixel in 'pixels'
+    std::unique_ptr<unsigned char, PixelDeleter> pixels;
+    size_t fileBytes = 0;       // size of the file on disk
+    size_t bytes = 0;           // size of the decoded pixels
+    double decodeMs = 0.0;      // wall time of the decode on its worker
+    std::string error;          // stbi_failure_reason() when decoding failed
+
+    bool ok() const { return pixels != nullptr; }
+};
+
+// Decodes image files on a fixed pool of worker threads and hands them back
+// in the order they finish, so the caller can upload each texture as soon as
+// it is ready instead of waiting for the slowest one. Each decode sets its
+// own vertical flip for its thread (FlipOnLoad, restored afterwards), so
+// requests with different flip settings can be in flight at once and load()
+// leaves the caller's stbi_set_flip_vertically_on_load alone. readyLimit bounds the
+// decoded textures waiting to be collected (plus those being decoded), which
+// caps memory when submitting many large files; 0 means no bound.
+//
+//     TextureLoader loader;
+//     loader.submit("container.jpg");
+//     loader.submit("awesomeface.png", 4);
+//     LoadedTexture texture;
+//     while (loader.next(texture))
+//         ... glTexImage2D(..., texture.pixels.get()) ...
+class TextureLoader
+{
+public:
+    // workerCount 0 means one worker per hardware thread
+    // ------------------------------------------------------------------------
+    explicit TextureLoader(unsigned int workerCount = 0, size_t readyLimit = 0)
+        : maxReady(readyLimit)
+    {
+        if (workerCount == 0)
+            workerCount = std::max(1u, std::thread::hardware_concurrency());
+        workers.reserve(workerCount);
+        for (unsigned int i = 0; i < workerCount; ++i)
+            workers.emplace_back([this]() { work(); });
+    }
+    // files still queued are dropped; decodes in progress are finished first
+    // ------------------------------------------------------------------------
+    ~TextureLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+    TextureLoader(const TextureLoader &) = delete;
+    TextureLoader &operator=(const TextureLoader &) = delete;
+
+    // queue a file; desiredChannels as for stbi_load. returns its index
+    // ------------------------------------------------------------------------
+    size_t submit(const std::string &path, int desiredChannels = 0, bool flipVertically = true)
+    {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            index = submitted++;
+            jobs.push_back(Job{ path, index, desiredChannels, flipVertically });
+        }
+        wake.notify_one();
+        return index;
+    }
+    // wait for the next texture to finish. returns false, without waiting,
+    // once every submitted file has been handed back
+    // ------------------------------------------------------------------------
+    bool next(LoadedTexture &texture)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return !ready.empty() || collected == submitted; });
+        return take(texture, lock);
+    }
+    // as next(), but returns false right away if none has finished yet
+    // ------------------------------------------------------------------------
+    bool tryNext(LoadedTexture &texture)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return take(texture, lock);
+    }
+    // submitted but not yet handed back
+    // ------------------------------------------------------------------------
+    size_t outstanding() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return submitted - collected;
+    }
+    // decode every path and return them in completion order (see index)
+    // ------------------------------------------------------------------------
+    static std::vector<LoadedTexture> loadAll(const std::vector<std::string> &paths, int desiredChannels = 0, bool flipVertically = true, unsigned int workerCount = 0)
+    {
+        if (workerCount == 0)
+            workerCount = std::max(1u, std::thread::hardware_concurrency());
+        TextureLoader loader((unsigned int)std::min<size_t>(workerCount, std::max<size_t>(1, paths.size())));
+        for (const std::string &path : paths)
+            loader.submit(path, desiredChannels, flipVertically);
+        std::vector<LoadedTexture> results;
+        results.reserve(paths.size());
+        LoadedTexture texture;
+        while (loader.next(texture))
+            results.push_back(std::move(texture));
+        return results;
+    }
+    // decode one file on the calling thread, timing it
+    // ------------------------------------------------------------------------
+    static LoadedTexture load(const std::string &path, int desiredChannels = 0, bool flipVertically = true)
+    {
+        return decode(Job{ path, 0, desiredChannels, flipVertically });
+    }
+
+private:
+    struct Job
+    {
+        std::string path;
+        size_t index;
+        int desiredChannels;
+        bool flip;
+    };
+
+    // ------------------------------------------------------------------------
+    static LoadedTexture decode(const Job &job)
+    {
+        LoadedTexture texture;
+        texture.path = job.path;
+        texture.index = job.index;
+        std::error_code ec;
+        auto size = std::filesystem::file_size(job.path, ec);
+        texture.fileBytes = ec ? 0 : (size_t)size;
+
+        auto start = std::chrono::steady_clock::now();
+        unsigned char *pixels;
+        {
+            FlipOnLoad flip(job.flip);
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP)
+            pixels = stbi_load_mmap(job.path.c_str(), &texture.width, &texture.height, &texture.channelsInFile, job.desiredChannels);
+#else
+            pixels = stbi_load(job.path.c_str(), &texture.width, &texture.height, &texture.channelsInFile, job.desiredChannels);
+#endif
+        }
+        texture.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (!pixels)
+        {
+            texture.width = texture.height = texture.channelsInFile = 0;
+            texture.error = stbi_failure_reason() ? stbi_failure_reason() : "unknown error";
+            return texture;
+        }
+        texture.components = job.desiredChannels ? job.desiredChannels : texture.channelsInFile;
+        texture.bytes = (size_t)texture.width * texture.height * texture.components;
+        texture.pixels.reset(pixels);
+        return texture;
+    }
+    // ------------------------------------------------------------------------
+    void work()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || (!jobs.empty() && (maxReady == 0 || ready.size() + decoding < maxReady)); });
+                if (stopping)
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                ++decoding;
+            }
+            LoadedTexture texture = decode(job);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready.push_back(std::move(texture));
+                --decoding;
+            }
+            done.notify_one();
+        }
+    }
+    // caller holds the lock
+    // ------------------------------------------------------------------------
+    bool take(LoadedTexture &texture, std::unique_lock<std::mutex> &lock)
+    {
+        if (ready.empty())
+            return false;
+        texture = std::move(ready.front());
+        ready.pop_front();
+        ++collected;
+        lock.unlock();
+        if (maxReady != 0)
+            wake.notify_one(); // room for another decode
+        return true;
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;   // workers: a job arrived, room freed up or stopping
+    std::condition_variable done;   // next(): a texture finished
+    std::deque<Job> jobs;
+    std::deque<LoadedTexture> ready;
+    size_t submitted = 0;
+    size_t collected = 0;
+    size_t decoding = 0;
+    size_t maxReady;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+#endif
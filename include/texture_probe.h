@@ -0,0 +1,200 @@
+#ifndef TEXTURE_PROBE_H
+#define TEXTURE_PROBE_H
+
+// stb_image and parallelFor
+#include "texture_support.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// what the header of one image file says, without decoding any pixels
+struct TextureInfo
+{
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    bool is16Bit = false;   // stbi_load_16 would return full 16-bit data
+    bool isHdr = false;     // stbi_loadf would return real floating point data
+    bool ok = false;
+    std::string error;      // stbi_failure_reason() when !ok
+};
+
+// Batch texture probing: gathers dimensions/channels of many files up front
+// (e.g. to size GPU storage before anything is decoded). Every probe is a
+// single stbi_info_ex() call, which reads only the header bytes and picks the
+// parser from the file's magic number. Files are probed on a pool of threads.
+class TextureProbe
+{
+public:
+    // probe a single file
+    // ------------------------------------------------------------------------
+    static TextureInfo probe(const std::string &path)
+    {
+        TextureInfo info;
+        int is16 = 0, isHdr = 0;
+        info.path = path;
+        info.ok = stbi_info_ex(path.c_str(), &info.width, &info.height, &info.components, &is16, &isHdr) != 0;
+        info.is16Bit = is16 != 0;
+        info.isHdr = isHdr != 0;
+        if (!info.ok)
+            info.error = stbi_failure_reason() ? stbi_failure_reason() : "unknown error";
+        return info;
+    }
+    // probe every path in parallel; results are in the same order as paths.
+    // threadCount 0 means one thread per hardware thread. if cachePath is not
+    // empty, entries whose path and modification time match the cache file
+    // are answered from it and the file is rewritten with the fresh results
+    // ------------------------------------------------------------------------
+    static std::vector<TextureInfo> probeAll(const std::vector<std::string> &paths, unsigned int threadCount = 0, const std::string &cachePath = "")
+    {
+        std::vector<TextureInfo> results(paths.size());
+        std::vector<long long> stamps(paths.size(), 0);
+        std::vector<size_t> misses;
+        std::unordered_map<std::string, CacheEntry> cache;
+        if (!cachePath.empty())
+            cache = loadCache(cachePath);
+
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            stamps[i] = modificationTime(paths[i]);
+            auto hit = cache.find(paths[i]);
+            if (hit != cache.end() && hit->second.stamp == stamps[i] && stamps[i] != 0)
+                results[i] = hit->second.info;
+            else
+                misses.push_back(i);
+        }
+
+        parallelFor(misses.size(), threadCount, [&](size_t k)
+        {
+            results[misses[k]] = probe(paths[misses[k]]);
+        });
+
+        if (!cachePath.empty() && !misses.empty())
+        {
+            for (size_t i = 0; i < paths.size(); ++i)
+                if (results[i].ok && stamps[i] != 0)
+                    cache[paths[i]] = CacheEntry{ stamps[i], results[i] };
+            saveCache(cachePath, cache);
+        }
+        return results;
+    }
+    // probe every image file (by extension) under a directory
+    // ------------------------------------------------------------------------
+    static std::vector<TextureInfo> probeDirectory(const std::string &directory, bool recursive = true, unsigned int threadCount = 0, const std::string &cachePath = "")
+    {
+        return probeAll(listImages(directory, recursive), threadCount, cachePath);
+    }
+    // image files under a directory, sorted so results are reproducible
+    // ------------------------------------------------------------------------
+    static std::vector<std::string> listImages(const std::string &directory, bool recursive = true)
+    {
+        namespace fs = std::filesystem;
+        std::vector<std::string> paths;
+        std::error_code ec;
+        auto consider = [&](const fs::directory_entry &entry)
+        {
+            std::error_code fileEc;
+            if (entry.is_regular_file(fileEc) && isImageExtension(entry.path().extension().string()))
+                paths.push_back(entry.path().string());
+        };
+        if (recursive)
+        {
+            for (fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec))
+                consider(*it);
+        }
+        else
+        {
+            for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+                consider(*it);
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+private:
+    struct CacheEntry
+    {
+        long long stamp;
+        TextureInfo info;
+    };
+
+    // ------------------------------------------------------------------------
+    static bool isImageExtension(std::string ext)
+    {
+        static const char *const known[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".pnm", ".ppm", ".pgm" };
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        for (const char *k : known)
+            if (ext == k)
+                return true;
+        return false;
+    }
+    // 0 when the file can't be stat'ed, which also disables caching for it
+    // ------------------------------------------------------------------------
+    static long long modificationTime(const std::string &path)
+    {
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(path, ec);
+        if (ec)
+            return 0;
+        return (long long)time.time_since_epoch().count();
+    }
+    // cache file: one line per texture,
+    //   stamp width height components is16 isHdr path
+    // path last so it may contain spaces
+    // ------------------------------------------------------------------------
+    static std::unordered_map<std::string, CacheEntry> loadCache(const std::string &cachePath)
+    {
+        std::unordered_map<std::string, CacheEntry> cache;
+        std::ifstream file(cachePath);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            CacheEntry entry;
+            int is16 = 0, isHdr = 0;
+            if (!(fields >> entry.stamp >> entry.info.width >> entry.info.height >> entry.info.components >> is16 >> isHdr))
+                continue;
+            fields.get(); // the single separating space
+            std::getline(fields, entry.info.path);
+            if (entry.info.path.empty())
+                continue;
+            entry.info.is16Bit = is16 != 0;
+            entry.info.isHdr = isHdr != 0;
+            entry.info.ok = true;
+            cache[entry.info.path] = entry;
+        }
+        return cache;
+    }
+    // written to a temporary file first so a crash never leaves half a cache
+    // ------------------------------------------------------------------------
+    static void saveCache(const std::string &cachePath, const std::unordered_map<std::string, CacheEntry> &cache)
+    {
+        std::string temporary = cachePath + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::trunc);
+            if (!file)
+                return;
+            for (const auto &item : cache)
+            {
+                const TextureInfo &info = item.second.info;
+                file << item.second.stamp << ' ' << info.width << ' ' << info.height << ' ' << info.components << ' '
+                     << (int)info.is16Bit << ' ' << (int)info.isHdr << ' ' << info.path << '\n';
+            }
+            if (!file)
+                return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temporary, cachePath, ec);
+    }
+};
+#endif
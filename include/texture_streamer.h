@@ -0,0 +1,334 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+
+#include "texture_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams textures in without stalling the render loop. Files are decoded on
+// TextureLoader's worker threads; once a file is decoded its rows are copied
+// into a ring of pixel buffer memory and uploaded with glTexSubImage2D from
+// there, at most frameBudget bytes per update(), so a large texture set
+// arrives over several frames instead of in one long hitch. Until a texture
+// is complete, texture() returns a shared checkerboard placeholder.
+//
+// The ring is one pixel unpack buffer split into three per-frame segments,
+// each guarded by a fence, so the CPU never writes memory the GPU may still
+// be reading. With OpenGL 4.4 (glBufferStorage, e.g. Mesa's llvmpipe) the
+// buffer stays persistently mapped; on older contexts each segment is mapped
+// unsynchronized while it is filled.
+//
+// All calls, including construction and destruction, need the GL context
+// current on the calling thread.
+//
+//     TextureStreamer streamer;
+//     unsigned int box = streamer.request("container.jpg");
+//     while (!glfwWindowShouldClose(window))
+//     {
+//         streamer.update();
+//         glBindTexture(GL_TEXTURE_2D, streamer.texture(box));
+//         ...
+//     }
+class TextureStreamer
+{
+public:
+    // frameBudget: bytes uploaded per update() at most, 4 KB or more (the ring
+    // holds three frames' worth); rows wider than that go up one per frame,
+    // from client memory. workerCount 0 means one decoder per hardware thread
+    // ------------------------------------------------------------------------
+    explicit TextureStreamer(size_t frameBudget = 4 << 20, unsigned int workerCount = 0)
+        : loader(workerCount), segmentBytes(std::max<size_t>(frameBudget, 4096))
+    {
+        const GLsizeiptr ringBytes = (GLsizeiptr)(segmentBytes * Segments);
+        glGenBuffers(1, &ring);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+        if (GLAD_GL_VERSION_4_4 && glBufferStorage)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, flags);
+            mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ringBytes, flags);
+        }
+        if (!mapped)
+        {
+            // no persistent mapping: a plain buffer, mapped per upload. a
+            // buffer made with glBufferStorage can't be respecified, so start over
+            glDeleteBuffers(1, &ring);
+            glGenBuffers(1, &ring);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // 2x2 checkerboard, repeated every 8 texels or so by the sampler
+        const unsigned char checker[] = { 255, 0, 255, 255,   40, 40, 40, 255,
+                                          40, 40, 40, 255,    255, 0, 255, 255 };
+        GLint previous = 0, previousAlignment = 4;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glGenTextures(1, &placeholderTexture);
+        glBindTexture(GL_TEXTURE_2D, placeholderTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, (GLuint)previous);
+    }
+    // ------------------------------------------------------------------------
+    ~TextureStreamer()
+    {
+        for (GLsync &fence : fences)
+            if (fence)
+                glDeleteSync(fence);
+        if (mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &ring);
+        for (Entry &entry : entries)
+            if (entry.texture)
+                glDeleteTextures(1, &entry.texture);
+        glDeleteTextures(1, &placeholderTexture);
+    }
+    TextureStreamer(const TextureStreamer &) = delete;
+    TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+    // start loading a file; desiredChannels as for stbi_load. returns the
+    // handle to pass to texture()
+    // ------------------------------------------------------------------------
+    unsigned int request(const std::string &path, int desiredChannels = 0, bool flipVertically = true, bool mipmaps = true)
+    {
+        Entry entry;
+        entry.path = path;
+        entry.mipmaps = mipmaps;
+        entries.push_back(std::move(entry));
+        loader.submit(path, desiredChannels, flipVertically);
+        ++outstanding;
+        return (unsigned int)(entries.size() - 1);
+    }
+    // call once per frame: picks up decoded files and uploads up to the frame
+    // budget. returns how many textures became ready
+    // ------------------------------------------------------------------------
+    int update()
+    {
+        LoadedTexture image;
+        while (loader.tryNext(image))
+        {
+            const size_t index = image.index;
+            Entry &entry = entries[index];
+            if (image.ok())
+            {
+                entry.image = std::move(image);
+                uploads.push_back(index);
+            }
+            else
+            {
+                entry.state = State::Failed;
+                entry.error = image.error;
+                --outstanding;
+            }
+        }
+        lastBytes = 0;
+        if (uploads.empty())
+            return 0;
+
+        const size_t segment = frame++ % Segments;
+        waitFor(segment);
+
+        GLint previousTexture = 0, previousAlignment = 4;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+
+        int finished = 0;
+        size_t used = 0;
+        while (!uploads.empty())
+        {
+            Entry &entry = entries[uploads.front()];
+            const LoadedTexture &source = entry.image;
+            const size_t rowBytes = (size_t)source.width * source.components;
+            const int rowsLeft = source.height - entry.rowsUploaded;
+            if (entry.texture == 0)
+                allocate(entry);
+            else
+                glBindTexture(GL_TEXTURE_2D, entry.texture);
+
+            int rows = (int)std::min<size_t>((size_t)rowsLeft, (segmentBytes - used) / rowBytes);
+            if (rowBytes > segmentBytes)
+            {
+                // a single row doesn't fit the ring: send one row from client
+                // memory, as the only upload this frame
+                if (used != 0)
+                    break;
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, entry.rowsUploaded, source.width, 1, format(source.components), GL_UNSIGNED_BYTE,
+                                source.pixels.get() + entry.rowsUploaded * rowBytes);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+                rows = 1;
+                used = segmentBytes;
+                lastBytes += rowBytes;
+            }
+            else
+            {
+                if (rows == 0)
+                    break;
+                const size_t offset = segment * segmentBytes + used;
+                const size_t bytes = rows * rowBytes;
+                copyToRing(offset, source.pixels.get() + entry.rowsUploaded * rowBytes, bytes);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, entry.rowsUploaded, source.width, rows, format(source.components), GL_UNSIGNED_BYTE,
+                                (const void *)offset);
+                used += bytes;
+                lastBytes += bytes;
+            }
+
+            entry.rowsUploaded += rows;
+            if (entry.rowsUploaded == source.height)
+            {
+                if (entry.mipmaps)
+                    glGenerateMipmap(GL_TEXTURE_2D);
+                entry.state = State::Ready;
+                entry.image = LoadedTexture();
+                uploads.pop_front();
+                --outstanding;
+                ++finished;
+            }
+        }
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        glBindTexture(GL_TEXTURE_2D, (GLuint)previousTexture);
+        return finished;
+    }
+    // update() until every requested texture is ready or has failed, ignoring
+    // frame pacing (e.g. behind a loading screen)
+    // ------------------------------------------------------------------------
+    void finish()
+    {
+        while (outstanding != 0)
+            if (update() == 0 && lastBytes == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // the texture to bind for a handle: the placeholder until it is ready
+    // ------------------------------------------------------------------------
+    unsigned int texture(unsigned int handle) const
+    {
+        const Entry &entry = entries[handle];
+        return entry.state == State::Ready ? entry.texture : placeholderTexture;
+    }
+    bool ready(unsigned int handle) const { return entries[handle].state == State::Ready; }
+    bool failed(unsigned int handle) const { return entries[handle].state == State::Failed; }
+    const std::string &error(unsigned int handle) const { return entries[handle].error; }
+    const std::string &path(unsigned int handle) const { return entries[handle].path; }
+    // requests neither ready nor failed yet
+    size_t pending() const { return outstanding; }
+    // bytes the last update() uploaded
+    size_t lastUploadBytes() const { return lastBytes; }
+    unsigned int placeholder() const { return placeholderTexture; }
+
+private:
+    static const size_t Segments = 3;
+
+    enum class State { Loading, Ready, Failed };
+    struct Entry
+    {
+        std::string path;
+        bool mipmaps = true;
+        State state = State::Loading;
+        unsigned int texture = 0;   // created when its first rows are uploaded
+        int rowsUploaded = 0;
+        LoadedTexture image;        // decoded pixels while uploading
+        std::string error;
+    };
+
+    // ------------------------------------------------------------------------
+    static GLenum format(int components)
+    {
+        switch (components)
+        {
+        case 1:  return GL_RED;
+        case 2:  return GL_RG;
+        case 3:  return GL_RGB;
+        default: return GL_RGBA;
+        }
+    }
+    // create the texture and its storage; grey and grey-alpha images are
+    // swizzled so they sample as stbi_load's channels read. called with the
+    // ring bound, which would turn the null data pointer into offset 0
+    // ------------------------------------------------------------------------
+    void allocate(Entry &entry)
+    {
+        static const GLenum internalFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        const LoadedTexture &source = entry.image;
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[source.components - 1], source.width, source.height, 0,
+                     format(source.components), GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, entry.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (source.components <= 2)
+        {
+            const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, source.components == 2 ? GL_GREEN : GL_ONE };
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        }
+    }
+    // block until the GPU is done with a ring segment (normally long since)
+    // ------------------------------------------------------------------------
+    void waitFor(size_t segment)
+    {
+        GLsync &fence = fences[segment];
+        if (!fence)
+            return;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    // ------------------------------------------------------------------------
+    void copyToRing(size_t offset, const unsigned char *pixels, size_t bytes)
+    {
+        if (mapped)
+        {
+            std::memcpy(mapped + offset, pixels, bytes);
+            return;
+        }
+        void *target = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, (GLintptr)offset, (GLsizeiptr)bytes,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (target)
+        {
+            std::memcpy(target, pixels, bytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+
+    TextureLoader loader;
+    const size_t segmentBytes;
+    unsigned int ring = 0;
+    unsigned char *mapped = nullptr;    // the whole ring, when persistently mapped
+    GLsync fences[Segments] = {};
+    size_t frame = 0;
+    unsigned int placeholderTexture = 0;
+    std::vector<Entry> entries;
+    std::deque<size_t> uploads;         // decoded entries, in the order they arrived
+    size_t outstanding = 0;
+    size_t lastBytes = 0;
+};
+#endif
@@ -0,0 +1,79 @@
+#ifndef TEXTURE_SUPPORT_H
+#define TEXTURE_SUPPORT_H
+
+// What the texture helpers (TextureProbe, TextureLoader, HdrLoader,
+// MipGenerator, TextureCompressor, ...) share: stb_image, a scoped vertical
+// flip setting and a parallel loop.
+
+// stb_image.h must be compiled (STB_IMAGE_IMPLEMENTATION) in exactly one .cpp
+// of the program, as the tutorials already do; don't pull it in a second time
+// after that .cpp has included it with the implementation enabled
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include "stb_image.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Sets stb_image's vertical flip for loads on the calling thread while it
+// lives, then gives the thread back whatever it had before: its own setting,
+// or following stbi_set_flip_vertically_on_load. The helpers flip per
+// request, and a bare stbi_set_flip_vertically_on_load_thread would leave the
+// thread (possibly the caller's) ignoring the global flag for good.
+class FlipOnLoad
+{
+public:
+    explicit FlipOnLoad(bool flip)
+    {
+        hadOwn = stbi_get_flip_vertically_on_load_thread(&previous) != 0;
+        stbi_set_flip_vertically_on_load_thread(flip ? 1 : 0);
+    }
+    ~FlipOnLoad()
+    {
+        if (hadOwn)
+            stbi_set_flip_vertically_on_load_thread(previous);
+        else
+            stbi_clear_flip_vertically_on_load_thread();
+    }
+    FlipOnLoad(const FlipOnLoad &) = delete;
+    FlipOnLoad &operator=(const FlipOnLoad &) = delete;
+
+private:
+    bool hadOwn = false;
+    int previous = 0;
+};
+
+// run body(0..count-1) on up to threadCount threads (0 = one per hardware
+// thread), the calling thread included. indices are handed out one at a
+// time, so a slow item doesn't hold up a whole slice
+template <typename Body>
+void parallelFor(size_t count, unsigned int threadCount, const Body &body)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    if ((size_t)threadCount > count)
+        threadCount = (unsigned int)count;
+    if (threadCount <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+            body(i);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+            body(i);
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (unsigned int t = 1; t < threadCount; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread &t : threads)
+        t.join();
+}
+#endif
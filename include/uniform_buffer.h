@@ -0,0 +1,334 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// How a C++ member type is laid out in a std140 uniform block: its GLSL
+// name, base alignment and size in the block, and the vectors it is made of
+// (matrix columns, each padded to a vec4 in the block but packed in glm).
+template <typename T>
+struct Std140Type;
+
+#define STD140_TYPE(T, name, alignment, bytes, vectors, vectorBytes, vectorStride) \
+    template <> struct Std140Type<T> \
+    { \
+        static const char *glsl() { return name; } \
+        static const size_t align = alignment, size = bytes; \
+        static const size_t columns = vectors, columnBytes = vectorBytes, columnStride = vectorStride; \
+    };
+STD140_TYPE(float,        "float", 4,  4,  1, 4,  4)
+STD140_TYPE(int,          "int",   4,  4,  1, 4,  4)
+STD140_TYPE(unsigned int, "uint",  4,  4,  1, 4,  4)
+STD140_TYPE(glm::vec2,    "vec2",  8,  8,  1, 8,  8)
+STD140_TYPE(glm::vec3,    "vec3",  16, 12, 1, 12, 12)
+STD140_TYPE(glm::vec4,    "vec4",  16, 16, 1, 16, 16)
+STD140_TYPE(glm::ivec4,   "ivec4", 16, 16, 1, 16, 16)
+STD140_TYPE(glm::mat2,    "mat2",  16, 32, 2, 8,  16)
+STD140_TYPE(glm::mat3,    "mat3",  16, 48, 3, 12, 16)
+STD140_TYPE(glm::mat4,    "mat4",  16, 64, 4, 16, 16)
+#undef STD140_TYPE
+
+// The std140 layout of a uniform block mirrored by the C++ struct S, built
+// from a list of S's members in the order the block declares them. Offsets
+// follow the std140 rules (vec3 aligned like vec4, matrix columns and array
+// elements padded to 16 bytes), so S itself can be a plain struct of glm
+// types; pack() copies it into the block layout and glsl() writes the
+// matching block declaration. One-dimensional arrays of the types above are
+// accepted as members too.
+//
+//     struct Camera { glm::mat4 view; glm::mat4 projection; };
+//     const Std140Layout<Camera> cameraLayout("Camera", {
+//         { "view", &Camera::view },
+//         { "projection", &Camera::projection } });
+template <typename S>
+class Std140Layout
+{
+public:
+    struct Field
+    {
+        const char *name;
+        const char *glsl;
+        size_t source;          // byte offset in S
+        size_t sourceStride;    // bytes between array elements in S
+        size_t offset;          // byte offset in the block
+        size_t align, size;     // std140 base alignment and size of one element
+        size_t columns, columnBytes, columnStride;
+        size_t count;           // array length, 0 for a single value
+        size_t stride;          // bytes between array elements in the block
+
+        template <typename M>
+        Field(const char *fieldName, M S::*member)
+        {
+            typedef typename std::remove_all_extents<M>::type Element;
+            typedef Std140Type<Element> Type;
+            static_assert(std::rank<M>::value <= 1, "only one-dimensional arrays have a std140 layout here");
+            const S probe{};
+            name = fieldName;
+            glsl = Type::glsl();
+            source = (size_t)((const unsigned char *)&(probe.*member) - (const unsigned char *)&probe);
+            sourceStride = sizeof(Element);
+            offset = 0;
+            count = std::extent<M>::value;
+            align = count ? 16 : Type::align;
+            size = Type::size;
+            columns = Type::columns;
+            columnBytes = Type::columnBytes;
+            columnStride = Type::columnStride;
+            stride = (size + 15) & ~(size_t)15;
+        }
+    };
+
+    // ------------------------------------------------------------------------
+    Std140Layout(const char *blockName, std::initializer_list<Field> members)
+        : block(blockName), fields(members)
+    {
+        size_t cursor = 0;
+        for (Field &field : fields)
+        {
+            field.offset = (cursor + field.align - 1) & ~(field.align - 1);
+            cursor = field.offset + (field.count ? field.stride * field.count : field.size);
+        }
+        bytes = (cursor + 15) & ~(size_t)15;
+    }
+
+    // bytes of the block, what glGetActiveUniformBlockiv reports as its data size
+    size_t size() const { return bytes; }
+    const std::string &name() const { return block; }
+    const std::vector<Field> &members() const { return fields; }
+
+    // write 'value' in block layout to 'destination', size() bytes; padding
+    // is left as it was
+    // ------------------------------------------------------------------------
+    void pack(const S &value, void *destination) const
+    {
+        const unsigned char *from = (const unsigned char *)&value;
+        unsigned char *to = (unsigned char *)destination;
+        for (const Field &field : fields)
+            for (size_t element = 0; element < std::max<size_t>(field.count, 1); ++element)
+                for (size_t column = 0; column < field.columns; ++column)
+                    std::memcpy(to + field.offset + element * field.stride + column * field.columnStride,
+                                from + field.source + element * field.sourceStride + column * field.columnBytes,
+                                field.columnBytes);
+    }
+    // the GLSL declaration of the block, e.g. for a shared include
+    // ------------------------------------------------------------------------
+    std::string glsl() const
+    {
+        std::string text = "layout (std140) uniform " + block + "\n{\n";
+        for (const Field &field : fields)
+        {
+            text += std::string("    ") + field.glsl + " " + field.name;
+            if (field.count)
+                text += "[" + std::to_string(field.count) + "]";
+            text += ";\n";
+        }
+        return text + "};\n";
+    }
+
+private:
+    std::string block;
+    std::vector<Field> fields;
+    size_t bytes = 0;
+};
+
+// Uniform buffer memory for data that changes every frame, such as the
+// camera and the per-object matrices. Each frame the blocks are pushed into
+// one segment of a ring of three and bound with glBindBufferRange, so the
+// data of a whole frame goes to the GPU in one piece instead of as one
+// glUniform* call per value and draw. A fence placed when the next frame
+// begins guards each segment, so a segment is only written again once the
+// GPU has finished the draws that read it. With OpenGL 4.4 (glBufferStorage)
+// the ring stays persistently mapped and push() writes straight into it;
+// otherwise pushes are staged and commit() maps the segment once,
+// unsynchronized, to copy them in.
+//
+// Binding points are chosen per block name by Shader::blockBinding(), which
+// every Shader also applies to its blocks after linking.
+//
+//     UniformRing ring;
+//     while (!glfwWindowShouldClose(window))
+//     {
+//         ring.beginFrame();
+//         UniformRing::Range camera = ring.push(cameraLayout, cameraData);
+//         UniformRing::Range box = ring.push(objectLayout, boxData);
+//         ring.commit();
+//         ring.bind(Shader::blockBinding("Camera"), camera);
+//         ring.bind(Shader::blockBinding("Object"), box);
+//         glDrawArrays(GL_TRIANGLES, 0, 36);
+//     }
+class UniformRing
+{
+public:
+    // part of the ring holding one pushed block
+    struct Range
+    {
+        size_t offset = 0;
+        size_t size = 0;        // 0 when the push did not fit
+        bool ok() const { return size != 0; }
+    };
+    struct Stats
+    {
+        size_t frames = 0;
+        size_t pushes = 0;
+        size_t bytes = 0;       // pushed, padding excluded
+        size_t overflows = 0;   // pushes that did not fit their frame's segment
+        size_t waits = 0;       // frames that found their segment still in use by the GPU
+    };
+
+    // frameBytes: room for the blocks of one frame, alignment padding included
+    // ------------------------------------------------------------------------
+    explicit UniformRing(size_t frameBytes = 64 << 10)
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        offsetAlignment = (size_t)std::max(alignment, 1);
+        segmentBytes = (frameBytes + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+        const GLsizeiptr ringBytes = (GLsizeiptr)(segmentBytes * Segments);
+        glGenBuffers(1, &ring);
+        glBindBuffer(GL_UNIFORM_BUFFER, ring);
+        if (GLAD_GL_VERSION_4_4 && glBufferStorage)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, ringBytes, nullptr, flags);
+            mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, ringBytes, flags);
+        }
+        if (!mapped)
+        {
+            // as in TextureStreamer: a buffer made with glBufferStorage can't
+            // be respecified, so start over with a plain one
+            glDeleteBuffers(1, &ring);
+            glGenBuffers(1, &ring);
+            glBindBuffer(GL_UNIFORM_BUFFER, ring);
+            glBufferData(GL_UNIFORM_BUFFER, ringBytes, nullptr, GL_STREAM_DRAW);
+            staging.resize(segmentBytes);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    // ------------------------------------------------------------------------
+    ~UniformRing()
+    {
+        for (GLsync &fence : fences)
+            if (fence)
+                glDeleteSync(fence);
+        if (mapped)
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, ring);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &ring);
+    }
+    UniformRing(const UniformRing &) = delete;
+    UniformRing &operator=(const UniformRing &) = delete;
+
+    // fence the previous frame's segment and move on to the next one, waiting
+    // for the GPU if it still reads it; call before the frame's first push
+    // ------------------------------------------------------------------------
+    void beginFrame()
+    {
+        if (started)
+            fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = started ? (segment + 1) % Segments : 0;
+        started = true;
+        used = committed = 0;
+        ++counters.frames;
+        GLsync &fence = fences[segment];
+        if (!fence)
+            return;
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            ++counters.waits;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED)
+                ;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    // room for 'bytes' in this frame's segment, to fill through memory()
+    // ------------------------------------------------------------------------
+    Range allocate(size_t bytes)
+    {
+        Range range;
+        const size_t start = (used + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+        if (bytes == 0 || start + bytes > segmentBytes)
+        {
+            ++counters.overflows;
+            return range;
+        }
+        used = start + bytes;
+        range.offset = segment * segmentBytes + start;
+        range.size = bytes;
+        ++counters.pushes;
+        counters.bytes += bytes;
+        return range;
+    }
+    // where to write a range allocated this frame
+    // ------------------------------------------------------------------------
+    unsigned char *memory(const Range &range)
+    {
+        return mapped ? mapped + range.offset : staging.data() + (range.offset - segment * segmentBytes);
+    }
+    // allocate a block and write 'value' into it in std140 layout
+    // ------------------------------------------------------------------------
+    template <typename S>
+    Range push(const Std140Layout<S> &layout, const S &value)
+    {
+        Range range = allocate(layout.size());
+        if (range.ok())
+            layout.pack(value, memory(range));
+        return range;
+    }
+    // make everything pushed so far visible to draws; nothing to do when the
+    // ring is persistently mapped (coherent), one mapped copy otherwise
+    // ------------------------------------------------------------------------
+    void commit()
+    {
+        if (mapped || committed == used)
+            return;
+        glBindBuffer(GL_UNIFORM_BUFFER, ring);
+        void *target = glMapBufferRange(GL_UNIFORM_BUFFER, (GLintptr)(segment * segmentBytes + committed), (GLsizeiptr)(used - committed),
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (target)
+        {
+            std::memcpy(target, staging.data() + committed, used - committed);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        committed = used;
+    }
+    // bind a pushed block to a uniform buffer binding point
+    // ------------------------------------------------------------------------
+    void bind(GLuint binding, const Range &range) const
+    {
+        if (range.ok())
+            glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring, (GLintptr)range.offset, (GLsizeiptr)range.size);
+    }
+
+    bool persistent() const { return mapped != nullptr; }
+    unsigned int buffer() const { return ring; }
+    const Stats &stats() const { return counters; }
+
+private:
+    static const size_t Segments = 3;
+
+    size_t offsetAlignment = 256;
+    size_t segmentBytes = 0;
+    unsigned int ring = 0;
+    unsigned char *mapped = nullptr;        // the whole ring, when persistently mapped
+    std::vector<unsigned char> staging;     // this frame's segment, when not
+    GLsync fences[Segments] = {};
+    size_t segment = 0;
+    bool started = false;
+    size_t used = 0;                        // bytes of the segment allocated this frame
+    size_t committed = 0;                   // of those, copied to the buffer by commit()
+    Stats counters;
+};
+#endif